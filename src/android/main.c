@@ -244,6 +244,11 @@ int file_unlock(FILE *file, uint64_t start, size_t length){
     return 0;
 }
 
+int file_truncate(FILE *file, uint64_t size){
+    fflush(file);
+    return ftruncate(fileno(file), size);
+}
+
 void setscale_fonts(void) {
     freefonts();
     loadfonts();
@@ -481,6 +486,10 @@ void redraw(void)
 {
     _redraw = 1;
 }
+void redraw_rect(int UNUSED(x), int UNUSED(y), int UNUSED(width), int UNUSED(height))
+{
+    redraw();
+}
 void force_redraw(void)
 {
     redraw();
@@ -99,6 +99,159 @@ ALCdevice* utox_audio_in_device_get(void) {
     }
 }
 
+/* Buffers each source cycles through, enough for JITTER_MAX_DELAY_US of 20ms frames */
+#define AUDIO_PLAY_BUFFERS 24
+
+/* How often the audio thread feeds the sources while any of them are playing */
+#define AUDIO_PLAYOUT_MS 10
+
+/* The incoming audio of a friend, or the preview at UTOX_MAX_NUM_FRIENDS. The jitter buffer is shared with the threads
+ * calling sourceplaybuffer() behind audio_play_lock, the rest is only touched by the audio thread. */
+typedef struct {
+    ALuint source; /* 0 if not started */
+    ALuint buffer[AUDIO_PLAY_BUFFERS], free[AUDIO_PLAY_BUFFERS];
+    uint32_t free_count;
+
+    /* The buffers queued on source, oldest first */
+    struct {
+        uint32_t duration_us, rate;
+    } queued[AUDIO_PLAY_BUFFERS];
+    uint32_t queued_head, queued_count;
+    uint64_t queued_us;
+
+    JITTER_BUFFER jitter;
+} AUDIO_PLAYBACK;
+
+static AUDIO_PLAYBACK audio_playback[UTOX_MAX_NUM_FRIENDS + 1];
+static pthread_mutex_t audio_play_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t audio_playing; /* started AUDIO_PLAYBACKs */
+
+/* Gives source i its buffers and a jitter buffer, so sourceplaybuffer() accepts frames for it */
+static void audio_playback_start(uint32_t i, ALuint source) {
+    AUDIO_PLAYBACK *p = &audio_playback[i];
+    if (p->source || !source) {
+        return;
+    }
+
+    ALint error;
+    alGetError();
+    alGenBuffers(AUDIO_PLAY_BUFFERS, p->buffer);
+    if ((error = alGetError()) != AL_NO_ERROR) {
+        debug("uToxAudio:\tError generating buffers with err %x\n", error);
+        return;
+    }
+
+    pthread_mutex_lock(&audio_play_lock);
+    _Bool ok = jitter_init(&p->jitter);
+    if (!ok) {
+        jitter_free(&p->jitter);
+    }
+    pthread_mutex_unlock(&audio_play_lock);
+
+    if (!ok) {
+        debug("uToxAudio:\tNot enough memory for a jitter buffer\n");
+        alDeleteBuffers(AUDIO_PLAY_BUFFERS, p->buffer);
+        return;
+    }
+
+    memcpy(p->free, p->buffer, sizeof(p->free));
+    p->free_count   = AUDIO_PLAY_BUFFERS;
+    p->queued_head  = 0;
+    p->queued_count = 0;
+    p->queued_us    = 0;
+
+    alSourcei(source, AL_LOOPING, AL_FALSE);
+    p->source = source;
+    audio_playing++;
+}
+
+static void audio_playback_stop(uint32_t i) {
+    AUDIO_PLAYBACK *p = &audio_playback[i];
+    if (!p->source) {
+        return;
+    }
+
+    alSourceStop(p->source);
+    alSourcei(p->source, AL_BUFFER, 0);
+    alDeleteBuffers(AUDIO_PLAY_BUFFERS, p->buffer);
+
+    pthread_mutex_lock(&audio_play_lock);
+    JITTER_STATS stats = p->jitter.stats;
+    jitter_free(&p->jitter);
+    pthread_mutex_unlock(&audio_play_lock);
+
+    debug("uToxAudio:\tPlayback %u: %u frames, %u underruns (%u frames concealed), %u dropped, jitter %ums, "
+          "target delay %ums\n", i, stats.frames, stats.underruns, stats.concealed, stats.dropped,
+          stats.jitter_us / 1000, stats.target_us / 1000);
+
+    p->source = 0;
+    audio_playing--;
+}
+
+/* Takes back the buffers p's source is done with, and queues what the jitter buffer has to play in them */
+static void audio_playback_feed(AUDIO_PLAYBACK *p) {
+    ALint processed = 0;
+    alGetSourcei(p->source, AL_BUFFERS_PROCESSED, &processed);
+    if (processed > (ALint)p->queued_count) {
+        processed = p->queued_count;
+    }
+
+    if (processed > 0) {
+        ALuint done[AUDIO_PLAY_BUFFERS];
+        alSourceUnqueueBuffers(p->source, processed, done);
+        for (ALint j = 0; j < processed; j++) {
+            p->free[p->free_count++] = done[j];
+            p->queued_us -= p->queued[p->queued_head].duration_us;
+            p->queued_head = (p->queued_head + 1) % AUDIO_PLAY_BUFFERS;
+            p->queued_count--;
+        }
+    }
+
+    uint64_t ahead = p->queued_us;
+    if (p->queued_count) {
+        ALint offset = 0;
+        alGetSourcei(p->source, AL_SAMPLE_OFFSET, &offset);
+        uint64_t played = (uint64_t)offset * 1000 * 1000 / p->queued[p->queued_head].rate;
+        ahead = (played < ahead) ? ahead - played : 0;
+    }
+
+    int16_t pcm[JITTER_FRAME_MAX];
+    uint32_t samples, rate;
+    uint8_t channels;
+    _Bool queued = 0;
+
+    while (p->free_count) {
+        pthread_mutex_lock(&audio_play_lock);
+        int frame = jitter_pop(&p->jitter, ahead, get_time(), pcm, &samples, &channels, &rate);
+        pthread_mutex_unlock(&audio_play_lock);
+
+        if (frame == JITTER_NONE) {
+            break;
+        }
+
+        ALuint bufid = p->free[--p->free_count];
+        alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, pcm, samples * 2 * channels, rate);
+        alSourceQueueBuffers(p->source, 1, &bufid);
+
+        uint32_t duration = (uint64_t)samples * 1000 * 1000 / rate;
+        uint32_t j = (p->queued_head + p->queued_count++) % AUDIO_PLAY_BUFFERS;
+        p->queued[j].duration_us = duration;
+        p->queued[j].rate = rate;
+        p->queued_us += duration;
+        ahead += duration;
+        queued = 1;
+    }
+
+    /* A source stops at the end of its queue, and needs starting again once there's more */
+    if (queued) {
+        ALint state;
+        alGetSourcei(p->source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING) {
+            alSourcePlay(p->source);
+        }
+    }
+}
+
 static ALCcontext *context;
 void utox_audio_out_device_open(void) {
     audio_out_handle = alcOpenDevice(audio_out_device);
@@ -140,6 +293,9 @@ void utox_audio_out_device_close(void) {
     if (!audio_out_handle) {
         return;
     }
+    for (uint32_t i = 0; i <= UTOX_MAX_NUM_FRIENDS; i++) {
+        audio_playback_stop(i);
+    }
     alDeleteSources((ALuint)1, &preview);
     alDeleteSources((ALuint)1, &ringtone);
     alcMakeContextCurrent(NULL);
@@ -169,47 +325,16 @@ ALCdevice* utox_audio_out_device_get(void) {
 }
 
 void sourceplaybuffer(unsigned int f, const int16_t *data, int samples, uint8_t channels, unsigned int sample_rate) {
-    if(!channels || channels > 2) {
-        return;
-    }
-
-    ALuint source;
-    if (f >= UTOX_MAX_NUM_FRIENDS) {
-        source = preview;
-    } else {
-        source = friend[f].audio_dest;
-    }
-
-
-    ALuint bufid;
-    ALint processed = 0, queued = 16;
-    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-    alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
-    alSourcei(source, AL_LOOPING, AL_FALSE);
-
-    if(processed) {
-        ALuint bufids[processed];
-        alSourceUnqueueBuffers(source, processed, bufids);
-        alDeleteBuffers(processed - 1, bufids + 1);
-        bufid = bufids[0];
-    } else if(queued < 16) {
-        alGenBuffers(1, &bufid);
-    } else {
-        debug("dropped audio frame\n");
+    if(!channels || channels > 2 || samples <= 0) {
         return;
     }
 
-    alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, data, samples * 2 * channels, sample_rate);
-    alSourceQueueBuffers(source, 1, &bufid);
+    AUDIO_PLAYBACK *p = &audio_playback[(f >= UTOX_MAX_NUM_FRIENDS) ? UTOX_MAX_NUM_FRIENDS : f];
 
-    // debug("audio frame || samples == %i channels == %u rate == %u \n", samples, channels, sample_rate);
-
-    ALint state;
-    alGetSourcei(source, AL_SOURCE_STATE, &state);
-    if(state != AL_PLAYING) {
-        alSourcePlay(source);
-        // debug("Starting source %u\n", i);
-    }
+    /* Dropped by the jitter buffer if the source isn't started */
+    pthread_mutex_lock(&audio_play_lock);
+    jitter_push(&p->jitter, data, samples, channels, sample_rate, get_time());
+    pthread_mutex_unlock(&audio_play_lock);
 }
 
 static void utox_audio_init_in(void) {
@@ -290,17 +415,205 @@ static void utox_audio_term_source(ALuint *source) {
     alDeleteSources((ALuint)1, source);
 }
 
+static UTOX_MSG_QUEUE audio_msg_queue = UTOX_MSG_QUEUE_INIT;
+
+/* From the first sample of a captured frame being recorded to handing the frame to toxav_audio_send_frame() */
+static struct {
+    uint64_t frames, total, max;
+} capture_latency;
+
 void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while(audio_thread_msg) {
-        yieldcpu(1);
+    msg_queue_post_wait(&audio_msg_queue, msg, param1, param2, data);
+}
+
+/* Per stage counters of the outgoing audio, each only written by the thread of its stage */
+typedef struct {
+    uint64_t frames;
+    uint64_t wait, wait_max; /* in the ring, before the stage got to the frame */
+    uint64_t time, time_max; /* taken by the stage */
+} AUDIO_STAGE_STATS;
+
+static AUDIO_STAGE_STATS audio_stage[3]; /* capture, filter, send */
+
+static void audio_stage_count(AUDIO_STAGE_STATS *st, uint64_t pushed, uint64_t start, uint64_t end) {
+    st->frames++;
+    st->wait += start - pushed;
+    st->time += end - start;
+    if (start - pushed > st->wait_max) {
+        st->wait_max = start - pushed;
+    }
+    if (end - start > st->time_max) {
+        st->time_max = end - start;
     }
+}
+
+/* Captured frames, from the audio thread to the DSP thread, and the ones worth sending, from there to the send thread */
+static AUDIO_RING audio_ring_dsp  = AUDIO_RING_INIT,
+                  audio_ring_send = AUDIO_RING_INIT;
+
+static volatile _Bool audio_pipeline_stop, audio_dsp_thread_init, audio_send_thread_init, audio_preview_on;
+
+/* Filters the captured frames, decides if they're worth sending and plays the preview */
+static void audio_dsp_thread(void *UNUSED(args)) {
+    Filter_Audio *f_a = NULL;
+
+    int16_t     *preview_buffer = NULL;
+    unsigned int preview_buffer_index = 0;
+    #define PREVIEW_BUFFER_SIZE (UTOX_DEFAULT_SAMPLE_RATE_A / 2)
+
+    preview_buffer = calloc(PREVIEW_BUFFER_SIZE, 2);
+    preview_buffer_index = 0;
+
+    while (!audio_pipeline_stop) {
+        // TODO move this code to filter_audio.c
+        #ifdef AUDIO_FILTERING
+            if (!f_a && audio_filtering_enabled) {
+                f_a = new_filter_audio(UTOX_DEFAULT_SAMPLE_RATE_A);
+                if (!f_a) {
+                    audio_filtering_enabled = 0;
+                    debug("filter audio failed\n");
+                } else {
+                    debug("filter audio on\n");
+                }
+            } else if (f_a && !audio_filtering_enabled) {
+                kill_filter_audio(f_a);
+                f_a = NULL;
+                debug("filter audio off\n");
+            }
+        #else
+            if (audio_filtering_enabled) {
+                audio_filtering_enabled = 0;
+            }
+        #endif
 
-    audio_msg.msg = msg;
-    audio_msg.param1 = param1;
-    audio_msg.param2 = param2;
-    audio_msg.data = data;
+        AUDIO_FRAME *frame = audio_ring_read(&audio_ring_dsp);
+        if (!frame) {
+            audio_ring_wait(&audio_ring_dsp, 100);
+            continue;
+        }
 
-    audio_thread_msg = 1;
+        uint64_t start = get_time();
+        int perframe = AUDIO_FRAME_SAMPLES / UTOX_DEFAULT_AUDIO_CHANNELS;
+        _Bool voice = 1;
+
+        #ifdef AUDIO_FILTERING
+        if (f_a) {
+            if (frame->has_loopback) {
+                pass_audio_output(f_a, frame->loopback, perframe);
+                set_echo_delay_ms(f_a, UTOX_DEFAULT_FRAME_A);
+            }
+
+            int ret = filter_audio(f_a, frame->pcm, perframe);
+
+            if (ret == -1) {
+                debug("filter audio error\n");
+            }
+
+            if (ret == 0) {
+                voice = 0;
+            }
+        }
+        #endif
+
+        /* If push to talk, we don't have to do anything */
+        if (!check_ptt_key()) {
+            voice = 0; //PTT is up, send nothing.
+        }
+
+        if (audio_preview_on && preview_buffer) {
+            if (preview_buffer_index + perframe > PREVIEW_BUFFER_SIZE) {
+                preview_buffer_index = 0;
+            }
+            sourceplaybuffer(UTOX_MAX_NUM_FRIENDS, preview_buffer + preview_buffer_index, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
+            if (voice) {
+                memcpy(preview_buffer + preview_buffer_index, frame->pcm, perframe * sizeof(int16_t));
+            } else {
+                memset(preview_buffer + preview_buffer_index, 0, perframe * sizeof(int16_t));
+            }
+            preview_buffer_index += perframe;
+        }
+
+        if (voice) {
+            AUDIO_FRAME *out = audio_ring_write(&audio_ring_send);
+            if (out) {
+                memcpy(out->pcm, frame->pcm, sizeof(out->pcm));
+                out->recorded = frame->recorded;
+                audio_ring_push(&audio_ring_send);
+            }
+        }
+
+        uint64_t pushed = frame->pushed;
+        audio_ring_pop(&audio_ring_dsp);
+        audio_stage_count(&audio_stage[1], pushed, start, get_time());
+    }
+
+    utox_filter_audio_kill(f_a);
+    free(preview_buffer);
+    audio_dsp_thread_init = 0;
+}
+
+/* Hands the frames worth sending to toxav, for every friend in a call */
+static void audio_send_thread(void *args) {
+    ToxAV *av = args;
+
+    while (!audio_pipeline_stop) {
+        AUDIO_FRAME *frame = audio_ring_read(&audio_ring_send);
+        if (!frame) {
+            audio_ring_wait(&audio_ring_send, 100);
+            continue;
+        }
+
+        uint64_t start = get_time();
+        int perframe = AUDIO_FRAME_SAMPLES / UTOX_DEFAULT_AUDIO_CHANNELS;
+
+        int i, active_call_count = 0;
+        for(i = 0; i < UTOX_MAX_NUM_FRIENDS; i++) {
+            if( UTOX_SEND_AUDIO(i) ) {
+                active_call_count++;
+                TOXAV_ERR_SEND_FRAME error = 0;
+                // debug("uToxAudio:\tSending audio frame!\n");
+                toxav_audio_send_frame(av, friend[i].number, frame->pcm, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A, &error);
+                if (error) {
+                    debug("toxav_send_audio error friend == %i, error ==  %i\n", i, error);
+                } else {
+                    // debug("Send a frame to friend %i\n",i);
+                    if (active_call_count >= UTOX_MAX_CALLS) {
+                        debug("We're calling more peers than allowed by UTOX_MAX_CALLS, This is a bug\n");
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (active_call_count) {
+            uint64_t latency = start - frame->recorded;
+            capture_latency.frames++;
+            capture_latency.total += latency;
+            if (latency > capture_latency.max) {
+                capture_latency.max = latency;
+            }
+        }
+
+        // TODO REMOVED until new groups api can be implemented.
+        /*Tox *tox = toxav_get_tox(av);
+        uint32_t num_chats = tox_count_chatlist(tox);
+
+        if (num_chats != 0) {
+            int32_t chats[num_chats];
+            uint32_t max = tox_get_chatlist(tox, chats, num_chats);
+            for (i = 0; i < max; ++i) {
+                if (groups_audio[chats[i]]) {
+                    toxav_group_send_audio(tox, chats[i], (int16_t *)buf, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
+                }
+            }
+        }*/
+
+        uint64_t pushed = frame->pushed;
+        audio_ring_pop(&audio_ring_send);
+        audio_stage_count(&audio_stage[2], pushed, start, get_time());
+    }
+
+    audio_send_thread_init = 0;
 }
 
 void utox_audio_thread(void *args){
@@ -317,6 +630,7 @@ void utox_audio_thread(void *args){
     //_Bool groups_audio[MAX_NUM_GROUPS] = {0};
 
     int     perframe = (UTOX_DEFAULT_FRAME_A * UTOX_DEFAULT_SAMPLE_RATE_A) / 1000;
+    uint64_t frame_ns = (uint64_t)UTOX_DEFAULT_FRAME_A * 1000 * 1000, frame_due = 0;
     uint8_t buf[perframe * 2 * UTOX_DEFAULT_AUDIO_CHANNELS]; //, dest[perframe * 2 * UTOX_DEFAULT_AUDIO_CHANNELS];
     memset(buf, 0, sizeof(buf));
 
@@ -375,21 +689,20 @@ void utox_audio_thread(void *args){
         debug("uToxAudio:\tFirst ringtone failed... can't queue buffers\n");
     }
 
-    Filter_Audio *f_a = NULL;
-
-    int16_t     *preview_buffer = NULL;
-    unsigned int preview_buffer_index = 0;
-    _Bool        preview_on = 0;
-    #define PREVIEW_BUFFER_SIZE (UTOX_DEFAULT_SAMPLE_RATE_A / 2)
-
-    preview_buffer = calloc(PREVIEW_BUFFER_SIZE, 2);
-    preview_buffer_index = 0;
+    /* Filtering and sending get threads of their own, so neither can hold up capturing */
+    audio_pipeline_stop    = 0;
+    audio_dsp_thread_init  = 1;
+    audio_send_thread_init = 1;
+    thread(audio_dsp_thread, NULL);
+    thread(audio_send_thread, av);
 
     while(1) {
         utox_audio_thread_init = 1;
-        if(audio_thread_msg) {
-            TOX_MSG *m = &audio_msg;
+        TOX_MSG queued, *m = &queued;
+        _Bool kill = 0;
+        while (msg_queue_get(&audio_msg_queue, &queued)) {
             if(!m->msg) {
+                kill = 1;
                 break;
             }
 
@@ -399,10 +712,12 @@ void utox_audio_thread(void *args){
                     if (!f->audio_dest) {
                         utox_audio_init_source(&f->audio_dest);
                     }
+                    audio_playback_start(m->param1, f->audio_dest);
                     break;
                 }
                 case UTOXAUDIO_STOP_FRIEND: {
                     FRIEND *f = &friend[m->param1];
+                    audio_playback_stop(m->param1);
                     if (f->audio_dest) {
                         utox_audio_term_source(&f->audio_dest);
                         f->audio_dest = 0;
@@ -410,11 +725,13 @@ void utox_audio_thread(void *args){
                     break;
                 }
                 case UTOXAUDIO_START_PREVIEW: {
-                    preview_on = 1;
+                    audio_preview_on = 1;
+                    audio_playback_start(UTOX_MAX_NUM_FRIENDS, preview);
                     break;
                 }
                 case UTOXAUDIO_STOP_PREVIEW: {
-                    preview_on = 0;
+                    audio_preview_on = 0;
+                    audio_playback_stop(UTOX_MAX_NUM_FRIENDS);
                     break;
                 }
                 case UTOXAUDIO_PLAY_RINGTONE: {
@@ -437,148 +754,116 @@ void utox_audio_thread(void *args){
                     break;
                 }
             }
-            audio_thread_msg = 0;
         }
 
-        // TODO move this code to filter_audio.c
-        #ifdef AUDIO_FILTERING
-            if (!f_a && audio_filtering_enabled) {
-                f_a = new_filter_audio(UTOX_DEFAULT_SAMPLE_RATE_A);
-                if (!f_a) {
-                    audio_filtering_enabled = 0;
-                    debug("filter audio failed\n");
-                } else {
-                    debug("filter audio on\n");
-                }
-            } else if (f_a && !audio_filtering_enabled) {
-                kill_filter_audio(f_a);
-                f_a = NULL;
-                debug("filter audio off\n");
-            }
-        #else
-            if (audio_filtering_enabled) {
-                audio_filtering_enabled = 0;
-            }
-        #endif
+        if (kill) {
+            break;
+        }
 
         _Bool sleep = 1;
+        uint32_t wait_ms = audio_playing ? AUDIO_PLAYOUT_MS : 50;
 
         if (microphone_on) {
             ALint samples;
             _Bool frame = 0;
+            uint64_t now = get_time(), recorded = 0; /* when the first sample of the frame was recorded */
+
+            /* Captured into the ring. If the DSP thread has fallen that far behind, the frame is dropped, but still
+             * taken off the device so it doesn't overflow. */
+            AUDIO_FRAME *out = NULL;
+            int16_t *dest = (int16_t*)buf;
+
             /* If we have a device_in we're on linux so we can just call OpenAL, otherwise we're on something else so
              * we'll need to call audio_frame() to add to the buffer for us. */
             if (audio_in_handle == (void*)1) {
-                frame = audio_frame((void*)buf);
+                /* It fills the frame over several calls, so it goes into buf and is only copied to the ring when
+                 * complete, one slot (or one drop) per frame */
+                frame = audio_frame(dest);
                 if (frame) {
-                    /* We have an audio frame to use, continue without sleeping. */
+                    out = audio_ring_write(&audio_ring_dsp);
+                    if (out) {
+                        memcpy(out->pcm, buf, sizeof(out->pcm));
+                    }
+
+                    /* We have an audio frame to use, continue without sleeping. There's no telling how long it's been
+                     * waiting, assume it was just completed. */
                     sleep = 0;
+                    recorded = now - frame_ns;
+                    frame_due = now + frame_ns;
+                } else {
+                    /* Poll every millisecond once the next one is due, but keep feeding playback in time */
+                    uint32_t due_ms = (frame_due > now) ? (frame_due - now + 999999) / 1000 / 1000 : 1;
+                    if (due_ms < wait_ms) {
+                        wait_ms = due_ms;
+                    }
                 }
             } else {
                 alcGetIntegerv(audio_in_handle, ALC_CAPTURE_SAMPLES, sizeof(samples), &samples);
                 if(samples >= perframe) {
-                    alcCaptureSamples(audio_in_handle, buf, perframe);
+                    out = audio_ring_write(&audio_ring_dsp);
+                    dest = out ? out->pcm : dest;
+                    alcCaptureSamples(audio_in_handle, dest, perframe);
                     frame = 1;
-                    if (samples >= perframe * 2) {
-                        sleep = 0;
-                    }
+                    recorded = now - (uint64_t)samples * 1000 * 1000 * 1000 / UTOX_DEFAULT_SAMPLE_RATE_A;
+                    samples -= perframe;
                 }
-            }
 
-            #ifdef AUDIO_FILTERING
-            #ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
-            if (f_a && audio_filtering_enabled) {
-                alcGetIntegerv(audio_out_device, ALC_LOOPBACK_CAPTURE_SAMPLES, sizeof(samples), &samples);
-                if(samples >= perframe) {
-                    int16_t buffer[perframe];
-                    alcCaptureSamplesLoopback(audio_out_handle, buffer, perframe);
-                    pass_audio_output(f_a, buffer, perframe);
-                    set_echo_delay_ms(f_a, UTOX_DEFAULT_FRAME_A);
-                    if (samples >= perframe * 2) {
-                        sleep = 0;
+                if (samples >= perframe) {
+                    sleep = 0;
+                } else {
+                    /* Wake up as soon as the device has the samples still missing from the next frame */
+                    uint32_t missing_ms = ((perframe - samples) * 1000 + UTOX_DEFAULT_SAMPLE_RATE_A - 1)
+                                          / UTOX_DEFAULT_SAMPLE_RATE_A;
+                    if (missing_ms < wait_ms) {
+                        wait_ms = missing_ms;
                     }
                 }
             }
-            #endif
-            #endif
-
-            if (frame) {
-                _Bool voice = 1;
-                #ifdef AUDIO_FILTERING
-                if (f_a) {
-                    int ret = filter_audio(f_a, (int16_t*)buf, perframe);
 
-                    if (ret == -1) {
-                        debug("filter audio error\n");
-                    }
+            if (frame && out) {
+                out->has_loopback = 0;
 
-                    if (ret == 0) {
-                        voice = 0;
+                #ifdef AUDIO_FILTERING
+                #ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
+                if (audio_filtering_enabled) {
+                    alcGetIntegerv(audio_out_device, ALC_LOOPBACK_CAPTURE_SAMPLES, sizeof(samples), &samples);
+                    if(samples >= perframe) {
+                        alcCaptureSamplesLoopback(audio_out_handle, out->loopback, perframe);
+                        out->has_loopback = 1;
+                        if (samples >= perframe * 2) {
+                            sleep = 0;
+                        }
                     }
                 }
                 #endif
+                #endif
 
-                /* If push to talk, we don't have to do anything */
-                if (!check_ptt_key()) {
-                    voice = 0; //PTT is up, send nothing.
-                }
-
-                if (preview_on) {
-                    if (preview_buffer_index + perframe > PREVIEW_BUFFER_SIZE) {
-                        preview_buffer_index = 0;
-                    }
-                    sourceplaybuffer(UTOX_MAX_NUM_FRIENDS, preview_buffer + preview_buffer_index, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
-                    if (voice) {
-                        memcpy(preview_buffer + preview_buffer_index, buf, perframe * sizeof(int16_t));
-                    } else {
-                        memset(preview_buffer + preview_buffer_index, 0, perframe * sizeof(int16_t));
-                    }
-                    preview_buffer_index += perframe;
-                }
-
-                if (voice) {
-                    int i, active_call_count = 0;
-                    for(i = 0; i < UTOX_MAX_NUM_FRIENDS; i++) {
-                        if( UTOX_SEND_AUDIO(i) ) {
-                            active_call_count++;
-                            TOXAV_ERR_SEND_FRAME error = 0;
-                            // debug("uToxAudio:\tSending audio frame!\n");
-                            toxav_audio_send_frame(av, friend[i].number, (const int16_t *)buf, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A, &error);
-                            if (error) {
-                                debug("toxav_send_audio error friend == %i, error ==  %i\n", i, error);
-                            } else {
-                                // debug("Send a frame to friend %i\n",i);
-                                if (active_call_count >= UTOX_MAX_CALLS) {
-                                    debug("We're calling more peers than allowed by UTOX_MAX_CALLS, This is a bug\n");
-                                    break;
-                                }
-                            }
-                        }
-                    }
+                out->recorded = recorded;
+                audio_ring_push(&audio_ring_dsp);
+                audio_stage_count(&audio_stage[0], now, now, get_time());
+            }
+        }
 
-                    // TODO REMOVED until new groups api can be implemented.
-                    /*Tox *tox = toxav_get_tox(av);
-                    uint32_t num_chats = tox_count_chatlist(tox);
-
-                    if (num_chats != 0) {
-                        int32_t chats[num_chats];
-                        uint32_t max = tox_get_chatlist(tox, chats, num_chats);
-                        for (i = 0; i < max; ++i) {
-                            if (groups_audio[chats[i]]) {
-                                toxav_group_send_audio(tox, chats[i], (int16_t *)buf, perframe, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
-                            }
-                        }
-                    }*/
+        if (audio_playing) {
+            for (uint32_t i = 0; i <= UTOX_MAX_NUM_FRIENDS; i++) {
+                if (audio_playback[i].source) {
+                    audio_playback_feed(&audio_playback[i]);
                 }
             }
         }
 
         if (sleep) {
-            yieldcpu(50);
+            /* Until the next frame can be captured, or the jitter buffers need feeding. Messages wake it early. */
+            msg_queue_wait(&audio_msg_queue, wait_ms);
         }
     }
 
-    utox_filter_audio_kill(f_a);
+    audio_pipeline_stop = 1;
+    audio_ring_wake(&audio_ring_dsp);
+    audio_ring_wake(&audio_ring_send);
+    while (audio_dsp_thread_init || audio_send_thread_init) {
+        yieldcpu(1);
+    }
 
     //missing some cleanup ?
     alDeleteSources(1, &ringtone);
@@ -588,7 +873,24 @@ void utox_audio_thread(void *args){
     utox_audio_in_device_close();
     utox_audio_out_device_close();
 
-    audio_thread_msg = 0;
+    const char *stage_name[] = { "capture", "filter", "send" };
+    uint32_t stage_dropped[] = { audio_ring_dsp.dropped, audio_ring_send.dropped, 0 };
+    for (int i = 0; i < 3; i++) {
+        AUDIO_STAGE_STATS *st = &audio_stage[i];
+        if (st->frames) {
+            debug("uToxAudio:\t%s: %"PRIu64" frames, %u dropped for lack of room in the next stage, waited avg %"PRIu64"us "
+                  "max %"PRIu64"us, took avg %"PRIu64"us max %"PRIu64"us\n", stage_name[i], st->frames, stage_dropped[i],
+                  st->wait / st->frames / 1000, st->wait_max / 1000, st->time / st->frames / 1000, st->time_max / 1000);
+        }
+    }
+
+    if (capture_latency.frames) {
+        /* A frame can't be sent before all of it is recorded, anything past frame_ns is added by capturing */
+        debug("uToxAudio:\tCapture to send latency over %"PRIu64" frames: avg %"PRIu64"us max %"PRIu64"us, of which "
+              "%"PRIu64"us is the frame itself\n", capture_latency.frames, capture_latency.total / capture_latency.frames / 1000,
+              capture_latency.max / 1000, frame_ns / 1000);
+    }
+    msg_queue_debug_stats(&audio_msg_queue, "uToxAudio");
     utox_audio_thread_init = 0;
     debug("UTOXAUDIO:\tClean thread exit!\n");
 }
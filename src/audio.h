@@ -52,6 +52,8 @@ void utox_audio_out_device_close(void);
 void utox_audio_out_device_set(ALCdevice *new_device);
 ALCdevice* utox_audio_out_device_get(void);
 
+/* Hands an audio frame of friend i, or of the preview if i is UTOX_MAX_NUM_FRIENDS, to its jitter buffer. Frames for
+ * a friend that's not in a call are dropped. Safe to call from any thread. */
 void sourceplaybuffer(unsigned int i, const int16_t *data, int samples, uint8_t channels, unsigned int sample_rate);
 
 /* send a message to the audio thread
@@ -0,0 +1,77 @@
+#include "main.h"
+
+/* With one producer and one consumer, each index only has one writer. The producer publishes a filled frame with a
+ * release store of head, the consumer gives it back with a release store of tail, and each loads the other's index
+ * with acquire, so the contents of a frame are always seen complete. Indexes are allowed to wrap, they're only ever
+ * compared through their difference.
+ *
+ * Sleeping works like in msg_queue.c: the consumer sets waiting before its last look at the ring, the producer checks
+ * it after pushing, and the fences on both sides make sure one of them sees the other. */
+#define AUDIO_RING_MASK (AUDIO_RING_SIZE - 1)
+
+AUDIO_FRAME* audio_ring_write(AUDIO_RING *r) {
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == AUDIO_RING_SIZE) {
+        r->dropped++;
+        return NULL;
+    }
+
+    return &r->frame[head & AUDIO_RING_MASK];
+}
+
+void audio_ring_wake(AUDIO_RING *r) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&r->waiting, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_mutex_lock(&r->wake_lock);
+    r->woken = 1;
+    pthread_cond_signal(&r->wake_cond);
+    pthread_mutex_unlock(&r->wake_lock);
+}
+
+void audio_ring_push(AUDIO_RING *r) {
+    r->frame[r->head & AUDIO_RING_MASK].pushed = get_time();
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    audio_ring_wake(r);
+}
+
+AUDIO_FRAME* audio_ring_read(AUDIO_RING *r) {
+    uint32_t tail = r->tail;
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
+    }
+
+    return &r->frame[tail & AUDIO_RING_MASK];
+}
+
+void audio_ring_pop(AUDIO_RING *r) {
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+void audio_ring_wait(AUDIO_RING *r, uint32_t timeout_ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec  += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000 * 1000;
+    if (until.tv_nsec >= 1000 * 1000 * 1000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&r->wake_lock);
+    r->woken = 0;
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while (!r->woken && __atomic_load_n(&r->head, __ATOMIC_RELAXED) == r->tail) {
+        if (pthread_cond_timedwait(&r->wake_cond, &r->wake_lock, &until)) {
+            /* Timed out */
+            break;
+        }
+    }
+
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&r->wake_lock);
+}
@@ -0,0 +1,55 @@
+/** Bounded, lock-free, single-producer single-consumer ring of audio frames.
+ *
+ * Connects the stages of the outgoing audio: capture on the audio thread, filtering on the DSP thread and sending on
+ * the send thread. Frames are filled and read in place, nothing is allocated on the way. A producer that
+ * finds the ring full drops the frame instead of waiting, so a slow stage can never hold up the ones before it.
+ * Rings are plain static variables initialized with AUDIO_RING_INIT.
+ */
+#include <pthread.h>
+
+/* Frames a ring holds, must be a power of 2 */
+#define AUDIO_RING_SIZE 8
+
+#define AUDIO_FRAME_SAMPLES (UTOX_DEFAULT_FRAME_A * UTOX_DEFAULT_SAMPLE_RATE_A / 1000 * UTOX_DEFAULT_AUDIO_CHANNELS)
+
+typedef struct {
+    int16_t pcm[AUDIO_FRAME_SAMPLES];
+    int16_t loopback[AUDIO_FRAME_SAMPLES]; /* what the speakers played meanwhile, for echo cancellation */
+    _Bool has_loopback;
+    uint64_t recorded; /* when the first sample was recorded */
+    uint64_t pushed;   /* when it was handed to the next stage */
+} AUDIO_FRAME;
+
+typedef struct {
+    AUDIO_FRAME frame[AUDIO_RING_SIZE];
+
+    volatile uint32_t head; /* next frame to fill, only written by the producer */
+    volatile uint32_t tail; /* next frame to read, only written by the consumer */
+    uint32_t dropped;       /* frames the producer found no room for */
+
+    /* Lets the consumer sleep until a frame is pushed, like msg_queue_wait() */
+    pthread_mutex_t wake_lock;
+    pthread_cond_t  wake_cond;
+    volatile _Bool  waiting, woken;
+} AUDIO_RING;
+
+#define AUDIO_RING_INIT { .wake_lock = PTHREAD_MUTEX_INITIALIZER, .wake_cond = PTHREAD_COND_INITIALIZER }
+
+/* returns the frame to fill next, or NULL if the ring is full. Only call this from the producer thread. */
+AUDIO_FRAME* audio_ring_write(AUDIO_RING *r);
+
+/* Hands the frame from audio_ring_write() to the consumer */
+void audio_ring_push(AUDIO_RING *r);
+
+/* returns the oldest frame, or NULL if there is none. Only call this from the consumer thread. */
+AUDIO_FRAME* audio_ring_read(AUDIO_RING *r);
+
+/* Gives the frame from audio_ring_read() back to the producer */
+void audio_ring_pop(AUDIO_RING *r);
+
+/** Sleeps until a frame is pushed to r, audio_ring_wake() is called, or timeout_ms pass. Only call this from the
+ * consumer thread. Returns immediately if there already are frames waiting. */
+void audio_ring_wait(AUDIO_RING *r, uint32_t timeout_ms);
+
+/* Wakes the consumer of r, even if there's nothing to read */
+void audio_ring_wake(AUDIO_RING *r);
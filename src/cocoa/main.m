@@ -243,6 +243,11 @@ void flush_file(FILE *file) {
     fsync(fd);
 }
 
+int file_truncate(FILE *file, uint64_t size) {
+    fflush(file);
+    return ftruncate(fileno(file), size);
+}
+
 int resize_file(FILE *file, uint64_t size) {
     // https://github.com/trbs/fallocate/blob/master/fallocate/_fallocatemodule.c
     int fd = fileno(file);
@@ -286,6 +291,10 @@ void redraw(void) {
     [ad soilWindowContents];
 }
 
+void redraw_rect(int x, int y, int width, int height) {
+    redraw();
+}
+
 void launch_at_startup(int should) {
     LSSharedFileListRef items = LSSharedFileListCreate(kCFAllocatorDefault, kLSSharedFileListSessionLoginItems, NULL);
     if (should) {
@@ -19,6 +19,8 @@ STRING_IDX utox_run_command(char_t *string, STRING_IDX string_length, char_t **c
 
     if (string[0] == '/') { /* Cool it's a command we support! */
         // debug("command found!\n");
+        /* A command without an argument, like a bare /search, is all of the string */
+        cmd_length = string_length;
         uint16_t i;
         for (i = 0; i < string_length; ++i) {
             if (string[i] == ' ') {
@@ -68,6 +70,16 @@ STRING_IDX utox_run_command(char_t *string, STRING_IDX string_length, char_t **c
                 return 0;
             }
         }
+    } else if ((cmd_length == 6) && (memcmp(*cmd, "search", 6) == 0)) {
+        if (*argument) {
+            search_start(*argument, argument_length);
+        } else {
+            /* Showing the next result may switch chats, don't leave the command in the next one's box */
+            edit_setstr(&edit_msg, (char_t *)"", 0);
+            search_next();
+        }
+
+        cmd_length = -1; /* We'll take care of this, don't return to edit */
     } else {
         // debug("Command unsupported!\n");
     }
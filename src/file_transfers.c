@@ -111,6 +111,8 @@ static void utox_new_contact_file(FILE_TRANSFER *file){
     postmessage(FILE_INCOMING_NEW, 0, 0, file_copy);
 }
 
+#define FILE_RESUME_SAVE_INTERVAL ((uint64_t)5 * 1000 * 1000 * 1000)
+
 /* Calculate the transfer speed for the UI. */
 static void calculate_speed(FILE_TRANSFER *file){
     if ((file->speed) > file->num_packets * 20 * 1371) {
@@ -133,7 +135,254 @@ static void calculate_speed(FILE_TRANSFER *file){
     }
 
     utox_update_user_file(file);
-    utox_file_save_ftinfo(file);
+
+    /* Resume info only needs to be roughly up to date, it's saved again on pause, break and exit */
+    if (time - file->resume_save_time >= FILE_RESUME_SAVE_INTERVAL) {
+        utox_file_save_ftinfo(file);
+    }
+}
+
+/* Incoming chunks are only ~1.3KB, so instead of writing each one from the toxcore thread they're collected in a
+ * per transfer buffer, and handed over in large blocks to a disk writer thread. The writer is the only one that
+ * touches the FILE after that, so closing it goes through the writer as well. fsync only happens when the transfer
+ * is paused or closed. */
+#define FILE_WRITE_BUFFER_SIZE (512 * 1024)
+#define FILE_WRITE_BUFFER_MAX  (16 * 1024 * 1024) /* Past this we wait for the writer instead of growing the buffer */
+#define FILE_WRITE_BUFFER_AGE  ((uint64_t)1000 * 1000 * 1000) /* Hand over buffered data at least once a second */
+
+typedef struct FILE_WRITE_BLOCK {
+    FILE     *file;
+    uint32_t friend_number, file_number;
+    uint64_t position;
+    size_t   length;
+    uint32_t chunks;
+    uint8_t  data[];
+} FILE_WRITE_BLOCK;
+
+enum {
+    FILE_WRITER_DATA = 1, /* data: FILE_WRITE_BLOCK, freed by the writer */
+    FILE_WRITER_SYNC,     /* data: FILE to fsync */
+    FILE_WRITER_CLOSE,    /* data: FILE to fsync and close */
+    FILE_WRITER_BARRIER,  /* data: volatile _Bool set once everything posted before it is done */
+};
+
+static UTOX_MSG_QUEUE file_writer_queue = UTOX_MSG_QUEUE_INIT;
+static _Bool file_writer_running;
+
+static void file_writer_thread(void *UNUSED(args)) {
+    uint64_t bytes = 0, writes = 0, chunks = 0, write_time = 0;
+    FILE *failed = NULL;
+
+    while (1) {
+        TOX_MSG msg;
+        if (!msg_queue_get(&file_writer_queue, &msg)) {
+            msg_queue_wait(&file_writer_queue, 1000);
+            continue;
+        }
+
+        switch (msg.msg) {
+            case FILE_WRITER_DATA: {
+                FILE_WRITE_BLOCK *block = msg.data;
+                uint64_t start = get_time();
+
+                uint8_t count = 10;
+                while (!file_lock(block->file, block->position, block->length)) {
+                    debug("FileTransfer:\tCan't get lock, sleeping...\n");
+                    yieldcpu(10);
+                    if (count == 0) {
+                        break;
+                    }
+                    count--;
+                }
+                fseeko(block->file, block->position, SEEK_SET);
+                size_t write_size = fwrite(block->data, 1, block->length, block->file);
+                fflush(block->file);
+                file_unlock(block->file, block->position, block->length);
+
+                if (write_size != block->length) {
+                    /* Only cancel once, the rest of the queued blocks for this file will fail too */
+                    if (block->file != failed) {
+                        debug("\n\nFileTransfer:\tERROR WRITING DATA TO FILE! (%u & %u)\n\n", block->friend_number,
+                              block->file_number);
+                        postmessage_toxcore(TOX_FILE_CANCEL, block->friend_number, block->file_number, NULL);
+                        failed = block->file;
+                    }
+                } else {
+                    bytes  += block->length;
+                    chunks += block->chunks;
+                    writes++;
+                    write_time += get_time() - start;
+                }
+                free(block);
+                break;
+            }
+            case FILE_WRITER_SYNC: {
+                flush_file(msg.data);
+                break;
+            }
+            case FILE_WRITER_CLOSE: {
+                flush_file(msg.data);
+                fclose(msg.data);
+                if (msg.data == failed) {
+                    failed = NULL;
+                }
+
+                /* Everything written since the last file was closed, which is this one's unless several are
+                 * being received at once */
+                if (write_time) {
+                    debug("FileTransfer:\tDisk writer: %"PRIu64" KiB in %"PRIu64" writes (%"PRIu64" chunks), "
+                          "%.1f MiB/s\n", bytes / 1024, writes, chunks,
+                          (double)bytes * 1e9 / write_time / 1024 / 1024);
+                }
+                bytes = writes = chunks = write_time = 0;
+                break;
+            }
+            case FILE_WRITER_BARRIER: {
+                __atomic_store_n((volatile _Bool*)msg.data, 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+    }
+}
+
+/* Posts to the disk writer, starting it the first time. Only call this from the toxcore thread.
+ *
+ * returns 0 if the queue is full and wait is 0. */
+static _Bool file_writer_post(uint8_t msg, void *data, _Bool wait) {
+    if (!file_writer_running) {
+        file_writer_running = 1;
+        thread(file_writer_thread, NULL);
+    }
+
+    if (wait) {
+        msg_queue_post_wait(&file_writer_queue, msg, 0, 0, data);
+        return 1;
+    }
+    return msg_queue_post(&file_writer_queue, msg, 0, 0, data);
+}
+
+/* Hands the buffered data of file to the disk writer.
+ *
+ * returns 0 if the writer is busy and wait is 0, the data stays buffered in that case. */
+static _Bool utox_file_write_flush(FILE_TRANSFER *file, _Bool wait) {
+    if (!file->write_block) {
+        return 1;
+    }
+
+    if (!file_writer_post(FILE_WRITER_DATA, file->write_block, wait)) {
+        return 0;
+    }
+
+    file->write_block    = NULL;
+    file->write_capacity = 0;
+    return 1;
+}
+
+/* Adds an incoming chunk to the write buffer of file, handing it to the writer when it's big or old enough.
+ *
+ * returns 0 if we ran out of memory. */
+static _Bool utox_file_buffer_write(FILE_TRANSFER *file, uint64_t position, const uint8_t *data, size_t length) {
+    FILE_WRITE_BLOCK *block = file->write_block;
+
+    if (block && position != block->position + block->length) {
+        /* Not contiguous with what we have, that has to go out first */
+        utox_file_write_flush(file, 1);
+        block = NULL;
+    }
+
+    if (!block) {
+        block = malloc(sizeof(*block) + FILE_WRITE_BUFFER_SIZE);
+        if (!block) {
+            return 0;
+        }
+        block->file          = file->file;
+        block->friend_number = file->friend_number;
+        block->file_number   = file->file_number;
+        block->position      = position;
+        block->length        = 0;
+        block->chunks        = 0;
+
+        file->write_block    = block;
+        file->write_capacity = FILE_WRITE_BUFFER_SIZE;
+        file->write_time     = get_time();
+    } else if (block->length + length > file->write_capacity) {
+        /* The writer couldn't take the last flush, grow rather than stall toxcore */
+        block = realloc(block, sizeof(*block) + file->write_capacity * 2);
+        if (!block) {
+            return 0;
+        }
+        file->write_block     = block;
+        file->write_capacity *= 2;
+    }
+
+    memcpy(block->data + block->length, data, length);
+    block->length += length;
+    block->chunks++;
+
+    if (block->length >= FILE_WRITE_BUFFER_SIZE || get_time() - file->write_time >= FILE_WRITE_BUFFER_AGE) {
+        utox_file_write_flush(file, block->length >= FILE_WRITE_BUFFER_MAX);
+    }
+    return 1;
+}
+
+/* Waits until the disk writer is done with everything posted to it so far */
+static void file_writer_drain(void) {
+    file_writer_drain();
+}
+
+/* Closes the FILE of file, through the disk writer if it may still have data for it */
+static void utox_file_close(FILE_TRANSFER *file) {
+    if (file->incoming && (file_writer_running || file->write_block)) {
+        /* A small file may still be all in write_block, with the writer never started */
+        utox_file_write_flush(file, 1);
+        file_writer_post(FILE_WRITER_CLOSE, file->file, 1);
+    } else {
+        fclose(file->file);
+    }
+    file->file = NULL;
+}
+
+void ft_flush_stale_writes(void) {
+    /* Stalled transfers are rare, so there's no need to look for them on every iteration */
+    static uint64_t last_check;
+    uint64_t time = get_time();
+    if (time - last_check < FILE_WRITE_BUFFER_AGE / 4) {
+        return;
+    }
+    last_check = time;
+
+    for (int i = 0; i < MAX_NUM_FRIENDS; i++) {
+        for (int j = 0; j < MAX_FILE_TRANSFERS; j++) {
+            FILE_TRANSFER *file = &incoming_transfer[i][j];
+            if (file->write_block && time - file->write_time >= FILE_WRITE_BUFFER_AGE) {
+                utox_file_write_flush(file, 0);
+            }
+        }
+    }
+}
+
+void ft_flush_writes(void) {
+    for (int i = 0; i < MAX_NUM_FRIENDS; i++) {
+        for (int j = 0; j < MAX_FILE_TRANSFERS; j++) {
+            FILE_TRANSFER *file = &incoming_transfer[i][j];
+            if (file->file && !file->in_memory && (file_writer_running || file->write_block)) {
+                utox_file_write_flush(file, 1);
+                file_writer_post(FILE_WRITER_SYNC, file->file, 1);
+            }
+            utox_file_save_ftinfo(file);
+            utox_file_save_ftinfo(&outgoing_transfer[i][j]);
+        }
+    }
+
+    if (!file_writer_running) {
+        return;
+    }
+
+    volatile _Bool done = 0;
+    file_writer_post(FILE_WRITER_BARRIER, (void*)&done, 1);
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        yieldcpu(1);
+    }
 }
 
 /* Create the file transfer resume info file. */
@@ -226,6 +475,7 @@ static void utox_kill_file(FILE_TRANSFER *file, uint8_t us){
     if (!file->incoming && friend[file->friend_number].transfer_count) {
         --friend[file->friend_number].transfer_count;
     }
+    utox_file_write_flush(file, 1);
     if(file->resume){
         utox_file_save_ftinfo(file);
         utox_file_free_ftinfo(file);
@@ -247,6 +497,7 @@ static void utox_break_file(FILE_TRANSFER *file){
     }
     file->status = FILE_TRANSFER_STATUS_BROKEN;
     utox_update_user_file(file);
+    utox_file_write_flush(file, 1);
     utox_file_save_ftinfo(file);
     if (file->in_use) {
         utox_cleanup_file_transfers(file->friend_number, file->file_number);
@@ -316,6 +567,12 @@ static void utox_pause_file(FILE_TRANSFER *file, uint8_t us){
         break;
     }
     }
+    if (file->incoming && file->file && file->write_block) {
+        /* Nothing new is coming for a while, get what we have onto the disk */
+        utox_file_write_flush(file, 1);
+        file_writer_post(FILE_WRITER_SYNC, file->file, 1);
+    }
+    utox_file_save_ftinfo(file);
     utox_update_user_file(file);
     //TODO free not freed data.
 }
@@ -406,6 +663,7 @@ static void utox_complete_file(FILE_TRANSFER *file){
         debug("FileTransfer:\tUnable to complete file in non-active state (file:%u)\n", file->file_number);
     }
     debug("FileTransfer:\tIncoming transfer is done (%u & %u)\n", file->friend_number, file->file_number);
+    utox_file_write_flush(file, 1);
     utox_file_save_ftinfo(file);
     utox_file_free_ftinfo(file);
     utox_cleanup_file_transfers(file->friend_number, file->file_number);
@@ -684,22 +942,9 @@ static void incoming_file_callback_chunk(Tox *UNUSED(tox), uint32_t friend_numbe
             //     }
             // }
         if(file_handle->file) {
-            uint8_t count = 10;
-            while(!file_lock(file_handle->file, position, length)){
-                debug("FileTransfer:\tCan't get lock, sleeping...\n");
-                yieldcpu(10);
-                if (count == 0) {
-                    break;
-                }
-                count--;
-                // If you get a bug report about this hanging utox, just disable it, it's unlikely to be needed!
-            }
-            fseeko(file_handle->file, position, SEEK_SET);
-            size_t write_size = fwrite(data, 1, length, file_handle->file);
-            fflush(file_handle->file);
-            file_unlock(file_handle->file, position, length);
-            if(write_size != length){
-                debug("\n\nFileTransfer:\tERROR WRITING DATA TO FILE! (%u & %u)\n\n", friend_number, file_number);
+            /* The disk writer reports write errors itself */
+            if(!utox_file_buffer_write(file_handle, position, data, length)){
+                debug("\n\nFileTransfer:\tUnable to buffer incoming data! (%u & %u)\n\n", friend_number, file_number);
                 postmessage_toxcore(TOX_FILE_CANCEL, friend_number, file_number, NULL);
                 return;
             }
@@ -893,6 +1138,36 @@ uint32_t outgoing_file_send(Tox *tox, uint32_t friend_number, uint8_t *path, uin
     return file_number;
 }
 
+/* Outgoing files are read FILE_READ_AHEAD_SIZE at a time, so most chunks are just a slice of the read buffer.
+ *
+ * returns a pointer to length bytes of the file at position, or NULL if they can't be read. */
+#define FILE_READ_AHEAD_SIZE (1024 * 1024)
+static const uint8_t* utox_file_read_ahead(FILE_TRANSFER *file, uint64_t position, size_t length) {
+    if (!file->file) {
+        return NULL;
+    }
+
+    if (position < file->read_position || position + length > file->read_position + file->read_length) {
+        if (!file->read_buffer) {
+            file->read_buffer = malloc(FILE_READ_AHEAD_SIZE);
+            if (!file->read_buffer) {
+                return NULL;
+            }
+        }
+        /* Toxcore may ask again for chunks it lost, so this isn't always the next window */
+        fseeko(file->file, position, SEEK_SET);
+        file->read_position = position;
+        file->read_length   = fread(file->read_buffer, 1, FILE_READ_AHEAD_SIZE, file->file);
+        file->read_count++;
+
+        if (length > file->read_length) {
+            return NULL;
+        }
+    }
+
+    return file->read_buffer + (position - file->read_position);
+}
+
 static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position, size_t length, void *UNUSED(user_data)){
 
     // debug("FileTransfer:\tChunk requested for friend_id (%u), and file_id (%u). Start (%lu), End (%zu).\r", friend_number, file_number, position, length);
@@ -905,37 +1180,22 @@ static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
         return;
     }
 
-    uint8_t buffer[length];
-    size_t read_size = 0;
+    const uint8_t *data = NULL;
+    uint64_t start = get_time();
 
     if(file_handle->in_memory){
-        // Memory
-        if(file_handle->is_avatar){
-            if(file_handle->size < length){
-                debug("FileTransfer:\tAvatar size mismatch!\n");
-                return;
-            }
-            memcpy(buffer, file_handle->avatar + position, length);
-            read_size = length; /* We hope!! */
-        } else {
-            if(file_handle->size < length){
-                debug("FileTransfer:\tMemory size mismatch!\n");
-                return;
-            }
-            memcpy(buffer, file_handle->memory + position, length);
-            read_size = length; /* We hope!! */
+        // Memory, toxcore copies the chunk so we can hand it a slice directly
+        if(file_handle->size < position + length){
+            debug("FileTransfer:\t%s size mismatch!\n", file_handle->is_avatar ? "Avatar" : "Memory");
+            return;
         }
+        data = (file_handle->is_avatar ? file_handle->avatar : file_handle->memory) + position;
     } else {
         // File
-        FILE *file = file_handle->file;
-        if(file){
-            fseeko(file, position, SEEK_SET);
-            read_size = fread(buffer, 1, length, file);
-            // debug("File okay\n");
-        }
+        data = utox_file_read_ahead(file_handle, position, length);
     }
 
-    if(read_size != length){
+    if(!data){
         debug("FileTransfer:\tERROR READING FILE! (%u & %u)\n", friend_number, file_number);
         //debug("FileTransfer:\t\tSize (%lu), Position (%lu), Length(%lu), Read_size (%lu), size_transferred (%lu).\n",
         //    file_handle->size, position, length, read_size, file_handle->size_transferred);
@@ -945,8 +1205,10 @@ static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
 
     TOX_ERR_FILE_SEND_CHUNK error;
 
-    tox_file_send_chunk(tox, friend_number, file_number, position, buffer, length, &error);
+    tox_file_send_chunk(tox, friend_number, file_number, position, data, length, &error);
     file_handle->size_transferred += length;
+    file_handle->chunk_count++;
+    file_handle->read_time += get_time() - start;
 
     calculate_speed(file_handle);
 }
@@ -1005,8 +1267,16 @@ void utox_cleanup_file_transfers(uint32_t friend_number, uint32_t file_number){
     }
 
     if (transfer->file) {
-        fclose(transfer->file);
+        utox_file_close(transfer);
+    }
+    free(transfer->write_block);
+
+    if (transfer->chunk_count && transfer->read_time) {
+        debug("FileTransfer:\tSent %u chunks with %u reads, %"PRIu64" chunks/s (%u & %u)\n", transfer->chunk_count,
+              transfer->read_count, (uint64_t)transfer->chunk_count * 1000 * 1000 * 1000 / transfer->read_time,
+              friend_number, file_number);
     }
+    free(transfer->read_buffer);
 
     if (transfer->saveinfo) {
         fclose(transfer->saveinfo);
@@ -1015,15 +1285,57 @@ void utox_cleanup_file_transfers(uint32_t friend_number, uint32_t file_number){
     memset(transfer, 0, sizeof(FILE_TRANSFER));
 }
 
+/* The resume info is a single fixed size record, rewritten in place:
+ *      0   uint32  FILE_RESUME_VERSION
+ *      4   uint32  path length
+ *      8   uint64  file size
+ *     16   uint64  bytes transferred
+ *     24   file id
+ *     56   path, zero padded to UTOX_FILE_NAME_LENGTH
+ *   1080   uint32  FNV-1a hash of everything before it
+ * Numbers are in host byte order. */
+#define FILE_RESUME_VERSION     1
+#define FILE_RESUME_PATH_OFFSET (24 + TOX_FILE_ID_LENGTH)
+#define FILE_RESUME_RECORD_SIZE (FILE_RESUME_PATH_OFFSET + UTOX_FILE_NAME_LENGTH + 4)
+
+static uint32_t resume_checksum(const uint8_t *data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
 void utox_file_save_ftinfo(FILE_TRANSFER *file){
     if(!file->saveinfo){
         return;
     }
-    fwrite(file, sizeof(*file), 1, file->saveinfo);
-    fwrite(file->path, sizeof(uint8_t), file->path_length, file->saveinfo);
-    fflush(file->saveinfo);
+
+    if (file->path_length > UTOX_FILE_NAME_LENGTH) {
+        debug("FileTransfer:\tPath too long to save resume info for %.*s\n", (uint32_t)file->name_length, file->name);
+        return;
+    }
+
+    uint8_t  record[FILE_RESUME_RECORD_SIZE] = {0};
+    uint32_t version = FILE_RESUME_VERSION, path_length = file->path_length, checksum;
+    /* Only claim what's been handed to the disk writer, the buffer would be lost if we crash. */
+    uint64_t transferred = file->write_block ? file->write_block->position : file->size_transferred;
+
+    memcpy(record,      &version,           sizeof(version));
+    memcpy(record + 4,  &path_length,       sizeof(path_length));
+    memcpy(record + 8,  &file->size,        sizeof(file->size));
+    memcpy(record + 16, &transferred,       sizeof(transferred));
+    memcpy(record + 24, file->file_id,      TOX_FILE_ID_LENGTH);
+    if (file->path) {
+        memcpy(record + FILE_RESUME_PATH_OFFSET, file->path, path_length);
+    }
+    checksum = resume_checksum(record, FILE_RESUME_RECORD_SIZE - 4);
+    memcpy(record + FILE_RESUME_RECORD_SIZE - 4, &checksum, sizeof(checksum));
+
     fseeko(file->saveinfo, 0, SEEK_SET);
+    fwrite(record, sizeof(record), 1, file->saveinfo);
     fflush(file->saveinfo);
+    file->resume_save_time = get_time();
 }
 
 _Bool utox_file_load_ftinfo(FILE_TRANSFER *file){
@@ -1045,42 +1357,47 @@ _Bool utox_file_load_ftinfo(FILE_TRANSFER *file){
         sprintf((char*)path + (path_length + TOX_PUBLIC_KEY_SIZE * 2), "%02i.ftoutfo", file->file_number % 100);
     }
 
-    void *load = file_raw((char*)path, &size_read);
+    uint8_t *load = file_raw((char*)path, &size_read);
+
+    if (file->file) {
+        /* Just in case we try to resume an active file. Whatever the writer still had for it has to be on the disk
+         * before the file gets opened again. */
+        utox_file_close(file);
+        file_writer_drain();
+    }
 
     if (!load) {
         if (file->incoming) {
             debug("FileTransfer:\tUnable to load saved info... uTox can't resume file %.*s\n", (uint32_t)file->name_length, file->name);
         }
         file->status = 0;
-        if (file->file) {
-            /* Just in case we try to resume an active file. */
-            fclose(file->file);
-        }
         return 0;
-    } else {
-        if (file->file) {
-            /* Just in case we try to resume an active file. */
-            fclose(file->file);
-        }
     }
 
-    FILE_TRANSFER *info = calloc(1, sizeof(*info));
-    memcpy(info, load, sizeof(*info));
-    info->path_length = (size_read - sizeof(*info));
-    info->path = malloc(info->path_length + 1);
-    memcpy(info->path, load + (sizeof(*info)), info->path_length);
-    info->path[info->path_length] = 0;
+    uint32_t version = 0, saved_path_length = 0, checksum = 0;
+    if (size_read == FILE_RESUME_RECORD_SIZE) {
+        memcpy(&version,           load,     sizeof(version));
+        memcpy(&saved_path_length, load + 4, sizeof(saved_path_length));
+        memcpy(&checksum,          load + FILE_RESUME_RECORD_SIZE - 4, sizeof(checksum));
+    }
+
+    if (version != FILE_RESUME_VERSION || saved_path_length > UTOX_FILE_NAME_LENGTH
+        || checksum != resume_checksum(load, FILE_RESUME_RECORD_SIZE - 4)) {
+        debug("FileTransfer:\tSaved info %s is damaged or from an older uTox, can't resume\n", path);
+        file->status = 0;
+        free(load);
+        return 0;
+    }
+
+    file->path_length = saved_path_length;
+    file->path = malloc(file->path_length + 1);
+    memcpy(file->path, load + FILE_RESUME_PATH_OFFSET, file->path_length);
+    file->path[file->path_length] = 0;
 
-    info->friend_number = file->friend_number;
-    info->file_number   = file->file_number;
-    info->name          = NULL;
-    info->name_length   = 0;
-    info->ui_data       = NULL;
-    info->file          = NULL;
-    info->saveinfo      = 0;
+    memcpy(&file->size,             load + 8,  sizeof(file->size));
+    memcpy(&file->size_transferred, load + 16, sizeof(file->size_transferred));
+    memcpy(file->file_id,           load + 24, TOX_FILE_ID_LENGTH);
 
-    memcpy(file, info, sizeof(*file));
-    free(info);
     free(load);
     return 1;
 }
@@ -25,9 +25,22 @@ typedef struct FILE_TRANSFER {
     /* speed + progress calculations. */
     uint32_t speed, num_packets;
     uint64_t last_check_time, last_check_transferred;
+    uint64_t resume_save_time;
 
     FILE *file, *saveinfo;
     MSG_FILE *ui_data;
+
+    /* Incoming data that hasn't been handed to the disk writer yet, see utox_file_buffer_write() */
+    struct FILE_WRITE_BLOCK *write_block;
+    size_t   write_capacity;
+    uint64_t write_time;
+
+    /* Outgoing data read ahead of the chunks toxcore asks for, see utox_file_read_ahead() */
+    uint8_t  *read_buffer;
+    uint64_t read_position;
+    size_t   read_length;
+    uint32_t read_count, chunk_count;
+    uint64_t read_time;
 } FILE_TRANSFER;
 
 void file_transfer_local_control(Tox *tox, uint32_t friend_number, uint32_t file_number, TOX_FILE_CONTROL control);
@@ -40,6 +53,11 @@ void utox_cleanup_file_transfers(uint32_t friend_number, uint32_t file_number);
 
 void ft_friend_online(Tox *tox, uint32_t friend_number);
 void ft_friend_offline(Tox *tox, uint32_t friend_number);
+/* Hands incoming chunks that have been buffered for FILE_WRITE_BUFFER_AGE to the disk writer, so a stalled transfer
+ * doesn't keep them off the disk. Call this regularly from the toxcore thread. */
+void ft_flush_stale_writes(void);
+/* Writes out every buffered incoming chunk and the resume info of every transfer, and waits for the disk writer. */
+void ft_flush_writes(void);
 
 void utox_file_save_ftinfo(FILE_TRANSFER *file);
 _Bool utox_file_load_ftinfo(FILE_TRANSFER *file);
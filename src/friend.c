@@ -118,6 +118,13 @@ void utox_friend_init(Tox *tox, uint32_t friend_number){
         // Get the chat backlog
         log_read(tox, friend_number);
 
+        // Catch its search index up with the log
+        uint8_t *key = malloc(TOX_PUBLIC_KEY_SIZE);
+        if (key) {
+            memcpy(key, f->cid, TOX_PUBLIC_KEY_SIZE);
+            postmessage_search(SEARCH_FRIEND, friend_number, 0, key);
+        }
+
         // Load the meta data, if it exists.
         friend_meta_data_read(tox, friend_number);
 }
@@ -127,6 +134,7 @@ void friend_setname(FRIEND *f, char_t *name, STRING_IDX length){
         MESSAGE *msg = malloc(sizeof(MESSAGE) + sizeof(" is now known as ") - 1 + f->name_length + length);
         msg->author = 0;
         msg->msg_type = MSG_TYPE_ACTION_TEXT;
+        msg->layout = NULL;
         msg->length = sizeof(" is now known as ") - 1 + f->name_length + length;
 
         char_t *p = msg->msg;
@@ -228,6 +236,7 @@ void friend_addmessage_notify(FRIEND *f, char_t *data, STRING_IDX length) {
     MESSAGE *msg = malloc(sizeof(MESSAGE) + length);
     msg->author = 0;
     msg->msg_type = MSG_TYPE_ACTION_TEXT;
+    msg->layout = NULL;
     msg->length = length;
     char_t *p = msg->msg;
     memcpy(p, data, length);
@@ -330,32 +339,12 @@ void friend_add(char_t *name, STRING_IDX length, char_t *msg, STRING_IDX msg_len
     }
 }
 
-#define LOGFILE_EXT ".txt"
-
 void friend_history_clear(FRIEND *f)
 {
-    uint8_t path[UTOX_FILE_NAME_LENGTH], *p;
-
     message_clear(&messages_friend, &f->msg);
 
-    {
-        /* We get the file path of the log file */
-        p = path + datapath(path);
-
-        if(countof(path) - (p - path) < TOX_PUBLIC_KEY_SIZE * 2 + sizeof(LOGFILE_EXT))
-        {
-            /* We ensure that we have enough space in the buffer,
-               if not we fail */
-            debug("error/history_clear: path too long\n");
-            return;
-        }
-
-        cid_to_string(p, f->cid);
-        p += TOX_PUBLIC_KEY_SIZE * 2;
-        memcpy((char*)p, LOGFILE_EXT, sizeof(LOGFILE_EXT));
-    }
-
-    remove((const char *)path);
+    /* The log writer may have it open, it has the search index cleared once it's gone */
+    log_writer_remove(f->cid);
 }
 
 void friend_free(FRIEND *f)
@@ -371,14 +360,7 @@ void friend_free(FRIEND *f)
     free(f->status_message);
     free(f->typed);
 
-    MSG_IDX i = 0;
-    while(i < f->msg.n) {
-        MESSAGE *msg = f->msg.data[i];
-        message_free(msg);
-        i++;
-    }
-
-    free(f->msg.data);
+    message_data_free(&f->msg);
 
     if(f->call_state_self) {
         // postmessage_audio(AUDIO_END, f->number, 0, NULL);
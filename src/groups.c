@@ -18,13 +18,7 @@ void group_free(GROUPCHAT *g) {
         j++;
     }
 
-    MSG_IDX k = 0;
-    while(k < g->msg.n) {
-        free(g->msg.data[k]);
-        k++;
-    }
-
-    free(g->msg.data);
+    message_data_free(&g->msg);
 
     memset(g, 0, sizeof(GROUPCHAT));//
 }
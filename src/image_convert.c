@@ -0,0 +1,1049 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Picked from the target, unless the build picks one itself: tools/ builds these with -DUTOX_SIMD_NONE, and with
+ * -DUTOX_SIMD_NEON on an emulated arm_neon.h, to test every version on one machine. */
+#if !defined(UTOX_SIMD_X86) && !defined(UTOX_SIMD_NEON) && !defined(UTOX_SIMD_NONE)
+#if defined(__x86_64__) || defined(__i386__)
+#define UTOX_SIMD_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define UTOX_SIMD_NEON
+#endif
+#endif
+
+#ifdef UTOX_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef UTOX_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#include "image_convert.h"
+
+/* The color conversions have SIMD versions for x86 (picked once at runtime by image_convert_init()) and for ARM
+ * builds with NEON enabled at compile time. They all give exactly the same output as the plain C version, which
+ * also handles whatever pixels at the end of a row don't fill a whole vector. */
+static pthread_once_t image_convert_once = PTHREAD_ONCE_INIT;
+static void image_convert_init(void);
+
+/* The fastest SIMD version of each kernel, NULL if there's none. Both return the number of pixels done. */
+static uint16_t (*yuv420tobgr_row_simd)(uint16_t width, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                        uint8_t *out);
+static uint16_t (*bgrx_rows_to_yuv420_simd)(const uint8_t *row0, const uint8_t *row1, uint16_t width,
+                                            uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v);
+
+/* Converts pixels start to width of one row */
+static void yuv420tobgr_row_c(uint16_t width, uint16_t start, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                              uint8_t *out)
+{
+    unsigned long int j;
+    for (j = start; j < width; ++j) {
+        uint8_t *point = out + 4 * j;
+        int t_y = y[j];
+        int t_u = u[j / 2];
+        int t_v = v[j / 2];
+        t_y = t_y < 16 ? 16 : t_y;
+
+        int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
+        int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
+        int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
+
+        point[2] = r>255? 255 : r<0 ? 0 : r;
+        point[1] = g>255? 255 : g<0 ? 0 : g;
+        point[0] = b>255? 255 : b<0 ? 0 : b;
+        point[3] = ~0;
+    }
+}
+
+#ifdef UTOX_SIMD_X86
+/* Does the math of yuv420tobgr_row_c() for 4 pixels in 32 bit lanes. y holds (luma - 16, 1) pairs, uv holds
+ * (u - 128, v - 128) pairs, the madds add the constants and the +128 rounding in the same step. */
+__attribute__((target("sse2")))
+static void yuv_to_bgr_sse2(__m128i y, __m128i uv, __m128i *r, __m128i *g, __m128i *b)
+{
+    y  = _mm_madd_epi16(y, _mm_set1_epi32((128 << 16) | 298));
+    *r = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, _mm_set1_epi32(409 << 16))), 8);
+    *g = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, _mm_set1_epi32((-208 << 16) | (uint16_t)-100))), 8);
+    *b = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, _mm_set1_epi32(516))), 8);
+}
+
+/* Stores 16 pixels, the saturating packs do the clamping. */
+__attribute__((target("sse2")))
+static void store_bgrx_sse2(uint8_t *out, __m128i r16_lo, __m128i r16_hi, __m128i g16_lo, __m128i g16_hi,
+                            __m128i b16_lo, __m128i b16_hi)
+{
+    __m128i r  = _mm_packus_epi16(r16_lo, r16_hi),
+            g  = _mm_packus_epi16(g16_lo, g16_hi),
+            b  = _mm_packus_epi16(b16_lo, b16_hi),
+            bg_lo = _mm_unpacklo_epi8(b, g),
+            bg_hi = _mm_unpackhi_epi8(b, g),
+            ra_lo = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1)),
+            ra_hi = _mm_unpackhi_epi8(r, _mm_set1_epi8(-1));
+
+    _mm_storeu_si128((__m128i*)out,        _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i*)(out + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128((__m128i*)(out + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+}
+
+/* returns the number of pixels converted, always a multiple of 16 */
+__attribute__((target("sse2")))
+static uint16_t yuv420tobgr_row_sse2(uint16_t width, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                     uint8_t *out)
+{
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+    uint16_t j;
+    for (j = 0; j + 16 <= width; j += 16) {
+        __m128i luma = _mm_max_epu8(_mm_loadu_si128((const __m128i*)(y + j)), _mm_set1_epi8(16)),
+                cb   = _mm_loadl_epi64((const __m128i*)(u + j / 2)),
+                cr   = _mm_loadl_epi64((const __m128i*)(v + j / 2));
+        /* Every chroma sample covers two pixels */
+        cb = _mm_unpacklo_epi8(cb, cb);
+        cr = _mm_unpacklo_epi8(cr, cr);
+
+        __m128i y16[2] = { _mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), _mm_set1_epi16(16)),
+                           _mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), _mm_set1_epi16(16)) },
+                u16[2] = { _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), _mm_set1_epi16(128)),
+                           _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), _mm_set1_epi16(128)) },
+                v16[2] = { _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), _mm_set1_epi16(128)),
+                           _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), _mm_set1_epi16(128)) },
+                r16[2], g16[2], b16[2];
+
+        for (int k = 0; k < 2; k++) {
+            __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+            yuv_to_bgr_sse2(_mm_unpacklo_epi16(y16[k], one), _mm_unpacklo_epi16(u16[k], v16[k]), &r_lo, &g_lo, &b_lo);
+            yuv_to_bgr_sse2(_mm_unpackhi_epi16(y16[k], one), _mm_unpackhi_epi16(u16[k], v16[k]), &r_hi, &g_hi, &b_hi);
+            r16[k] = _mm_packs_epi32(r_lo, r_hi);
+            g16[k] = _mm_packs_epi32(g_lo, g_hi);
+            b16[k] = _mm_packs_epi32(b_lo, b_hi);
+        }
+
+        store_bgrx_sse2(out + 4 * j, r16[0], r16[1], g16[0], g16[1], b16[0], b16[1]);
+    }
+    return j;
+}
+
+/* Same as the SSE2 version, but with 16 pixels in one register. The in-lane unpacks split each half into pixels
+ * 0-3/8-11 and 4-7/12-15, and the in-lane packs put them back in order. */
+__attribute__((target("avx2")))
+static uint16_t yuv420tobgr_row_avx2(uint16_t width, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                     uint8_t *out)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    uint16_t j;
+    for (j = 0; j + 32 <= width; j += 32) {
+        __m256i r16[2], g16[2], b16[2];
+
+        for (int k = 0; k < 2; k++) {
+            __m128i luma = _mm_max_epu8(_mm_loadu_si128((const __m128i*)(y + j + k * 16)), _mm_set1_epi8(16)),
+                    cb   = _mm_loadl_epi64((const __m128i*)(u + (j + k * 16) / 2)),
+                    cr   = _mm_loadl_epi64((const __m128i*)(v + (j + k * 16) / 2));
+
+            __m256i y16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(luma), _mm256_set1_epi16(16)),
+                    u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(cb, cb)), _mm256_set1_epi16(128)),
+                    v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(cr, cr)), _mm256_set1_epi16(128)),
+                    y_lo  = _mm256_madd_epi16(_mm256_unpacklo_epi16(y16, one), _mm256_set1_epi32((128 << 16) | 298)),
+                    y_hi  = _mm256_madd_epi16(_mm256_unpackhi_epi16(y16, one), _mm256_set1_epi32((128 << 16) | 298)),
+                    uv_lo = _mm256_unpacklo_epi16(u16, v16),
+                    uv_hi = _mm256_unpackhi_epi16(u16, v16),
+                    cr_r  = _mm256_set1_epi32(409 << 16),
+                    cr_g  = _mm256_set1_epi32((-208 << 16) | (uint16_t)-100),
+                    cr_b  = _mm256_set1_epi32(516);
+
+            r16[k] = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(y_lo, _mm256_madd_epi16(uv_lo, cr_r)), 8),
+                                        _mm256_srai_epi32(_mm256_add_epi32(y_hi, _mm256_madd_epi16(uv_hi, cr_r)), 8));
+            g16[k] = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(y_lo, _mm256_madd_epi16(uv_lo, cr_g)), 8),
+                                        _mm256_srai_epi32(_mm256_add_epi32(y_hi, _mm256_madd_epi16(uv_hi, cr_g)), 8));
+            b16[k] = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(y_lo, _mm256_madd_epi16(uv_lo, cr_b)), 8),
+                                        _mm256_srai_epi32(_mm256_add_epi32(y_hi, _mm256_madd_epi16(uv_hi, cr_b)), 8));
+        }
+
+        /* Pack both rows of 16 at once, then put the 64 bit quarters back in pixel order */
+        __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r16[0], r16[1]), 0xD8),
+                g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g16[0], g16[1]), 0xD8),
+                b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b16[0], b16[1]), 0xD8),
+                a = _mm256_set1_epi8(-1),
+                bg_lo = _mm256_unpacklo_epi8(b, g),
+                bg_hi = _mm256_unpackhi_epi8(b, g),
+                ra_lo = _mm256_unpacklo_epi8(r, a),
+                ra_hi = _mm256_unpackhi_epi8(r, a),
+                p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo), /* pixels 0-3 and 16-19 */
+                p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo), /* 4-7 and 20-23 */
+                p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi), /* 8-11 and 24-27 */
+                p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi); /* 12-15 and 28-31 */
+
+        _mm256_storeu_si256((__m256i*)(out + 4 * j),      _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 4 * j + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 4 * j + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i*)(out + 4 * j + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    return j;
+}
+
+/* The AVX2 version, with the SSE2 one doing what's left of the row */
+static uint16_t yuv420tobgr_row_avx2_sse2(uint16_t width, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                          uint8_t *out)
+{
+    uint16_t done = yuv420tobgr_row_avx2(width, y, u, v, out);
+    return done + yuv420tobgr_row_sse2(width - done, y + done, u + done / 2, v + done / 2, out + 4 * done);
+}
+#endif
+
+#ifdef UTOX_SIMD_NEON
+/* returns the number of pixels converted, always a multiple of 8 */
+static uint16_t yuv420tobgr_row_neon(uint16_t width, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                     uint8_t *out)
+{
+    uint16_t j;
+    for (j = 0; j + 8 <= width; j += 8) {
+        uint8x8_t luma = vmax_u8(vld1_u8(y + j), vdup_n_u8(16));
+        /* Every chroma sample covers two pixels, only the first 4 of each zip matter */
+        uint8x8_t cb = vreinterpret_u8_u32(vld1_lane_u32((const void*)(u + j / 2), vdup_n_u32(0), 0)),
+                  cr = vreinterpret_u8_u32(vld1_lane_u32((const void*)(v + j / 2), vdup_n_u32(0), 0));
+
+        int16x8_t y16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(luma)), vdupq_n_s16(16)),
+                  u16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cb, cb).val[0])), vdupq_n_s16(128)),
+                  v16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vzip_u8(cr, cr).val[0])), vdupq_n_s16(128));
+
+        int32x4_t y_lo = vmlal_n_s16(vdupq_n_s32(128), vget_low_s16(y16), 298),
+                  y_hi = vmlal_n_s16(vdupq_n_s32(128), vget_high_s16(y16), 298);
+
+        int32x4_t r_lo = vmlal_n_s16(y_lo, vget_low_s16(v16), 409),
+                  r_hi = vmlal_n_s16(y_hi, vget_high_s16(v16), 409),
+                  g_lo = vmlal_n_s16(vmlal_n_s16(y_lo, vget_low_s16(u16), -100), vget_low_s16(v16), -208),
+                  g_hi = vmlal_n_s16(vmlal_n_s16(y_hi, vget_high_s16(u16), -100), vget_high_s16(v16), -208),
+                  b_lo = vmlal_n_s16(y_lo, vget_low_s16(u16), 516),
+                  b_hi = vmlal_n_s16(y_hi, vget_high_s16(u16), 516);
+
+        uint8x8x4_t pixels;
+        pixels.val[0] = vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(b_lo, 8)), vqmovn_s32(vshrq_n_s32(b_hi, 8))));
+        pixels.val[1] = vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(g_lo, 8)), vqmovn_s32(vshrq_n_s32(g_hi, 8))));
+        pixels.val[2] = vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(r_lo, 8)), vqmovn_s32(vshrq_n_s32(r_hi, 8))));
+        pixels.val[3] = vdup_n_u8(255);
+        vst4_u8(out + 4 * j, pixels);
+    }
+    return j;
+}
+#endif
+
+void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v, unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out)
+{
+    pthread_once(&image_convert_once, image_convert_init);
+
+    unsigned long int i;
+    for (i = 0; i < height; ++i) {
+        const uint8_t *row_y = y + i * ystride, *row_u = u + (i / 2) * ustride, *row_v = v + (i / 2) * vstride;
+        uint8_t *row_out = out + 4 * i * width;
+        uint16_t done = yuv420tobgr_row_simd ? yuv420tobgr_row_simd(width, row_y, row_u, row_v, row_out) : 0;
+        yuv420tobgr_row_c(width, done, row_y, row_u, row_v, row_out);
+    }
+}
+
+void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height)
+{
+    uint8_t *end = input + width * height * 2;
+    while(input != end) {
+        uint8_t *line_end = input + width * 2;
+        while(input != line_end) {
+            *plane_y++ = *input++;
+            *plane_v++ = *input++;
+            *plane_y++ = *input++;
+            *plane_u++ = *input++;
+        }
+
+        line_end = input + width * 2;
+        while(input != line_end) {
+            *plane_y++ = *input++;
+            input++;//u
+            *plane_y++ = *input++;
+            input++;//v
+        }
+
+    }
+}
+
+static uint8_t rgb_to_y(int r, int g, int b)
+{
+    int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
+    return y>255? 255 : y<0 ? 0 : y;
+}
+
+static uint8_t rgb_to_u(int r, int g, int b)
+{
+    int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
+    return u>255? 255 : u<0 ? 0 : u;
+}
+
+static uint8_t rgb_to_v(int r, int g, int b)
+{
+    int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
+    return v>255? 255 : v<0 ? 0 : v;
+}
+
+/* Plain C versions, still used as is for odd widths, which they handle in their own particular way. */
+static void bgrtoyuv420_c(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    uint16_t x, y;
+    uint8_t *p;
+    uint8_t r, g, b;
+
+    for(y = 0; y + 1 < height; y += 2) {
+        p = rgb;
+        for(x = 0; x != width; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+        }
+
+        for(x = 0; x != width / 2; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = ((int)b + (int)*(rgb - 6) + (int)*p + (int)*(p + 3) + 2) / 4; p++;
+            g = ((int)g + (int)*(rgb - 5) + (int)*p + (int)*(p + 3) + 2) / 4; p++;
+            r = ((int)r + (int)*(rgb - 4) + (int)*p + (int)*(p + 3) + 2) / 4; p++;
+
+            *plane_u++ = rgb_to_u(r, g, b);
+            *plane_v++ = rgb_to_v(r, g, b);
+
+            p += 3;
+        }
+    }
+}
+
+static void bgrxtoyuv420_c(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    uint16_t x, y;
+    uint8_t *p;
+    uint8_t r, g, b;
+
+    for(y = 0; y + 1 < height; y += 2) {
+        p = rgb;
+        for(x = 0; x != width; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+        }
+
+        for(x = 0; x != width / 2; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = ((int)b + (int)*(rgb - 8) + (int)*p + (int)*(p + 4) + 2) / 4; p++;
+            g = ((int)g + (int)*(rgb - 7) + (int)*p + (int)*(p + 4) + 2) / 4; p++;
+            r = ((int)r + (int)*(rgb - 6) + (int)*p + (int)*(p + 4) + 2) / 4; p++;
+            p++;
+
+            *plane_u++ = rgb_to_u(r, g, b);
+            *plane_v++ = rgb_to_v(r, g, b);
+
+            p += 4;
+        }
+    }
+}
+
+/* Converts pixel pairs start to width (both even) of two BGRX rows. */
+static void bgrx_rows_to_yuv420_c(const uint8_t *row0, const uint8_t *row1, uint16_t start, uint16_t width,
+                                  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    uint16_t x;
+    for (x = start; x < width; x += 2) {
+        const uint8_t *p = row0 + 4 * x, *q = row1 + 4 * x;
+
+        y0[x]     = rgb_to_y(p[2], p[1], p[0]);
+        y0[x + 1] = rgb_to_y(p[6], p[5], p[4]);
+        y1[x]     = rgb_to_y(q[2], q[1], q[0]);
+        y1[x + 1] = rgb_to_y(q[6], q[5], q[4]);
+
+        int b = (p[0] + p[4] + q[0] + q[4] + 2) / 4,
+            g = (p[1] + p[5] + q[1] + q[5] + 2) / 4,
+            r = (p[2] + p[6] + q[2] + q[6] + 2) / 4;
+
+        u[x / 2] = rgb_to_u(r, g, b);
+        v[x / 2] = rgb_to_v(r, g, b);
+    }
+}
+
+#ifdef UTOX_SIMD_X86
+/* Adds up the pairs of 32 bit lanes of a and b, returns (a0 + a1, a2 + a3, b0 + b1, b2 + b3). */
+__attribute__((target("sse2")))
+static __m128i add_lane_pairs_sse2(__m128i a, __m128i b)
+{
+    __m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+    return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+                         _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+/* returns the luma of 4 BGRX pixels in 32 bit lanes */
+__attribute__((target("sse2")))
+static __m128i bgrx_to_y_sse2(__m128i pixels)
+{
+    const __m128i zero = _mm_setzero_si128(), coef = _mm_set_epi16(0, 9798, 19235, 3736, 0, 9798, 19235, 3736);
+    return _mm_srli_epi32(add_lane_pairs_sse2(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coef),
+                                              _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coef)), 15);
+}
+
+/* Same as bgrx_rows_to_yuv420_c(), 8 pixels at a time. returns the number of pixels converted. */
+__attribute__((target("sse2")))
+static uint16_t bgrx_rows_to_yuv420_sse2(const uint8_t *row0, const uint8_t *row1, uint16_t width,
+                                         uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    const __m128i zero   = _mm_setzero_si128(), two = _mm_set1_epi16(2),
+                  coef_u = _mm_set_epi16(0, -5538, -10846, 16351, 0, -5538, -10846, 16351),
+                  coef_v = _mm_set_epi16(0, 16351, -13697, -2664, 0, 16351, -13697, -2664),
+                  offset = _mm_set1_epi32(128);
+    uint16_t x;
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i*)(row0 + 4 * x)),
+                p1 = _mm_loadu_si128((const __m128i*)(row0 + 4 * x + 16)),
+                q0 = _mm_loadu_si128((const __m128i*)(row1 + 4 * x)),
+                q1 = _mm_loadu_si128((const __m128i*)(row1 + 4 * x + 16));
+
+        __m128i luma = _mm_packs_epi32(bgrx_to_y_sse2(p0), bgrx_to_y_sse2(p1));
+        _mm_storel_epi64((__m128i*)(y0 + x), _mm_packus_epi16(luma, zero));
+        luma = _mm_packs_epi32(bgrx_to_y_sse2(q0), bgrx_to_y_sse2(q1));
+        _mm_storel_epi64((__m128i*)(y1 + x), _mm_packus_epi16(luma, zero));
+
+        /* Sum each 2x2 block per channel, then fold the two pixels of each 64 bit half together */
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(q0, zero)),
+                s1 = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(q0, zero)),
+                s2 = _mm_add_epi16(_mm_unpacklo_epi8(p1, zero), _mm_unpacklo_epi8(q1, zero)),
+                s3 = _mm_add_epi16(_mm_unpackhi_epi8(p1, zero), _mm_unpackhi_epi8(q1, zero));
+        s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+        s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+        s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+        s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+
+        __m128i avg01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2),
+                avg23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+
+        __m128i cb = _mm_add_epi32(_mm_srai_epi32(add_lane_pairs_sse2(_mm_madd_epi16(avg01, coef_u),
+                                                                      _mm_madd_epi16(avg23, coef_u)), 15), offset),
+                cr = _mm_add_epi32(_mm_srai_epi32(add_lane_pairs_sse2(_mm_madd_epi16(avg01, coef_v),
+                                                                      _mm_madd_epi16(avg23, coef_v)), 15), offset);
+
+        /* Saturating packs clamp to 0-255, then the low 4 bytes of each hold the 4 samples */
+        __m128i uv = _mm_packus_epi16(_mm_packs_epi32(cb, cr), zero);
+        int32_t samples = _mm_cvtsi128_si32(uv);
+        memcpy(u + x / 2, &samples, 4);
+        samples = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+        memcpy(v + x / 2, &samples, 4);
+    }
+    return x;
+}
+#endif
+
+#ifdef UTOX_SIMD_NEON
+/* Same as bgrx_rows_to_yuv420_c(), 8 pixels at a time. returns the number of pixels converted. */
+static uint16_t bgrx_rows_to_yuv420_neon(const uint8_t *row0, const uint8_t *row1, uint16_t width,
+                                         uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    uint16_t x;
+    for (x = 0; x + 8 <= width; x += 8) {
+        uint8x8x4_t p = vld4_u8(row0 + 4 * x), q = vld4_u8(row1 + 4 * x);
+
+        for (int k = 0; k < 2; k++) {
+            uint8x8x4_t px = k ? q : p;
+            uint16x8_t b = vmovl_u8(px.val[0]), g = vmovl_u8(px.val[1]), r = vmovl_u8(px.val[2]);
+            uint32x4_t lo = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_low_u16(r), 9798), vget_low_u16(g), 19235),
+                                        vget_low_u16(b), 3736),
+                       hi = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_high_u16(r), 9798), vget_high_u16(g), 19235),
+                                        vget_high_u16(b), 3736);
+            vst1_u8((k ? y1 : y0) + x, vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15))));
+        }
+
+        /* Pairwise adds sum each 2x2 block */
+        int16x4_t b = vreinterpret_s16_u16(vshr_n_u16(vadd_u16(vadd_u16(vpaddl_u8(p.val[0]), vpaddl_u8(q.val[0])),
+                                                               vdup_n_u16(2)), 2)),
+                  g = vreinterpret_s16_u16(vshr_n_u16(vadd_u16(vadd_u16(vpaddl_u8(p.val[1]), vpaddl_u8(q.val[1])),
+                                                               vdup_n_u16(2)), 2)),
+                  r = vreinterpret_s16_u16(vshr_n_u16(vadd_u16(vadd_u16(vpaddl_u8(p.val[2]), vpaddl_u8(q.val[2])),
+                                                               vdup_n_u16(2)), 2));
+
+        int32x4_t cb = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(r, -5538), g, -10846), b, 16351),
+                  cr = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(r, 16351), g, -13697), b, -2664);
+        cb = vaddq_s32(vshrq_n_s32(cb, 15), vdupq_n_s32(128));
+        cr = vaddq_s32(vshrq_n_s32(cr, 15), vdupq_n_s32(128));
+
+        uint8x8_t uv = vqmovun_s16(vcombine_s16(vqmovn_s32(cb), vqmovn_s32(cr)));
+        vst1_lane_u32((void*)(u + x / 2), vreinterpret_u32_u8(uv), 0);
+        vst1_lane_u32((void*)(v + x / 2), vreinterpret_u32_u8(uv), 1);
+    }
+    return x;
+}
+#endif
+
+/* Converts a pair of BGRX rows width pixels wide with the fastest kernel we have */
+static void bgrx_rows_to_yuv420(const uint8_t *row0, const uint8_t *row1, uint16_t width,
+                                uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v)
+{
+    uint16_t done = bgrx_rows_to_yuv420_simd ? bgrx_rows_to_yuv420_simd(row0, row1, width, y0, y1, u, v) : 0;
+    bgrx_rows_to_yuv420_c(row0, row1, done, width, y0, y1, u, v);
+}
+
+/* Frames with at least this many pixels are split into horizontal bands, converted by COLOR_CONVERT_BANDS threads.
+ * Build with -DCOLOR_CONVERT_BANDS=1 to always convert on the calling thread. */
+#ifndef COLOR_CONVERT_BANDS
+#define COLOR_CONVERT_BANDS 4
+#endif
+#define COLOR_CONVERT_BAND_PIXELS (1920 * 1080)
+
+typedef struct {
+    uint8_t  *plane_y, *plane_u, *plane_v;
+    const uint8_t *rgb;
+    uint16_t width, height;
+    uint8_t  bytes_per_pixel; /* 3 for BGR, 4 for BGRX */
+} COLOR_CONVERT_BAND;
+
+static void* rgb_band_to_yuv420(void *args)
+{
+    COLOR_CONVERT_BAND *band = args;
+    uint16_t width = band->width;
+    uint8_t *rows = NULL;
+
+    if (band->bytes_per_pixel == 3) {
+        /* BGR gets widened to BGRX first, so the same kernels can do both */
+        rows = malloc(width * 8);
+        if (!rows) {
+            return NULL;
+        }
+    }
+
+    for (uint16_t y = 0; y < band->height; y += 2) {
+        const uint8_t *row0 = band->rgb + (size_t)y * width * band->bytes_per_pixel,
+                      *row1 = row0 + width * band->bytes_per_pixel;
+        uint8_t *y0 = band->plane_y + (size_t)y * width, *y1 = y0 + width,
+                *u  = band->plane_u + (size_t)y / 2 * width / 2, *v = band->plane_v + (size_t)y / 2 * width / 2;
+
+        if (rows) {
+            for (uint16_t x = 0; x < width; x++) {
+                memcpy(rows + 4 * x, row0 + 3 * x, 3);
+                memcpy(rows + 4 * (width + x), row1 + 3 * x, 3);
+            }
+            row0 = rows;
+            row1 = rows + 4 * width;
+        }
+
+        bgrx_rows_to_yuv420(row0, row1, width, y0, y1, u, v);
+    }
+
+    free(rows);
+    return NULL;
+}
+
+static void rgb_to_yuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb, uint16_t width,
+                          uint16_t height, uint8_t bytes_per_pixel)
+{
+    pthread_once(&image_convert_once, image_convert_init);
+
+    COLOR_CONVERT_BAND band[COLOR_CONVERT_BANDS];
+    pthread_t thread_band[COLOR_CONVERT_BANDS];
+    _Bool     threaded[COLOR_CONVERT_BANDS];
+    int bands = (uint32_t)width * height >= COLOR_CONVERT_BAND_PIXELS ? COLOR_CONVERT_BANDS : 1;
+
+    /* Bands are a whole number of row pairs tall, a last odd row is done by rgb_last_row_to_yuv420() */
+    height &= ~1;
+    uint16_t rows = (height / 2 + bands - 1) / bands * 2, start = 0;
+
+    int i;
+    for (i = 0; i < bands && start < height; i++) {
+        band[i].width           = width;
+        band[i].height          = height - start < rows ? height - start : rows;
+        band[i].bytes_per_pixel = bytes_per_pixel;
+        band[i].rgb             = rgb + (size_t)start * width * bytes_per_pixel;
+        band[i].plane_y         = plane_y + (size_t)start * width;
+        band[i].plane_u         = plane_u + (size_t)start / 2 * width / 2;
+        band[i].plane_v         = plane_v + (size_t)start / 2 * width / 2;
+        start += band[i].height;
+
+        /* The last band runs on this thread, and so does everything if a thread can't be started */
+        threaded[i] = i != bands - 1 && start < height
+                      && !pthread_create(&thread_band[i], NULL, rgb_band_to_yuv420, &band[i]);
+        if (!threaded[i]) {
+            rgb_band_to_yuv420(&band[i]);
+        }
+    }
+
+    while (i--) {
+        if (threaded[i]) {
+            pthread_join(thread_band[i], NULL);
+        }
+    }
+}
+
+/* The row pairs leave out the last row of a frame with an odd height. It has no row to pair up with, so its chroma
+ * comes from it alone. */
+static void rgb_last_row_to_yuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb,
+                                   uint16_t width, uint16_t height, uint8_t bytes_per_pixel)
+{
+    if (!(height & 1)) {
+        return;
+    }
+
+    const uint8_t *row = rgb + (size_t)(height - 1) * width * bytes_per_pixel;
+    plane_y += (size_t)(height - 1) * width;
+    plane_u += (size_t)(height / 2) * (width / 2);
+    plane_v += (size_t)(height / 2) * (width / 2);
+
+    for (uint16_t x = 0; x < width; x++) {
+        const uint8_t *p = row + x * bytes_per_pixel;
+        plane_y[x] = rgb_to_y(p[2], p[1], p[0]);
+    }
+
+    for (uint16_t x = 0; x < width / 2; x++) {
+        const uint8_t *p = row + 2 * x * bytes_per_pixel, *q = p + bytes_per_pixel;
+        int b = (2 * p[0] + 2 * q[0] + 2) / 4, g = (2 * p[1] + 2 * q[1] + 2) / 4, r = (2 * p[2] + 2 * q[2] + 2) / 4;
+        plane_u[x] = rgb_to_u(r, g, b);
+        plane_v[x] = rgb_to_v(r, g, b);
+    }
+}
+
+void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    if (width & 1) {
+        bgrtoyuv420_c(plane_y, plane_u, plane_v, rgb, width, height);
+    } else {
+        rgb_to_yuv420(plane_y, plane_u, plane_v, rgb, width, height, 3);
+    }
+    rgb_last_row_to_yuv420(plane_y, plane_u, plane_v, rgb, width, height, 3);
+}
+
+void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    if (width & 1) {
+        bgrxtoyuv420_c(plane_y, plane_u, plane_v, rgb, width, height);
+    } else {
+        rgb_to_yuv420(plane_y, plane_u, plane_v, rgb, width, height, 4);
+    }
+    rgb_last_row_to_yuv420(plane_y, plane_u, plane_v, rgb, width, height, 4);
+}
+
+void bgrxtoyuv420_rect(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb, uint16_t width,
+                       uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    pthread_once(&image_convert_once, image_convert_init);
+
+    for (uint16_t row = y; row < y + h; row += 2) {
+        const uint8_t *row0 = rgb + ((size_t)row * width + x) * 4;
+        uint8_t *y0 = plane_y + (size_t)row * width + x;
+
+        bgrx_rows_to_yuv420(row0, row0 + width * 4, w, y0, y0 + width,
+                            plane_u + (size_t)row / 2 * width / 2 + x / 2,
+                            plane_v + (size_t)row / 2 * width / 2 + x / 2);
+    }
+}
+
+/* scale_rgbx_image() is separable: every output row is first blended from a few source rows (vertical pass), then
+ * every pixel of that row from a few of its pixels (horizontal pass). Growing uses bilinear weights, shrinking
+ * averages the area of the source each output pixel covers.
+ *
+ * Weights are Q14 fixed point and every output sample has the same number of taps, padded with zero weights, so
+ * the SIMD loops don't have to care about the filter. */
+#define SCALE_SHIFT 14
+#define SCALE_ONE   (1 << SCALE_SHIFT)
+
+typedef struct {
+    uint16_t *start;  /* first source row/column of each output row/column */
+    int16_t  *weight; /* taps weights for each of them, adding up to SCALE_ONE */
+    uint16_t taps;
+} SCALE_TABLE;
+
+/* The fastest SIMD versions of scale_rows_c() and scale_row_c(), NULL if there's none */
+static uint32_t (*scale_rows_simd)(const uint8_t **rows, const int16_t *weight, uint16_t taps, uint32_t length,
+                                   uint8_t *out);
+static uint16_t (*scale_row_simd)(const uint8_t *in, const SCALE_TABLE *table, uint16_t new_width, uint8_t *out);
+
+/* Fills in the weights of output sample i into weight[], returns the first source sample they apply to. */
+static uint16_t scale_weights(uint16_t i, uint16_t old_size, uint16_t new_size, double *weight, uint16_t *count)
+{
+    double scale = (double)old_size / new_size;
+
+    if (scale <= 1.0) {
+        double center = (i + 0.5) * scale - 0.5;
+        int first = (int)floor(center);
+        double frac = center - first;
+
+        if (first < 0) {
+            first = 0;
+            frac  = 0;
+        } else if (first >= old_size - 1) {
+            first = old_size - 1;
+            frac  = 0;
+        }
+
+        weight[0] = 1.0 - frac;
+        weight[1] = frac;
+        *count    = first + 1 < old_size ? 2 : 1;
+        return first;
+    }
+
+    double lo = i * scale, hi = (i + 1) * scale;
+    uint16_t first = (uint16_t)lo, last = (uint16_t)ceil(hi);
+    if (last > old_size) {
+        last = old_size;
+    }
+
+    for (uint16_t j = first; j < last; j++) {
+        double from = j < lo ? lo : j, to = j + 1 > hi ? hi : j + 1;
+        weight[j - first] = (to - from) / scale;
+    }
+    *count = last - first;
+    return first;
+}
+
+static _Bool scale_table_init(SCALE_TABLE *table, uint16_t old_size, uint16_t new_size)
+{
+    uint16_t taps = (uint16_t)ceil((double)old_size / new_size) + 1, count;
+    double weight[taps];
+
+    /* Use as few taps as any output sample really needs, but an even number when possible for the SIMD loops */
+    table->taps = 1;
+    for (uint16_t i = 0; i < new_size; i++) {
+        scale_weights(i, old_size, new_size, weight, &count);
+        if (count > table->taps) {
+            table->taps = count;
+        }
+    }
+    if ((table->taps & 1) && table->taps < old_size) {
+        table->taps++;
+    }
+
+    table->start  = malloc(new_size * sizeof(*table->start));
+    table->weight = calloc(new_size * table->taps, sizeof(*table->weight));
+    if (!table->start || !table->weight) {
+        free(table->start);
+        free(table->weight);
+        return 0;
+    }
+
+    for (uint16_t i = 0; i < new_size; i++) {
+        uint16_t first = scale_weights(i, old_size, new_size, weight, &count), shift = 0;
+
+        /* Keep all taps inside the source, padding goes in front if it has to */
+        if (first + table->taps > old_size) {
+            shift = first + table->taps - old_size;
+            first -= shift;
+        }
+
+        int16_t *w = table->weight + i * table->taps + shift;
+        int sum = 0, largest = 0;
+        for (uint16_t k = 0; k < count; k++) {
+            w[k] = (int16_t)(weight[k] * SCALE_ONE + 0.5);
+            sum += w[k];
+            if (w[k] > w[largest]) {
+                largest = k;
+            }
+        }
+        /* Rounding mustn't change the brightness */
+        w[largest] += SCALE_ONE - sum;
+        table->start[i] = first;
+    }
+
+    return 1;
+}
+
+static void scale_table_free(SCALE_TABLE *table)
+{
+    free(table->start);
+    free(table->weight);
+}
+
+/* Blends length bytes of the taps rows in rows[] into out, starting at byte done. */
+static void scale_rows_c(const uint8_t **rows, const int16_t *weight, uint16_t taps, uint32_t done, uint32_t length,
+                         uint8_t *out)
+{
+    for (uint32_t x = done; x < length; x++) {
+        int32_t sum = SCALE_ONE / 2;
+        for (uint16_t k = 0; k < taps; k++) {
+            sum += rows[k][x] * weight[k];
+        }
+        out[x] = sum >> SCALE_SHIFT;
+    }
+}
+
+/* Scales the BGRX row in to new_width pixels in out, starting at pixel done. */
+static void scale_row_c(const uint8_t *in, const SCALE_TABLE *table, uint16_t done, uint16_t new_width, uint8_t *out)
+{
+    for (uint16_t x = done; x < new_width; x++) {
+        const uint8_t *p = in + table->start[x] * 4;
+        const int16_t *w = table->weight + x * table->taps;
+        int32_t b = SCALE_ONE / 2, g = SCALE_ONE / 2, r = SCALE_ONE / 2, a = SCALE_ONE / 2;
+
+        for (uint16_t k = 0; k < table->taps; k++, p += 4) {
+            b += p[0] * w[k];
+            g += p[1] * w[k];
+            r += p[2] * w[k];
+            a += p[3] * w[k];
+        }
+
+        out[x * 4]     = b >> SCALE_SHIFT;
+        out[x * 4 + 1] = g >> SCALE_SHIFT;
+        out[x * 4 + 2] = r >> SCALE_SHIFT;
+        out[x * 4 + 3] = a >> SCALE_SHIFT;
+    }
+}
+
+#ifdef UTOX_SIMD_X86
+/* Same as scale_rows_c(), 16 bytes at a time. Taps are taken in pairs, so each madd does two of them at once.
+ * returns the number of bytes done. */
+__attribute__((target("sse2")))
+static uint32_t scale_rows_sse2(const uint8_t **rows, const int16_t *weight, uint16_t taps, uint32_t length,
+                                uint8_t *out)
+{
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(SCALE_ONE / 2);
+    uint32_t x;
+    for (x = 0; x + 16 <= length; x += 16) {
+        __m128i sum0 = round, sum1 = round, sum2 = round, sum3 = round;
+
+        for (uint16_t k = 0; k < taps; k += 2) {
+            _Bool pair = k + 1 < taps;
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x)),
+                    b = pair ? _mm_loadu_si128((const __m128i*)(rows[k + 1] + x)) : zero,
+                    w = _mm_set1_epi32((uint16_t)weight[k] | (pair ? (uint32_t)weight[k + 1] << 16 : 0));
+
+            __m128i alo = _mm_unpacklo_epi8(a, zero), ahi = _mm_unpackhi_epi8(a, zero),
+                    blo = _mm_unpacklo_epi8(b, zero), bhi = _mm_unpackhi_epi8(b, zero);
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), w));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), w));
+            sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), w));
+            sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), w));
+        }
+
+        __m128i lo = _mm_packs_epi32(_mm_srai_epi32(sum0, SCALE_SHIFT), _mm_srai_epi32(sum1, SCALE_SHIFT)),
+                hi = _mm_packs_epi32(_mm_srai_epi32(sum2, SCALE_SHIFT), _mm_srai_epi32(sum3, SCALE_SHIFT));
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+/* Same as scale_rows_sse2(), 32 bytes at a time. Unpacks and packs work within 128 bit lanes, so they undo each
+ * other and the bytes come out in order. */
+__attribute__((target("avx2")))
+static uint32_t scale_rows_avx2(const uint8_t **rows, const int16_t *weight, uint16_t taps, uint32_t length,
+                                uint8_t *out)
+{
+    const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi32(SCALE_ONE / 2);
+    uint32_t x;
+    for (x = 0; x + 32 <= length; x += 32) {
+        __m256i sum0 = round, sum1 = round, sum2 = round, sum3 = round;
+
+        for (uint16_t k = 0; k < taps; k += 2) {
+            _Bool pair = k + 1 < taps;
+            __m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + x)),
+                    b = pair ? _mm256_loadu_si256((const __m256i*)(rows[k + 1] + x)) : zero,
+                    w = _mm256_set1_epi32((uint16_t)weight[k] | (pair ? (uint32_t)weight[k + 1] << 16 : 0));
+
+            __m256i alo = _mm256_unpacklo_epi8(a, zero), ahi = _mm256_unpackhi_epi8(a, zero),
+                    blo = _mm256_unpacklo_epi8(b, zero), bhi = _mm256_unpackhi_epi8(b, zero);
+            sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_unpacklo_epi16(alo, blo), w));
+            sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_unpackhi_epi16(alo, blo), w));
+            sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_unpacklo_epi16(ahi, bhi), w));
+            sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(_mm256_unpackhi_epi16(ahi, bhi), w));
+        }
+
+        __m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(sum0, SCALE_SHIFT), _mm256_srai_epi32(sum1, SCALE_SHIFT)),
+                hi = _mm256_packs_epi32(_mm256_srai_epi32(sum2, SCALE_SHIFT), _mm256_srai_epi32(sum3, SCALE_SHIFT));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+/* Same as scale_row_c(), for an even number of taps, two output pixels at a time. Two neighbouring source pixels get
+ * their channels interleaved, so one madd applies both of their weights to all 4 channels. returns the number of
+ * pixels done. */
+__attribute__((target("sse2")))
+static uint16_t scale_row_sse2(const uint8_t *in, const SCALE_TABLE *table, uint16_t new_width, uint8_t *out)
+{
+    if (table->taps & 1) {
+        return 0;
+    }
+
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(SCALE_ONE / 2);
+    uint16_t x;
+    for (x = 0; x + 2 <= new_width; x += 2) {
+        const uint8_t *p0 = in + table->start[x] * 4, *p1 = in + table->start[x + 1] * 4;
+        const int16_t *w0 = table->weight + x * table->taps, *w1 = w0 + table->taps;
+        __m128i sum0 = round, sum1 = round;
+
+        for (uint16_t k = 0; k < table->taps; k += 2, p0 += 8, p1 += 8) {
+            __m128i pixels = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)p0), _mm_loadl_epi64((const __m128i*)p1)),
+                    lo = _mm_unpacklo_epi8(pixels, zero), hi = _mm_unpackhi_epi8(pixels, zero);
+            int32_t weight0, weight1;
+            memcpy(&weight0, w0 + k, 4);
+            memcpy(&weight1, w1 + k, 4);
+
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8)),
+                                                      _mm_set1_epi32(weight0)));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8)),
+                                                      _mm_set1_epi32(weight1)));
+        }
+
+        __m128i sum = _mm_packs_epi32(_mm_srai_epi32(sum0, SCALE_SHIFT), _mm_srai_epi32(sum1, SCALE_SHIFT));
+        _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(sum, zero));
+    }
+    return x;
+}
+#endif
+
+#ifdef UTOX_SIMD_NEON
+/* Same as scale_rows_c(), 8 bytes at a time. returns the number of bytes done. */
+static uint32_t scale_rows_neon(const uint8_t **rows, const int16_t *weight, uint16_t taps, uint32_t length,
+                                uint8_t *out)
+{
+    uint32_t x;
+    for (x = 0; x + 8 <= length; x += 8) {
+        uint32x4_t lo = vdupq_n_u32(0), hi = vdupq_n_u32(0);
+
+        for (uint16_t k = 0; k < taps; k++) {
+            uint16x8_t p = vmovl_u8(vld1_u8(rows[k] + x));
+            lo = vmlal_n_u16(lo, vget_low_u16(p), weight[k]);
+            hi = vmlal_n_u16(hi, vget_high_u16(p), weight[k]);
+        }
+
+        vst1_u8(out + x, vqmovn_u16(vcombine_u16(vrshrn_n_u32(lo, SCALE_SHIFT), vrshrn_n_u32(hi, SCALE_SHIFT))));
+    }
+    return x;
+}
+#endif
+
+/* Picks the kernels for this CPU, the first time anything gets converted or scaled */
+static void image_convert_init(void)
+{
+#if defined(UTOX_SIMD_X86)
+    if (__builtin_cpu_supports("sse2")) {
+        yuv420tobgr_row_simd     = yuv420tobgr_row_sse2;
+        bgrx_rows_to_yuv420_simd = bgrx_rows_to_yuv420_sse2;
+        scale_rows_simd          = scale_rows_sse2;
+        scale_row_simd           = scale_row_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        yuv420tobgr_row_simd = yuv420tobgr_row_avx2_sse2;
+        scale_rows_simd      = scale_rows_avx2;
+    }
+#elif defined(UTOX_SIMD_NEON)
+    yuv420tobgr_row_simd     = yuv420tobgr_row_neon;
+    bgrx_rows_to_yuv420_simd = bgrx_rows_to_yuv420_neon;
+    scale_rows_simd          = scale_rows_neon;
+#endif
+}
+
+/* Output rows from row to row + height of a scale, with everything it needs */
+typedef struct {
+    const uint8_t *old_rgbx;
+    uint8_t       *new_rgbx;
+    uint16_t      old_width, new_width, row, height;
+    const SCALE_TABLE *horizontal, *vertical;
+} SCALE_BAND;
+
+static void* scale_band(void *args)
+{
+    SCALE_BAND *band = args;
+    const SCALE_TABLE *vertical = band->vertical;
+    uint32_t length = band->old_width * 4;
+    const uint8_t *rows[vertical->taps];
+
+    uint8_t *blended = malloc(length);
+    if (!blended) {
+        return NULL;
+    }
+
+    for (uint16_t y = band->row; y < band->row + band->height; y++) {
+        const int16_t *weight = vertical->weight + y * vertical->taps;
+        for (uint16_t k = 0; k < vertical->taps; k++) {
+            rows[k] = band->old_rgbx + (size_t)(vertical->start[y] + k) * length;
+        }
+
+        uint32_t done = scale_rows_simd ? scale_rows_simd(rows, weight, vertical->taps, length, blended) : 0;
+        scale_rows_c(rows, weight, vertical->taps, done, length, blended);
+
+        uint8_t *out = band->new_rgbx + (size_t)y * band->new_width * 4;
+        uint16_t pixels = scale_row_simd ? scale_row_simd(blended, band->horizontal, band->new_width, out) : 0;
+        scale_row_c(blended, band->horizontal, pixels, band->new_width, out);
+    }
+
+    free(blended);
+    return NULL;
+}
+
+void scale_rgbx_image(uint8_t *old_rgbx, uint16_t old_width, uint16_t old_height, uint8_t *new_rgbx, uint16_t new_width, uint16_t new_height)
+{
+    if (!old_width || !old_height || !new_width || !new_height) {
+        return;
+    }
+
+    if (old_width == new_width && old_height == new_height) {
+        memcpy(new_rgbx, old_rgbx, (size_t)old_width * old_height * 4);
+        return;
+    }
+
+    SCALE_TABLE horizontal, vertical;
+    if (!scale_table_init(&horizontal, old_width, new_width)) {
+        return;
+    }
+    if (!scale_table_init(&vertical, old_height, new_height)) {
+        scale_table_free(&horizontal);
+        return;
+    }
+
+    pthread_once(&image_convert_once, image_convert_init);
+
+    /* Big images are split into bands the same way as the color conversion above */
+    SCALE_BAND band[COLOR_CONVERT_BANDS];
+    pthread_t thread_band[COLOR_CONVERT_BANDS];
+    _Bool     threaded[COLOR_CONVERT_BANDS];
+    int bands = (uint32_t)new_width * new_height >= COLOR_CONVERT_BAND_PIXELS ? COLOR_CONVERT_BANDS : 1;
+    uint16_t rows = (new_height + bands - 1) / bands, start = 0;
+
+    int i;
+    for (i = 0; i < bands && start < new_height; i++) {
+        band[i].old_rgbx   = old_rgbx;
+        band[i].new_rgbx   = new_rgbx;
+        band[i].old_width  = old_width;
+        band[i].new_width  = new_width;
+        band[i].row        = start;
+        band[i].height     = new_height - start < rows ? new_height - start : rows;
+        band[i].horizontal = &horizontal;
+        band[i].vertical   = &vertical;
+        start += band[i].height;
+
+        threaded[i] = i != bands - 1 && start < new_height
+                      && !pthread_create(&thread_band[i], NULL, scale_band, &band[i]);
+        if (!threaded[i]) {
+            scale_band(&band[i]);
+        }
+    }
+
+    while (i--) {
+        if (threaded[i]) {
+            pthread_join(thread_band[i], NULL);
+        }
+    }
+
+    scale_table_free(&horizontal);
+    scale_table_free(&vertical);
+}
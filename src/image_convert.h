@@ -0,0 +1,19 @@
+/** Color format conversions and scaling of video frames and images.
+ *
+ * Every function has SIMD versions for x86 (picked at runtime) and for ARM builds with NEON, that give exactly the
+ * same output as its plain C version. Big frames are split into bands converted on threads of their own.
+ *
+ * Depends on nothing but libc and pthreads, so tools/test_image_convert.c can test and benchmark it.
+ */
+#include <stdint.h>
+
+void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v, unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out);
+void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height);
+void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
+void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
+/* same as bgrxtoyuv420(), but only converts the w by h rectangle at x, y. x, y, w and h must be even. */
+void bgrxtoyuv420_rect(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb, uint16_t width,
+                       uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Resizes a BGRX image, bilinear when growing it and averaging when shrinking it. */
+void scale_rgbx_image(uint8_t *old_rgbx, uint16_t old_width, uint16_t old_height, uint8_t *new_rgbx, uint16_t new_width, uint16_t new_height);
@@ -0,0 +1,161 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jitter_buffer.h"
+
+#define JITTER_LAST JITTER_FRAMES
+
+_Bool jitter_init(JITTER_BUFFER *jb)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->pcm = malloc((JITTER_FRAMES + 1) * JITTER_FRAME_MAX * sizeof(int16_t));
+    jb->stats.target_us = JITTER_MIN_DELAY_US;
+    return jb->pcm != NULL;
+}
+
+void jitter_free(JITTER_BUFFER *jb)
+{
+    free(jb->pcm);
+    jb->pcm = NULL;
+}
+
+static void jitter_drop(JITTER_BUFFER *jb)
+{
+    jb->stats.buffered_us -= jb->frame[jb->head].duration_us;
+    jb->stats.dropped++;
+    jb->head = (jb->head + 1) % JITTER_FRAMES;
+    jb->count--;
+}
+
+void jitter_push(JITTER_BUFFER *jb, const int16_t *pcm, uint32_t samples, uint8_t channels, uint32_t rate, uint64_t now)
+{
+    if(!jb->pcm || !samples || !channels || !rate || samples * channels > JITTER_FRAME_MAX) {
+        return;
+    }
+
+    uint32_t duration = (uint64_t)samples * 1000 * 1000 / rate;
+
+    /* Frames are sent one duration apart, anything else is down to the network. Talkspurts start whenever they
+     * start, so the gap before one isn't jitter. */
+    if(jb->last_arrival) {
+        double gap = (double)(now - jb->last_arrival) / 1000;
+        if(gap < JITTER_SPURT_GAP_US) {
+            jb->jitter_us += (fabs(gap - jb->last_duration_us) - jb->jitter_us) / 16;
+        }
+    }
+    jb->last_arrival = now;
+    jb->last_duration_us = duration;
+
+    double target = duration + 3 * jb->jitter_us;
+    if(target < JITTER_MIN_DELAY_US) {
+        target = JITTER_MIN_DELAY_US;
+    } else if(target > JITTER_MAX_DELAY_US) {
+        target = JITTER_MAX_DELAY_US;
+    }
+    jb->stats.target_us = target;
+    jb->stats.jitter_us = jb->jitter_us;
+
+    if(jb->count == JITTER_FRAMES) {
+        jitter_drop(jb);
+    }
+
+    if(!jb->count && !jb->playing) {
+        jb->spurt_start = now;
+    }
+
+    uint32_t i = (jb->head + jb->count++) % JITTER_FRAMES;
+    memcpy(jb->pcm + i * JITTER_FRAME_MAX, pcm, samples * channels * sizeof(int16_t));
+    jb->frame[i].samples = samples;
+    jb->frame[i].channels = channels;
+    jb->frame[i].rate = rate;
+    jb->frame[i].duration_us = duration;
+
+    jb->stats.buffered_us += duration;
+    jb->stats.frames++;
+}
+
+/* Copies frame i to pcm, with the gain going from gain_start to gain_end over it */
+static void jitter_copy(JITTER_BUFFER *jb, uint32_t i, int16_t *pcm, uint32_t *samples, uint8_t *channels,
+                        uint32_t *rate, double gain_start, double gain_end)
+{
+    uint32_t n = jb->frame[i].samples * jb->frame[i].channels;
+    const int16_t *src = jb->pcm + i * JITTER_FRAME_MAX;
+
+    if(gain_start == 1.0 && gain_end == 1.0) {
+        memcpy(pcm, src, n * sizeof(int16_t));
+    } else {
+        for(uint32_t s = 0; s < n; s++) {
+            pcm[s] = src[s] * (gain_start + (gain_end - gain_start) * s / n);
+        }
+    }
+
+    *samples = jb->frame[i].samples;
+    *channels = jb->frame[i].channels;
+    *rate = jb->frame[i].rate;
+}
+
+int jitter_pop(JITTER_BUFFER *jb, uint64_t ahead_us, uint64_t now, int16_t *pcm, uint32_t *samples, uint8_t *channels,
+               uint32_t *rate)
+{
+    if(!jb->pcm) {
+        return JITTER_NONE;
+    }
+
+    uint32_t target = jb->stats.target_us;
+
+    if(!jb->playing) {
+        /* Start a talkspurt with the target delay buffered, or with what there is if no more came in that time */
+        if(!jb->count || (ahead_us + jb->stats.buffered_us < target && (now - jb->spurt_start) / 1000 < target)) {
+            return JITTER_NONE;
+        }
+        jb->playing = 1;
+        jb->conceal_run = 0;
+    }
+
+    if(ahead_us >= target) {
+        return JITTER_NONE;
+    }
+
+    if(jb->count) {
+        /* After a burst, or frames that were concealed and then came in after all, catch up with the target */
+        while(jb->count > 1 &&
+              ahead_us + jb->stats.buffered_us >= target + (JITTER_SLACK_FRAMES + 1) * jb->frame[jb->head].duration_us) {
+            jitter_drop(jb);
+        }
+
+        uint32_t i = jb->head;
+        jitter_copy(jb, i, pcm, samples, channels, rate, 1.0, 1.0);
+
+        /* Kept for concealing the frames after it */
+        memcpy(jb->pcm + JITTER_LAST * JITTER_FRAME_MAX, pcm, *samples * *channels * sizeof(int16_t));
+        jb->frame[JITTER_LAST] = jb->frame[i];
+
+        jb->stats.buffered_us -= jb->frame[i].duration_us;
+        jb->head = (jb->head + 1) % JITTER_FRAMES;
+        jb->count--;
+        jb->conceal_run = 0;
+        return JITTER_FRAME;
+    }
+
+    /* Nothing arrived, but the frame may still make it while the output has enough left */
+    if(ahead_us >= JITTER_CONCEAL_AHEAD_US) {
+        return JITTER_NONE;
+    }
+
+    if(jb->conceal_run == JITTER_CONCEAL_FRAMES || !jb->frame[JITTER_LAST].samples) {
+        /* Faded out, the talkspurt is over */
+        jb->playing = 0;
+        return JITTER_NONE;
+    }
+
+    if(!jb->conceal_run) {
+        jb->stats.underruns++;
+    }
+    jb->conceal_run++;
+    jb->stats.concealed++;
+
+    jitter_copy(jb, JITTER_LAST, pcm, samples, channels, rate, 1.0 - (double)(jb->conceal_run - 1) / JITTER_CONCEAL_FRAMES,
+                1.0 - (double)jb->conceal_run / JITTER_CONCEAL_FRAMES);
+    return JITTER_CONCEALED;
+}
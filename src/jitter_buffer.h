@@ -0,0 +1,83 @@
+/** Adaptive jitter buffer for the audio frames of a call.
+ *
+ * Frames are pushed as they arrive from the network, at whatever pace that is, and popped by the playout at the pace
+ * of the sound card. The buffer keeps an estimate of how much the time between arrivals varies (the interarrival
+ * jitter of RFC 3550, as there are no sequence numbers or timestamps to go on), and holds back just enough audio to
+ * ride that out: the target delay. Beyond it frames get dropped so the delay doesn't grow after a burst, and when
+ * nothing arrived in time the last frame is repeated, fading out, so a lost frame doesn't click.
+ *
+ * Not thread safe, depends on nothing but libc.
+ */
+#include <stdint.h>
+
+/* Frames held at most, the oldest is dropped to make room for a new one past that */
+#define JITTER_FRAMES 32
+
+/* Most samples (of all channels) a frame can have, 60ms of 48kHz stereo */
+#define JITTER_FRAME_MAX (48000 * 60 / 1000 * 2)
+
+/* Bounds of the target delay */
+#define JITTER_MIN_DELAY_US (40 * 1000)
+#define JITTER_MAX_DELAY_US (400 * 1000)
+
+/* Frames buffered past the target before one is dropped */
+#define JITTER_SLACK_FRAMES 2
+
+/* Concealment starts once the output has less than this left to play */
+#define JITTER_CONCEAL_AHEAD_US (20 * 1000)
+
+/* Frames concealed in a row before it's taken as the end of a talkspurt */
+#define JITTER_CONCEAL_FRAMES 5
+
+/* A gap between frames this long starts a new talkspurt, and doesn't count as jitter */
+#define JITTER_SPURT_GAP_US (500 * 1000)
+
+enum {
+    JITTER_NONE,      /* nothing to play yet */
+    JITTER_FRAME,     /* a frame that arrived */
+    JITTER_CONCEALED, /* made up in place of one that didn't */
+};
+
+typedef struct {
+    uint32_t target_us;   /* delay aimed for */
+    uint32_t jitter_us;   /* interarrival jitter */
+    uint32_t buffered_us; /* held in the buffer, not counting what the output has queued */
+    uint32_t frames;      /* frames pushed */
+    uint32_t underruns;   /* times nothing had arrived in time, each is one or more concealed frames */
+    uint32_t concealed;   /* frames made up */
+    uint32_t dropped;     /* frames dropped to keep the delay down, or because the buffer was full */
+} JITTER_STATS;
+
+typedef struct {
+    int16_t *pcm; /* JITTER_FRAMES frames of JITTER_FRAME_MAX samples, then the last frame played */
+    struct {
+        uint32_t samples, rate, duration_us;
+        uint8_t channels;
+    } frame[JITTER_FRAMES + 1];
+    uint32_t head, count;
+
+    uint64_t last_arrival; /* ns, 0 before the first frame */
+    uint32_t last_duration_us;
+    uint64_t spurt_start;  /* when the first frame of the talkspurt waiting to be played arrived */
+    double jitter_us;
+    _Bool playing;         /* in a talkspurt, concealing instead of waiting for the buffer to fill */
+    uint32_t conceal_run;  /* frames concealed in a row */
+
+    JITTER_STATS stats;
+} JITTER_BUFFER;
+
+/* returns 0 if there isn't enough memory */
+_Bool jitter_init(JITTER_BUFFER *jb);
+void jitter_free(JITTER_BUFFER *jb);
+
+/* Adds a frame that arrived at now (ns, any monotonic clock) */
+void jitter_push(JITTER_BUFFER *jb, const int16_t *pcm, uint32_t samples, uint8_t channels, uint32_t rate, uint64_t now);
+
+/** Gets the next frame to play, if the output should get one now.
+ *
+ * ahead_us is how much the output still has queued to play. Call it again until it returns JITTER_NONE, and at least
+ * every JITTER_CONCEAL_AHEAD_US / 2 while playing, so concealment can start before the output runs dry.
+ *
+ * returns JITTER_NONE, or JITTER_FRAME/JITTER_CONCEALED with the frame copied to pcm (JITTER_FRAME_MAX samples). */
+int jitter_pop(JITTER_BUFFER *jb, uint64_t ahead_us, uint64_t now, int16_t *pcm, uint32_t *samples, uint8_t *channels,
+               uint32_t *rate);
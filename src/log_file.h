@@ -0,0 +1,26 @@
+/** On disk format of the chat logs.
+ *
+ * <pubkey>.txt is a sequence of records, each a LOG_FILE_MSG_HEADER followed by namelen bytes of the name the author
+ * had at the time and length bytes of the message. Kept free of uTox's own headers, so tools can read logs too.
+ */
+#include <stdint.h>
+
+enum {
+  LOG_FILE_MSG_TYPE_TEXT = 0,
+  LOG_FILE_MSG_TYPE_ACTION = 1,
+};
+
+typedef struct {
+    uint64_t time;
+    uint16_t namelen, length;
+    uint8_t flags;
+    uint8_t msg_type;
+    uint8_t zeroes[2];
+} LOG_FILE_MSG_HEADER;
+
+/* Every record in <pubkey>.txt has one of these in <pubkey>.idx, in the same order, so the backlog can be
+ * found with a single seek instead of reading through the whole log. */
+typedef struct {
+    uint64_t offset;
+    uint64_t time;
+} LOG_FILE_INDEX_RECORD;
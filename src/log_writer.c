@@ -0,0 +1,315 @@
+#include "main.h"
+
+/* An open log, and the records waiting to be written to it. Only touched by the log writer thread. */
+typedef struct {
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+    FILE *log, *index; /* index is NULL if the log doesn't have a usable one, log_read() builds it then */
+    uint32_t fid;      /* for telling the search thread about new records */
+    uint64_t end;      /* where in log the first record of batch goes */
+    uint64_t used;     /* when it was last written to, to find the one to close when all are in use */
+
+    uint8_t *batch;
+    size_t batch_length, batch_size;
+    LOG_FILE_INDEX_RECORD *records;
+    uint32_t record_count, record_size;
+} LOG_WRITER_HANDLE;
+
+static LOG_WRITER_HANDLE log_handle[LOG_WRITER_HANDLES];
+static uint64_t log_handle_clock;
+
+/* When the oldest record that's waiting has to be written, 0 if none are */
+static uint64_t commit_due;
+
+/* Counters, for debugging and tuning */
+static struct {
+    uint64_t records, commits, opens, time, max;
+} log_stats;
+
+static UTOX_MSG_QUEUE log_msg_queue = UTOX_MSG_QUEUE_INIT;
+
+/* Sequence number of the last LOG_WRITER_CLOSE posted, only written by the toxcore thread, and of the last one done,
+ * only written by the log writer thread */
+static volatile uint32_t close_posted, close_done;
+
+void postmessage_log(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    msg_queue_post_wait(&log_msg_queue, msg, param1, param2, data);
+}
+
+static _Bool log_writer_path(uint8_t *path, size_t size, const uint8_t *cid, const char *ext) {
+    int base = datapath(path);
+    return log_file_name_key(path + base, size - base, cid, ext) != -1;
+}
+
+/* Writes the records waiting for h, the log first, so an index record never points past the end of the log */
+static void log_handle_commit(LOG_WRITER_HANDLE *h) {
+    if (!h->batch_length) {
+        return;
+    }
+
+    uint64_t start = get_time();
+
+    if (fwrite(h->batch, h->batch_length, 1, h->log) != 1) {
+        /* The index doesn't match the log anymore, log_read() rebuilds it */
+        debug("Log:\tWrite error, %u records lost\n", h->record_count);
+        if (h->index) {
+            fclose(h->index);
+            h->index = NULL;
+        }
+        fseeko(h->log, 0, SEEK_END);
+        h->end = ftello(h->log);
+    } else {
+        h->end += h->batch_length;
+
+        if (h->index) {
+            fseeko(h->index, 0, SEEK_END);
+            if (fwrite(h->records, sizeof(*h->records) * h->record_count, 1, h->index) != 1 || fflush(h->index)) {
+                debug("Log:\tIndex write error\n");
+                fclose(h->index);
+                h->index = NULL;
+            }
+        }
+
+        postmessage_search(SEARCH_LOG, h->fid, 0, NULL);
+    }
+
+    h->batch_length = 0;
+    h->record_count = 0;
+
+    uint64_t time = get_time() - start;
+    log_stats.commits++;
+    log_stats.time += time;
+    if (time > log_stats.max) {
+        log_stats.max = time;
+    }
+}
+
+static void log_handle_close(LOG_WRITER_HANDLE *h) {
+    if (!h->log) {
+        return;
+    }
+
+    log_handle_commit(h);
+    fclose(h->log);
+    if (h->index) {
+        fclose(h->index);
+    }
+    free(h->batch);
+    free(h->records);
+    memset(h, 0, sizeof(*h));
+}
+
+static LOG_WRITER_HANDLE* log_handle_find(const uint8_t *cid) {
+    for (int i = 0; i < LOG_WRITER_HANDLES; i++) {
+        if (log_handle[i].log && !memcmp(log_handle[i].cid, cid, TOX_PUBLIC_KEY_SIZE)) {
+            return &log_handle[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* returns the open log of cid, opening it in place of the least recently used one if it isn't, or NULL */
+static LOG_WRITER_HANDLE* log_handle_get(const uint8_t *cid) {
+    LOG_WRITER_HANDLE *h = log_handle_find(cid);
+    if (h) {
+        return h;
+    }
+
+    h = &log_handle[0];
+    for (int i = 0; i < LOG_WRITER_HANDLES && h->log; i++) {
+        if (!log_handle[i].log || log_handle[i].used < h->used) {
+            h = &log_handle[i];
+        }
+    }
+    log_handle_close(h);
+
+    uint8_t path[UTOX_FILE_NAME_LENGTH];
+    if (!log_writer_path(path, sizeof(path), cid, ".txt")) {
+        return NULL;
+    }
+
+    h->log = fopen((char*)path, "ab");
+    if (!h->log) {
+        debug("Log:\tUnable to open %s\n", path);
+        return NULL;
+    }
+
+    /* Batches are written with a single fwrite(), don't let stdio split them */
+    setvbuf(h->log, NULL, _IONBF, 0);
+    fseeko(h->log, 0, SEEK_END);
+    h->end = ftello(h->log);
+
+    /* Only extend an index log_read() has already built; if it's missing or damaged, log_read() will notice the
+     * records it doesn't cover and index them itself. */
+    log_writer_path(path, sizeof(path), cid, ".idx");
+    h->index = fopen((char*)path, "r+b");
+    if (h->index) {
+        fseeko(h->index, 0, SEEK_END);
+        if (ftello(h->index) % sizeof(LOG_FILE_INDEX_RECORD)) {
+            fclose(h->index);
+            h->index = NULL;
+        }
+    }
+
+    memcpy(h->cid, cid, sizeof(h->cid));
+    log_stats.opens++;
+    return h;
+}
+
+static void log_writer_record(uint32_t fid, LOG_WRITE *w) {
+    LOG_WRITER_HANDLE *h = log_handle_get(w->cid);
+    if (!h) {
+        return;
+    }
+
+    size_t length = sizeof(w->header) + w->length;
+    if (h->batch_length + length > h->batch_size) {
+        size_t size = (h->batch_length + length) * 2;
+        uint8_t *batch = realloc(h->batch, size);
+        if (!batch) {
+            debug("Log:\tNot enough memory, record lost\n");
+            return;
+        }
+        h->batch = batch;
+        h->batch_size = size;
+    }
+
+    if (h->record_count == h->record_size) {
+        uint32_t size = h->record_size ? h->record_size * 2 : 16;
+        LOG_FILE_INDEX_RECORD *records = realloc(h->records, size * sizeof(*records));
+        if (!records) {
+            debug("Log:\tNot enough memory, record lost\n");
+            return;
+        }
+        h->records = records;
+        h->record_size = size;
+    }
+
+    h->records[h->record_count++] = (LOG_FILE_INDEX_RECORD){
+        .offset = h->end + h->batch_length,
+        .time   = w->header.time,
+    };
+    memcpy(h->batch + h->batch_length, &w->header, sizeof(w->header));
+    memcpy(h->batch + h->batch_length + sizeof(w->header), w->data, w->length);
+    h->batch_length += length;
+
+    h->fid = fid;
+    h->used = ++log_handle_clock;
+    log_stats.records++;
+
+    if (h->batch_length >= LOG_WRITER_BATCH_SIZE) {
+        log_handle_commit(h);
+    } else if (!commit_due) {
+        commit_due = get_time() + (uint64_t)LOG_WRITER_COMMIT_MS * 1000 * 1000;
+    }
+}
+
+static void log_writer_message(uint8_t msg, uint32_t param1, uint32_t UNUSED(param2), void *data) {
+    switch (msg) {
+        case LOG_WRITER_RECORD: {
+            /* param1: friend number
+             * data: LOG_WRITE */
+            log_writer_record(param1, data);
+            free(data);
+            break;
+        }
+        case LOG_WRITER_CLOSE: {
+            /* param1: sequence number
+             * data: public key, or NULL */
+            if (data) {
+                LOG_WRITER_HANDLE *h = log_handle_find(data);
+                if (h) {
+                    log_handle_close(h);
+                }
+            } else {
+                for (int i = 0; i < LOG_WRITER_HANDLES; i++) {
+                    log_handle_close(&log_handle[i]);
+                }
+
+                if (log_stats.commits) {
+                    debug("Log:\t%"PRIu64" records in %"PRIu64" writes, %"PRIu64" opens, avg %"PRIu64"us max "
+                          "%"PRIu64"us per write\n", log_stats.records, log_stats.commits, log_stats.opens,
+                          log_stats.time / log_stats.commits / 1000, log_stats.max / 1000);
+                }
+            }
+            free(data);
+            close_done = param1;
+            break;
+        }
+        case LOG_WRITER_REMOVE: {
+            /* data: public key */
+            LOG_WRITER_HANDLE *h = log_handle_find(data);
+            if (h) {
+                log_handle_close(h);
+            }
+
+            /* The indexes go with it, or the next log_read() would follow their offsets into the new log */
+            uint8_t path[UTOX_FILE_NAME_LENGTH];
+            if (log_writer_path(path, sizeof(path), data, ".txt")) {
+                remove((const char*)path);
+            }
+            if (log_writer_path(path, sizeof(path), data, ".idx")) {
+                remove((const char*)path);
+            }
+            if (log_writer_path(path, sizeof(path), data, ".fts")) {
+                remove((const char*)path);
+            }
+
+            /* Only now, so the search thread can't index the old log again after it's let go of its index */
+            postmessage_search(SEARCH_CLEAR, 0, 0, data);
+            break;
+        }
+    }
+}
+
+/** Writes the records posted with LOG_WRITER_RECORD to the logs.
+ *
+ * Records for all logs are collected for up to LOG_WRITER_COMMIT_MS, and then written with one write per log, instead
+ * of opening, writing and closing the log and its index for every record.
+ */
+void log_writer_thread(void *UNUSED(args)) {
+    while (1) {
+        TOX_MSG msg;
+        while (msg_queue_get(&log_msg_queue, &msg)) {
+            log_writer_message(msg.msg, msg.param1, msg.param2, msg.data);
+        }
+
+        uint64_t now = get_time();
+        if (commit_due && now >= commit_due) {
+            for (int i = 0; i < LOG_WRITER_HANDLES; i++) {
+                if (log_handle[i].log) {
+                    log_handle_commit(&log_handle[i]);
+                }
+            }
+            commit_due = 0;
+        }
+
+        msg_queue_wait(&log_msg_queue, commit_due ? (commit_due - now) / 1000 / 1000 + 1 : 60 * 1000);
+    }
+}
+
+void log_writer_close(const uint8_t *key) {
+    uint8_t *copy = NULL;
+    if (key) {
+        /* Closing all of them is fine too, if there's no memory */
+        copy = malloc(TOX_PUBLIC_KEY_SIZE);
+        if (copy) {
+            memcpy(copy, key, TOX_PUBLIC_KEY_SIZE);
+        }
+    }
+
+    postmessage_log(LOG_WRITER_CLOSE, ++close_posted, 0, copy);
+    while (close_done != close_posted) {
+        yieldcpu(1);
+    }
+}
+
+void log_writer_remove(const uint8_t *key) {
+    uint8_t *copy = malloc(TOX_PUBLIC_KEY_SIZE);
+    if (!copy) {
+        return;
+    }
+
+    memcpy(copy, key, TOX_PUBLIC_KEY_SIZE);
+    postmessage_log(LOG_WRITER_REMOVE, 0, 0, copy);
+}
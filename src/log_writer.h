@@ -0,0 +1,43 @@
+/** Appending to the chat logs.
+ *
+ * log_write() hands every record to the log writer thread, which keeps the logs of the friends chatted with last open
+ * and writes the records that came in over LOG_WRITER_COMMIT_MS in one go. Records are only ever written whole, and
+ * their index records only after them, so threads reading the logs never see an index record without its record. A
+ * crash in the middle of a write can still cut the last record short; log_read() drops it.
+ */
+
+/* Messages for the log writer thread */
+enum {
+    LOG_WRITER_RECORD = 1, /* param1: friend number, data: LOG_WRITE */
+    LOG_WRITER_CLOSE,      /* param1: sequence number, data: malloc'd public key of the friend, or NULL for all */
+    LOG_WRITER_REMOVE,     /* data: malloc'd public key of the friend, its log and indexes get deleted */
+};
+
+/* Logs kept open at once */
+#define LOG_WRITER_HANDLES 32
+
+/* Longest a record waits before it's written */
+#define LOG_WRITER_COMMIT_MS 100
+
+/* Bytes of records to collect for a log before it's written right away */
+#define LOG_WRITER_BATCH_SIZE (64 * 1024)
+
+/* A record for the log of the friend with public key cid */
+typedef struct {
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+    uint32_t length; /* of data */
+    LOG_FILE_MSG_HEADER header;
+    uint8_t data[]; /* header.namelen bytes of name, then header.length bytes of message */
+} LOG_WRITE;
+
+void postmessage_log(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+void log_writer_thread(void *args);
+
+/* Writes out and closes the log of the friend with public key key, or all logs if key is NULL, and waits for it.
+ * Call it before reading a log that records may still be waiting for. Only call this from the toxcore thread. */
+void log_writer_close(const uint8_t *key);
+
+/* Deletes the log, record index and search index of the friend with public key key, after writing out what's waiting
+ * for it, and then has the search thread drop the index it may have open with SEARCH_CLEAR */
+void log_writer_remove(const uint8_t *key);
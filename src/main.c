@@ -8,6 +8,7 @@ void parse_args(int argc, char *argv[], bool *theme_was_set_on_argv, int8_t *sho
     // set default options
     theme = THEME_DEFAULT; // global declaration
     utox_portable = false; // global declaration
+    utox_backlog_capacity = UTOX_MAX_BACKLOG_MESSAGES; // global declaration
     *theme_was_set_on_argv = false;
     *should_launch_at_startup = 0;
     *set_show_window = 0;
@@ -19,13 +20,14 @@ void parse_args(int argc, char *argv[], bool *theme_was_set_on_argv, int8_t *sho
         {"set",        required_argument,   NULL,  's'},
         {"unset",      required_argument,   NULL,  'u'},
         {"no-updater", no_argument,         NULL,  'n'},
+        {"backlog",    required_argument,   NULL,  'b'},
         {"version",    no_argument,         NULL,  'v'},
         {"help",       no_argument,         NULL,  'h'},
         {0, 0, 0, 0}
     };
 
     int opt, long_index =0;
-    while ((opt = getopt_long(argc, argv,"t:ps:u:nvh", long_options, &long_index )) != -1) {
+    while ((opt = getopt_long(argc, argv,"t:ps:u:nb:vh", long_options, &long_index )) != -1) {
         // loop through each option; ":" after each option means an argument is required
         switch (opt) {
             case 't':
@@ -77,6 +79,16 @@ void parse_args(int argc, char *argv[], bool *theme_was_set_on_argv, int8_t *sho
                 *no_updater = 1;
                 break;
 
+            case 'b': {
+                long capacity = strtol(optarg, NULL, 10);
+                if (capacity < 1 || capacity > (1 << 20)) {
+                    debug("Please specify a backlog of 1 to 1048576 messages.\n");
+                    exit(EXIT_FAILURE);
+                }
+                utox_backlog_capacity = capacity;
+                break;
+            }
+
             case 'v':
                 debug("uTox version: %s\n", VERSION);
                 exit(EXIT_SUCCESS);
@@ -90,6 +102,7 @@ void parse_args(int argc, char *argv[], bool *theme_was_set_on_argv, int8_t *sho
                 debug("  -s --set=<option>        Set an option: start-on-boot, show-window, hide-window.\n");
                 debug("  -u --unset=<option>      Unset an option: start-on-boot.\n");
                 debug("  -n --no-updater          Disable the updater.\n");
+                debug("  -b --backlog=<messages>  Keep at most this many messages in memory per chat (default %u).\n", UTOX_MAX_BACKLOG_MESSAGES);
                 debug("  -v --version             Print the version and exit.\n");
                 debug("  -h --help                Shows this help text.\n");
                 exit(EXIT_SUCCESS);
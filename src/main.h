@@ -45,7 +45,8 @@
 // Limits and sizes
 #define UTOX_MAX_CALLS            16
 #define UTOX_MAX_NUM_FRIENDS      256 /* Deprecated; Avoid Use */
-#define UTOX_MAX_BACKLOG_MESSAGES 128
+#define UTOX_MAX_BACKLOG_MESSAGES 2048 /* Default for utox_backlog_capacity */
+#define UTOX_LOG_PAGE_MESSAGES    64   /* Read from the log at a time when scrolling back */
 #define UTOX_MAX_NUM_GROUPS       512
 #define UTOX_FILE_NAME_LENGTH     1024
 
@@ -184,7 +185,10 @@ extern unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_by
 typedef uint8_t *UTOX_IMAGE;
 
 #include "tox.h"
+#include "msg_queue.h"
+#include "jitter_buffer.h"
 #include "audio.h"
+#include "audio_ring.h"
 #include "video.h"
 #include "utox_av.h"
 
@@ -222,7 +226,11 @@ typedef uint8_t *UTOX_IMAGE;
 #include "commands.h"
 
 #include "util.h"
+#include "image_convert.h"
 #include "dns.h"
+#include "search_index.h"
+#include "search.h"
+#include "log_writer.h"
 #include "file_transfers.h"
 
 #include "ui_edits.h"
@@ -241,6 +249,8 @@ volatile uint16_t loaded_audio_in_device, loaded_audio_out_device;
 _Bool tox_connected;
 // TODO: remove globals
 _Bool encrypted_profile;
+// Most messages kept in memory per friend or group, see --backlog
+uint32_t utox_backlog_capacity;
 _Bool audio_preview, video_preview;
 
 
@@ -311,6 +321,8 @@ void image_free(UTOX_NATIVE_IMAGE *image);
 
 void showkeyboard(_Bool show);
 void redraw(void);
+/* Like redraw(), but only the area given needs drawing again, on platforms that can draw parts of the window */
+void redraw_rect(int x, int y, int width, int height);
 void update_tray(void);
 void force_redraw(void); // TODO: as parameter for redraw()?
 
@@ -392,6 +404,8 @@ void flush_file(FILE *file);
 int ch_mod(uint8_t *file);
 int file_lock(FILE *file, uint64_t start, size_t length);
 int file_unlock(FILE *file, uint64_t start, size_t length);
+/* Cuts file down to size bytes, returns 0 on success */
+int file_truncate(FILE *file, uint64_t size);
 
 /* OS-specific cleanup function for when edits are defocused. Commit IME state, etc. */
 void edit_will_deactivate(void);
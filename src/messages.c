@@ -45,6 +45,185 @@ MSG_FILE* message_add_type_file(FILE_TRANSFER *file){//TODO shove on ui thread
     return msg;
 }
 
+/* Width the text of a message gets in a messages panel width wide, the same for laying it out, drawing and hit
+ * testing so they all share the message's layout */
+static int message_text_width(int width) {
+    return abs(width - MESSAGES_X - TIME_WIDTH);
+}
+
+void *message_get(MSG_DATA *p, MSG_IDX i)
+{
+    return p->data[(p->first + i) & (p->size - 1)];
+}
+
+/* Fenwick tree of message heights, see MSG_DATA. It's indexed by slot rather than by message, so that the ring can
+ * move on without shifting it. Element k (1 based) of the tree holds the sum of the heights in slots k - (k & -k) to
+ * k - 1, where empty slots count as 0 high. */
+static void message_heights_rebuild(MSG_DATA *p)
+{
+    if(!p->height_tree) {
+        p->height_count = 0;
+        return;
+    }
+
+    /* Linear time build: every node passes its sum on to its parent */
+    memset(p->height_tree, 0, (p->size + 1) * sizeof(uint32_t));
+    for(MSG_IDX k = 1; k <= p->size; k++) {
+        if(((k - 1 - p->first) & (p->size - 1)) < p->n) {
+            p->height_tree[k] += ((MESSAGE*)p->data[k - 1])->height;
+        }
+
+        MSG_IDX parent = k + (k & -k);
+        if(parent <= p->size) {
+            p->height_tree[parent] += p->height_tree[k];
+        }
+    }
+
+    p->height_count = p->n;
+}
+
+/* Adds delta to the height in slot */
+static void message_heights_add(MSG_DATA *p, MSG_IDX slot, int32_t delta)
+{
+    for(MSG_IDX k = slot + 1; k <= p->size; k += k & -k) {
+        p->height_tree[k] += delta;
+    }
+}
+
+/* returns the sum of the heights in slots 0 to slot - 1 */
+static uint32_t message_heights_prefix(MSG_DATA *p, MSG_IDX slot)
+{
+    uint32_t sum = 0;
+    for(MSG_IDX k = slot; k; k -= k & -k) {
+        sum += p->height_tree[k];
+    }
+    return sum;
+}
+
+/* returns the sum of the heights of messages 0 to i - 1 */
+static uint32_t message_heights_before(MSG_DATA *p, MSG_IDX i)
+{
+    if(p->height_count != p->n) {
+        message_heights_rebuild(p);
+    }
+
+    if(p->height_count != p->n) {
+        /* No memory for the tree, add them up the slow way */
+        uint32_t sum = 0;
+        for(MSG_IDX j = 0; j < i; j++) {
+            sum += ((MESSAGE*)message_get(p, j))->height;
+        }
+        return sum;
+    }
+
+    /* Unsigned sums wrap around, so this works out even when the messages do */
+    uint32_t sum = message_heights_prefix(p, p->first + i - (p->first + i > p->size ? p->size : 0));
+    if(p->first + i > p->size) {
+        sum += message_heights_prefix(p, p->size);
+    }
+    return sum - message_heights_prefix(p, p->first);
+}
+
+/* returns the index of the message y pixels down from the top of the first one, n if that's past the last one */
+static MSG_IDX message_heights_find(MSG_DATA *p, uint32_t y)
+{
+    if(p->height_count != p->n) {
+        message_heights_rebuild(p);
+    }
+
+    if(p->height_count != p->n) {
+        MSG_IDX i = 0;
+        while(i < p->n && ((MESSAGE*)message_get(p, i))->height <= y) {
+            y -= ((MESSAGE*)message_get(p, i))->height;
+            i++;
+        }
+        return i;
+    }
+
+    uint32_t total = message_heights_prefix(p, p->size), skipped = message_heights_prefix(p, p->first);
+    if(y >= total) {
+        return p->n;
+    }
+
+    /* Turn y into an offset from slot 0, the messages after the last slot carry on at the start of the array */
+    if(y < total - skipped) {
+        y += skipped;
+    } else {
+        y -= total - skipped;
+    }
+
+    /* Walk down from the biggest power of two, skipping every subtree that ends at or above y */
+    MSG_IDX k = 0;
+    for(MSG_IDX step = p->size; step; step /= 2) {
+        if(k + step <= p->size && p->height_tree[k + step] <= y) {
+            k += step;
+            y -= p->height_tree[k];
+        }
+    }
+
+    return (k - p->first) & (p->size - 1);
+}
+
+_Bool message_reserve(MSG_DATA *p, MSG_IDX count)
+{
+    if(count <= p->size) {
+        return 1;
+    }
+
+    MSG_IDX size = p->size ? p->size : 64;
+    while(size < count) {
+        size *= 2;
+    }
+
+    void **data = malloc(size * sizeof(void*));
+    uint32_t *tree = malloc((size + 1) * sizeof(uint32_t));
+    if(!data || !tree) {
+        free(data);
+        free(tree);
+        return 0;
+    }
+
+    /* Unroll the ring, so the oldest message is back in slot 0 */
+    for(MSG_IDX i = 0; i < p->n; i++) {
+        data[i] = message_get(p, i);
+    }
+
+    free(p->data);
+    free(p->height_tree);
+    p->data = data;
+    p->height_tree = tree;
+    p->size = size;
+    p->first = 0;
+
+    message_heights_rebuild(p);
+    return 1;
+}
+
+/* Starts reading the next page of the log when messages first to last are in view and the history above or below
+ * them is running out. */
+static void messages_page_log(MESSAGES *m, MSG_IDX first, MSG_IDX last)
+{
+    MSG_DATA *p = m->data;
+    if(p->log_loading) {
+        return;
+    }
+
+    MSG_IDX page = (UTOX_LOG_PAGE_MESSAGES < utox_backlog_capacity) ? UTOX_LOG_PAGE_MESSAGES : utox_backlog_capacity;
+    uint64_t start, end;
+
+    if(first < page / 2 && p->log_start) {
+        end = p->log_start;
+        start = (end > page) ? end - page : 0;
+    } else if(first < p->history && last + page / 2 >= p->history && p->log_start + p->history < p->log_end) {
+        start = p->log_start + p->history;
+        end = (p->log_end - start > page) ? start + page : p->log_end;
+    } else {
+        return;
+    }
+
+    p->log_loading = log_read_page(p->id, start, end - start);
+}
+
 /** Formats all messages from self and friends, and then call draw functions
  * to write them to the UI.
  *
@@ -54,14 +233,20 @@ void messages_draw(MESSAGES *m, int x, int y, int width, int height) {
     // Do not draw author name next to every message
     uint8_t lastauthor = 0xFF;
 
-    // Message iterator
-    void **p = m->data->data;
-    MSG_IDX i, n = m->data->n;
-    y += 0;//UTOX_SCALE(2 );
+    // Fetch more of the log before the view gets to the end of what's loaded
+    m->view_height = height;
+    if(!m->type) {
+        uint32_t top = scroll_gety(m->panel.content_scroll, height);
+        messages_page_log(m, message_heights_find(m->data, top), message_heights_find(m->data, top + height));
+    }
+
+    // Message iterator, starting at the first one that's visible
+    MSG_IDX i = y < 0 ? message_heights_find(m->data, -y) : 0, n = m->data->n;
+    y += message_heights_before(m->data, i);
 
     // Go through messages
-    for(i = 0; i != n; i++) {
-        MESSAGE *msg = *p++;
+    for(; i != n; i++) {
+        MESSAGE *msg = message_get(m->data, i);
 
         // Empty message
         if(msg->height == 0) {
@@ -166,10 +351,15 @@ void messages_draw(MESSAGES *m, int x, int y, int width, int height) {
             }
 
             setfont(FONT_TEXT);
-            int ny = drawtextmultiline(x + MESSAGES_X, x + width - TIME_WIDTH,
-                                                    y,               MAIN_TOP,
-                                       y + msg->height, font_small_lineheight,
-                                       msg->msg, msg->length, h1, h2 - h1, 0, 0, 1);
+            TEXT_LAYOUT *layout = text_layout(&msg->layout, message_text_width(width), font_small_lineheight,
+                                              msg->msg, msg->length);
+            if(!layout) {
+                y += msg->height;
+                break;
+            }
+
+            int ny = text_layout_draw(layout, x + MESSAGES_X, y, MAIN_TOP, y + msg->height,
+                                      msg->msg, h1, h2 - h1, 0, 0);
 
             if(ny < y || (uint32_t)(ny - y) + MESSAGES_SPACING != msg->height) {
                 debug("error101 %u %u\n", ny -y, msg->height - MESSAGES_SPACING);
@@ -416,7 +606,7 @@ _Bool messages_mmove(MESSAGES *m, int UNUSED(px), int UNUSED(py), int width, int
                      int mx, int my, int dx, int UNUSED(dy)) {
     if(m->idown < m->data->n) {
         int maxwidth = width - MESSAGES_X - TIME_WIDTH;
-        MSG_IMG *img_down = m->data->data[m->idown];
+        MSG_IMG *img_down = message_get(m->data, m->idown);
         if((img_down->msg_type == MSG_TYPE_IMAGE) && (img_down->w > maxwidth)) {
             img_down->position -= (double)dx / (double)(img_down->w - maxwidth);
             if(img_down->position > 1.0) {
@@ -439,12 +629,12 @@ _Bool messages_mmove(MESSAGES *m, int UNUSED(px), int UNUSED(py), int width, int
 
     setfont(FONT_TEXT);
 
-    void **p = m->data->data;
-    MSG_IDX i = 0, n = m->data->n;
+    MSG_IDX i = message_heights_find(m->data, my), n = m->data->n;
     _Bool need_redraw = 0;
+    my -= message_heights_before(m->data, i);
 
     while(i != n) {
-        MESSAGE *msg = *p++;
+        MESSAGE *msg = message_get(m->data, i);
 
         int dy = msg->height;
 
@@ -453,8 +643,10 @@ _Bool messages_mmove(MESSAGES *m, int UNUSED(px), int UNUSED(py), int width, int
             case MSG_TYPE_TEXT:
             case MSG_TYPE_ACTION_TEXT: {
                 /* normal message */
-                m->over = hittextmultiline(mx - MESSAGES_X, width - MESSAGES_X - TIME_WIDTH, my < 0 ? 0 : my,
-                                           msg->height, font_small_lineheight, msg->msg, msg->length, 1);
+                TEXT_LAYOUT *layout = text_layout(&msg->layout, message_text_width(width), font_small_lineheight,
+                                                  msg->msg, msg->length);
+                m->over = layout ? text_layout_hit(layout, mx - MESSAGES_X, my < 0 ? 0 : my, msg->msg, msg->length)
+                                 : msg->length;
 
                 _Bool prev_urlmdown = m->urlmdown;
                 if (m->urlover != STRING_IDX_MAX) {
@@ -583,7 +775,7 @@ _Bool messages_mmove(MESSAGES *m, int UNUSED(px), int UNUSED(py), int width, int
             }
 
             if((i != m->iover) && (m->iover != MSG_IDX_MAX) && ((msg->msg_type == MSG_TYPE_FILE) ||
-               (((MESSAGE*)(m->data->data[m->iover]))->msg_type == MSG_TYPE_FILE))) {
+               (((MESSAGE*)(message_get(m->data, m->iover)))->msg_type == MSG_TYPE_FILE))) {
                 need_redraw = 1; // Redraw file on hover-in/out.
             }
 
@@ -642,7 +834,7 @@ _Bool messages_mmove(MESSAGES *m, int UNUSED(px), int UNUSED(py), int width, int
 _Bool messages_mdown(MESSAGES *m) {
     m->idown = MSG_IDX_MAX;
     if(m->iover != MSG_IDX_MAX) {
-        MESSAGE *msg = m->data->data[m->iover];
+        MESSAGE *msg = message_get(m->data, m->iover);
         switch(msg->msg_type) {
         case MSG_TYPE_TEXT:
         case MSG_TYPE_ACTION_TEXT: {
@@ -756,7 +948,7 @@ _Bool messages_mdown(MESSAGES *m) {
 _Bool messages_dclick(MESSAGES *m, _Bool triclick)
 {
     if(m->iover != MSG_IDX_MAX) {
-        MESSAGE *msg = m->data->data[m->iover];
+        MESSAGE *msg = message_get(m->data, m->iover);
         switch(msg->msg_type) {
         case MSG_TYPE_TEXT:
         case MSG_TYPE_ACTION_TEXT: {
@@ -802,7 +994,7 @@ _Bool messages_mright(MESSAGES *m)
         return 0;
     }
 
-    MESSAGE* msg = (MESSAGE*)m->data->data[m->iover];
+    MESSAGE* msg = (MESSAGE*)message_get(m->data, m->iover);
 
     switch(msg->msg_type) {
     case MSG_TYPE_TEXT:
@@ -823,7 +1015,7 @@ _Bool messages_mwheel(MESSAGES *UNUSED(m), int UNUSED(height), double UNUSED(d),
 _Bool messages_mup(MESSAGES *m){
 
     if(m->iover != MSG_IDX_MAX) {
-        MESSAGE *msg = m->data->data[m->iover];
+        MESSAGE *msg = message_get(m->data, m->iover);
         if(msg->msg_type == MSG_TYPE_TEXT){
             if(m->urlover != STRING_IDX_MAX && m->urlmdown) {
                 char_t url[m->urllen + 1];
@@ -863,12 +1055,11 @@ int messages_selection(MESSAGES *m, void *buffer, uint32_t len, _Bool names)
     }
 
     MSG_IDX i = m->data->istart, n = m->data->iend + 1;
-    void **dp = &m->data->data[i];
 
     char_t *p = buffer;
 
     while(i != MSG_IDX_MAX && i != n) {
-        MESSAGE *msg = *dp++;
+        MESSAGE *msg = message_get(m->data, i);
 
         if(names && (i != m->data->istart || m->data->start == 0)) {
             if(m->type) {
@@ -975,7 +1166,9 @@ static int msgheight(MESSAGE *msg, int width)
     switch(msg->msg_type) {
     case MSG_TYPE_TEXT:
     case MSG_TYPE_ACTION_TEXT: {
-        int theight = text_height(abs(width - MESSAGES_X - TIME_WIDTH), font_small_lineheight, msg->msg, msg->length);
+        TEXT_LAYOUT *layout = text_layout(&msg->layout, message_text_width(width), font_small_lineheight,
+                                          msg->msg, msg->length);
+        int theight = layout ? text_layout_height(layout) : 0;
         return (theight == 0) ? 0 : theight + MESSAGES_SPACING;
     }
 
@@ -1006,7 +1199,7 @@ void messages_updateheight(MESSAGES *m)
     uint32_t height = 0;
     MSG_IDX i = 0;
     while(i < data->n) {
-        MESSAGE *msg = data->data[i];
+        MESSAGE *msg = message_get(data, i);
         msg->height = msgheight(msg, m->width);
         height += msg->height;
         i++;
@@ -1015,12 +1208,14 @@ void messages_updateheight(MESSAGES *m)
     m->height = height;
     data->height = height;
     data->width = m->width;
+    message_heights_rebuild(data);
     m->panel.content_scroll->content_height = height;
 }
 
 static void message_setheight(MESSAGES *m, MESSAGE *msg, MSG_DATA *p)
 {
     if(m->width == 0) {
+        msg->height = 0;
         return;
     }
 
@@ -1041,16 +1236,333 @@ void message_updateheight(MESSAGES *m, MESSAGE *msg, MSG_DATA *p)
 
     setfont(FONT_TEXT);
 
+    uint32_t old_height = msg->height;
     p->height -= msg->height;
     msg->height = msgheight(msg, m->width);
     p->height += msg->height;
+
+    if(p->height_count == p->n) {
+        /* Newest first, that's where messages still changing usually are */
+        for(MSG_IDX i = p->n; i--;) {
+            MSG_IDX slot = (p->first + i) & (p->size - 1);
+            if(p->data[slot] == msg) {
+                message_heights_add(p, slot, (int32_t)(msg->height - old_height));
+                break;
+            }
+        }
+    }
+
     if(m->data == p) {
         m->panel.content_scroll->content_height = p->height;
     }
 }
 
+void message_redraw(MESSAGES *m, MSG_DATA *p, void *msg)
+{
+    PANEL *panel = &m->panel;
+    if(m->data != p || panel->drawn_width <= 0) {
+        return;
+    }
+
+    // Newest first, that's where transfers in progress usually are
+    for(MSG_IDX i = p->n; i--;) {
+        if(message_get(p, i) != msg) {
+            continue;
+        }
+
+        int top = panel->drawn_y + (int)message_heights_before(p, i) - scroll_gety(panel->content_scroll, m->view_height);
+        int bottom = top + ((MESSAGE*)msg)->height;
+        if(top < panel->drawn_y) {
+            top = panel->drawn_y;
+        }
+        if(bottom > panel->drawn_y + panel->drawn_height) {
+            bottom = panel->drawn_y + panel->drawn_height;
+        }
+
+        if(top < bottom) {
+            redraw_rect(panel->drawn_x, top, panel->drawn_width, bottom - top);
+        }
+        return;
+    }
+}
+
+/* Where message i of p ends up after removed messages at index at are replaced by added ones. returns MSG_IDX_MAX
+ * if it was one of the removed ones. */
+static MSG_IDX message_index_moved(MSG_IDX i, MSG_IDX at, MSG_IDX removed, MSG_IDX added)
+{
+    if(i == MSG_IDX_MAX || i < at) {
+        return i;
+    }
+    if(i < at + removed) {
+        return MSG_IDX_MAX;
+    }
+    return i - removed + added;
+}
+
+/* Keeps the selection and hover on the same messages after removed messages at index at are replaced by added ones,
+ * and drops them if their message is gone. */
+static void message_indices_move(MESSAGES *m, MSG_DATA *p, MSG_IDX at, MSG_IDX removed, MSG_IDX added)
+{
+    MSG_IDX istart = message_index_moved(p->istart, at, removed, added);
+    MSG_IDX iend = message_index_moved(p->iend, at, removed, added);
+    if((istart == MSG_IDX_MAX) != (p->istart == MSG_IDX_MAX) || (iend == MSG_IDX_MAX) != (p->iend == MSG_IDX_MAX)) {
+        p->istart = p->iend = p->start = p->end = 0;
+    } else {
+        p->istart = istart;
+        p->iend = iend;
+    }
+
+    if(p == m->data) {
+        m->idown = message_index_moved(m->idown, at, removed, added);
+        m->iover = message_index_moved(m->iover, at, removed, added);
+    }
+}
+
+/* Inserts count messages before message at. The ring must have room for them. */
+static void message_insert(MESSAGES *m, MSG_DATA *p, MSG_IDX at, void **msgs, MSG_IDX count)
+{
+    MSG_IDX mask = p->size - 1;
+
+    if(at < p->n - at) {
+        // Fewer messages before at, move those back
+        p->first = (p->first - count) & mask;
+        for(MSG_IDX i = 0; i < at; i++) {
+            p->data[(p->first + i) & mask] = p->data[(p->first + i + count) & mask];
+        }
+    } else {
+        for(MSG_IDX i = p->n; i-- > at;) {
+            p->data[(p->first + i + count) & mask] = p->data[(p->first + i) & mask];
+        }
+    }
+
+    p->n += count;
+    p->height_count = 0;
+    for(MSG_IDX i = 0; i < count; i++) {
+        p->data[(p->first + at + i) & mask] = msgs[i];
+        message_setheight(m, msgs[i], p);
+    }
+
+    message_indices_move(m, p, at, 0, count);
+}
+
+/* Frees count messages starting at message at */
+static void message_remove(MESSAGES *m, MSG_DATA *p, MSG_IDX at, MSG_IDX count)
+{
+    MSG_IDX mask = p->size - 1;
+
+    for(MSG_IDX i = at; i < at + count; i++) {
+        MESSAGE *msg = message_get(p, i);
+        p->height -= msg->height;
+        message_free(msg);
+    }
+
+    if(at < p->n - at - count) {
+        // Fewer messages before at, move those forward
+        for(MSG_IDX i = at; i--;) {
+            p->data[(p->first + i + count) & mask] = p->data[(p->first + i) & mask];
+        }
+        p->first = (p->first + count) & mask;
+    } else {
+        for(MSG_IDX i = at; i < p->n - count; i++) {
+            p->data[(p->first + i) & mask] = p->data[(p->first + i + count) & mask];
+        }
+    }
+
+    p->n -= count;
+    p->height_count = 0;
+    message_indices_move(m, p, at, count, 0);
+}
+
+/* returns whether p is the list being shown, scrolled back to its history */
+static _Bool message_view_in_history(MESSAGES *m, MSG_DATA *p)
+{
+    if(m->data != p || !p->history) {
+        return 0;
+    }
+
+    return message_heights_find(p, scroll_gety(m->panel.content_scroll, m->view_height)) < p->history;
+}
+
+/* Selects all of message i of p, and scrolls it to the middle of the view */
+static void message_show(MESSAGES *m, MSG_DATA *p, MSG_IDX i)
+{
+    MESSAGE *msg = message_get(p, i);
+    p->istart = p->iend = i;
+    p->start = 0;
+    p->end = (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) ? msg->length : 0;
+
+    double d = 1.0;
+    if(p->height > (uint32_t)m->view_height) {
+        int64_t y = (int64_t)message_heights_before(p, i) - (m->view_height - (int64_t)msg->height) / 2;
+        d = (y <= 0) ? 0.0 : (double)y / (p->height - m->view_height);
+        if(d > 1.0) {
+            d = 1.0;
+        }
+    }
+
+    if(m->data == p) {
+        m->panel.content_scroll->content_height = p->height;
+        m->panel.content_scroll->d = d;
+    } else {
+        p->scroll = d;
+    }
+}
+
+void messages_log_page(MESSAGES *m, MSG_DATA *p, uint64_t start, void **msgs, MSG_IDX count)
+{
+    p->log_loading = 0;
+
+    // Older records go in front of the history, newer ones close the gap after it
+    _Bool older = (start + count == p->log_start);
+    if((!older && (start != p->log_start + p->history || start + count > p->log_end)) ||
+       count > utox_backlog_capacity || !message_reserve(p, p->n + count)) {
+        while(count) {
+            message_free(msgs[--count]);
+        }
+        return;
+    }
+
+    // Remember which message is at the top of the view, and how far down it
+    _Bool active = (m->data == p);
+    SCROLLABLE *scroll = m->panel.content_scroll;
+    uint32_t top = active ? scroll_gety(scroll, m->view_height) : 0;
+    MSG_IDX anchor = message_heights_find(p, top);
+    uint32_t offset = top - message_heights_before(p, anchor);
+
+    // Keep the history bounded by dropping the end of it that's furthest from the view
+    MSG_IDX at = older ? 0 : p->history;
+    if(p->history + count > utox_backlog_capacity) {
+        MSG_IDX drop = p->history + count - utox_backlog_capacity;
+        MSG_IDX drop_at = older ? p->history - drop : 0;
+
+        message_remove(m, p, drop_at, drop);
+        anchor = message_index_moved(anchor, drop_at, drop, 0);
+        p->history -= drop;
+        at -= older ? 0 : drop;
+        if(!older) {
+            p->log_start += drop;
+        }
+    }
+
+    message_insert(m, p, at, msgs, count);
+    anchor = message_index_moved(anchor, at, 0, count);
+    p->history += count;
+    if(older) {
+        p->log_start = start;
+    }
+
+    if(active) {
+        scroll->content_height = p->height;
+        if(anchor != MSG_IDX_MAX && p->height > (uint32_t)m->view_height) {
+            scroll->d = (double)(message_heights_before(p, anchor) + offset) / (p->height - m->view_height);
+            if(scroll->d > 1.0) {
+                scroll->d = 1.0;
+            }
+        }
+    }
+
+    if(p->log_jump > p->log_start && p->log_jump <= p->log_start + p->history) {
+        message_show(m, p, p->log_jump - 1 - p->log_start);
+        p->log_jump = 0;
+    }
+}
+
+void messages_log_jump(MESSAGES *m, MSG_DATA *p, uint64_t record)
+{
+    p->log_jump = 0;
+
+    if(record >= p->log_start && record < p->log_start + p->history) {
+        message_show(m, p, record - p->log_start);
+        return;
+    }
+
+    if(record >= p->log_end) {
+        // Logged since the log was read, so it's one of the newest messages
+        if(m->data == p) {
+            m->panel.content_scroll->d = 1.0;
+        } else {
+            p->scroll = 1.0;
+        }
+        return;
+    }
+
+    // Swap the history for the page around the record, the ones around that get paged in as they're scrolled to
+    MSG_IDX page = (UTOX_LOG_PAGE_MESSAGES < utox_backlog_capacity) ? UTOX_LOG_PAGE_MESSAGES : utox_backlog_capacity;
+    uint64_t start = (record > page / 2) ? record - page / 2 : 0;
+    uint64_t end = (p->log_end - start > page) ? start + page : p->log_end;
+
+    message_remove(m, p, 0, p->history);
+    p->history = 0;
+    p->log_start = start;
+    p->log_jump = record + 1;
+    p->log_loading = log_read_page(p->id, start, end - start);
+    if(m->data == p) {
+        m->panel.content_scroll->content_height = p->height;
+    }
+}
+
+/* Frees the oldest message of p, moving the selection and hover indices along so they stay over the same messages */
+static void message_evict(MESSAGES *m, MSG_DATA *p)
+{
+    MESSAGE *msg = p->data[p->first];
+    p->height -= msg->height;
+
+    if(p->height_count == p->n) {
+        message_heights_add(p, p->first, -(int32_t)msg->height);
+        p->height_count--;
+    } else {
+        p->height_count = 0;
+    }
+
+    message_free(msg);
+    p->first = (p->first + 1) & (p->size - 1);
+    p->n--;
+
+    if(p->history) {
+        p->history--;
+        p->log_start++;
+    }
+    if(!p->history) {
+        // Scrolling back picks up again where the log ended when it was read
+        p->log_start = p->log_end;
+    }
+
+    if (p->istart != MSG_IDX_MAX) {
+        if(0 < p->istart) {
+            p->istart--;
+        } else {
+            p->start = 0;
+        }
+    }
+    if (p->iend != MSG_IDX_MAX) {
+        if(0 < p->iend) {
+            p->iend--;
+        } else {
+            p->end = 0;
+        }
+    }
+    if (p == m->data) {
+        if (m->idown != MSG_IDX_MAX) {
+            if(0 < m->idown) {
+                m->idown--;
+            } else {
+                m->down = 0;
+            }
+        }
+        if (m->iover != MSG_IDX_MAX) {
+            if(0 < m->iover) {
+                m->iover--;
+            } else {
+                m->over = 0;
+            }
+        }
+    }
+}
+
 /** Appends a messages from self or friend to the message list;
- * will realloc or trim messages as needed;
+ * the list is a ring, it only grows until it holds utox_backlog_capacity
+ * messages, then every new one replaces the oldest, unless the history
+ * read from the log is scrolled back to.
  *
  * also handles auto scrolling selections with messages
  *
@@ -1066,49 +1578,40 @@ void message_add(MESSAGES *m, MESSAGE *msg, MSG_DATA *p)
     // Set the time this message was received by utox
     msg->time = ti->tm_hour * 60 + ti->tm_min;
 
-    if(p->n < UTOX_MAX_BACKLOG_MESSAGES) {
-        p->data = realloc(p->data, (p->n + 1) * sizeof(void*));
-        p->data[p->n++] = msg;
-    } else {
-        p->height -= ((MESSAGE*)p->data[0])->height;
-        message_free(p->data[0]);
-        memmove(p->data, p->data + 1, (UTOX_MAX_BACKLOG_MESSAGES - 1) * sizeof(void*));
-        p->data[UTOX_MAX_BACKLOG_MESSAGES - 1] = msg;
-
-        // Scroll selection up so that it stays over the same messages.
-        if (p->istart != MSG_IDX_MAX) {
-            if(0 < p->istart) {
-                p->istart--;
-            } else {
-                p->start = 0;
-            }
+    if(message_view_in_history(m, p)) {
+        // Keep the history that's being read, and drop the oldest messages
+        // added since instead. Up to twice the capacity in all.
+        if(p->n - p->history >= utox_backlog_capacity) {
+            message_remove(m, p, p->history, p->n - p->history - utox_backlog_capacity + 1);
         }
-        if (p->iend != MSG_IDX_MAX) {
-            if(0 < p->iend) {
-                p->iend--;
-            } else {
-                p->end = 0;
-            }
+    } else if(p->n && p->n >= utox_backlog_capacity) {
+        message_evict(m, p);
+        // One more while scrolling back has left the list over capacity,
+        // so it shrinks back a little with every new message.
+        if(p->n >= utox_backlog_capacity) {
+            message_evict(m, p);
         }
-        if (p == m->data) {
-            if (m->idown != MSG_IDX_MAX) {
-                if(0 < m->idown) {
-                    m->idown--;
-                } else {
-                    m->down = 0;
-                }
-            }
-            if (m->iover != MSG_IDX_MAX) {
-                if(0 < m->iover) {
-                    m->iover--;
-                } else {
-                    m->over = 0;
-                }
-            }
+    }
+
+    if(!message_reserve(p, p->n + 1)) {
+        if(!p->n) {
+            // Not freed, the caller might still be holding on to it
+            debug("Messages:\tno memory for the message list\n");
+            return;
         }
+        // Make room the old way
+        message_evict(m, p);
     }
 
+    MSG_IDX slot = (p->first + p->n) & (p->size - 1);
+    p->data[slot] = msg;
+    p->n++;
+
     message_setheight(m, msg, p);
+    if(p->height_count == p->n - 1) {
+        p->height_count++;
+        message_heights_add(p, slot, msg->height);
+    }
 }
 
 _Bool messages_char(uint32_t ch)
@@ -1151,6 +1654,11 @@ _Bool messages_char(uint32_t ch)
 void message_free(MESSAGE *msg)
 {
     switch(msg->msg_type) {
+    case MSG_TYPE_TEXT:
+    case MSG_TYPE_ACTION_TEXT: {
+        free(msg->layout);
+        break;
+    }
     case MSG_TYPE_IMAGE: {
         MSG_IMG *img = (void*)msg;
         image_free(img->image);
@@ -1165,21 +1673,33 @@ void message_free(MESSAGE *msg)
     free(msg);
 }
 
-void message_clear(MESSAGES *m, MSG_DATA *p)
+void message_data_free(MSG_DATA *p)
 {
-    MSG_IDX i;
-
-    for(i = 0; i < p->n; i++)
-    {
-        message_free((MESSAGE*)p->data[i]);
+    for(MSG_IDX i = 0; i < p->n; i++) {
+        message_free(message_get(p, i));
     }
 
     free(p->data);
     p->data = NULL;
-    p->n = 0;
+    p->n = p->first = p->size = 0;
+
+    free(p->height_tree);
+    p->height_tree = NULL;
+    p->height_count = 0;
+}
+
+void message_clear(MESSAGES *m, MSG_DATA *p)
+{
+    message_data_free(p);
 
     p->istart = p->iend = p->start = p->end = 0;
 
+    // The log is gone too, nothing is left to page in
+    p->history = 0;
+    p->log_start = p->log_end = 0;
+    p->log_loading = 0;
+    p->log_jump = 0;
+
     p->height = 0;
     if(m->data == p) {
         m->panel.content_scroll->content_height = p->height;
@@ -16,8 +16,33 @@ typedef struct {
     // Indices in strings of corresponding messages, where selection starts/ends.
     STRING_IDX start, end;
 
-    // Pointers at various message structs, at most MAX_BACKLOG_MESSAGES.
+    // Ring of pointers at various message structs, at most
+    // utox_backlog_capacity of them. It has size slots, a power of two
+    // (0 while data is NULL), and the oldest message is in slot first.
+    // Use message_get() to look up a message by its index.
     void **data;
+    MSG_IDX first, size;
+
+    // Fenwick tree over the heights in the size slots of data, so
+    // finding the message at some y offset doesn't have to add up every
+    // message before it. Covers the oldest height_count messages, and
+    // gets rebuilt when that isn't all n of them.
+    uint32_t *height_tree;
+    MSG_IDX height_count;
+
+    // Messages 0 to history - 1 were read from the friend's log, they're
+    // its records log_start onwards. Records after those up to log_end,
+    // where the log ended when it was first read, aren't in memory, and
+    // get paged in again when they're scrolled to. Messages after history
+    // are the ones added since. log_loading is set while a page is being
+    // read in the background.
+    MSG_IDX history;
+    uint64_t log_start, log_end;
+    _Bool log_loading;
+
+    // Record to show once the page with it has been read, plus 1. 0 when
+    // there's none.
+    uint64_t log_jump;
 
     // Field for preserving position of text scroll,
     // while this MSG_DATA is inactive.
@@ -43,6 +68,10 @@ struct messages {
 
     uint32_t height, width;
 
+    // Height of the area the messages were last drawn in, used to keep
+    // the view still when older messages get loaded above it.
+    int view_height;
+
     // Indices of messages, that the mouse is over now/has been
     // pressed mousedown over. MSG_IDX_MAX, when the mouse isn't over
     // any message/when not in selection mode.
@@ -75,6 +104,10 @@ typedef struct {
     uint32_t height;
     uint32_t time;
 
+    // Line breaks and styles of msg, built when first needed and kept
+    // until the width or font changes. NULL when there's none yet.
+    TEXT_LAYOUT *layout;
+
     STRING_IDX length;
     char_t msg[0];
 } MESSAGE;
@@ -130,7 +163,29 @@ _Bool messages_char(uint32_t ch);
 
 void messages_updateheight(MESSAGES *m);
 void message_updateheight(MESSAGES *m, MESSAGE *msg, MSG_DATA *p);
+
+/* redraw_rect() of the part of the view msg of p is in, if it is in view */
+void message_redraw(MESSAGES *m, MSG_DATA *p, void *msg);
 void message_add(MESSAGES *m, MESSAGE *msg, MSG_DATA *p);
 void message_clear(MESSAGES *m, MSG_DATA *p);
 
+/* returns message i of p, counting from the oldest one */
+void *message_get(MSG_DATA *p, MSG_IDX i);
+
+/* Makes room for count messages in p without it having to wrap around.
+ * returns 0 if there's no memory for that. */
+_Bool message_reserve(MSG_DATA *p, MSG_IDX count);
+
+/* Frees all messages of p, and p's own buffers */
+void message_data_free(MSG_DATA *p);
+
+/* Adds the count messages in msgs, read from records start onwards of the
+ * log, to the history of p. Pages that no longer line up with the history
+ * are freed instead. */
+void messages_log_page(MESSAGES *m, MSG_DATA *p, uint64_t start, void **msgs, MSG_IDX count);
+
+/* Selects the message of record record of the log and scrolls to it,
+ * paging it in first if it isn't in memory. */
+void messages_log_jump(MESSAGES *m, MSG_DATA *p, uint64_t record);
+
 void message_free(MESSAGE *msg);
@@ -0,0 +1,144 @@
+#include "main.h"
+
+/* This is Dmitry Vyukov's bounded MPMC queue, used with a single consumer.
+ *
+ * Every cell carries a sequence number. A producer may fill the cell for position pos once its sequence equals pos,
+ * and the consumer may read it once the sequence is pos + 1. After reading, the consumer sets it to
+ * pos + UTOX_MSG_QUEUE_SIZE, which hands the cell to the producer that gets it on the next lap around the ring.
+ *
+ * Sequences are stored relative to the index of their cell, so that a zeroed queue starts out with every cell free.
+ * Positions are allowed to wrap, they're only ever compared through their difference.
+ *
+ * A sleeping consumer sets waiting before its last look at the queue, and producers check it after posting. The fences
+ * on both sides make sure at least one of them sees the other, so a message can't slip in unnoticed, while producers
+ * only pay for the mutex when the consumer is actually asleep. */
+#define MSG_QUEUE_MASK (UTOX_MSG_QUEUE_SIZE - 1)
+
+static uint32_t cell_sequence(UTOX_MSG_QUEUE_CELL *cell, uint32_t index) {
+    return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) + index;
+}
+
+static void cell_set_sequence(UTOX_MSG_QUEUE_CELL *cell, uint32_t index, uint32_t sequence) {
+    __atomic_store_n(&cell->sequence, sequence - index, __ATOMIC_RELEASE);
+}
+
+static void msg_queue_wake(UTOX_MSG_QUEUE *q) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&q->waiting, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_mutex_lock(&q->wake_lock);
+    q->woken = 1;
+    pthread_cond_signal(&q->wake_cond);
+    pthread_mutex_unlock(&q->wake_lock);
+}
+
+_Bool msg_queue_post(UTOX_MSG_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    UTOX_MSG_QUEUE_CELL *cell;
+    uint32_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        cell = &q->cell[pos & MSG_QUEUE_MASK];
+        int32_t diff = (int32_t)(cell_sequence(cell, pos & MSG_QUEUE_MASK) - pos);
+
+        if (diff == 0) {
+            /* Cell is free, try to claim it. On failure pos is reloaded and we try again. */
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The consumer hasn't read this cell since the last lap. */
+            return 0;
+        } else {
+            /* Another producer claimed it first. */
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->msg.msg    = msg;
+    cell->msg.param1 = param1;
+    cell->msg.param2 = param2;
+    cell->msg.data   = data;
+    cell->posted     = get_time();
+    cell_set_sequence(cell, pos & MSG_QUEUE_MASK, pos + 1);
+
+    uint32_t waiting = pos + 1 - __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    uint32_t max     = __atomic_load_n(&q->max_depth, __ATOMIC_RELAXED);
+    while (waiting > max) {
+        if (__atomic_compare_exchange_n(&q->max_depth, &max, waiting, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    msg_queue_wake(q);
+    return 1;
+}
+
+void msg_queue_post_wait(UTOX_MSG_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    while (!msg_queue_post(q, msg, param1, param2, data)) {
+        yieldcpu(1);
+    }
+}
+
+_Bool msg_queue_get(UTOX_MSG_QUEUE *q, TOX_MSG *msg) {
+    uint32_t pos = q->tail;
+    UTOX_MSG_QUEUE_CELL *cell = &q->cell[pos & MSG_QUEUE_MASK];
+
+    if (cell_sequence(cell, pos & MSG_QUEUE_MASK) != pos + 1) {
+        /* Empty, or the producer of the next message is still filling it in. */
+        return 0;
+    }
+
+    *msg = cell->msg;
+    q->last_posted = cell->posted;
+    uint64_t wait = get_time() - cell->posted;
+
+    cell_set_sequence(cell, pos & MSG_QUEUE_MASK, pos + UTOX_MSG_QUEUE_SIZE);
+    __atomic_store_n(&q->tail, pos + 1, __ATOMIC_RELAXED);
+
+    if (wait > q->max_wait) {
+        q->max_wait = wait;
+    }
+    q->total++;
+
+    return 1;
+}
+
+_Bool msg_queue_wait(UTOX_MSG_QUEUE *q, uint32_t timeout_ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec  += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000 * 1000;
+    if (until.tv_nsec >= 1000 * 1000 * 1000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&q->wake_lock);
+    q->woken = 0;
+    __atomic_store_n(&q->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while (!q->woken && !msg_queue_depth(q)) {
+        if (pthread_cond_timedwait(&q->wake_cond, &q->wake_lock, &until)) {
+            /* Timed out */
+            break;
+        }
+    }
+
+    _Bool woken = q->woken || msg_queue_depth(q);
+    __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->wake_lock);
+
+    return woken;
+}
+
+uint32_t msg_queue_depth(UTOX_MSG_QUEUE *q) {
+    return __atomic_load_n(&q->head, __ATOMIC_RELAXED) - __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
+
+void msg_queue_debug_stats(UTOX_MSG_QUEUE *q, const char *name) {
+    debug("%s queue:\t%"PRIu64" messages, depth %u, max depth %u, max wait %"PRIu64"us\n", name, q->total,
+          msg_queue_depth(q), q->max_depth, q->max_wait / 1000);
+}
@@ -0,0 +1,61 @@
+/** Bounded, lock-free, multi-producer single-consumer queue of TOX_MSGs.
+ *
+ * Used to post messages to the toxcore, toxav and audio threads: any thread may post, only the owning thread reads.
+ * Queues are plain static variables initialized with UTOX_MSG_QUEUE_INIT, there's no init or free call.
+ */
+#include <pthread.h>
+
+/* Must be a power of 2 */
+#define UTOX_MSG_QUEUE_SIZE 256
+
+typedef struct {
+    /* Tells producers and the consumer whose turn it is to use this cell, see msg_queue.c */
+    volatile uint32_t sequence;
+    uint64_t posted; /* get_time() when the message was posted */
+    TOX_MSG msg;
+} UTOX_MSG_QUEUE_CELL;
+
+typedef struct {
+    UTOX_MSG_QUEUE_CELL cell[UTOX_MSG_QUEUE_SIZE];
+
+    volatile uint32_t head; /* next cell to post to, shared by all producers */
+    volatile uint32_t tail; /* next cell to read from, only touched by the consumer */
+
+    /* Counters, for debugging and tuning */
+    volatile uint32_t max_depth; /* most messages ever waiting at once */
+    uint64_t          max_wait;  /* longest time (ns) a message waited before it was read */
+    uint64_t          total;     /* messages read */
+    uint64_t          last_posted; /* when the message msg_queue_get() returned last was posted */
+
+    /* Lets the consumer sleep until something is posted, see msg_queue_wait() */
+    pthread_mutex_t wake_lock;
+    pthread_cond_t  wake_cond;
+    volatile _Bool  waiting, woken;
+} UTOX_MSG_QUEUE;
+
+#define UTOX_MSG_QUEUE_INIT { .wake_lock = PTHREAD_MUTEX_INITIALIZER, .wake_cond = PTHREAD_COND_INITIALIZER }
+
+/** Adds a message to the end of the queue, without blocking.
+ *
+ * returns 1 on success, 0 if the queue is full. */
+_Bool msg_queue_post(UTOX_MSG_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+/** Adds a message to the end of the queue, waiting for the consumer to make room if it's full. */
+void msg_queue_post_wait(UTOX_MSG_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+/** Takes the oldest message off the queue and copies it to msg. Only call this from the consumer thread.
+ *
+ * returns 1 if there was a message, 0 if the queue is empty. */
+_Bool msg_queue_get(UTOX_MSG_QUEUE *q, TOX_MSG *msg);
+
+/** Sleeps until a message is posted to q, or timeout_ms pass. Only call this from the consumer thread.
+ *
+ * Returns immediately if there already are messages waiting.
+ * returns 1 if there are messages to read, 0 on timeout. */
+_Bool msg_queue_wait(UTOX_MSG_QUEUE *q, uint32_t timeout_ms);
+
+/* returns the number of messages currently waiting */
+uint32_t msg_queue_depth(UTOX_MSG_QUEUE *q);
+
+/* prints the counters of q, with name to tell queues apart */
+void msg_queue_debug_stats(UTOX_MSG_QUEUE *q, const char *name);
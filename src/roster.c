@@ -589,6 +589,17 @@ void list_selectchat(int index) {
     }
 }
 
+void list_selectfriend(FRIEND *f) {
+    for (uint32_t i = 0; i < itemcount; i++) {
+        if (item[i].item == ITEM_FRIEND && item[i].data == f) {
+            if (selected_item != &item[i]) {
+                show_page(&item[i]);
+            }
+            return;
+        }
+    }
+}
+
 void list_reselect_current(void) {
     show_page(selected_item);
 }
@@ -51,6 +51,7 @@ void list_deletesitem(void);
 void list_deleteright_mouse_item(void);
 
 void list_selectchat(int index);
+void list_selectfriend(FRIEND *f);
 void list_selectaddfriend(void);
 void list_reselect_current(void);
 void list_selectsettings(void);
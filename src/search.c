@@ -0,0 +1,318 @@
+#include "main.h"
+
+/* The index of one friend's log. Only touched by the search thread. */
+typedef struct {
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+    _Bool known;  /* cid is set */
+    _Bool behind; /* the log may have records the index doesn't */
+    SEARCH_INDEX index; /* index.file is NULL until it's first needed */
+} SEARCH_FRIEND_INDEX;
+
+static SEARCH_FRIEND_INDEX search_friend[MAX_NUM_FRIENDS];
+
+static UTOX_MSG_QUEUE search_msg_queue = UTOX_MSG_QUEUE_INIT;
+
+/* Results of the last query, only touched by the UI thread */
+static SEARCH_RESULT *search_result;
+static uint32_t search_result_count, search_result_next;
+
+void postmessage_search(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    msg_queue_post_wait(&search_msg_queue, msg, param1, param2, data);
+}
+
+/** Opens the log of s, its record index, and the search index next to them if it isn't open yet.
+ *
+ * returns the log, with the record index in *log_index and the number of records in it in *records, or NULL. */
+static FILE* search_log_open(SEARCH_FRIEND_INDEX *s, FILE **log_index, uint64_t *records) {
+    uint8_t path[UTOX_FILE_NAME_LENGTH];
+    int base;
+
+    FILE *log = log_open(path, sizeof(path), s->cid, &base);
+    if (!log) {
+        return NULL;
+    }
+
+    if (log_file_name_key(path + base, sizeof(path) - base, s->cid, ".idx") == -1) {
+        fclose(log);
+        return NULL;
+    }
+
+    // Built by log_read(), there's nothing to go on without it
+    *log_index = fopen((char*)path, "rb");
+    if (!*log_index) {
+        fclose(log);
+        return NULL;
+    }
+    fseeko(*log_index, 0, SEEK_END);
+    *records = ftello(*log_index) / sizeof(LOG_FILE_INDEX_RECORD);
+
+    if (!s->index.file) {
+        log_file_name_key(path + base, sizeof(path) - base, s->cid, ".fts");
+        FILE *file = fopen((char*)path, "r+b");
+        if (!file) {
+            file = fopen((char*)path, "w+b");
+        }
+
+        if (!file || !search_index_open(&s->index, file)) {
+            debug("Search:\tUnable to open the index (%s)\n", path);
+            if (file) {
+                fclose(file);
+            }
+            s->index.file = NULL;
+            fclose(*log_index);
+            fclose(log);
+            return NULL;
+        }
+    }
+
+    return log;
+}
+
+/* Indexes the next SEARCH_INDEX_FLUSH_RECORDS records of the log of s, and clears s->behind once it's caught up */
+static void search_friend_work(SEARCH_FRIEND_INDEX *s) {
+    FILE *log, *log_index;
+    uint64_t records;
+
+    s->behind = 0;
+    log = search_log_open(s, &log_index, &records);
+    if (!log) {
+        return;
+    }
+
+    SEARCH_INDEX *index = &s->index;
+    if (index->pending.end > records) {
+        /* The log was deleted or replaced since the index was built */
+        debug("Search:\tIndex is ahead of its log, rebuilding it\n");
+        search_index_clear(index);
+    }
+
+    uint64_t count = records - index->pending.end;
+    if (count > SEARCH_INDEX_FLUSH_RECORDS) {
+        count = SEARCH_INDEX_FLUSH_RECORDS;
+    }
+
+    uint64_t added = search_index_read_log(index, log, log_index, count);
+    fclose(log_index);
+    fclose(log);
+
+    if (index->pending.end - index->pending.first >= SEARCH_INDEX_FLUSH_RECORDS && !search_index_flush(index)) {
+        /* Out of space, or a damaged segment that can't be merged. Start over, but not before the next record gets
+         * logged, so a full disk isn't tried over and over. */
+        debug("Search:\tUnable to write the index, rebuilding it\n");
+        search_index_clear(index);
+        return;
+    }
+
+    /* Stop at a log that can't be read, rather than trying it over and over */
+    s->behind = (added == count && index->pending.end < records);
+}
+
+static int search_result_cmp(const void *a, const void *b) {
+    uint64_t x = ((SEARCH_RESULT*)a)->time, y = ((SEARCH_RESULT*)b)->time;
+    return (x < y) - (x > y);
+}
+
+/* Looks for the words in str in all logs, and posts the newest SEARCH_MAX_RESULTS matches to the UI */
+static void search_query(const char *str) {
+    uint64_t start = get_time();
+    uint64_t hashes[SEARCH_MAX_TERMS], records[SEARCH_MAX_RESULTS];
+
+    uint32_t terms = search_terms((const uint8_t*)str, strlen(str), hashes, countof(hashes));
+    if (terms > countof(hashes)) {
+        terms = countof(hashes);
+    }
+
+    // Every friend's newest matches, sorted by time once they're all in
+    SEARCH_RESULT *results = NULL;
+    uint32_t count = 0, size = 0;
+
+    for (uint32_t fid = 0; fid < countof(search_friend) && terms; fid++) {
+        SEARCH_FRIEND_INDEX *s = &search_friend[fid];
+        if (!s->index.file) {
+            continue;
+        }
+
+        uint32_t found = search_index_find(&s->index, hashes, terms, records, countof(records));
+        if (!found) {
+            continue;
+        }
+
+        if (count + found > size) {
+            size = (count + found) * 2;
+            SEARCH_RESULT *r = realloc(results, size * sizeof(*results));
+            if (!r) {
+                break;
+            }
+            results = r;
+        }
+
+        // The times are in the record index
+        FILE *log_index = NULL;
+        uint8_t path[UTOX_FILE_NAME_LENGTH];
+        int base;
+        FILE *log = log_open(path, sizeof(path), s->cid, &base);
+        if (log) {
+            fclose(log);
+            if (log_file_name_key(path + base, sizeof(path) - base, s->cid, ".idx") != -1) {
+                log_index = fopen((char*)path, "rb");
+            }
+        }
+
+        for (uint32_t i = 0; i < found; i++) {
+            LOG_FILE_INDEX_RECORD record = { .time = 0 };
+            if (log_index) {
+                fseeko(log_index, records[i] * sizeof(record), SEEK_SET);
+                if (fread(&record, sizeof(record), 1, log_index) != 1) {
+                    record.time = 0;
+                }
+            }
+
+            SEARCH_RESULT *r = &results[count++];
+            r->fid = fid;
+            memcpy(r->cid, s->cid, sizeof(r->cid));
+            r->record = records[i];
+            r->time = record.time;
+        }
+
+        if (log_index) {
+            fclose(log_index);
+        }
+    }
+
+    qsort(results, count, sizeof(*results), search_result_cmp);
+    if (count > SEARCH_MAX_RESULTS) {
+        count = SEARCH_MAX_RESULTS;
+    }
+
+    debug("Search:\t%u results for \"%s\" in %"PRIu64"us\n", count, str, (get_time() - start) / 1000);
+    postmessage(SEARCH_RESULTS, count, 0, results);
+}
+
+static void search_message(uint8_t msg, uint32_t param1, uint32_t UNUSED(param2), void *data) {
+    switch (msg) {
+        case SEARCH_FRIEND: {
+            /* param1: friend number
+             * data: its public key */
+            if (param1 < countof(search_friend)) {
+                SEARCH_FRIEND_INDEX *s = &search_friend[param1];
+                if (!s->known || memcmp(s->cid, data, sizeof(s->cid))) {
+                    /* A new friend, or a different profile */
+                    if (s->index.file) {
+                        search_index_close(&s->index);
+                    }
+                    memcpy(s->cid, data, sizeof(s->cid));
+                    s->known = 1;
+                }
+                s->behind = 1;
+            }
+            free(data);
+            break;
+        }
+        case SEARCH_LOG: {
+            /* param1: friend number */
+            if (param1 < countof(search_friend) && search_friend[param1].known) {
+                search_friend[param1].behind = 1;
+            }
+            break;
+        }
+        case SEARCH_QUERY: {
+            /* data: the words */
+            search_query(data);
+            free(data);
+            break;
+        }
+        case SEARCH_CLEAR: {
+            /* data: public key */
+            for (uint32_t i = 0; i < countof(search_friend); i++) {
+                SEARCH_FRIEND_INDEX *s = &search_friend[i];
+                if (s->known && !memcmp(s->cid, data, sizeof(s->cid))) {
+                    search_index_close(&s->index);
+                    /* Whatever has been logged since gets indexed from scratch */
+                    s->behind = 1;
+                }
+            }
+
+            uint8_t path[UTOX_FILE_NAME_LENGTH];
+            int base = datapath(path);
+            if (log_file_name_key(path + base, sizeof(path) - base, data, ".fts") != -1) {
+                remove((const char*)path);
+            }
+            free(data);
+            break;
+        }
+    }
+}
+
+/** Indexes the logs in the background.
+ *
+ * Queries are always handled first, the indexing is done a few thousand records at a time in between, so a search
+ * never waits on a big log being indexed. Records not written out to the index yet are lost when uTox quits; they get
+ * read from the log again next time.
+ */
+void search_thread(void *UNUSED(args)) {
+    uint32_t next = 0;
+
+    while (1) {
+        TOX_MSG msg;
+        while (msg_queue_get(&search_msg_queue, &msg)) {
+            search_message(msg.msg, msg.param1, msg.param2, msg.data);
+        }
+
+        // Take turns, so one big log doesn't hold up the others
+        _Bool worked = 0;
+        for (uint32_t i = 0; i < countof(search_friend) && !worked; i++) {
+            SEARCH_FRIEND_INDEX *s = &search_friend[(next + i) % countof(search_friend)];
+            if (s->behind) {
+                search_friend_work(s);
+                next = (next + i + 1) % countof(search_friend);
+                worked = 1;
+            }
+        }
+
+        if (!worked) {
+            msg_queue_wait(&search_msg_queue, 1000);
+        }
+    }
+}
+
+void search_start(const char_t *str, STRING_IDX length) {
+    char *query = malloc(length + 1);
+    if (!query) {
+        return;
+    }
+
+    memcpy(query, str, length);
+    query[length] = 0;
+    postmessage_search(SEARCH_QUERY, 0, 0, query);
+}
+
+void search_results(SEARCH_RESULT *results, uint32_t count) {
+    free(search_result);
+    search_result = results;
+    search_result_count = count;
+    search_result_next = 0;
+
+    if (!search_next()) {
+        debug("Search:\tNothing found\n");
+    }
+}
+
+_Bool search_next(void) {
+    while (search_result_next < search_result_count) {
+        SEARCH_RESULT *r = &search_result[search_result_next++];
+        if (r->fid >= friends) {
+            continue;
+        }
+
+        FRIEND *f = &friend[r->fid];
+        if (memcmp(f->cid, r->cid, sizeof(f->cid))) {
+            continue;
+        }
+
+        list_selectfriend(f);
+        messages_log_jump(&messages_friend, &f->msg, r->record);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/** Searching the chat logs of all friends.
+ *
+ * Every friend's log gets a SEARCH_INDEX (see search_index.h) next to it, built and kept up to date by the search
+ * thread, so neither log_write() nor the UI ever wait on it. Queries are answered on the search thread too, and the
+ * results come back to the UI thread with SEARCH_RESULTS.
+ */
+
+/* Messages for the search thread */
+enum {
+    SEARCH_FRIEND, /* param1: friend number, data: malloc'd copy of its public key, after log_read() */
+    SEARCH_LOG,    /* param1: friend number, a record was added to its log */
+    SEARCH_QUERY,  /* data: malloc'd, NUL terminated words to look for */
+    SEARCH_CLEAR,  /* data: malloc'd copy of a friend's public key, its log was removed by the log writer */
+};
+
+/* Most results a query returns */
+#define SEARCH_MAX_RESULTS 256
+
+/* Most words a query looks for, the rest are ignored */
+#define SEARCH_MAX_TERMS 16
+
+typedef struct {
+    uint32_t fid;
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE]; /* so results for a friend that's been removed since can be told apart */
+    uint64_t record, time;
+} SEARCH_RESULT;
+
+void postmessage_search(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+void search_thread(void *args);
+
+/* Starts looking for the words in str, the first result gets shown once they're in */
+void search_start(const char_t *str, STRING_IDX length);
+
+/* Takes over the count results in results, newest first, and shows the first one. Called on the UI thread. */
+void search_results(SEARCH_RESULT *results, uint32_t count);
+
+/* Shows the next result of the last search. returns 0 if there are no more. */
+_Bool search_next(void);
@@ -0,0 +1,788 @@
+#include <stdlib.h>
+#include <string.h>
+#include "search_index.h"
+
+/* Postings are varints: the first record less the first record of the segment, then the difference to the one
+ * before for every other one. */
+static uint32_t varint_put(uint8_t *dest, uint64_t value)
+{
+    uint32_t length = 0;
+    while(value >= 0x80) {
+        dest[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    dest[length++] = value;
+    return length;
+}
+
+/* returns the bytes read, 0 if the varint runs past end */
+static uint32_t varint_get(const uint8_t *src, const uint8_t *end, uint64_t *value)
+{
+    uint64_t v = 0;
+    for(uint32_t i = 0; src + i < end && i < 10; i++) {
+        v |= (uint64_t)(src[i] & 0x7F) << (7 * i);
+        if(!(src[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* returns the number of records decoded from length bytes of postings into records, which has room for count */
+static uint32_t postings_decode(const uint8_t *src, uint32_t length, uint64_t base, uint64_t *records, uint32_t count)
+{
+    const uint8_t *end = src + length;
+    uint64_t record = base;
+    uint32_t i;
+
+    for(i = 0; i < count; i++) {
+        uint64_t delta;
+        uint32_t used = varint_get(src, end, &delta);
+        if(!used) {
+            break;
+        }
+        src += used;
+        record += delta;
+        records[i] = record;
+    }
+
+    return i;
+}
+
+uint32_t search_terms(const uint8_t *text, size_t length, uint64_t *hashes, uint32_t max)
+{
+    uint32_t count = 0;
+    size_t i = 0;
+
+    while(i < length) {
+        /* FNV-1a over the lowercased word */
+        uint64_t hash = 0xcbf29ce484222325ull;
+        size_t start = i;
+
+        for(; i < length; i++) {
+            uint8_t c = text[i];
+            if(c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            } else if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)) {
+                break;
+            }
+            hash = (hash ^ c) * 0x100000001b3ull;
+        }
+
+        if(i != start) {
+            if(count < max) {
+                /* 0 marks empty slots */
+                hashes[count] = hash ? hash : 1;
+            }
+            count++;
+        }
+        i++;
+    }
+
+    return count;
+}
+
+/* Buffered reading of a region of the file, so that merging doesn't seek for every word */
+typedef struct {
+    uint64_t pos, end;
+    uint32_t at, length;
+    uint8_t data[1 << 16];
+} SEARCH_READER;
+
+static void reader_init(SEARCH_READER *r, uint64_t pos, uint64_t end)
+{
+    r->pos = pos;
+    r->end = end;
+    r->at = r->length = 0;
+}
+
+static _Bool reader_read(FILE *file, SEARCH_READER *r, void *dest, size_t size)
+{
+    uint8_t *d = dest;
+
+    while(size) {
+        if(r->at == r->length) {
+            uint64_t left = r->end - r->pos;
+            if(!left) {
+                return 0;
+            }
+
+            r->length = (left < sizeof(r->data)) ? left : sizeof(r->data);
+            r->at = 0;
+            fseeko(file, r->pos, SEEK_SET);
+            if(fread(r->data, r->length, 1, file) != 1) {
+                r->length = 0;
+                return 0;
+            }
+            r->pos += r->length;
+        }
+
+        size_t n = (size < r->length - r->at) ? size : r->length - r->at;
+        memcpy(d, r->data + r->at, n);
+        r->at += n;
+        d += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+/* Buffered writing, from pos on */
+typedef struct {
+    uint64_t pos;
+    uint32_t length;
+    _Bool error;
+    uint8_t data[1 << 20];
+} SEARCH_WRITER;
+
+static void writer_flush(FILE *file, SEARCH_WRITER *w)
+{
+    if(w->length) {
+        fseeko(file, w->pos, SEEK_SET);
+        if(fwrite(w->data, w->length, 1, file) != 1) {
+            w->error = 1;
+        }
+        w->pos += w->length;
+        w->length = 0;
+    }
+}
+
+static void writer_write(FILE *file, SEARCH_WRITER *w, const void *src, size_t size)
+{
+    const uint8_t *s = src;
+
+    while(size) {
+        if(w->length == sizeof(w->data)) {
+            writer_flush(file, w);
+        }
+
+        size_t n = (size < sizeof(w->data) - w->length) ? size : sizeof(w->data) - w->length;
+        memcpy(w->data + w->length, s, n);
+        w->length += n;
+        s += n;
+        size -= n;
+    }
+}
+
+/* returns where the next byte written will end up */
+static uint64_t writer_tell(SEARCH_WRITER *w)
+{
+    return w->pos + w->length;
+}
+
+static uint64_t segment_terms_start(const SEARCH_INDEX_SEGMENT *s)
+{
+    return s->footer.length - sizeof(SEARCH_INDEX_FOOTER) - (uint64_t)s->footer.terms * sizeof(SEARCH_INDEX_TERM);
+}
+
+/* Checks that term points at postings inside segment s, so a damaged file can't make us allocate or read wildly */
+static _Bool segment_term_valid(const SEARCH_INDEX_SEGMENT *s, const SEARCH_INDEX_TERM *term)
+{
+    return term->count <= s->footer.end - s->footer.first && term->offset >= sizeof(SEARCH_INDEX_HEADER) &&
+           term->offset <= segment_terms_start(s) && term->length <= segment_terms_start(s) - term->offset;
+}
+
+/* Slot of hash in the table of p, the empty slot it would go in if it's not there */
+static SEARCH_PENDING_TERM* pending_slot(SEARCH_PENDING *p, uint64_t hash)
+{
+    uint32_t mask = p->size - 1, i = (hash * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+    while(p->table[i].hash && p->table[i].hash != hash) {
+        i = (i + 1) & mask;
+    }
+    return &p->table[i];
+}
+
+static _Bool pending_grow(SEARCH_PENDING *p)
+{
+    uint32_t size = p->size ? p->size * 2 : 1024;
+    SEARCH_PENDING_TERM *table = calloc(size, sizeof(*table)), *old = p->table;
+    if(!table) {
+        return 0;
+    }
+
+    uint32_t old_size = p->size;
+    p->table = table;
+    p->size = size;
+    for(uint32_t i = 0; i < old_size; i++) {
+        if(old[i].hash) {
+            *pending_slot(p, old[i].hash) = old[i];
+        }
+    }
+
+    free(old);
+    return 1;
+}
+
+static void pending_free(SEARCH_PENDING *p)
+{
+    for(uint32_t i = 0; i < p->size; i++) {
+        free(p->table[i].records);
+    }
+    free(p->table);
+    p->table = NULL;
+    p->size = p->terms = 0;
+    p->first = p->end;
+}
+
+void search_index_add(SEARCH_INDEX *index, uint64_t record, const uint8_t *text, size_t length)
+{
+    SEARCH_PENDING *p = &index->pending;
+    if(record != p->end) {
+        return;
+    }
+    p->end++;
+
+    uint64_t hashes[256];
+    uint32_t count = search_terms(text, length, hashes, 256);
+    if(count > 256) {
+        count = 256;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        if((p->terms + 1) * 4 > p->size * 3 && !pending_grow(p)) {
+            return;
+        }
+
+        SEARCH_PENDING_TERM *t = pending_slot(p, hashes[i]);
+        if(!t->hash) {
+            t->hash = hashes[i];
+            p->terms++;
+        } else if(t->count && t->records[t->count - 1] == record) {
+            /* Same word twice in one record */
+            continue;
+        }
+
+        if(t->count == t->size) {
+            uint32_t size = t->size ? t->size * 2 : 4;
+            uint64_t *records = realloc(t->records, size * sizeof(uint64_t));
+            if(!records) {
+                continue;
+            }
+            t->records = records;
+            t->size = size;
+        }
+        t->records[t->count++] = record;
+    }
+}
+
+uint64_t search_index_read_log(SEARCH_INDEX *index, FILE *log, FILE *log_index, uint64_t count)
+{
+    LOG_FILE_INDEX_RECORD record;
+    LOG_FILE_MSG_HEADER header;
+    uint64_t position = UINT64_MAX, added = 0;
+
+    uint8_t *text = malloc(UINT16_MAX);
+    if(!text) {
+        return 0;
+    }
+
+    fseeko(log_index, index->pending.end * sizeof(record), SEEK_SET);
+    while(added < count && fread(&record, sizeof(record), 1, log_index) == 1) {
+        if(record.offset != position) {
+            fseeko(log, record.offset, SEEK_SET);
+        }
+
+        if(fread(&header, sizeof(header), 1, log) != 1) {
+            break;
+        }
+        fseeko(log, header.namelen, SEEK_CUR);
+        if(header.length && fread(text, header.length, 1, log) != 1) {
+            break;
+        }
+        position = record.offset + sizeof(header) + header.namelen + header.length;
+
+        search_index_add(index, index->pending.end, text, header.length);
+        added++;
+    }
+
+    free(text);
+    return added;
+}
+
+_Bool search_index_open(SEARCH_INDEX *index, FILE *file)
+{
+    SEARCH_INDEX_HEADER header;
+    SEARCH_INDEX_FOOTER footer;
+    uint64_t size, pos = 0, end = 0;
+
+    memset(index, 0, sizeof(*index));
+    index->file = file;
+
+    if(fseeko(file, 0, SEEK_END)) {
+        return 0;
+    }
+    size = ftello(file);
+
+    while(index->segments < SEARCH_INDEX_MAX_SEGMENTS && pos + sizeof(header) + sizeof(footer) <= size) {
+        fseeko(file, pos, SEEK_SET);
+        if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != SEARCH_INDEX_MAGIC ||
+           header.length < sizeof(header) + sizeof(footer) || header.length > size - pos) {
+            break;
+        }
+
+        fseeko(file, pos + header.length - sizeof(footer), SEEK_SET);
+        if(fread(&footer, sizeof(footer), 1, file) != 1 || footer.magic != SEARCH_INDEX_MAGIC ||
+           footer.length != header.length || footer.first != end || footer.end < footer.first ||
+           (uint64_t)footer.terms * sizeof(SEARCH_INDEX_TERM) > header.length - sizeof(header) - sizeof(footer)) {
+            break;
+        }
+
+        index->segment[index->segments].start = pos;
+        index->segment[index->segments].footer = footer;
+        index->segments++;
+        end = footer.end;
+        pos += header.length;
+    }
+
+    /* A segment that was being written when uTox stopped, or garbage. The records in it get indexed again. */
+    if(pos != size && file_truncate(file, pos)) {
+        return 0;
+    }
+
+    index->pending.first = index->pending.end = end;
+    return 1;
+}
+
+void search_index_close(SEARCH_INDEX *index)
+{
+    pending_free(&index->pending);
+    if(index->file) {
+        fclose(index->file);
+        index->file = NULL;
+    }
+}
+
+_Bool search_index_clear(SEARCH_INDEX *index)
+{
+    index->pending.end = 0;
+    pending_free(&index->pending);
+    index->segments = 0;
+    return !file_truncate(index->file, 0);
+}
+
+static int pending_term_cmp(const void *a, const void *b)
+{
+    uint64_t x = (*(SEARCH_PENDING_TERM**)a)->hash, y = (*(SEARCH_PENDING_TERM**)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/* One of the inputs of a merge: a segment on disk, or the pending records if segment is NULL */
+typedef struct {
+    const SEARCH_INDEX_SEGMENT *segment;
+    SEARCH_READER terms, postings;
+    SEARCH_INDEX_TERM term; /* the current one */
+    _Bool done;
+} SEARCH_MERGE_INPUT;
+
+static void merge_next(FILE *file, SEARCH_MERGE_INPUT *in)
+{
+    in->done = !reader_read(file, &in->terms, &in->term, sizeof(in->term));
+}
+
+_Bool search_index_flush(SEARCH_INDEX *index)
+{
+    SEARCH_PENDING *p = &index->pending;
+    FILE *file = index->file;
+
+    if(p->end == p->first) {
+        return 1;
+    }
+
+    /* Merge the newest segments that aren't bigger than what's written along with them */
+    int first = index->segments;
+    uint64_t records = p->end - p->first;
+    while(first && (index->segment[first - 1].footer.end - index->segment[first - 1].footer.first <= records ||
+                    first >= SEARCH_INDEX_MAX_SEGMENTS)) {
+        first--;
+        records += index->segment[first].footer.end - index->segment[first].footer.first;
+    }
+
+    uint64_t start = first ? index->segment[first - 1].start + index->segment[first - 1].footer.length : 0;
+    uint64_t out = index->segments ? index->segment[index->segments - 1].start +
+                                     index->segment[index->segments - 1].footer.length : 0;
+    uint64_t base = first < index->segments ? index->segment[first].footer.first : p->first;
+
+    int inputs = index->segments - first;
+    SEARCH_MERGE_INPUT *in = malloc(inputs * sizeof(*in) + 1);
+    SEARCH_PENDING_TERM **pending = malloc(p->terms * sizeof(*pending) + 1);
+    SEARCH_WRITER *w = malloc(sizeof(*w));
+    SEARCH_INDEX_TERM *terms = NULL;
+    uint8_t *bytes = NULL;
+    uint32_t terms_count = 0, terms_size = 0, bytes_size = 0;
+    _Bool ok = 0;
+
+    if(!in || !pending || !w) {
+        goto done;
+    }
+
+    for(int i = 0; i < inputs; i++) {
+        const SEARCH_INDEX_SEGMENT *s = &index->segment[first + i];
+        in[i].segment = s;
+        reader_init(&in[i].terms, s->start + segment_terms_start(s), s->start + segment_terms_start(s) +
+                    (uint64_t)s->footer.terms * sizeof(SEARCH_INDEX_TERM));
+        reader_init(&in[i].postings, s->start + sizeof(SEARCH_INDEX_HEADER), s->start + segment_terms_start(s));
+        merge_next(file, &in[i]);
+    }
+
+    uint32_t pending_count = 0, pending_at = 0;
+    for(uint32_t i = 0; i < p->size; i++) {
+        /* A word whose first record didn't fit in memory has none */
+        if(p->table[i].hash && p->table[i].count) {
+            pending[pending_count++] = &p->table[i];
+        }
+    }
+    qsort(pending, pending_count, sizeof(*pending), pending_term_cmp);
+
+    w->pos = out;
+    w->length = 0;
+    w->error = 0;
+    SEARCH_INDEX_HEADER header = { .magic = SEARCH_INDEX_MAGIC };
+    writer_write(file, w, &header, sizeof(header));
+
+    /* Walk all inputs in hash order, writing the postings of every word as the records of all of them in turn */
+    while(1) {
+        uint64_t hash = 0;
+        _Bool any = 0;
+        for(int i = 0; i < inputs; i++) {
+            if(!in[i].done && (!any || in[i].term.hash < hash)) {
+                hash = in[i].term.hash;
+                any = 1;
+            }
+        }
+        if(pending_at < pending_count && (!any || pending[pending_at]->hash < hash)) {
+            hash = pending[pending_at]->hash;
+            any = 1;
+        }
+        if(!any) {
+            break;
+        }
+
+        if(terms_count == terms_size) {
+            terms_size = terms_size ? terms_size * 2 : 4096;
+            SEARCH_INDEX_TERM *t = realloc(terms, terms_size * sizeof(*terms));
+            if(!t) {
+                goto done;
+            }
+            terms = t;
+        }
+
+        SEARCH_INDEX_TERM *term = &terms[terms_count++];
+        term->hash = hash;
+        term->offset = writer_tell(w) - out;
+        term->count = 0;
+        term->length = 0;
+
+        uint64_t last = base;
+        for(int i = 0; i < inputs; i++) {
+            if(in[i].done || in[i].term.hash != hash) {
+                continue;
+            }
+            if(!segment_term_valid(in[i].segment, &in[i].term)) {
+                goto done;
+            }
+            if(!in[i].term.count) {
+                /* Flushed before words without records were left out */
+                if(in[i].term.length) {
+                    goto done;
+                }
+                merge_next(file, &in[i]);
+                continue;
+            }
+
+            uint32_t length = in[i].term.length;
+            if(length > bytes_size) {
+                uint8_t *b = realloc(bytes, length);
+                if(!b) {
+                    goto done;
+                }
+                bytes = b;
+                bytes_size = length;
+            }
+            if(!reader_read(file, &in[i].postings, bytes, length)) {
+                goto done;
+            }
+
+            /* Only the first delta changes, it's from the first record of the new segment now. Decode the rest
+             * anyway, to check them and find the last record. */
+            uint64_t first_delta = 0, record = in[i].segment->footer.first, delta;
+            uint32_t first_used = varint_get(bytes, bytes + length, &first_delta), used, count = 0;
+            if(!first_used) {
+                goto done;
+            }
+            for(const uint8_t *b = bytes; b < bytes + length; b += used) {
+                used = varint_get(b, bytes + length, &delta);
+                if(!used) {
+                    goto done;
+                }
+                record += delta;
+                count++;
+            }
+            if(count != in[i].term.count) {
+                goto done;
+            }
+
+            uint8_t v[10];
+            uint32_t v_length = varint_put(v, in[i].segment->footer.first + first_delta - last);
+            writer_write(file, w, v, v_length);
+            writer_write(file, w, bytes + first_used, length - first_used);
+            term->count += count;
+            term->length += v_length + length - first_used;
+            last = record;
+            merge_next(file, &in[i]);
+        }
+
+        if(pending_at < pending_count && pending[pending_at]->hash == hash) {
+            SEARCH_PENDING_TERM *t = pending[pending_at++];
+            for(uint32_t j = 0; j < t->count; j++) {
+                uint8_t v[10];
+                uint32_t v_length = varint_put(v, t->records[j] - last);
+                writer_write(file, w, v, v_length);
+                term->length += v_length;
+                last = t->records[j];
+            }
+            term->count += t->count;
+        }
+
+        if(!term->count) {
+            terms_count--;
+        }
+    }
+
+    writer_write(file, w, terms, terms_count * sizeof(*terms));
+
+    SEARCH_INDEX_FOOTER footer = {
+        .first  = base,
+        .end    = p->end,
+        .terms  = terms_count,
+        .length = writer_tell(w) + sizeof(footer) - out,
+        .magic  = SEARCH_INDEX_MAGIC,
+    };
+    writer_write(file, w, &footer, sizeof(footer));
+    writer_flush(file, w);
+
+    header.length = footer.length;
+    fseeko(file, out, SEEK_SET);
+    if(w->error || fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto done;
+    }
+
+    /* Move it down over the segments it replaces, going up so nothing gets overwritten before it's copied */
+    if(start != out) {
+        for(uint64_t copied = 0; copied < footer.length;) {
+            uint32_t n = (footer.length - copied < sizeof(w->data)) ? footer.length - copied : sizeof(w->data);
+            fseeko(file, out + copied, SEEK_SET);
+            if(fread(w->data, n, 1, file) != 1) {
+                goto done;
+            }
+            fseeko(file, start + copied, SEEK_SET);
+            if(fwrite(w->data, n, 1, file) != 1) {
+                goto done;
+            }
+            copied += n;
+        }
+    }
+
+    if(fflush(file) || file_truncate(file, start + footer.length)) {
+        goto done;
+    }
+
+    index->segment[first].start = start;
+    index->segment[first].footer = footer;
+    index->segments = first + 1;
+    pending_free(p);
+    ok = 1;
+
+done:
+    if(!ok) {
+        /* Drop whatever got written past the old segments */
+        fflush(file);
+        file_truncate(file, out);
+    }
+
+    free(in);
+    free(pending);
+    free(w);
+    free(terms);
+    free(bytes);
+    return ok;
+}
+
+/* Intersects the sorted list records with the postings of a word, in place. returns the records left. */
+static uint32_t postings_intersect(uint64_t *records, uint32_t count, const uint8_t *src, uint32_t length,
+                                   uint64_t base)
+{
+    const uint8_t *end = src + length;
+    uint64_t record = base;
+    uint32_t kept = 0, i = 0;
+
+    while(i < count && src < end) {
+        uint64_t delta;
+        uint32_t used = varint_get(src, end, &delta);
+        if(!used) {
+            break;
+        }
+        src += used;
+        record += delta;
+
+        while(i < count && records[i] < record) {
+            i++;
+        }
+        if(i < count && records[i] == record) {
+            records[kept++] = record;
+            i++;
+        }
+    }
+
+    return kept;
+}
+
+/* Looks hash up in the table of words of segment s */
+static _Bool segment_term(FILE *file, const SEARCH_INDEX_SEGMENT *s, uint64_t hash, SEARCH_INDEX_TERM *term)
+{
+    uint64_t table = s->start + segment_terms_start(s);
+    uint32_t low = 0, high = s->footer.terms;
+
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        fseeko(file, table + (uint64_t)mid * sizeof(*term), SEEK_SET);
+        if(fread(term, sizeof(*term), 1, file) != 1) {
+            return 0;
+        }
+
+        if(term->hash == hash) {
+            return segment_term_valid(s, term);
+        } else if(term->hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return 0;
+}
+
+static int index_term_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((SEARCH_INDEX_TERM*)a)->count, y = ((SEARCH_INDEX_TERM*)b)->count;
+    return (x > y) - (x < y);
+}
+
+/* Finds the records in segment s that have all words, writing the newest max of them to results newest first */
+static uint32_t segment_find(FILE *file, const SEARCH_INDEX_SEGMENT *s, const uint64_t *hashes, uint32_t count,
+                             uint64_t *results, uint32_t max)
+{
+    SEARCH_INDEX_TERM terms[count];
+    for(uint32_t i = 0; i < count; i++) {
+        if(!segment_term(file, s, hashes[i], &terms[i])) {
+            return 0;
+        }
+    }
+
+    /* Start with the rarest word, so there's as little as possible to keep and check */
+    qsort(terms, count, sizeof(*terms), index_term_cmp);
+
+    uint32_t found = 0, size = 0;
+    uint64_t *records = malloc(terms[0].count * sizeof(uint64_t));
+    uint8_t *bytes = NULL;
+
+    for(uint32_t i = 0; records && i < count; i++) {
+        if(terms[i].length > size) {
+            uint8_t *b = realloc(bytes, terms[i].length);
+            if(!b) {
+                found = 0;
+                break;
+            }
+            bytes = b;
+            size = terms[i].length;
+        }
+
+        fseeko(file, s->start + terms[i].offset, SEEK_SET);
+        if(fread(bytes, terms[i].length, 1, file) != 1) {
+            found = 0;
+            break;
+        }
+
+        if(i == 0) {
+            found = postings_decode(bytes, terms[i].length, s->footer.first, records, terms[i].count);
+        } else {
+            found = postings_intersect(records, found, bytes, terms[i].length, s->footer.first);
+        }
+
+        if(!found) {
+            break;
+        }
+    }
+
+    uint32_t n = (found < max) ? found : max;
+    for(uint32_t i = 0; i < n; i++) {
+        results[i] = records[found - 1 - i];
+    }
+
+    free(records);
+    free(bytes);
+    return n;
+}
+
+/* Same as segment_find(), for the records not written out yet */
+static uint32_t pending_find(SEARCH_PENDING *p, const uint64_t *hashes, uint32_t count, uint64_t *results,
+                             uint32_t max)
+{
+    if(!p->size) {
+        return 0;
+    }
+
+    SEARCH_PENDING_TERM *terms[count], *rarest = NULL;
+    for(uint32_t i = 0; i < count; i++) {
+        terms[i] = pending_slot(p, hashes[i]);
+        if(!terms[i]->hash) {
+            return 0;
+        }
+        if(!rarest || terms[i]->count < rarest->count) {
+            rarest = terms[i];
+        }
+    }
+
+    /* Walk the rarest word back from its newest record, checking the others have it too */
+    uint32_t found = 0;
+    for(uint32_t j = rarest->count; j-- && found < max;) {
+        uint64_t record = rarest->records[j];
+        _Bool all = 1;
+
+        for(uint32_t i = 0; i < count && all; i++) {
+            SEARCH_PENDING_TERM *t = terms[i];
+            /* Binary search, the lists are in order */
+            uint32_t low = 0, high = t->count;
+            while(low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                if(t->records[mid] < record) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            all = (low < t->count && t->records[low] == record);
+        }
+
+        if(all) {
+            results[found++] = record;
+        }
+    }
+
+    return found;
+}
+
+uint32_t search_index_find(SEARCH_INDEX *index, const uint64_t *hashes, uint32_t count, uint64_t *records, uint32_t max)
+{
+    if(!count) {
+        return 0;
+    }
+
+    /* Newest first: the records not written out yet, then the segments from the newest one back */
+    uint32_t found = pending_find(&index->pending, hashes, count, records, max);
+    for(int s = index->segments; s-- && found < max;) {
+        found += segment_find(index->file, &index->segment[s], hashes, count, records + found, max - found);
+    }
+
+    return found;
+}
@@ -0,0 +1,102 @@
+/** Full text index over a friend's log, kept in <pubkey>.fts next to it.
+ *
+ * Maps every word of every record to the records that contain it. The file is a sequence of segments, each covering
+ * the records of the segments before it onwards, and each an inverted index of its own: postings lists of record
+ * numbers, sorted by the hash of their word, followed by the table of words and a footer. New records collect in
+ * memory and get written out as a new segment, merged with the newest segments on disk that aren't bigger than it,
+ * so there are only O(log n) segments and writing out a record costs O(log n) amortized.
+ *
+ * A segment is only ever merged by writing the result past the end of the file and moving it down, so a crash can
+ * only lose the newest segments. search_index_open() drops anything it can't read, and the records that were in it
+ * get indexed again from the log.
+ *
+ * Depends on nothing but libc and file_truncate(), so tools can build the same index.
+ */
+#include <stdio.h>
+#include "log_file.h"
+
+#define SEARCH_INDEX_MAGIC 0x31535446584f5455ull /* "UTOXFTS1" */
+
+/* Most segments a file can have, a file of n records has about log2(n / SEARCH_INDEX_FLUSH_RECORDS) */
+#define SEARCH_INDEX_MAX_SEGMENTS 40
+
+/* Records to collect in memory before search_index_flush() is worth it */
+#define SEARCH_INDEX_FLUSH_RECORDS 4096
+
+typedef struct {
+    uint64_t magic, length;
+} SEARCH_INDEX_HEADER;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset; /* of the postings, from the start of the segment */
+    uint32_t count;  /* records in the postings */
+    uint32_t length; /* bytes of postings */
+} SEARCH_INDEX_TERM;
+
+typedef struct {
+    uint64_t first, end; /* records first to end - 1 are in the segment */
+    uint32_t terms, zero;
+    uint64_t length, magic;
+} SEARCH_INDEX_FOOTER;
+
+typedef struct {
+    uint64_t start; /* offset in the file */
+    SEARCH_INDEX_FOOTER footer;
+} SEARCH_INDEX_SEGMENT;
+
+typedef struct {
+    uint64_t hash; /* 0 for an empty slot */
+    uint32_t count, size;
+    uint64_t *records;
+} SEARCH_PENDING_TERM;
+
+/* Records first to end - 1, not written out yet. An open addressing table of their words. */
+typedef struct {
+    uint64_t first, end;
+    SEARCH_PENDING_TERM *table;
+    uint32_t size, terms;
+} SEARCH_PENDING;
+
+typedef struct {
+    FILE *file;
+    SEARCH_INDEX_SEGMENT segment[SEARCH_INDEX_MAX_SEGMENTS];
+    int segments;
+    SEARCH_PENDING pending;
+} SEARCH_INDEX;
+
+int file_truncate(FILE *file, uint64_t size);
+
+/** Splits text into words and hashes them. Words are runs of letters, digits and non ASCII characters, ASCII is
+ * matched without case.
+ *
+ * returns the number of words, of which the first max are written to hashes. */
+uint32_t search_terms(const uint8_t *text, size_t length, uint64_t *hashes, uint32_t max);
+
+/** Reads the segments of the index in file, which must be open for reading and writing, and cuts off whatever
+ * follows the last good one. New records are added from the end of the last segment on.
+ *
+ * returns 0 if the file can't be read or cut. */
+_Bool search_index_open(SEARCH_INDEX *index, FILE *file);
+
+/* Frees the records not written out yet and closes the file, without writing them out. */
+void search_index_close(SEARCH_INDEX *index);
+
+/* Starts the index over empty, for logs that no longer match it. returns 0 if the file couldn't be cut. */
+_Bool search_index_clear(SEARCH_INDEX *index);
+
+/* Adds the text of the next record, which must be record index->pending.end. */
+void search_index_add(SEARCH_INDEX *index, uint64_t record, const uint8_t *text, size_t length);
+
+/** Adds up to count records from the log and its record index, starting at the next record the index needs.
+ *
+ * returns the number of records added, less than count at the end of the log or on a read error. */
+uint64_t search_index_read_log(SEARCH_INDEX *index, FILE *log, FILE *log_index, uint64_t count);
+
+/* Writes the records collected in memory out to the file as a segment. returns 0 on a write error. */
+_Bool search_index_flush(SEARCH_INDEX *index);
+
+/** Finds the records that contain all count words in hashes, newest first.
+ *
+ * returns the number of records written to records, at most max. */
+uint32_t search_index_find(SEARCH_INDEX *index, const uint64_t *hashes, uint32_t count, uint64_t *records, uint32_t max);
@@ -397,3 +397,227 @@ STRING_IDX text_linedown(int width, int height, STRING_IDX p, uint16_t lineheigh
 
     return hittextmultiline(x, width, y, INT_MAX, lineheight, str, length, 1);
 }
+
+static _Bool text_layout_add(TEXT_LAYOUT **layout, STRING_IDX start, STRING_IDX length, uint32_t line, int x, int width,
+                             uint8_t style)
+{
+    TEXT_LAYOUT *l = *layout;
+    if(l->count == l->capacity) {
+        uint32_t capacity = l->capacity ? l->capacity * 2 : 16;
+        l = realloc(l, sizeof(TEXT_LAYOUT) + capacity * sizeof(TEXT_RUN));
+        if(!l) {
+            return 0;
+        }
+        l->capacity = capacity;
+        *layout = l;
+    }
+
+    l->run[l->count++] = (TEXT_RUN){
+        .start = start,
+        .length = length,
+        .line = line,
+        .x = x,
+        .width = width,
+        .style = style
+    };
+    return 1;
+}
+
+/* Same walk as drawtextmultiline(), but it records where everything goes instead of drawing it */
+static _Bool text_layout_build(TEXT_LAYOUT **layout, int right, char_t *data, STRING_IDX length)
+{
+    uint8_t line_style = TEXT_STYLE_NORMAL;
+    _Bool link = 0;
+    uint32_t line = 0;
+    int x = 0;
+    char_t *a = data, *b = a, *end = a + length;
+    while(1) {
+        if(a != end) {
+            if(*a == '>' && (a == data || *(a - 1) == '\n'))  {
+                line_style = TEXT_STYLE_QUOTE;
+            }
+
+            if((a == data || *(a - 1) == '\n' || *(a - 1) == ' ') && ((end - a >= 7 && memcmp(a, "http://", 7) == 0) || (end - a >= 8 && memcmp(a, "https://", 8) == 0))) {
+                link = 1;
+            }
+
+            if(a == data || *(a - 1) == '\n') {
+                char_t *r = a;
+                while (r != end && *r != '\n') {
+                    r++;
+                }
+                if (r != a && *(r - 1) == '<') {
+                    line_style = TEXT_STYLE_RED;
+                }
+            }
+        }
+
+        if(a == end || *a == ' ' || *a == '\n') {
+            uint8_t style = link ? TEXT_STYLE_LINK : line_style;
+            int count = a - b, w = textwidth(b, count);
+            while(x + w > right) {
+                if(x == 0) {
+                    int fit = textfit(b, count, right);
+                    if(fit == 0) {
+                        /* Not even one character fits */
+                        (*layout)->lines = 0;
+                        return 1;
+                    }
+                    if(!text_layout_add(layout, b - data, fit, line, x, textwidth(b, fit), style)) {
+                        return 0;
+                    }
+                    count -= fit;
+                    b += fit;
+                    line++;
+                } else {
+                    line++;
+                    int l = utf8_len(b);
+                    count -= l;
+                    b += l;
+                }
+                x = 0;
+                w = textwidth(b, count);
+            }
+
+            if(!text_layout_add(layout, b - data, count, line, x, w, style)) {
+                return 0;
+            }
+
+            x += w;
+            b = a;
+            link = 0;
+
+            if(a == end) {
+                break;
+            }
+
+            if(*a == '\n') {
+                line_style = TEXT_STYLE_NORMAL;
+                line++;
+                b += utf8_len(b);
+                x = 0;
+            }
+        }
+        a += utf8_len(a);
+    }
+
+    (*layout)->lines = line + 1;
+    return 1;
+}
+
+TEXT_LAYOUT* text_layout(TEXT_LAYOUT **layout, int width, uint16_t lineheight, char_t *str, STRING_IDX length)
+{
+    TEXT_LAYOUT *l = *layout;
+    if(l && l->width == width && l->lineheight == lineheight && l->generation == text_layout_generation) {
+        return l;
+    }
+
+    if(!l) {
+        l = calloc(1, sizeof(TEXT_LAYOUT));
+        if(!l) {
+            return NULL;
+        }
+        *layout = l;
+    }
+
+    l->width = width;
+    l->lineheight = lineheight;
+    l->generation = text_layout_generation;
+    l->count = 0;
+
+    if(!text_layout_build(layout, width, str, length)) {
+        free(*layout);
+        *layout = NULL;
+        return NULL;
+    }
+
+    return *layout;
+}
+
+int text_layout_draw(const TEXT_LAYOUT *layout, int x, int y, int top, int bottom, char_t *str, STRING_IDX h, STRING_IDX hlen, STRING_IDX mark, STRING_IDX marklen)
+{
+    static const uint32_t *style_color[] = {
+        [TEXT_STYLE_QUOTE] = &COLOR_MAIN_QUOTETEXT,
+        [TEXT_STYLE_RED]   = &COLOR_MAIN_REDTEXT,
+        [TEXT_STYLE_LINK]  = &COLOR_MAIN_URLTEXT,
+    };
+
+    uint16_t lineheight = layout->lineheight;
+    for(uint32_t i = 0; i < layout->count; i++) {
+        const TEXT_RUN *r = &layout->run[i];
+        int ry = y + (int)r->line * lineheight;
+        if(ry + lineheight < top) {
+            continue;
+        }
+
+        if(ry >= bottom) {
+            break;
+        }
+
+        uint32_t color = 0;
+        if(r->style != TEXT_STYLE_NORMAL) {
+            color = setcolor(*style_color[r->style]);
+        }
+
+        drawtexth(x + r->x, ry, str + r->start, r->length, r->start, h, hlen, lineheight);
+        drawtextmark(x + r->x, ry, str + r->start, r->length, r->start, mark, marklen, lineheight);
+
+        if(r->style != TEXT_STYLE_NORMAL) {
+            setcolor(color);
+        }
+    }
+
+    return y + (int)layout->lines * lineheight;
+}
+
+STRING_IDX text_layout_hit(const TEXT_LAYOUT *layout, int mx, int my, char_t *str, STRING_IDX length)
+{
+    if(my < 0) {
+        return 0;
+    }
+
+    uint32_t line = my / layout->lineheight;
+    if(line >= layout->lines) {
+        return length;
+    }
+
+    /* Runs are in line order, find the first one on this line */
+    uint32_t lo = 0, hi = layout->count;
+    while(lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if(layout->run[mid].line < line) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if(lo == layout->count || layout->run[lo].line != line) {
+        return length;
+    }
+
+    const TEXT_RUN *r = &layout->run[lo];
+    if(mx < r->x) {
+        return r->start;
+    }
+
+    for(; lo < layout->count && layout->run[lo].line == line; lo++) {
+        r = &layout->run[lo];
+        if(mx < r->x + r->width) {
+            if(mx <= r->x) {
+                return r->start;
+            }
+            /* Let the space or newline after a word be picked too, like hittextmultiline() does */
+            STRING_IDX next = r->start + r->length;
+            _Bool delimiter = next < length && (str[next] == ' ' || str[next] == '\n');
+            return r->start + textfit_near(str + r->start, r->length + delimiter, mx - r->x);
+        }
+    }
+
+    return r->start + r->length;
+}
+
+int text_layout_height(const TEXT_LAYOUT *layout)
+{
+    return layout->lines * layout->lineheight;
+}
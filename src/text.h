@@ -5,3 +5,43 @@ int text_height(int right, uint16_t lineheight, char_t *str, STRING_IDX length);
 
 STRING_IDX text_lineup(int width, int height, STRING_IDX p, uint16_t lineheight, char_t *str, STRING_IDX length, SCROLLABLE *scroll);
 STRING_IDX text_linedown(int width, int height, STRING_IDX p, uint16_t lineheight, char_t *str, STRING_IDX length, SCROLLABLE *scroll);
+
+enum {
+    TEXT_STYLE_NORMAL,
+    TEXT_STYLE_QUOTE, /* line starting with '>' */
+    TEXT_STYLE_RED,   /* line ending with '<' */
+    TEXT_STYLE_LINK,
+};
+
+/* A piece of text drawn in one go, on one line and in one style */
+typedef struct {
+    STRING_IDX start, length; /* bytes of the string */
+    uint32_t line;
+    uint16_t x, width;        /* from the left edge of the text */
+    uint8_t style;
+} TEXT_RUN;
+
+/* Line breaks and styles of a string for one width, lineheight and font, as drawtextmultiline() would lay it out.
+ * Built by text_layout() and kept by its owner until the string changes, see MESSAGE. */
+typedef struct {
+    int width;
+    uint16_t lineheight;
+    uint32_t generation;
+
+    uint32_t lines; /* 0 if the text can't be fit into width */
+    uint32_t count, capacity;
+    TEXT_RUN run[];
+} TEXT_LAYOUT;
+
+/* Bumped whenever glyph widths change (scale or font), so every cached layout gets rebuilt */
+uint32_t text_layout_generation;
+
+/* returns the layout of str at width with the current font, rebuilding *layout if it's out of date, or NULL on
+ * allocation failure */
+TEXT_LAYOUT* text_layout(TEXT_LAYOUT **layout, int width, uint16_t lineheight, char_t *str, STRING_IDX length);
+/* same as drawtextmultiline() with multiline set, for a string laid out by text_layout() */
+int text_layout_draw(const TEXT_LAYOUT *layout, int x, int y, int top, int bottom, char_t *str, STRING_IDX h, STRING_IDX hlen, STRING_IDX mark, STRING_IDX marklen);
+/* same as hittextmultiline() with multiline set, for a string laid out by text_layout() */
+STRING_IDX text_layout_hit(const TEXT_LAYOUT *layout, int mx, int my, char_t *str, STRING_IDX length);
+/* returns the height of the laid out text, 0 if it doesn't fit */
+int text_layout_height(const TEXT_LAYOUT *layout);
@@ -4,183 +4,255 @@
 struct Tox_Options options = {.proxy_host = proxy_address};
 volatile _Bool save_needed = 1;
 
-/* Writes log filename for fid to dest. returns length written */
-static int log_file_name(uint8_t *dest, size_t size_dest, Tox *tox, int fid) {
-    if (size_dest < TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".txt"))
+int log_file_name_key(uint8_t *dest, size_t size_dest, const uint8_t *key, const char *ext) {
+    size_t ext_size = strlen(ext) + 1;
+    if (size_dest < TOX_PUBLIC_KEY_SIZE * 2 + ext_size)
         return -1;
 
-    uint8_t client_id[TOX_PUBLIC_KEY_SIZE];
-    tox_friend_get_public_key(tox, fid, client_id, 0);
-    cid_to_string(dest, client_id); dest += TOX_PUBLIC_KEY_SIZE * 2;
-    memcpy((char*)dest, ".txt", sizeof(".txt"));
+    cid_to_string(dest, (uint8_t*)key); dest += TOX_PUBLIC_KEY_SIZE * 2;
+    memcpy((char*)dest, ext, ext_size);
 
-    return TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".txt");
+    return TOX_PUBLIC_KEY_SIZE * 2 + ext_size;
 }
 
-enum {
-  LOG_FILE_MSG_TYPE_TEXT = 0,
-  LOG_FILE_MSG_TYPE_ACTION = 1,
-};
-
-typedef struct {
-    uint64_t time;
-    uint16_t namelen, length;
-    uint8_t flags;
-    uint8_t msg_type;
-    uint8_t zeroes[2];
-} LOG_FILE_MSG_HEADER;
-
 void log_write(Tox *tox, int fid, const uint8_t *message, uint16_t length, _Bool author, uint8_t msg_type) {
     if (!logging_enabled) {
         return;
     }
 
-    uint8_t path[UTOX_FILE_NAME_LENGTH], *p;
-    uint8_t name[TOX_MAX_NAME_LENGTH];
-    size_t namelen;
-    FILE *file;
-
-    p = path + datapath(path);
+    size_t namelen = author ? tox_self_get_name_size(tox) : tox_friend_get_name_size(tox, fid, 0);
+    if (namelen > TOX_MAX_NAME_LENGTH) {
+        namelen = 0;
+    }
 
-    int len = log_file_name(p, sizeof(path) - (p - path), tox, fid);
-    if (len == -1)
+    LOG_WRITE *w = malloc(sizeof(*w) + namelen + length);
+    if (!w) {
+        debug("Log:\tNot enough memory, record lost\n");
         return;
+    }
 
-    p += len;
-
-    file = fopen((char*)path, "ab");
-    if (file) {
-        time_t rawtime;
-        time(&rawtime);
+    if (!tox_friend_get_public_key(tox, fid, w->cid, 0)) {
+        free(w);
+        return;
+    }
 
+    if (namelen) {
         if (author) {
-            namelen = tox_self_get_name_size(tox);
-            tox_self_get_name(tox, name);
+            tox_self_get_name(tox, w->data);
         } else {
-            namelen = tox_friend_get_name_size(tox, fid, 0);
-            tox_friend_get_name(tox, fid, name, 0);
-
+            tox_friend_get_name(tox, fid, w->data, 0);
         }
+    }
+    memcpy(w->data + namelen, message, length);
+
+    w->length = namelen + length;
+    w->header = (LOG_FILE_MSG_HEADER){
+        .time = time(NULL),
+        .namelen = namelen,
+        .length = length,
+        .flags = author,
+        .msg_type = msg_type,
+    };
+
+    postmessage_log(LOG_WRITER_RECORD, fid, 0, w);
+}
 
-        if (namelen > TOX_MAX_NAME_LENGTH) {
-            namelen = 0;
-        }
+/* Checks that record describes a complete entry of log, returns the offset just past it or 0 if it doesn't. */
+static uint64_t log_index_record_end(FILE *log, uint64_t log_size, const LOG_FILE_INDEX_RECORD *record) {
+    LOG_FILE_MSG_HEADER header;
+
+    if (record->offset + sizeof(header) > log_size) {
+        return 0;
+    }
 
-        LOG_FILE_MSG_HEADER header = {
-            .time = rawtime,
-            .namelen = namelen,
-            .length = length,
-            .flags = author,
-            .msg_type = msg_type,
-        };
+    fseeko(log, record->offset, SEEK_SET);
+    if (1 != fread(&header, sizeof(header), 1, log) || header.time != record->time) {
+        return 0;
+    }
 
-        fwrite(&header, sizeof(header), 1, file);
-        fwrite(name, namelen, 1, file);
-        fwrite(message, length, 1, file);
-        fclose(file);
+    uint64_t end = record->offset + sizeof(header) + header.namelen + header.length;
+    if (end > log_size) {
+        return 0;
     }
+
+    return end;
 }
 
-void log_read(Tox *tox, int fid) {
-    uint8_t path[UTOX_FILE_NAME_LENGTH], *p;
-    FILE *file;
+/** Opens the index for the log at log_path, and brings it up to date with the log.
+ *
+ * Records appended to the log without an index (logs written by older versions of uTox, or while the index was
+ * unavailable) get indexed here, and an index that doesn't match the log gets rebuilt from scratch. A final record
+ * that was cut short is dropped from the log, so that later records are readable again.
+ *
+ * returns the index positioned anywhere, with the number of records it holds in *count; or NULL on failure.
+ */
+static FILE* log_index_open(FILE *log, uint8_t *log_path, uint8_t *index_path, uint64_t *count) {
+    LOG_FILE_INDEX_RECORD record;
+    uint64_t log_size, indexed = 0, end = 0;
+
+    fseeko(log, 0, SEEK_END);
+    log_size = ftello(log);
+
+    FILE *index = fopen((char*)index_path, "r+b");
+    if (index) {
+        fseeko(index, 0, SEEK_END);
+        uint64_t index_size = ftello(index);
+
+        if (index_size % sizeof(record) == 0 && index_size) {
+            fseeko(index, -(off_t)sizeof(record), SEEK_END);
+            if (1 == fread(&record, sizeof(record), 1, index)) {
+                end = log_index_record_end(log, log_size, &record);
+            }
+        }
 
-    p = path + datapath(path);
+        if (end) {
+            indexed = index_size / sizeof(record);
+        } else if (index_size) {
+            debug("Log index doesn't match the log, rebuilding (%s)\n", index_path);
+            fclose(index);
+            index = NULL;
+        }
+    }
 
-    int len = log_file_name(p, sizeof(path) - (p - path), tox, fid);
-    if (len == -1) {
-        debug("Error getting log file name for friend %d\n", fid);
-        return;
+    if (!index) {
+        index = fopen((char*)index_path, "w+b");
+        if (!index) {
+            /* Can't keep an index next to this log, build a throwaway one. */
+            debug("Unable to create log index (%s)\n", index_path);
+            index = tmpfile();
+            if (!index) {
+                return NULL;
+            }
+        }
     }
 
-    file = fopen((char*)path, "rb");
-    if(!file) {
-        debug("File not found (%s)\n", path);
-        p = path + datapath_old(path);
+    if (end < log_size) {
+        LOG_FILE_MSG_HEADER header;
+
+        debug("Indexing log from offset %"PRIu64" (%s)\n", end, log_path);
+        fseeko(log, end, SEEK_SET);
+        fseeko(index, indexed * sizeof(record), SEEK_SET);
+
+        while (end < log_size) {
+            if (1 != fread(&header, sizeof(header), 1, log) ||
+                end + sizeof(header) + header.namelen + header.length > log_size) {
+                /* The last record was cut short, probably by a crash while it was being written. Drop it, or every
+                 * record appended after it would be misread. */
+                debug("Log ends with an incomplete record, truncating at %"PRIu64" (%s)\n", end, log_path);
+                FILE *log_writable = fopen((char*)log_path, "r+b");
+                if (!log_writable || file_truncate(log_writable, end)) {
+                    debug("Unable to truncate log (%s)\n", log_path);
+                }
+                if (log_writable) {
+                    fclose(log_writable);
+                }
+                break;
+            }
 
-        len = log_file_name(p, sizeof(path) - (p - path), tox, fid);
-        if (len == -1) {
-            debug("Error getting log file name for friend %d\n", fid);
-            return;
-        }
+            record.offset = end;
+            record.time   = header.time;
+            if (1 != fwrite(&record, sizeof(record), 1, index)) {
+                debug("Log index write error (%s)\n", index_path);
+                break;
+            }
 
-        file = fopen((char*) path, "rb");
-        if (!file) {
-            debug("File not found (%s)\n", path);
-            return;
+            end += sizeof(header) + header.namelen + header.length;
+            fseeko(log, end, SEEK_SET);
+            indexed++;
         }
+
+        fflush(index);
     }
 
-    LOG_FILE_MSG_HEADER header;
-    off_t rewinds[UTOX_MAX_BACKLOG_MESSAGES] = {};
-    size_t records_count = 0;
+    *count = indexed;
+    return index;
+}
 
-    /* TODO: some checks to avoid crashes with corrupted log files
-     * first find the last UTOX_MAX_BACKLOG_MESSAGES messages in the log */
-    while (1 == fread(&header, sizeof(LOG_FILE_MSG_HEADER), 1, file)) {
-        fseeko(file, header.namelen + header.length, SEEK_CUR);
+FILE* log_open(uint8_t *path, size_t size, const uint8_t *key, int *base) {
+    *base = datapath(path);
+    if (log_file_name_key(path + *base, size - *base, key, ".txt") == -1) {
+        debug("Error getting log file name\n");
+        return NULL;
+    }
 
-        rewinds[records_count % countof(rewinds)] =
-                (off_t) sizeof(LOG_FILE_MSG_HEADER) + header.namelen + header.length;
-        records_count++;
+    FILE *file = fopen((char*)path, "rb");
+    if (file) {
+        return file;
     }
+    debug("File not found (%s)\n", path);
 
-    if (ferror(file) || !feof(file)) {
-        // TODO: consider removing or truncating the log file.
-        // If !feof() this means that the file has an incomplete record,
-        // which would prevent it from loading forever, even though
-        // new records will keep being appended as usual.
-        debug("Log read error (%s)\n", path);
-        fclose(file);
-        return;
+    *base = datapath_old(path);
+    if (log_file_name_key(path + *base, size - *base, key, ".txt") == -1) {
+        debug("Error getting log file name\n");
+        return NULL;
     }
 
-    // Backtrack to read last UTOX_MAX_BACKLOG_MESSAGES in full.
-    off_t rewind = 0;
-    MSG_IDX i;
-    for(i = 0; (i < records_count) && (i < countof(rewinds)); i++) {
-        rewind += rewinds[i];
+    file = fopen((char*)path, "rb");
+    if (!file) {
+        debug("File not found (%s)\n", path);
     }
-    fseeko(file, -rewind, SEEK_CUR);
+    return file;
+}
 
-    MSG_DATA *m = &friend[fid].msg;
-    m->data = malloc(sizeof(void*) * i);
-    m->n = 0;
+/** Reads the messages of the count index records in records from the log file.
+ *
+ * Every record becomes exactly one message, so that message i of a page can be found again as record i. Records of
+ * a type this version doesn't know are shown as plain text.
+ *
+ * returns the number of messages read into msgs, less than count if the log couldn't be read past that. */
+static MSG_IDX log_read_messages(FILE *file, const uint8_t *path, const LOG_FILE_INDEX_RECORD *records, MSG_IDX count,
+                                 void **msgs) {
+    LOG_FILE_MSG_HEADER header;
+    uint64_t position = count ? records[0].offset : 0;
+    fseeko(file, position, SEEK_SET);
+
+    MSG_IDX r;
+    for (r = 0; r < count; r++) {
+        if (records[r].offset != position) {
+            fseeko(file, records[r].offset, SEEK_SET);
+        }
 
-    /* add the messages */
-    while((0 < i) && (1 == fread(&header, sizeof(LOG_FILE_MSG_HEADER), 1, file))) {
-        i--;
+        if (1 != fread(&header, sizeof(LOG_FILE_MSG_HEADER), 1, file)) {
+            debug("Log read error (%s)\n", path);
+            break;
+        }
+        position = records[r].offset + sizeof(header) + header.namelen + header.length;
 
         // Skip unused friend name recorded at the time.
         fseeko(file, header.namelen, SEEK_CUR);
 
-        MESSAGE *msg = NULL;
+        MESSAGE *msg = malloc(sizeof(MESSAGE) + header.length);
+        if (!msg) {
+            debug("Not enough memory for log message (%s)\n", path);
+            break;
+        }
+
         switch(header.msg_type) {
         case LOG_FILE_MSG_TYPE_ACTION: {
-            msg = malloc(sizeof(MESSAGE) + header.length);
             msg->msg_type = MSG_TYPE_ACTION_TEXT;
             break;
         }
         case LOG_FILE_MSG_TYPE_TEXT: {
-            msg = malloc(sizeof(MESSAGE) + header.length);
             msg->msg_type = MSG_TYPE_TEXT;
             break;
         }
         default: {
-            debug("Unknown backlog message type(%d), skipping.\n", (int)header.msg_type);
-            fseeko(file, header.length, SEEK_CUR);
-            continue;
+            debug("Unknown backlog message type(%d), showing it as text.\n", (int)header.msg_type);
+            msg->msg_type = MSG_TYPE_TEXT;
+            break;
         }
         }
 
         // Read text message.
         msg->author = header.flags & 1;
+        msg->height = 0;
+        msg->layout = NULL;
         msg->length = header.length;
 
         if(1 != fread(msg->msg, msg->length, 1, file)) {
             debug("Log read error (%s)\n", path);
-            fclose(file);
-            return;
+            free(msg);
+            break;
         }
 
         msg->length = utf8_validate(msg->msg, msg->length);
@@ -191,49 +263,223 @@ void log_read(Tox *tox, int fid) {
 
         msg->time = ti->tm_hour * 60 + ti->tm_min;
 
-        m->data[m->n++] = msg;
+        msgs[r] = msg;
 
-        // debug("loaded backlog: %d: %.*s\n", fid, msg->length, msg->msg);
+        // debug("loaded backlog: %.*s\n", msg->length, msg->msg);
     }
 
+    return r;
+}
+
+void log_read(Tox *tox, int fid) {
+    uint8_t path[UTOX_FILE_NAME_LENGTH], index_path[UTOX_FILE_NAME_LENGTH];
+    uint8_t client_id[TOX_PUBLIC_KEY_SIZE];
+    int base;
+
+    tox_friend_get_public_key(tox, fid, client_id, 0);
+
+    /* Records may still be on their way to the log */
+    log_writer_close(client_id);
+
+    FILE *file = log_open(path, sizeof(path), client_id, &base);
+    if (!file) {
+        return;
+    }
+
+    /* Keep the index next to whichever log we found. */
+    memcpy(index_path, path, base);
+    int len = log_file_name_key(index_path + base, sizeof(index_path) - base, client_id, ".idx");
+    if (len == -1) {
+        debug("Error getting log index name for friend %d\n", fid);
+        fclose(file);
+        return;
+    }
+
+    uint64_t records_count;
+    FILE *index = log_index_open(file, path, index_path, &records_count);
+    if (!index) {
+        debug("Log read error (%s)\n", path);
+        fclose(file);
+        return;
+    }
+
+    // Only the last utox_backlog_capacity records get loaded, older ones are paged in by log_read_page().
+    MSG_IDX i = (records_count < utox_backlog_capacity) ? records_count : utox_backlog_capacity;
+    MSG_DATA *m = &friend[fid].msg;
+    LOG_FILE_INDEX_RECORD *records = malloc(i * sizeof(*records));
+    if ((i && !records) || !message_reserve(m, i)) {
+        debug("Not enough memory for the backlog of friend %d\n", fid);
+        free(records);
+        fclose(index);
+        fclose(file);
+        return;
+    }
+
+    fseeko(index, (records_count - i) * sizeof(*records), SEEK_SET);
+    if (i != fread(records, sizeof(*records), i, index)) {
+        debug("Log index read error (%s)\n", index_path);
+        free(records);
+        fclose(index);
+        fclose(file);
+        return;
+    }
+    fclose(index);
+
+    // The list is empty, so the ring starts at slot 0
+    m->n = log_read_messages(file, path, records, i, m->data);
+    m->history = m->n;
+    m->log_start = records_count - i;
+    m->log_end = records_count;
+
+    free(records);
     fclose(file);
 }
 
+/* A page of a friend's log, read by log_page_thread() and handed to the UI thread with FRIEND_LOG_PAGE */
+typedef struct {
+    uint32_t fid;
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+    uint64_t start;
+    MSG_IDX count;
+    void *msg[];
+} LOG_PAGE;
+
+static void log_page_thread(void *args) {
+    LOG_PAGE *page = args;
+    uint8_t path[UTOX_FILE_NAME_LENGTH];
+    int base;
+    MSG_IDX count = page->count;
+
+    page->count = 0;
+
+    FILE *file = log_open(path, sizeof(path), page->cid, &base);
+    if (file) {
+        LOG_FILE_INDEX_RECORD *records = malloc(count * sizeof(*records));
+        uint8_t index_path[UTOX_FILE_NAME_LENGTH];
+
+        memcpy(index_path, path, base);
+        FILE *index = NULL;
+        if (records && log_file_name_key(index_path + base, sizeof(index_path) - base, page->cid, ".idx") != -1) {
+            index = fopen((char*)index_path, "rb");
+        }
+
+        if (index) {
+            fseeko(index, page->start * sizeof(*records), SEEK_SET);
+            if (count == fread(records, sizeof(*records), count, index)) {
+                page->count = log_read_messages(file, path, records, count, page->msg);
+            } else {
+                debug("Log index read error (%s)\n", index_path);
+            }
+            fclose(index);
+        }
+
+        /* All of the page or nothing, a short page would leave the messages and records out of step. */
+        if (page->count != count) {
+            while (page->count) {
+                message_free(page->msg[--page->count]);
+            }
+        }
+
+        free(records);
+        fclose(file);
+    }
+
+    postmessage(FRIEND_LOG_PAGE, page->fid, 0, page);
+}
+
+_Bool log_read_page(uint32_t fid, uint64_t start, uint32_t count) {
+    LOG_PAGE *page = malloc(sizeof(LOG_PAGE) + count * sizeof(void*));
+    if (!page) {
+        return 0;
+    }
+
+    page->fid = fid;
+    memcpy(page->cid, friend[fid].cid, sizeof(page->cid));
+    page->start = start;
+    page->count = count;
+
+    thread(log_page_thread, page);
+    return 1;
+}
+
 static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
                                uint32_t param1, uint32_t param2, void *data);
 
-void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (tox_thread_msg) {
-        yieldcpu(1);
-    }
+static UTOX_MSG_QUEUE tox_msg_queue = UTOX_MSG_QUEUE_INIT;
+
+/* Time between posting TOX_SEND_MESSAGE/TOX_SEND_ACTION and handing the message to tox_friend_send_message(). */
+static struct {
+    uint64_t count, total, max;
+} send_latency;
 
+void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
     if (!tox_thread_init) {
         /* Tox is not yet active, drop message (Probably a mistake) */
         return;
     }
 
-    tox_msg.msg = msg;
-    tox_msg.param1 = param1;
-    tox_msg.param2 = param2;
-    tox_msg.data = data;
+    msg_queue_post_wait(&tox_msg_queue, msg, param1, param2, data);
+}
+
+/* The key the profile was last encrypted with, and a hash of the passphrase it was derived from, salted with the
+ * key's own random salt, so no copy of the passphrase is kept around. Only touched by the saver thread. */
+static struct {
+    TOX_PASS_KEY key;
+    uint8_t passphrase_hash[TOX_HASH_LENGTH];
+    _Bool known;
+} save_key;
 
-    tox_thread_msg = 1;
+static void save_key_clear(void) {
+    memset(&save_key, 0, sizeof(save_key));
 }
 
-static int utox_encrypt_data(void *clear_text, size_t clear_length, uint8_t *cypher_data) {
-    size_t passphrase_length = edit_profile_password.length;
+static _Bool save_key_hash(uint8_t *hash, const uint8_t *salt, const uint8_t *passphrase, size_t passphrase_length) {
+    uint8_t data[TOX_PASS_SALT_LENGTH + passphrase_length];
+    memcpy(data, salt, TOX_PASS_SALT_LENGTH);
+    memcpy(data + TOX_PASS_SALT_LENGTH, passphrase, passphrase_length);
+
+    _Bool ok = tox_hash(hash, data, sizeof(data));
+    memset(data, 0, sizeof(data));
+    return ok;
+}
 
+/* returns the key for passphrase, only running the (slow on purpose) KDF when the passphrase changed, or NULL */
+static TOX_PASS_KEY* save_key_get(const uint8_t *passphrase, size_t passphrase_length) {
+    uint8_t hash[TOX_HASH_LENGTH];
+    if (save_key.known && save_key_hash(hash, save_key.key.salt, passphrase, passphrase_length) &&
+        !memcmp(hash, save_key.passphrase_hash, sizeof(hash))) {
+        return &save_key.key;
+    }
+
+    save_key_clear();
+
+    uint64_t start = get_time();
+    TOX_ERR_KEY_DERIVATION err = 0;
+    if (!tox_derive_key_from_pass((uint8_t*)passphrase, passphrase_length, &save_key.key, &err)) {
+        debug("Toxcore:\tUnable to derive the profile key (%u)\n", err);
+        save_key_clear();
+        return NULL;
+    }
+    debug("Toxcore:\tDerived the profile key in %"PRIu64"ms\n", (get_time() - start) / 1000 / 1000);
+
+    /* Without the hash the key still works, it's just derived again next time */
+    save_key.known = save_key_hash(save_key.passphrase_hash, save_key.key.salt, passphrase, passphrase_length);
+    return &save_key.key;
+}
+
+static int utox_encrypt_data(void *clear_text, size_t clear_length, const uint8_t *passphrase, size_t passphrase_length,
+                             uint8_t *cypher_data) {
     if (passphrase_length < 4) {
         return UTOX_ENC_ERR_LENGTH;
     }
 
-    uint8_t passphrase[passphrase_length];
-    memcpy(passphrase, edit_profile_password.data, passphrase_length);
-    TOX_ERR_ENCRYPTION err = 0;
+    TOX_PASS_KEY *key = save_key_get(passphrase, passphrase_length);
+    if (!key) {
+        return UTOX_ENC_ERR_UNKNOWN;
+    }
 
-    tox_pass_encrypt((uint8_t*)clear_text, clear_length,
-                     (uint8_t*)passphrase, passphrase_length,
-                     cypher_data, &err);
+    TOX_ERR_ENCRYPTION err = 0;
+    tox_pass_key_encrypt((uint8_t*)clear_text, clear_length, key, cypher_data, &err);
 
     if (err) {
         debug("Fatal Error; unable to encrypt data!\n");
@@ -368,17 +614,33 @@ static void load_defaults(Tox *tox) {
     tox_self_set_status_message(tox, status, status_len, 0);
 }
 
-static void write_save(Tox *tox) {
-    uint8_t path_tmp[UTOX_FILE_NAME_LENGTH], path_real[UTOX_FILE_NAME_LENGTH], *p;
-    /* Get toxsave info from tox*/
-    size_t clear_length = tox_get_savedata_size(tox);
-    uint8_t data[clear_length];
+/* A snapshot of the profile, handed from the toxcore thread to the saver thread */
+typedef struct {
+    size_t length, passphrase_length;
+    uint8_t data[]; /* the savedata, followed by the passphrase to encrypt it with */
+} UTOX_PROFILE_SAVE;
+
+/* Messages for the saver thread */
+enum {
+    SAVE_PROFILE = 1, /* param1: sequence number, data: UTOX_PROFILE_SAVE */
+    SAVE_FORGET_KEY,  /* drop the cached key, after writing any save posted before */
+};
+
+static UTOX_MSG_QUEUE save_msg_queue = UTOX_MSG_QUEUE_INIT;
+
+/* Sequence number of the last save posted, only written by the toxcore thread, and of the last one on disk, only
+ * written by the saver thread */
+static volatile uint32_t save_posted, save_written;
 
-    /* create encrypted data buffer */
-    size_t encrypted_length = clear_length + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
-    uint8_t encrypted_data[encrypted_length];
+static void save_free(UTOX_PROFILE_SAVE *save) {
+    memset(save->data, 0, save->length + save->passphrase_length);
+    free(save);
+}
 
-    tox_get_savedata(tox, data);
+/* Encrypts save if there's a passphrase, and writes it over the profile */
+static void save_write(UTOX_PROFILE_SAVE *save) {
+    uint8_t path_tmp[UTOX_FILE_NAME_LENGTH], path_real[UTOX_FILE_NAME_LENGTH], *p;
+    uint64_t start = get_time();
 
     /* Get save path! */
     p = path_real + datapath(path_real);
@@ -389,20 +651,30 @@ static void write_save(Tox *tox) {
     memcpy(path_tmp + (path_len - 1), ".tmp", sizeof(".tmp"));
     debug("Writing tox_save to: '%s'\n", (char*)path_tmp);
 
-    if (edit_profile_password.length == 0) {
+    if (save->passphrase_length == 0) {
         // user doesn't use encryption
-        file_write_raw(path_tmp, data, clear_length);
+        file_write_raw(path_tmp, save->data, save->length);
         debug("Unencrypted save data written\n");
     } else {
-        UTOX_ENC_ERR enc_err = utox_encrypt_data(data, clear_length, encrypted_data);
+        /* create encrypted data buffer */
+        size_t encrypted_length = save->length + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+        uint8_t *encrypted_data = malloc(encrypted_length);
+
+        UTOX_ENC_ERR enc_err = UTOX_ENC_ERR_UNKNOWN;
+        if (encrypted_data) {
+            enc_err = utox_encrypt_data(save->data, save->length, save->data + save->length, save->passphrase_length,
+                                        encrypted_data);
+        }
+
         if (enc_err) {
             /* encryption failed, write clear text data */
-            file_write_raw(path_tmp, data, clear_length);
+            file_write_raw(path_tmp, save->data, save->length);
             debug("\n\n\t\tWARNING UTOX WAS UNABLE TO ENCRYPT DATA!\n\t\tDATA WRITTEN IN CLEAR TEXT!\n\n");
         } else {
             file_write_raw(path_tmp, encrypted_data, encrypted_length);
             debug("Encrypted save data written\n");
         }
+        free(encrypted_data);
     }
 
     if (rename((char*)path_tmp, (char*)path_real) != 0) {
@@ -423,7 +695,81 @@ static void write_save(Tox *tox) {
         }
     }
 
+    debug("Toxcore:\tProfile saved in %"PRIu64"ms\n", (get_time() - start) / 1000 / 1000);
+}
+
+/** Writes the profile in the background, so toxcore never waits on the KDF or the disk.
+ *
+ * Saves posted while one is being written are coalesced, only the newest of them gets written.
+ */
+static void save_thread(void *UNUSED(args)) {
+    uint64_t coalesced = 0;
+
+    while (1) {
+        UTOX_PROFILE_SAVE *save = NULL;
+        uint32_t seq = 0;
+        _Bool forget_key = 0;
+
+        TOX_MSG msg;
+        while (msg_queue_get(&save_msg_queue, &msg)) {
+            switch (msg.msg) {
+                case SAVE_PROFILE: {
+                    if (save) {
+                        save_free(save);
+                        coalesced++;
+                    }
+                    save = msg.data;
+                    seq  = msg.param1;
+                    break;
+                }
+                case SAVE_FORGET_KEY: {
+                    forget_key = 1;
+                    break;
+                }
+            }
+        }
+
+        if (save) {
+            save_write(save);
+            save_free(save);
+            save_written = seq;
+        }
+
+        if (forget_key) {
+            save_key_clear();
+            if (coalesced) {
+                debug("Toxcore:\t%"PRIu64" saves coalesced into newer ones\n", coalesced);
+            }
+        }
+
+        msg_queue_wait(&save_msg_queue, 60 * 1000);
+    }
+}
+
+/* Takes a snapshot of the profile and hands it to the saver thread */
+static void write_save(Tox *tox) {
+    size_t length = tox_get_savedata_size(tox), passphrase_length = edit_profile_password.length;
+
+    UTOX_PROFILE_SAVE *save = malloc(sizeof(*save) + length + passphrase_length);
+    if (!save) {
+        debug("Toxcore:\tUnable to allocate the save, trying again later\n");
+        return;
+    }
+
+    save->length            = length;
+    save->passphrase_length = passphrase_length;
+    tox_get_savedata(tox, save->data);
+    memcpy(save->data + length, edit_profile_password.data, passphrase_length);
+
     save_needed = 0;
+    msg_queue_post_wait(&save_msg_queue, SAVE_PROFILE, ++save_posted, 0, save);
+}
+
+/* Waits for the saves posted so far to be written */
+static void save_flush(void) {
+    while (save_written != save_posted) {
+        yieldcpu(1);
+    }
 }
 
 void tox_settingschanged(void) {
@@ -642,6 +988,13 @@ void toxcore_thread(void *UNUSED(args)) {
     _Bool reconfig = 1;
     int toxcore_init_err = 0;
 
+    // Indexes the logs in the background, for as long as uTox runs
+    thread(search_thread, NULL);
+    // Writes the profile, for as long as uTox runs
+    thread(save_thread, NULL);
+    // Appends to the chat logs, for as long as uTox runs
+    thread(log_writer_thread, NULL);
+
     while (reconfig) {
         reconfig = 0;
 
@@ -708,32 +1061,50 @@ void toxcore_thread(void *UNUSED(args)) {
                 }
             }
 
-            // If there's a message, load it, and send to the tox message thread
-            if (tox_thread_msg) {
-                TOX_MSG *msg = &tox_msg;
-                // If msg->msg is 0, reconfig if needed and break from tox_do
-                if (!msg->msg) {
-                    reconfig        = msg->param1;
-                    tox_thread_msg  = 0;
+            // Handle every message that's waiting, but don't starve toxcore if they keep coming
+            TOX_MSG msg;
+            _Bool kill = 0;
+            int handled = 0;
+            while (handled < UTOX_MSG_QUEUE_SIZE && msg_queue_get(&tox_msg_queue, &msg)) {
+                // If msg.msg is 0, reconfig if needed and break from tox_do
+                if (!msg.msg) {
+                    reconfig        = msg.param1;
                     tox_thread_init = 0;
+                    kill            = 1;
                     break;
                 }
-                tox_thread_message(tox, av, time, msg->msg, msg->param1, msg->param2, msg->data);
-                tox_thread_msg = 0;
+                tox_thread_message(tox, av, time, msg.msg, msg.param1, msg.param2, msg.data);
+                handled++;
             }
 
+            if (kill) {
+                /* Anything posted after the kill was meant for this instance of toxcore, drop it */
+                while (msg_queue_get(&tox_msg_queue, &msg)) {
+                    debug("Toxcore:\tDropping message %u posted after TOX_KILL\n", msg.msg);
+                }
+                break;
+            }
+
+            ft_flush_stale_writes();
+
             if (!dont_send_typing_notes){
                 // Thread active transfers and check if friend is typing
                 utox_thread_work_for_typing_notifications(tox, time);
             }
 
-            /* Ask toxcore how many ms to wait, then wait at the most 20ms */
-            uint32_t interval = tox_iteration_interval(tox);
-            yieldcpu((interval > 20) ? 20 : interval);
+            /* Sleep for as long as toxcore lets us, unless uTox posts something before that. If we just handled
+             * messages, go straight back to tox_iterate() so whatever they queued in toxcore goes out now. */
+            if (!handled) {
+                msg_queue_wait(&tox_msg_queue, tox_iteration_interval(tox));
+            }
         }
 
         /* If for anyreason, we exit, write the save, and clear the password */
+        ft_flush_writes();
         write_save(tox);
+        msg_queue_post_wait(&save_msg_queue, SAVE_FORGET_KEY, 0, 0, NULL);
+        save_flush();
+        log_writer_close(NULL);
         edit_setstr(&edit_profile_password, (char_t *)"", 0);
 
         // Wait for all a/v threads to return 0
@@ -749,6 +1120,11 @@ void toxcore_thread(void *UNUSED(args)) {
     }
 
     tox_thread_init = 0;
+    msg_queue_debug_stats(&tox_msg_queue, "Toxcore");
+    if (send_latency.count) {
+        debug("Toxcore:\tSent %"PRIu64" messages, post to send latency avg %"PRIu64"us max %"PRIu64"us\n",
+              send_latency.count, send_latency.total / send_latency.count / 1000, send_latency.max / 1000);
+    }
     debug("Tox thread:\tClean exit!\n");
 }
 
@@ -914,6 +1290,13 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             // Send last or only message
             tox_friend_send_message(tox, param1, type, p, param2, 0);
 
+            uint64_t latency = get_time() - tox_msg_queue.last_posted;
+            send_latency.count++;
+            send_latency.total += latency;
+            if (latency > send_latency.max) {
+                send_latency.max = latency;
+            }
+
             /* write message to friend to logfile */
             log_write(tox, param1, data, param2, 1, LOG_FILE_MSG_TYPE_TEXT);
 
@@ -1486,9 +1869,12 @@ void tox_message(uint8_t tox_message_id, uint16_t param1, uint16_t param2, void
             }
             if (f_notify) {
                 file_notify(f, msg);
+                redraw();
+            } else if (selected_item->item == ITEM_FRIEND && selected_item->data == f) {
+                /* Just the progress, only the transfer's own message needs drawing again */
+                message_redraw(&messages_friend, &f->msg, msg);
             }
 
-            redraw();
             free(file);
             break;
         }
@@ -1578,7 +1964,10 @@ void tox_message(uint8_t tox_message_id, uint16_t param1, uint16_t param2, void
         case FRIEND_TYPING: {
             FRIEND *f = &friend[param1];
             friend_set_typing(f, param2);
-            redraw();
+            /* Only shown under the messages of the friend that's open */
+            if (selected_item->item == ITEM_FRIEND && selected_item->data == f) {
+                redraw_friend_typing();
+            }
             break;
         }
         case FRIEND_MESSAGE: {
@@ -1586,6 +1975,27 @@ void tox_message(uint8_t tox_message_id, uint16_t param1, uint16_t param2, void
             redraw();
             break;
         }
+        case FRIEND_LOG_PAGE: {
+            /* data: LOG_PAGE read by log_page_thread() */
+            LOG_PAGE *page = data;
+            FRIEND *f = &friend[param1];
+
+            if (memcmp(f->cid, page->cid, sizeof(f->cid))) {
+                /* The friend was removed while the page was being read */
+                while (page->count) {
+                    message_free(page->msg[--page->count]);
+                }
+            } else if (!page->count) {
+                /* Leave log_loading set, so a log that can't be read isn't tried again on every redraw */
+                debug("Unable to read the log of friend %u from record %"PRIu64"\n", param1, page->start);
+            } else {
+                messages_log_page(&messages_friend, &f->msg, page->start, page->msg, page->count);
+                redraw();
+            }
+
+            free(page);
+            break;
+        }
         /* Adding and deleting */
         case FRIEND_INCOMING_REQUEST: {
             /* data: pointer to FRIENDREQ structure
@@ -1665,17 +2075,15 @@ void tox_message(uint8_t tox_message_id, uint16_t param1, uint16_t param2, void
         case AV_VIDEO_FRAME: {
             /* param1: video handle to send frame to (friend id + 1 or 0 for preview)
                param2: self preview frame for pending call.
-               data: packaged frame data */
+               the frame itself is waiting in the frame pool of param1 */
 
-            utox_frame_pkg *frame = data;
-            if (ACCEPT_VIDEO_FRAME(param1 - 1) || param2) {
+            utox_frame_pkg *frame = video_frame_pool_take(param1);
+            if (frame && (ACCEPT_VIDEO_FRAME(param1 - 1) || param2)) {
                 STRING *s = SPTR(WINDOW_TITLE_VIDEO_PREVIEW);
                 video_begin(param1, s->str, s->length, frame->w, frame->h);
                 video_frame(param1, frame->img, frame->w, frame->h, 0);
                 // TODO re-enable the resize option, disabled for reasons
             }
-            free(frame->img);
-            free(data);
             redraw();
             break;
         }
@@ -1832,5 +2240,13 @@ void tox_message(uint8_t tox_message_id, uint16_t param1, uint16_t param2, void
             redraw();
             break;
         }
+        /* Searching the logs */
+        case SEARCH_RESULTS: {
+            /* param1: number of results
+             * data: SEARCH_RESULTs, newest first */
+            search_results(data, param1);
+            redraw();
+            break;
+        }
     }
 }
@@ -110,6 +110,7 @@ enum {
     /* Interactions */
     FRIEND_TYPING, // 20
     FRIEND_MESSAGE,
+    FRIEND_LOG_PAGE,
     /* Adding and deleting */
     FRIEND_INCOMING_REQUEST,
     FRIEND_ACCEPT_REQUEST,
@@ -120,8 +121,8 @@ enum {
     AV_CALL_INCOMING,
     AV_CALL_RINGING,
     AV_CALL_ACCEPTED,
-    AV_CALL_DISCONNECTED,
-    AV_VIDEO_FRAME, // 30
+    AV_CALL_DISCONNECTED, // 30
+    AV_VIDEO_FRAME,
     AV_CLOSE_WINDOW,
 
     /* Group interactions, commented out for the new groupchats (coming soon maybe?) */
@@ -134,6 +135,9 @@ enum {
     GROUP_AUDIO_START,
     GROUP_AUDIO_END,
     GROUP_UPDATE,
+
+    /* Searching the logs */
+    SEARCH_RESULTS,
 };
 
 struct TOX_SEND_INLINE_MSG {
@@ -149,14 +153,29 @@ enum {
     UTOX_AV_STARTED,
 };
 
-/* Inter-thread communication vars. */
-TOX_MSG tox_msg, audio_msg, video_msg, toxav_msg;
-volatile _Bool tox_thread_msg, audio_thread_msg, video_thread_msg, toxav_thread_msg;
+/* Inter-thread communication vars. The toxcore, toxav and audio threads each have a UTOX_MSG_QUEUE instead. */
+TOX_MSG video_msg;
+volatile _Bool video_thread_msg;
 volatile _Bool save_needed;
 
+/* Writes log filename with extension ext for the friend with public key key to dest. returns length written */
+int log_file_name_key(uint8_t *dest, size_t size_dest, const uint8_t *key, const char *ext);
+
+/** Opens the log of the friend with public key key for reading, looking in the current data directory first and in
+ * the old one after that.
+ *
+ * returns the log with its path in path and the length of the directory part in *base, or NULL if there's none. */
+FILE* log_open(uint8_t *path, size_t size, const uint8_t *key, int *base);
+
 /** [log_read description] */
 void log_read(Tox *tox, int fid);
 
+/** Reads count records of friend fid's log, starting at record start, on a new thread.
+ *
+ * The messages arrive on the UI thread with FRIEND_LOG_PAGE, and get added with messages_log_page().
+ * returns 0 if the read couldn't be started. */
+_Bool log_read_page(uint32_t fid, uint64_t start, uint32_t count);
+
 /** [init_avatar description]
  *
  * TODO move this to avatar.h
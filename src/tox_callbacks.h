@@ -5,6 +5,7 @@ static void* copy_message(const uint8_t *str, uint16_t length, uint8_t msg_type)
     MESSAGE *msg = malloc(sizeof(MESSAGE) + length);
     msg->author = 0;
     msg->msg_type = msg_type;
+    msg->layout = NULL;
     msg->length = length;
     memcpy(msg->msg, str, length);
 
@@ -27,6 +28,7 @@ static void* copy_groupmessage(Tox *tox, const uint8_t *str, uint16_t length, ui
     MESSAGE *msg = malloc(sizeof(MESSAGE) + 1 + length + namelen);
     msg->author = 0;
     msg->msg_type = msg_type;
+    msg->layout = NULL;
     msg->length = length;
     memcpy(msg->msg, str, length);
 
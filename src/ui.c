@@ -99,6 +99,18 @@ static void draw_user_badge(int UNUSED(x), int UNUSED(y), int UNUSED(width), int
     }
 }
 
+/* Top of the line under the messages that says the friend is typing, for the chat panel at y that's height high */
+static int friend_typing_y(int y, int height) {
+    return (y + height) + CHAT_BOX_TOP - UTOX_SCALE(7 );
+}
+
+void redraw_friend_typing(void) {
+    PANEL *p = &panel_friend_chat;
+    if (p->drawn_width > 0) {
+        redraw_rect(p->drawn_x, friend_typing_y(p->drawn_y, p->drawn_height), p->drawn_width, UTOX_SCALE(9 ));
+    }
+}
+
 /* Header for friend chat window */
 static void draw_friend(int x, int y, int w, int height){
     FRIEND *f = selected_item->data;
@@ -124,7 +136,7 @@ static void draw_friend(int x, int y, int w, int height){
     drawtextrange(MAIN_LEFT + UTOX_SCALE(30 ), utox_window_width - UTOX_SCALE(64 ), UTOX_SCALE(16 ), f->status_message, f->status_length);
 
     if (f->typing) {
-        int typing_y = ((y + height) + CHAT_BOX_TOP - UTOX_SCALE(7 ));
+        int typing_y = friend_typing_y(y, height);
         setfont(FONT_MISC);
         // @TODO: separate these colors if needed
         setcolor(COLOR_MAIN_HINTTEXT);
@@ -845,6 +857,8 @@ void ui_set_scale(uint8_t scale) {
         messages_group.panel.width      = -SCROLL_WIDTH;
 
     setscale_fonts();
+    /* Glyph widths changed, lay out all text again */
+    text_layout_generation++;
 
     setfont(FONT_SELF_NAME);
 
@@ -1460,17 +1474,119 @@ void ui_mouseleave(void)
     redraw();
 }
 
+typedef struct {
+    int x, y, width, height;
+} UI_RECT;
+
+/* Parts of the window that changed since it was drawn last. Past UI_DAMAGE_RECTS of them, all of it gets drawn. */
+#define UI_DAMAGE_RECTS 8
+static UI_RECT damage[UI_DAMAGE_RECTS];
+static int damage_count;
+static _Bool damage_all;
+
+/* While drawing: the part being drawn, and the part the panel being drawn can be seen in, inside scrolled panels */
+static UI_RECT draw_damage, draw_view;
+
+/* Frame time counters, for frames that drew all of the window and for those that only drew the damage */
+static struct {
+    uint64_t frames, time, max, area;
+} draw_stats[2];
+
+/* Sets *r to the part a and b have in common. returns 0 if there's none. */
+static _Bool rect_intersect(UI_RECT *r, const UI_RECT *a, const UI_RECT *b)
+{
+    int left = (a->x > b->x) ? a->x : b->x, top = (a->y > b->y) ? a->y : b->y;
+    int right = (a->x + a->width < b->x + b->width) ? a->x + a->width : b->x + b->width;
+    int bottom = (a->y + a->height < b->y + b->height) ? a->y + a->height : b->y + b->height;
+
+    if(right <= left || bottom <= top) {
+        *r = (UI_RECT){ 0 };
+        return 0;
+    }
+
+    *r = (UI_RECT){ left, top, right - left, bottom - top };
+    return 1;
+}
+
+void ui_damage(int x, int y, int width, int height)
+{
+    if(damage_all || width <= 0 || height <= 0) {
+        return;
+    }
+
+    /* Merge it with the rects it touches, so nothing gets drawn twice */
+    UI_RECT r = { x, y, width, height };
+    for(int i = 0; i < damage_count;) {
+        UI_RECT *d = &damage[i];
+        if(r.x <= d->x + d->width && d->x <= r.x + r.width && r.y <= d->y + d->height && d->y <= r.y + r.height) {
+            int right = (r.x + r.width > d->x + d->width) ? r.x + r.width : d->x + d->width;
+            int bottom = (r.y + r.height > d->y + d->height) ? r.y + r.height : d->y + d->height;
+            r.x = (r.x < d->x) ? r.x : d->x;
+            r.y = (r.y < d->y) ? r.y : d->y;
+            r.width = right - r.x;
+            r.height = bottom - r.y;
+
+            /* The bigger rect may touch ones it didn't before, start over */
+            *d = damage[--damage_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if(damage_count == UI_DAMAGE_RECTS) {
+        damage_all = 1;
+        return;
+    }
+    damage[damage_count++] = r;
+}
+
+void ui_damage_all(void)
+{
+    damage_all = 1;
+}
+
+void panel_redraw(PANEL *p)
+{
+    if(p->drawn_width > 0 && p->drawn_height > 0) {
+        redraw_rect(p->drawn_x, p->drawn_y, p->drawn_width, p->drawn_height);
+    }
+}
+
+void ui_debug_draw_stats(void)
+{
+    for(int i = 0; i < 2; i++) {
+        if(draw_stats[i].frames) {
+            debug("Draw:\t%"PRIu64" %s frames, avg %"PRIu64"us max %"PRIu64"us, avg %"PRIu64" pixels\n",
+                  draw_stats[i].frames, i ? "damage only" : "whole window", draw_stats[i].time / draw_stats[i].frames / 1000,
+                  draw_stats[i].max / 1000, draw_stats[i].area / draw_stats[i].frames);
+        }
+    }
+}
+
 static void panel_draw_sub(PANEL *p, int x, int y, int width, int height)
 {
     FIX_XY_CORDS_FOR_SUBPANELS();
 
+    UI_RECT rect = { x, y, width, height }, view = draw_view, seen;
+    rect_intersect(&seen, &rect, &draw_view);
+    p->drawn_x = seen.x;
+    p->drawn_y = seen.y;
+    p->drawn_width = seen.width;
+    p->drawn_height = seen.height;
+
     if (p->content_scroll) {
         pushclip(x, y, width, height);
         y -= scroll_gety(p->content_scroll, height);
+        draw_view = seen;
     }
 
+    /* Panels with a type keep to their own rect, so one outside the damage doesn't need drawing */
+    UI_RECT damaged;
     if (p->type) {
-        drawfunc[p->type - 1](p, x, y, width, height);
+        if (rect_intersect(&damaged, &seen, &draw_damage)) {
+            drawfunc[p->type - 1](p, x, y, width, height);
+        }
     } else {
         if (p->drawfunc) {
             p->drawfunc(x, y, width, height);
@@ -1488,39 +1604,76 @@ static void panel_draw_sub(PANEL *p, int x, int y, int width, int height)
 
     if (p->content_scroll) {
         popclip();
+        draw_view = view;
     }
 }
 
 void panel_draw(PANEL *p, int x, int y, int width, int height)
 {
+    uint64_t start = get_time(), area = 0;
+
     FIX_XY_CORDS_FOR_SUBPANELS();
 
-    //pushclip(x, y, width, height);
+    /* Nothing but redraw_rect() since the last time, draw just those parts, one at a time */
+    UI_RECT all = { x, y, width, height };
+    _Bool partial = (!damage_all && damage_count);
+    int passes = partial ? damage_count : 1;
 
-    if(p->type) {
-        drawfunc[p->type - 1](p, x, y, width, height);
-    } else {
-        if(p->drawfunc) {
-            p->drawfunc(x, y, width, height);
+    for(int i = 0; i < passes; i++) {
+        if(partial) {
+            if(!rect_intersect(&draw_damage, &damage[i], &all)) {
+                continue;
+            }
+            pushclip(draw_damage.x, draw_damage.y, draw_damage.width, draw_damage.height);
+        } else {
+            draw_damage = all;
         }
-    }
+        draw_view = all;
 
-    PANEL **pp = p->child, *subp;
-    if(pp) {
-        while((subp = *pp++)) {
-            if(!subp->disabled) {
-                panel_draw_sub(subp, x, y, width, height);
+        p->drawn_x = x;
+        p->drawn_y = y;
+        p->drawn_width = width;
+        p->drawn_height = height;
+
+        if(p->type) {
+            drawfunc[p->type - 1](p, x, y, width, height);
+        } else {
+            if(p->drawfunc) {
+                p->drawfunc(x, y, width, height);
             }
         }
-    }
 
-    //popclip();
+        PANEL **pp = p->child, *subp;
+        if(pp) {
+            while((subp = *pp++)) {
+                if(!subp->disabled) {
+                    panel_draw_sub(subp, x, y, width, height);
+                }
+            }
+        }
+
+        dropdown_drawactive();
+        contextmenu_draw();
+        tooltip_draw();
+
+        if(partial) {
+            popclip();
+        }
+
+        enddraw(draw_damage.x, draw_damage.y, draw_damage.width, draw_damage.height);
+        area += (uint64_t)draw_damage.width * draw_damage.height;
+    }
 
-    dropdown_drawactive();
-    contextmenu_draw();
-    tooltip_draw();
+    damage_count = 0;
+    damage_all = 0;
 
-    enddraw(x, y, width, height);
+    uint64_t time = get_time() - start;
+    draw_stats[partial].frames++;
+    draw_stats[partial].time += time;
+    draw_stats[partial].area += area;
+    if(time > draw_stats[partial].max) {
+        draw_stats[partial].max = time;
+    }
 }
 
 _Bool panel_mmove(PANEL *p, int x, int y, int width, int height, int mx, int my, int dx, int dy)
@@ -1550,24 +1703,36 @@ _Bool panel_mmove(PANEL *p, int x, int y, int width, int height, int mx, int my,
     }
 
     _Bool draw = p->type ? mmovefunc[p->type - 1](p, x, y, width, height, mx, mmy, dx, dy) : 0;
+    if (draw) {
+        if (p->type == PANEL_DROPDOWN) {
+            /* An open dropdown is drawn over the panels below it */
+            redraw();
+        } else if (p->type != PANEL_SCROLLABLE) {
+            panel_redraw(p);
+        }
+    }
+
     // Has to be called before children mmove
-    if (p == &panel_root) {
-        draw |= tooltip_mmove();
+    if (p == &panel_root && tooltip_mmove()) {
+        draw = 1;
+        redraw();
     }
     PANEL **pp = p->child, *subp;
     if(pp) {
         while((subp = *pp++)) {
-            if(!subp->disabled) {
-                draw |= panel_mmove(subp, x, y, width, height, mx, my, dx, dy);
+            if(!subp->disabled && panel_mmove(subp, x, y, width, height, mx, my, dx, dy)) {
+                draw = 1;
+                if (subp->type == PANEL_SCROLLABLE) {
+                    /* The panels it scrolls are next to it */
+                    panel_redraw(p);
+                }
             }
         }
     }
 
-    if (p == &panel_root) {
-        draw |= contextmenu_mmove(mx, my, dx, dy);
-        if(draw) {
-            redraw();
-        }
+    if (p == &panel_root && contextmenu_mmove(mx, my, dx, dy)) {
+        draw = 1;
+        redraw();
     }
 
     return draw;
@@ -38,6 +38,10 @@ struct panel
     SCROLLABLE *content_scroll;
     void (*drawfunc)(int, int, int, int);
     PANEL **child;
+
+    // Part of the window the panel could be seen in when it was last drawn,
+    // so panel_redraw() knows what to draw again. 0 wide if none.
+    int drawn_x, drawn_y, drawn_width, drawn_height;
 };
 
 enum {
@@ -117,8 +121,23 @@ void ui_size(int width, int height);
 
 void ui_mouseleave(void);
 
+/** Draws p, or only the parts of it damaged since it was last drawn, if anything but redraw() damaged it since. Only
+ * the panels in those parts get drawn, and only those parts get copied to the screen. */
 void panel_draw(PANEL *p, int x, int y, int width, int height);
 
+/* Damage for panel_draw(), call redraw_rect() or redraw() rather than these, so the window gets drawn again too */
+void ui_damage(int x, int y, int width, int height);
+void ui_damage_all(void);
+
+/* redraw_rect() where p was drawn last */
+void panel_redraw(PANEL *p);
+
+/* redraw_rect() of the line that says the selected friend is typing */
+void redraw_friend_typing(void);
+
+/* Prints how long drawing the whole window and only parts of it took */
+void ui_debug_draw_stats(void);
+
 _Bool panel_mmove(PANEL *p, int x, int y, int width, int height, int mx, int my, int dx, int dy);
 void panel_mdown(PANEL *p);
 _Bool panel_dclick(PANEL *p, _Bool triclick);
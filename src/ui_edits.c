@@ -116,6 +116,7 @@ void edit_msg_onenter(EDIT *edit) {
         MESSAGE *msg = malloc(length + sizeof(MESSAGE));
         msg->author = 1;
         msg->msg_type = action ? MSG_TYPE_ACTION_TEXT : MSG_TYPE_TEXT;
+        msg->layout = NULL;
         msg->length = length;
         memcpy(msg->msg, text, length);
 
@@ -1,16 +1,9 @@
 #include "main.h"
 
-void postmessage_utoxav(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while(toxav_thread_msg) {
-        yieldcpu(1);
-    }
+static UTOX_MSG_QUEUE toxav_msg_queue = UTOX_MSG_QUEUE_INIT;
 
-    toxav_msg.msg = msg;
-    toxav_msg.param1 = param1;
-    toxav_msg.param2 = param2;
-    toxav_msg.data = data;
-
-    toxav_thread_msg = 1;
+void postmessage_utoxav(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    msg_queue_post_wait(&toxav_msg_queue, msg, param1, param2, data);
 }
 
 #define VERIFY_AUDIO_IN()   if (call_count) { \
@@ -39,11 +32,14 @@ void utox_av_ctrl_thread(void *args) {
     thread(utox_video_thread, av);
 
     while (1) {
-        if (toxav_thread_msg) {
-            TOX_MSG *msg = &toxav_msg;
+        TOX_MSG queued, *msg = &queued;
+        _Bool kill = 0, handled = 0;
+        while (msg_queue_get(&toxav_msg_queue, &queued)) {
             if (msg->msg == UTOXAV_KILL) {
+                kill = 1;
                 break;
             }
+            handled = 1;
 
             if (!utox_audio_thread_init || !utox_video_thread_init) {
                 yieldcpu(10);
@@ -210,15 +206,27 @@ void utox_av_ctrl_thread(void *args) {
                     break;
                 }
             }
+        }
+
+        if (kill) {
+            break;
+        }
+
+        if (handled) {
             VERIFY_AUDIO_IN();
         }
 
-        toxav_thread_msg = 0;
         toxav_iterate(av);
         yieldcpu(toxav_iteration_interval(av));
     }
 
-    toxav_thread_msg = 0;
+    /* Drop anything posted to this instance after the kill */
+    TOX_MSG dropped;
+    while (msg_queue_get(&toxav_msg_queue, &dropped)) {
+        debug("UTOXAV:\tDropping message %u posted after UTOXAV_KILL\n", dropped.msg);
+    }
+
+    msg_queue_debug_stats(&toxav_msg_queue, "UTOXAV");
     utox_av_ctrl_init = 0;
     debug("UTOXAV:\tClean thread exit!\n");
     return;
@@ -342,13 +350,14 @@ static void utox_av_incoming_frame_v(ToxAV *toxAV, uint32_t friend_number, uint1
     f->video_width = width;
     f->video_height = height;
 
-    utox_frame_pkg *frame = malloc(sizeof(*frame));
-    frame->w = width;
-    frame->h = height;
-    frame->img = malloc(width * height * 4);
+    utox_frame_pkg *frame = video_frame_pool_get(friend_number + 1, width, height);
+    if (!frame) {
+        debug("uToxAV:\tNo memory for video frame from friend %u\n", friend_number);
+        return;
+    }
 
     yuv420tobgr(width, height, y, u, v, ystride, ustride, vstride, frame->img);
-    postmessage(AV_VIDEO_FRAME, friend_number + 1, 0, (void*)frame);
+    video_frame_pool_post(friend_number + 1, 0);
 }
 
 static void utox_audio_friend_accepted(ToxAV *av, uint32_t friend_number) {
@@ -26,12 +26,88 @@ static _Bool utox_open_video_device(void *handle) {
 }
 
 static void utox_close_video_device(void *handle) {
-    if (handle >= (void*)2) {
+    if (handle == (void*)1) {
+        video_close((void*)1);
+        vpx_img_free(&input);
+    } else if (handle >= (void*)2) {
         video_close(*(void**)handle);
         vpx_img_free(&input);
     }
 }
 
+/* Three frames per stream, one being drawn by the UI, one being filled in by the producer, and the newest finished
+ * one in between. Producer and UI swap theirs with the one in between, and FRAME_POOL_FRESH says whether it's newer
+ * than what the UI last took. */
+#define FRAME_POOL_FRESH 4
+
+typedef struct {
+    utox_frame_pkg frame[3];
+    size_t         size[3]; /* bytes allocated for each frame's img */
+
+    _Bool            init;
+    uint8_t          back;    /* only used by the producer */
+    uint8_t          front;   /* only used by the UI */
+    volatile uint8_t pending; /* index of the frame in between, | FRAME_POOL_FRESH */
+
+    uint32_t posted, dropped;
+} UTOX_FRAME_POOL;
+
+static UTOX_FRAME_POOL frame_pool[UTOX_MAX_NUM_FRIENDS + 1];
+
+utox_frame_pkg* video_frame_pool_get(uint32_t id, uint16_t width, uint16_t height) {
+    UTOX_FRAME_POOL *pool = &frame_pool[id];
+    if (!pool->init) {
+        /* The UI doesn't look at the pool before the first AV_VIDEO_FRAME, which is posted after this */
+        pool->back    = 0;
+        pool->pending = 1;
+        pool->front   = 2;
+        pool->init    = 1;
+    }
+
+    utox_frame_pkg *frame = &pool->frame[pool->back];
+    size_t size = (size_t)width * height * 4;
+    if (pool->size[pool->back] < size) {
+        void *img = realloc(frame->img, size);
+        if (!img) {
+            return NULL;
+        }
+        frame->img = img;
+        pool->size[pool->back] = size;
+        debug("uToxVideo:\tFrame pool %u grown for %ux%u (%u frames posted, %u dropped)\n", id, width, height,
+              pool->posted, pool->dropped);
+    }
+
+    frame->w = width;
+    frame->h = height;
+    return frame;
+}
+
+void video_frame_pool_post(uint32_t id, _Bool preview) {
+    UTOX_FRAME_POOL *pool = &frame_pool[id];
+    uint8_t old = __atomic_exchange_n(&pool->pending, pool->back | FRAME_POOL_FRESH, __ATOMIC_ACQ_REL);
+    pool->back = old & ~FRAME_POOL_FRESH;
+
+    if (old & FRAME_POOL_FRESH) {
+        /* The UI hasn't taken the last one, it'll get this one instead with the message that's already waiting */
+        pool->dropped++;
+        return;
+    }
+
+    pool->posted++;
+    postmessage(AV_VIDEO_FRAME, id, preview, NULL);
+}
+
+utox_frame_pkg* video_frame_pool_take(uint32_t id) {
+    UTOX_FRAME_POOL *pool = &frame_pool[id];
+    if (!(__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) & FRAME_POOL_FRESH)) {
+        return NULL;
+    }
+
+    /* Only we clear FRAME_POOL_FRESH, so it's still set */
+    pool->front = __atomic_exchange_n(&pool->pending, pool->front, __ATOMIC_ACQ_REL) & ~FRAME_POOL_FRESH;
+    return &pool->frame[pool->front];
+}
+
 static          void    *video_device[16]     = {NULL}; /* TODO; magic number */
 static          int16_t  video_device_count   = 0;
 static volatile uint32_t video_device_current = 0;
@@ -147,16 +223,14 @@ void utox_video_thread(void *args) {
             if (r == 1) {
                 if (video_preview) {
                     /* Make a copy of the video frame for uTox to display */
-                    utox_frame_pkg *frame = malloc(sizeof(*frame));
-                    frame->w   = utox_video_frame.w;
-                    frame->h   = utox_video_frame.h;
-                    frame->img = malloc(utox_video_frame.w * utox_video_frame.h * 4);
+                    utox_frame_pkg *frame = video_frame_pool_get(0, utox_video_frame.w, utox_video_frame.h);
+                    if (frame) {
+                        yuv420tobgr(utox_video_frame.w, utox_video_frame.h,
+                                    utox_video_frame.y, utox_video_frame.u, utox_video_frame.v,
+                                    utox_video_frame.w, (utox_video_frame.w / 2), (utox_video_frame.w / 2), frame->img);
 
-                    yuv420tobgr(utox_video_frame.w, utox_video_frame.h,
-                                utox_video_frame.y, utox_video_frame.u, utox_video_frame.v,
-                                utox_video_frame.w, (utox_video_frame.w / 2), (utox_video_frame.w / 2), frame->img);
-
-                    postmessage(AV_VIDEO_FRAME, 0, 1, (void*)frame);
+                        video_frame_pool_post(0, 1);
+                    }
                 }
 
                 int i, active_video_count = 0;
@@ -30,6 +30,20 @@ typedef struct UTOX_FRAME_PKG {
 
 utox_av_video_frame utox_video_frame;
 
+/* Frames are handed to the UI through a small pool per video stream (0 for the preview, friend number + 1 for
+ * friends). Buffers are reused, and if the UI hasn't drawn the last frame yet when a new one is ready, the old one is
+ * dropped instead of queued. */
+
+/* Returns the frame to fill in next for stream id, with img big enough for width x height. Only the thread that
+ * produces stream id may call this. returns NULL if we're out of memory. */
+utox_frame_pkg* video_frame_pool_get(uint32_t id, uint16_t width, uint16_t height);
+
+/* Hands the frame from video_frame_pool_get() to the UI, posting AV_VIDEO_FRAME if it doesn't have one waiting. */
+void video_frame_pool_post(uint32_t id, _Bool preview);
+
+/* UI thread only; returns the newest frame of stream id, or NULL. It's valid until the next call for the same id. */
+utox_frame_pkg* video_frame_pool_take(uint32_t id);
+
 void utox_video_append_device(void *device, _Bool localized, void* name, _Bool default_);
 void utox_video_change_device(uint16_t i);
 
@@ -895,6 +895,11 @@ int file_unlock(FILE *file, uint64_t start, size_t length){
     return UnlockFileEx(file, 0, start, start + length, &lock_overlap);
 }
 
+int file_truncate(FILE *file, uint64_t size){
+    fflush(file);
+    return _chsize_s(_fileno(file), size);
+}
+
 /** Creates a tray baloon popup with the message, and flashes the main window
  *
  * accepts: char_t *title, title length, char_t *msg, msg length;
@@ -932,6 +937,10 @@ void redraw(void) {
     panel_draw(&panel_root, 0, 0, utox_window_width, utox_window_height);
 }
 
+void redraw_rect(int UNUSED(x), int UNUSED(y), int UNUSED(width), int UNUSED(height)) {
+    redraw();
+}
+
 /**
  * update_tray(void)
  * creates a win32 NOTIFYICONDATAW struct, sets the tiptab flag, gives *hwnd,
@@ -1937,6 +1946,27 @@ void video_frame(uint32_t id, uint8_t *img_data, uint16_t width, uint16_t height
     if(width == r.right && height == r.bottom) {
         SetDIBitsToDevice(dc, 0, 0, width, height, 0, 0, 0, height, img_data, &bmi, DIB_RGB_COLORS);
     } else {
-        StretchDIBits(dc, 0, 0, r.right, r.bottom, 0, 0, width, height, img_data, &bmi, DIB_RGB_COLORS, SRCCOPY);
+        /* StretchDIBits() drops or repeats whole rows and columns, filter the frame ourselves instead.
+         * The buffer is only ever used here, on the UI thread, and is kept around for the next frame. */
+        static uint8_t *scaled;
+        static size_t scaled_size;
+        size_t size = (size_t)r.right * r.bottom * 4;
+
+        if(size > scaled_size) {
+            uint8_t *new_scaled = realloc(scaled, size);
+            if(new_scaled) {
+                scaled = new_scaled;
+                scaled_size = size;
+            }
+        }
+
+        if(size && size <= scaled_size) {
+            scale_rgbx_image(img_data, width, height, scaled, r.right, r.bottom);
+            bmi.bmiHeader.biWidth = r.right;
+            bmi.bmiHeader.biHeight = -r.bottom;
+            SetDIBitsToDevice(dc, 0, 0, r.right, r.bottom, 0, 0, 0, r.bottom, scaled, &bmi, DIB_RGB_COLORS);
+        } else {
+            StretchDIBits(dc, 0, 0, r.right, r.bottom, 0, 0, width, height, img_data, &bmi, DIB_RGB_COLORS, SRCCOPY);
+        }
     }
 }
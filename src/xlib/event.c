@@ -15,6 +15,10 @@ _Bool doevent(XEvent event)
             return 1;
         }
 
+        if (video_window_event(&event)) {
+            return 1;
+        }
+
         if(event.type == ClientMessage) {
             XClientMessageEvent *ev = &event.xclient;
             if((Atom)event.xclient.data.l[0] == wm_delete_window) {
@@ -2,39 +2,66 @@
 
 static void font_info_open(FONT_INFO *i, FcPattern *pattern);
 
-Picture loadglyphpic(uint8_t *data, int width, int height, int pitch, _Bool no_subpixel, _Bool vertical, _Bool swap_blue_red)
+/* Uploads the bitmap of g to the glyphset of f that fits it, creating the glyphset if needed.
+ * returns the glyphset, or None on failure. */
+GlyphSet loadglyph(FONT *f, GLYPH *g, uint8_t *data, int pitch, _Bool no_subpixel, _Bool vertical, _Bool swap_blue_red)
 {
+    int width = g->width, height = g->height;
+    /* Empty glyphs only need their advance, keep them with the A8 ones so they don't split up runs */
     if(!width || !height) {
-        return None;
+        no_subpixel = 1;
+    }
+
+    GlyphSet *set = no_subpixel ? &f->glyphset_a8 : &f->glyphset_argb;
+    if(!*set) {
+        *set = XRenderCreateGlyphSet(display, XRenderFindStandardFormat(display, no_subpixel ? PictStandardA8 : PictStandardARGB32));
+        if(!*set) {
+            return None;
+        }
     }
 
-    Picture picture;
-    GC legc;
-    Pixmap pixmap;
-    XImage *img;
+    XGlyphInfo info = {
+        .width = width,
+        .height = height,
+        .x = -g->x,
+        .y = -g->y,
+        .xOff = g->xadvance,
+        .yOff = 0
+    };
+
+    Glyph id = g->ucs4;
+    uint8_t *image;
+    int size;
 
     if(no_subpixel) {
-        pixmap = XCreatePixmap(display, window, width, height, 8);
-        img = XCreateImage(display, CopyFromParent, 8, ZPixmap, 0, (char*)data, width, height, 8, 0);
-        legc = XCreateGC(display, pixmap, 0, NULL);
-        XPutImage(display, pixmap, legc, img, 0, 0, 0, 0, width, height);
-        picture = XRenderCreatePicture(display, pixmap, XRenderFindStandardFormat(display, PictStandardA8), 0, NULL);
-    } else {
+        /* Rows of A8 glyph images are padded to 4 bytes */
+        int stride = (width + 3) & ~3;
+        size = stride * height;
+        image = calloc(1, size ? size : 1);
+        if(!image) {
+            return None;
+        }
 
-        uint32_t *rgbx, *p, *end;
+        for(int row = 0; row < height; row++) {
+            memcpy(image + row * stride, data + row * pitch, width);
+        }
+    } else {
+        uint32_t *argb, *p, *end;
 
-        rgbx = malloc(4 * width * height);
-        if(!rgbx) {
+        size = 4 * width * height;
+        argb = malloc(size);
+        if(!argb) {
             return None;
         }
 
-        p = rgbx;
+        /* Alpha is ignored with component alpha, but keep it opaque like the RGB24 pictures used to be */
+        p = argb;
         int i = height;
         if (!vertical) {
             do {
                 end = p + width;
                 while(p != end) {
-                    *p++ = swap_blue_red ? RGB(data[2], data[1], data[0]) : RGB(data[0], data[1], data[2]);
+                    *p++ = 0xFF000000 | (swap_blue_red ? RGB(data[2], data[1], data[0]) : RGB(data[0], data[1], data[2]));
                     data += 3;
                 }
                 data += pitch - width * 3;
@@ -43,70 +70,76 @@ Picture loadglyphpic(uint8_t *data, int width, int height, int pitch, _Bool no_s
             do {
                 end = p + width;
                 while(p != end) {
-                    *p++ = swap_blue_red ? RGB(data[2 * pitch], data[1 * pitch], data[0]) : RGB(data[0], data[1 * pitch], data[2 * pitch]);
+                    *p++ = 0xFF000000 | (swap_blue_red ? RGB(data[2 * pitch], data[1 * pitch], data[0]) : RGB(data[0], data[1 * pitch], data[2 * pitch]));
                     data += 1;
                 }
                 data += (pitch - width) + (pitch * 2);
             } while(--i);
         }
 
-        pixmap = XCreatePixmap(display, window, width, height, depth);
-        img = XCreateImage(display, CopyFromParent, depth, ZPixmap, 0, (char*)rgbx, width, height, 32, 0);
-        legc = XCreateGC(display, pixmap, 0, NULL);
-        XPutImage(display, pixmap, legc, img, 0, 0, 0, 0, width, height);
+        image = (uint8_t*)argb;
+    }
 
+    XRenderAddGlyphs(display, *set, &id, &info, 1, (char*)image, size);
+    free(image);
 
+    return *set;
+}
 
-        XRenderPictureAttributes attr = {.component_alpha = 1};
-        picture = XRenderCreatePicture(display, pixmap, XRenderFindStandardFormat(display, PictStandardRGB24), CPComponentAlpha, &attr);
+/* Glyphs of a FONT are kept in an open addressing hash table with linear probing, keyed by codepoint. Codepoints none
+ * of the fonts have are kept as well, marked missing, so asking for them again doesn't go back to fontconfig. */
+#define GLYPH_TABLE_MIN_BITS 8
+#define GLYPH_EMPTY          (~(uint32_t)0)
 
-        free(rgbx);
+static GLYPH* glyph_slot(GLYPH *table, uint8_t bits, uint32_t ch)
+{
+    uint32_t mask = (1u << bits) - 1, pos = (ch * 2654435761u) >> (32 - bits);
+    while(table[pos].ucs4 != ch && table[pos].ucs4 != GLYPH_EMPTY) {
+        pos = (pos + 1) & mask;
     }
-
-    XFreeGC(display, legc);
-    XFreePixmap(display, pixmap);
-
-    return picture;
+    return &table[pos];
 }
 
-GLYPH* font_getglyph(FONT *f, uint32_t ch)
+static _Bool glyph_table_grow(FONT *f)
 {
-    uint32_t hash = ch % 128;
-    GLYPH *g = f->glyphs[hash], *s = g;
-    if(g) {
-        while(g->ucs4 != ~0) {
-            if(g->ucs4 == ch) {
-                return g;
-            }
-            g++;
-        }
+    uint8_t bits = f->glyph_bits ? f->glyph_bits + 1 : GLYPH_TABLE_MIN_BITS;
+    GLYPH *table = malloc(sizeof(GLYPH) << bits);
+    if(!table) {
+        return 0;
+    }
+    memset(table, 0xFF, sizeof(GLYPH) << bits);
 
-        if(!FcCharSetHasChar(charset, ch)) {
-            return NULL;
+    if(f->glyphs) {
+        for(uint32_t i = 0; i != 1u << f->glyph_bits; i++) {
+            if(f->glyphs[i].ucs4 != GLYPH_EMPTY) {
+                *glyph_slot(table, bits, f->glyphs[i].ucs4) = f->glyphs[i];
+            }
         }
+        free(f->glyphs);
+    }
 
-        uint32_t count = (uint32_t)(g - s);
-        g = realloc(s, (count + 2) * sizeof(GLYPH));
-        if(!g) {
-            return NULL;
-        }
+    f->glyphs = table;
+    f->glyph_bits = bits;
+    return 1;
+}
 
-        f->glyphs[hash] = g;
-        g += count;
-    } else {
-        if(!FcCharSetHasChar(charset, ch)) {
-            return NULL;
-        }
+/* returns the face of f that has ch, opening a fallback face from the system's font list if none of the ones we have
+ * do, or NULL */
+static FONT_INFO* font_getface(FONT *f, uint32_t ch)
+{
+    /* Text mostly sticks to one script, so try the face the last codepoint from the same block used first */
+    uint32_t block = ch >> 8;
+    if(!f->block_info) {
+        f->block_info = calloc(0x110000 >> 8, 1);
+    }
 
-        g = malloc(sizeof(GLYPH) * 2);
-        if(!g) {
-            return NULL;
+    if(f->block_info && block < 0x110000 >> 8 && f->block_info[block]) {
+        FONT_INFO *i = &f->info[f->block_info[block] - 1];
+        if(FcCharSetHasChar(i->cs, ch)) {
+            return i;
         }
-
-        f->glyphs[hash] = g;
     }
 
-    //return FcCharSetHasChar (pub->charset, ucs4);
     FONT_INFO *i = f->info;
     while(i->face) {
         if(FcCharSetHasChar(i->cs, ch)) {
@@ -153,26 +186,36 @@ GLYPH* font_getglyph(FONT *f, uint32_t ch)
         }
     }
 
-    int lcd_filter = FC_LCD_DEFAULT;
-    FcPatternGetInteger(f->pattern, FC_LCD_FILTER, 0, &lcd_filter);
-    FT_Library_SetLcdFilter( ftlib, lcd_filter);
+    uint32_t index = (uint32_t)(i - f->info);
+    if(f->block_info && block < 0x110000 >> 8 && index < UINT8_MAX) {
+        f->block_info[block] = index + 1;
+    }
+
+    return i;
+}
+
+/* Works out the FreeType flags from the fontconfig settings of f, once when the font is opened */
+static void font_render_flags(FONT *f)
+{
+    f->lcd_filter = FC_LCD_DEFAULT;
+    FcPatternGetInteger(f->pattern, FC_LCD_FILTER, 0, &f->lcd_filter);
 
     int ft_flags = FT_LOAD_DEFAULT;
     int ft_render_flags = FT_RENDER_MODE_NORMAL;
 
-    _Bool hinting = 1, antialias = 1, vertical_layout = 0, autohint = 0;
-    FcPatternGetBool(f->pattern, FC_HINTING, 0, (int *)&hinting);
-    FcPatternGetBool(f->pattern, FC_ANTIALIAS, 0, (int *)&antialias);
-    FcPatternGetBool(f->pattern, FC_VERTICAL_LAYOUT, 0, (int *)&vertical_layout);
-    FcPatternGetBool(f->pattern, FC_AUTOHINT, 0, (int *)&autohint);
+    FcBool hinting = 1, antialias = 1, vertical_layout = 0, autohint = 0;
+    FcPatternGetBool(f->pattern, FC_HINTING, 0, &hinting);
+    FcPatternGetBool(f->pattern, FC_ANTIALIAS, 0, &antialias);
+    FcPatternGetBool(f->pattern, FC_VERTICAL_LAYOUT, 0, &vertical_layout);
+    FcPatternGetBool(f->pattern, FC_AUTOHINT, 0, &autohint);
 
     int hint_style = FC_HINT_FULL;
-    FcPatternGetInteger(f->pattern, FC_HINT_STYLE, 0, (int *)&hint_style);
+    FcPatternGetInteger(f->pattern, FC_HINT_STYLE, 0, &hint_style);
 
     // int weight;
     // FcPatternGetInteger(f->pattern, FC_WEIGHT, 0, (int *)&weight);
     int subpixel = FC_RGBA_NONE;
-    FcPatternGetInteger(f->pattern, FC_RGBA, 0, (int *)&subpixel);
+    FcPatternGetInteger(f->pattern, FC_RGBA, 0, &subpixel);
 
     _Bool no_subpixel = (subpixel == FC_RGBA_NONE);
     _Bool vert = ft_vert;
@@ -204,12 +247,58 @@ GLYPH* font_getglyph(FONT *f, uint32_t ch)
     if (autohint)
         ft_flags |= FT_LOAD_FORCE_AUTOHINT;
 
-    g[1].ucs4 = ~0;
-    FT_Load_Char(i->face, ch, ft_flags);
-    FT_Render_Glyph(i->face->glyph, ft_render_flags);
-    FT_GlyphSlotRec *p = i->face->glyph;
+    f->ft_flags = ft_flags;
+    f->ft_render_flags = ft_render_flags;
+    f->no_subpixel = no_subpixel;
+}
+
+GLYPH* font_getglyph(FONT *f, uint32_t ch)
+{
+    if(ch == GLYPH_EMPTY) {
+        return NULL;
+    }
+
+    if(f->glyphs) {
+        GLYPH *g = glyph_slot(f->glyphs, f->glyph_bits, ch);
+        if(g->ucs4 == ch) {
+            return g->missing ? NULL : g;
+        }
+    }
+
+    /* Keep the table at most 3/4 full */
+    if((f->glyph_count + 1) * 4 > (3u << f->glyph_bits) && !glyph_table_grow(f)) {
+        return NULL;
+    }
 
+    GLYPH *g = glyph_slot(f->glyphs, f->glyph_bits, ch);
+    memset(g, 0, sizeof(*g));
     g->ucs4 = ch;
+    f->glyph_count++;
+
+    FONT_INFO *i = NULL;
+    if(FcCharSetHasChar(charset, ch)) {
+        i = font_getface(f, ch);
+    }
+
+    if(!i) {
+        g->missing = 1;
+        return NULL;
+    }
+
+    /* The LCD filter belongs to the library, only change it when switching between fonts that want different ones */
+    static int lcd_filter = -1;
+    if(f->lcd_filter != lcd_filter) {
+        lcd_filter = f->lcd_filter;
+        FT_Library_SetLcdFilter(ftlib, lcd_filter);
+    }
+
+    _Bool no_subpixel = f->no_subpixel;
+    _Bool vert = ft_vert;
+
+    FT_Load_Char(i->face, ch, f->ft_flags);
+    FT_Render_Glyph(i->face->glyph, f->ft_render_flags);
+    FT_GlyphSlotRec *p = i->face->glyph;
+
     g->x = p->bitmap_left;
     g->y = PIXELS(i->face->size->metrics.ascender) - p->bitmap_top;
     g->height = p->bitmap.rows;
@@ -228,6 +317,7 @@ GLYPH* font_getglyph(FONT *f, uint32_t ch)
         }
         free(p->bitmap.buffer);
         p->bitmap.buffer = mybuf;
+        p->bitmap.pitch = g->width;
         no_subpixel = 1;
     } else if (p->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY) {
         g->width = p->bitmap.width;
@@ -247,7 +337,7 @@ GLYPH* font_getglyph(FONT *f, uint32_t ch)
     }
 
     //debug("%u %u %u %u %C\n", PIXELS(i->face->size->metrics.height), g->width, g->height, p->bitmap.pitch, ch);
-    g->pic = loadglyphpic(p->bitmap.buffer, g->width, g->height, p->bitmap.pitch, no_subpixel, vert, ft_swap_blue_red);
+    g->set = loadglyph(f, g, p->bitmap.buffer, p->bitmap.pitch, no_subpixel, vert, ft_swap_blue_red);
 
     return g;
 }
@@ -372,6 +462,8 @@ static _Bool font_open(FONT *a_font, ...) {
 
     a_font->info[1].face = NULL;
 
+    font_render_flags(a_font);
+
     return 1;
 }
 
@@ -429,20 +521,22 @@ void freefonts(void) {
             free(f->info);
         }
 
-        int j = 0;
-        for(j = 0; j != countof(f->glyphs); j++) {
-            GLYPH *g = f->glyphs[j];
-            if(g) {
-                while(g->ucs4 != ~0) {
-                    if(g->pic) {
-                        XRenderFreePicture(display, g->pic);
-                    }
-                    g++;
-                }
+        free(f->glyphs);
+        f->glyphs = NULL;
+        f->glyph_bits = 0;
+        f->glyph_count = 0;
 
-                free(f->glyphs[j]);
-                f->glyphs[j] = NULL;
-            }
+        free(f->block_info);
+        f->block_info = NULL;
+
+        if(f->glyphset_a8) {
+            XRenderFreeGlyphSet(display, f->glyphset_a8);
+            f->glyphset_a8 = None;
+        }
+
+        if(f->glyphset_argb) {
+            XRenderFreeGlyphSet(display, f->glyphset_argb);
+            f->glyphset_argb = None;
         }
     }
 }
@@ -9,8 +9,8 @@ typedef struct
 {
     uint32_t ucs4;
     int16_t x, y;
-    uint16_t width, height, xadvance, xxxx;
-    Picture pic;
+    uint16_t width, height, xadvance, missing; /* missing: none of the fonts have it */
+    GlyphSet set; /* the glyph is in this one of its FONT's glyphsets, with ucs4 as its id */
 } GLYPH;
 
 typedef struct
@@ -23,7 +23,21 @@ typedef struct
 {
     FcPattern *pattern;
     FONT_INFO *info;
-    GLYPH *glyphs[128];
+
+    /* Hash table of 2^glyph_bits glyphs, see font_getglyph() */
+    GLYPH *glyphs;
+    uint8_t glyph_bits;
+    uint32_t glyph_count;
+
+    /* For each block of 256 codepoints, 1 + the index in info of the face last used for it, or 0 */
+    uint8_t *block_info;
+
+    /* FreeType flags worked out from pattern when the font is opened */
+    int ft_flags, ft_render_flags, lcd_filter;
+    _Bool no_subpixel;
+
+    /* Rendered glyphs live on the server, in an A8 glyphset or, for subpixel ones, an ARGB32 one */
+    GlyphSet glyphset_a8, glyphset_argb;
 } FONT;
 
 FT_Library ftlib;
@@ -33,7 +47,7 @@ FcFontSet *fs;
 
 _Bool ft_vert, ft_swap_blue_red;
 
-Picture loadglyphpic(uint8_t *data, int width, int height, int pitch, _Bool no_subpixel, _Bool vertical, _Bool swap_blue_red);
+GlyphSet loadglyph(FONT *f, GLYPH *g, uint8_t *data, int pitch, _Bool no_subpixel, _Bool vertical, _Bool swap_blue_red);
 GLYPH* font_getglyph(FONT *f, uint32_t ch);
 void initfonts(void);
 void loadfonts(void);
@@ -206,8 +206,32 @@ void drawalpha(int bm, int x, int y, int width, int height, uint32_t color)
     XRenderFreePicture(display, src);
 }
 
+/* Glyphs of a _drawtext() call waiting to be drawn. Consecutive glyphs from the same glyphset share one element, and
+ * everything goes to the server as a single XRenderCompositeText32(). */
+#define TEXT_BATCH_GLYPHS 256
+
+typedef struct {
+    XGlyphElt32  elt[TEXT_BATCH_GLYPHS];
+    unsigned int glyph[TEXT_BATCH_GLYPHS];
+    int elts, glyphs;
+    int x, y; /* where the first glyph goes */
+} TEXT_BATCH;
+
+static void text_batch_flush(TEXT_BATCH *batch)
+{
+    if(batch->glyphs) {
+        XRenderCompositeText32(display, PictOpOver, colorpic, renderpic, NULL, 0, 0, batch->x, batch->y, batch->elt, batch->elts);
+    }
+    batch->elts = 0;
+    batch->glyphs = 0;
+}
+
 static int _drawtext(int x, int xmax, int y, char_t *str, STRING_IDX length)
 {
+    TEXT_BATCH batch;
+    batch.elts = 0;
+    batch.glyphs = 0;
+
     GLYPH *g;
     uint8_t len;
     uint32_t ch;
@@ -219,16 +243,48 @@ static int _drawtext(int x, int xmax, int y, char_t *str, STRING_IDX length)
         g = font_getglyph(sfont, ch);
         if(g) {
             if(x + g->xadvance + UTOX_SCALE(5) > xmax && length) {
+                text_batch_flush(&batch);
                 return -x;
             }
 
-            if(g->pic) {
-                XRenderComposite(display, PictOpOver, colorpic, g->pic, renderpic, 0, 0, 0, 0, x + g->x, y + g->y, g->width, g->height);
+            if(!g->set) {
+                /* Couldn't be uploaded, skip it without losing our place */
+                text_batch_flush(&batch);
+            } else {
+                if(batch.glyphs == TEXT_BATCH_GLYPHS) {
+                    text_batch_flush(&batch);
+                }
+
+                if(!batch.glyphs) {
+                    /* The first element is positioned absolutely, glyph advances move along from there */
+                    batch.x = x;
+                    batch.y = y;
+                    batch.elt[0] = (XGlyphElt32){
+                        .glyphset = g->set,
+                        .chars = batch.glyph,
+                        .nchars = 0,
+                        .xOff = x,
+                        .yOff = y
+                    };
+                    batch.elts = 1;
+                } else if(batch.elt[batch.elts - 1].glyphset != g->set) {
+                    batch.elt[batch.elts++] = (XGlyphElt32){
+                        .glyphset = g->set,
+                        .chars = batch.glyph + batch.glyphs,
+                        .nchars = 0,
+                        .xOff = 0,
+                        .yOff = 0
+                    };
+                }
+
+                batch.glyph[batch.glyphs++] = g->ucs4;
+                batch.elt[batch.elts - 1].nchars++;
             }
             x += g->xadvance;
         }
     }
 
+    text_batch_flush(&batch);
     return x;
 }
 
@@ -289,6 +345,26 @@ void pushclip(int left, int top, int width, int height)
         //XSetClipMask(display, gc, drawbuf);
     }
 
+    /* Inside another clip, only draw where both allow it */
+    if(clipk) {
+        XRectangle *outer = &clip[clipk - 1];
+        int right = left + width, bottom = top + height;
+        if(left < outer->x) {
+            left = outer->x;
+        }
+        if(top < outer->y) {
+            top = outer->y;
+        }
+        if(right > outer->x + outer->width) {
+            right = outer->x + outer->width;
+        }
+        if(bottom > outer->y + outer->height) {
+            bottom = outer->y + outer->height;
+        }
+        width = (right > left) ? right - left : 0;
+        height = (bottom > top) ? bottom - top : 0;
+    }
+
     XRectangle *r = &clip[clipk++];
     r->x = left;
     r->y = top;
@@ -946,6 +1022,11 @@ int file_unlock(FILE *file, uint64_t start, size_t length){
     }
 }
 
+int file_truncate(FILE *file, uint64_t size){
+    fflush(file);
+    return ftruncate(fileno(file), size);
+}
+
 void notify(char_t *title, STRING_IDX title_length, char_t *msg, STRING_IDX msg_length, FRIEND *f) {
     if(havefocus) {
         return;
@@ -979,6 +1060,16 @@ void showkeyboard(_Bool show) {}
 void edit_will_deactivate(void) {}
 
 void redraw(void) {
+    ui_damage_all();
+    _redraw = 1;
+}
+
+void redraw_rect(int x, int y, int width, int height) {
+    if(width <= 0 || height <= 0) {
+        return;
+    }
+
+    ui_damage(x, y, width, height);
     _redraw = 1;
 }
 
@@ -995,6 +1086,7 @@ void force_redraw(void) {
             }
         }
     };
+    ui_damage_all();
     _redraw = 1;
     XSendEvent(display, window, 0, 0, &ev);
     XFlush(display);
@@ -1266,6 +1358,8 @@ int main(int argc, char *argv[]) {
     }
     BREAK:
 
+    ui_debug_draw_stats();
+
     postmessage_utoxav(UTOXAV_KILL, 0, 0, NULL);
     postmessage_toxcore(TOX_KILL, 0, 0, NULL);
 
@@ -113,7 +113,7 @@ _Bool havefocus;
 _Bool _redraw;
 uint16_t drawwidth, drawheight;
 
-Window video_win[MAX_NUM_FRIENDS];
+Window video_win[MAX_NUM_FRIENDS + 1]; /* 0 is the preview, friend number + 1 for friends */
 XImage *screen_image;
 
 extern int utox_v4l_fd;
@@ -146,6 +146,10 @@ Picture ximage_to_picture(XImage *img, const XRenderPictFormat *format);
 _Bool doevent(XEvent event);
 
 void tray_window_event(XEvent event);
+
+/* handles ConfigureNotify and MIT-SHM completion events of the video windows, returns 1 if the event was theirs */
+_Bool video_window_event(XEvent *event);
+
 void draw_tray_icon(void);
 void togglehide(void);
 
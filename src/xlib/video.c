@@ -1,11 +1,101 @@
 #include "../main.h"
 
+/* Every video window keeps an image and a Pixmap the size of the stream, and the window's own size from
+ * ConfigureNotify. A frame is copied into the image, uploaded to the Pixmap (through MIT-SHM when the server has it)
+ * and scaled into the window by XRender. */
+typedef struct {
+    XImage          *image;
+    XShmSegmentInfo shm;
+    _Bool           use_shm, put_pending; /* put_pending: server hasn't finished reading the shm image yet */
+
+    Pixmap  pixmap;
+    Picture pixmap_pic, window_pic;
+    uint16_t window_width, window_height;
+} VIDEO_WINDOW;
+
+static VIDEO_WINDOW video_window[MAX_NUM_FRIENDS + 1];
+static int shm_completion_event = -1; /* -1 until checked, 0 if the server doesn't do MIT-SHM */
+
+static void video_window_free_image(VIDEO_WINDOW *vw) {
+    if (!vw->image) {
+        return;
+    }
+
+    if (vw->use_shm) {
+        XShmDetach(display, &vw->shm);
+        /* Make sure the server is done with it before it goes away */
+        XSync(display, False);
+        shmdt(vw->shm.shmaddr);
+        vw->image->data = NULL;
+    }
+    XDestroyImage(vw->image);
+    XRenderFreePicture(display, vw->pixmap_pic);
+    XFreePixmap(display, vw->pixmap);
+
+    vw->image       = NULL;
+    vw->put_pending = 0;
+}
+
+static _Bool video_window_alloc_image(VIDEO_WINDOW *vw, uint16_t width, uint16_t height) {
+    if (shm_completion_event == -1) {
+        shm_completion_event = XShmQueryExtension(display) ? XShmGetEventBase(display) + ShmCompletion : 0;
+    }
+
+    vw->use_shm = 0;
+    if (shm_completion_event) {
+        vw->image = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &vw->shm, width, height);
+        if (vw->image) {
+            vw->shm.shmid = shmget(IPC_PRIVATE, vw->image->bytes_per_line * height, IPC_CREAT | 0600);
+            vw->shm.shmaddr = vw->shm.shmid < 0 ? (char*)-1 : shmat(vw->shm.shmid, 0, 0);
+            vw->shm.readOnly = True;
+
+            if (vw->shm.shmaddr != (char*)-1 && XShmAttach(display, &vw->shm)) {
+                vw->image->data = vw->shm.shmaddr;
+                vw->use_shm = 1;
+                /* Gets removed once both of us detach */
+                XSync(display, False);
+                shmctl(vw->shm.shmid, IPC_RMID, NULL);
+            } else {
+                debug("uToxVideo:\tMIT-SHM image failed, falling back to XPutImage\n");
+                if (vw->shm.shmaddr != (char*)-1) {
+                    shmdt(vw->shm.shmaddr);
+                }
+                if (vw->shm.shmid >= 0) {
+                    shmctl(vw->shm.shmid, IPC_RMID, NULL);
+                }
+                XDestroyImage(vw->image);
+                vw->image = NULL;
+            }
+        }
+    }
+
+    if (!vw->use_shm) {
+        vw->image = XCreateImage(display, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+        if (!vw->image) {
+            return 0;
+        }
+        vw->image->data = malloc(vw->image->bytes_per_line * height);
+        if (!vw->image->data) {
+            XDestroyImage(vw->image);
+            vw->image = NULL;
+            return 0;
+        }
+    }
+
+    vw->pixmap     = XCreatePixmap(display, window, width, height, depth);
+    vw->pixmap_pic = XRenderCreatePicture(display, vw->pixmap, pictformat, 0, NULL);
+    XRenderSetPictureFilter(display, vw->pixmap_pic, FilterBilinear, NULL, 0);
+    return 1;
+}
+
 void video_frame(uint32_t id, uint8_t *img_data, uint16_t width, uint16_t height, _Bool resize) {
     if (!video_win[id]) {
         debug("frame for null window %u\n", id);
         return;
     }
 
+    VIDEO_WINDOW *vw = &video_window[id];
+
     if (resize) {
         XWindowChanges changes = {
             .width = width,
@@ -14,39 +104,76 @@ void video_frame(uint32_t id, uint8_t *img_data, uint16_t width, uint16_t height
         XConfigureWindow(display, video_win[id], CWWidth | CWHeight, &changes);
     }
 
-    XWindowAttributes attrs;
-    XGetWindowAttributes(display, video_win[id], &attrs);
-
-    XImage image = {
-        .width = attrs.width,
-        .height = attrs.height,
-        .depth = 24,
-        .bits_per_pixel = 32,
-        .format = ZPixmap,
-        .byte_order = LSBFirst,
-        .bitmap_unit = 8,
-        .bitmap_bit_order = LSBFirst,
-        .bytes_per_line = attrs.width * 4,
-        .red_mask = 0xFF0000,
-        .green_mask = 0xFF00,
-        .blue_mask = 0xFF,
-        .data = (char*)img_data
-    };
+    if (vw->put_pending) {
+        /* The server is still reading the last frame, a newer one will come along */
+        return;
+    }
 
-    /* scale image if needed */
-    uint8_t *new_data = malloc(attrs.width * attrs.height * 4);
-    if (new_data && (attrs.width != width || attrs.height != height)) {
-        scale_rgbx_image(img_data, width, height, new_data, attrs.width, attrs.height);
-        image.data = (char*)new_data;
+    if (vw->image && (vw->image->width != width || vw->image->height != height)) {
+        video_window_free_image(vw);
     }
 
+    if (!vw->image && !video_window_alloc_image(vw, width, height)) {
+        debug("uToxVideo:\tUnable to create image for window %u\n", id);
+        return;
+    }
+
+    XImage *image = vw->image;
+    if (image->bytes_per_line == width * 4) {
+        memcpy(image->data, img_data, width * height * 4);
+    } else {
+        for (uint16_t row = 0; row < height; row++) {
+            memcpy(image->data + row * image->bytes_per_line, img_data + row * width * 4, width * 4);
+        }
+    }
 
     GC default_gc = DefaultGC(display, screen);
-    Pixmap pixmap = XCreatePixmap(display, window, attrs.width, attrs.height, depth);
-    XPutImage(display, pixmap, default_gc, &image, 0, 0, 0, 0, attrs.width, attrs.height);
-    XCopyArea(display, pixmap, video_win[id], default_gc, 0, 0, attrs.width, attrs.height, 0, 0);
-    XFreePixmap(display, pixmap);
-    free(new_data);
+    if (vw->use_shm) {
+        XShmPutImage(display, vw->pixmap, default_gc, image, 0, 0, 0, 0, width, height, True);
+        vw->put_pending = 1;
+    } else {
+        XPutImage(display, vw->pixmap, default_gc, image, 0, 0, 0, 0, width, height);
+    }
+
+    /* Scale the stream to the window */
+    XTransform trans = {
+        {{XDoubleToFixed((double)width / vw->window_width), 0, 0},
+         {0, XDoubleToFixed((double)height / vw->window_height), 0},
+         {0, 0, XDoubleToFixed(1.0)}}
+    };
+    XRenderSetPictureTransform(display, vw->pixmap_pic, &trans);
+    XRenderComposite(display, PictOpSrc, vw->pixmap_pic, None, vw->window_pic, 0, 0, 0, 0, 0, 0,
+                     vw->window_width, vw->window_height);
+    XFlush(display);
+}
+
+/* Called for ConfigureNotify and MIT-SHM completion events of windows other than the main one.
+ *
+ * returns 1 if the event was for one of the video windows. */
+_Bool video_window_event(XEvent *event) {
+    if (shm_completion_event > 0 && event->type == shm_completion_event) {
+        XShmCompletionEvent *ev = (XShmCompletionEvent*)event;
+        for (int i = 0; i <= MAX_NUM_FRIENDS; i++) {
+            if (video_window[i].image && video_window[i].pixmap == ev->drawable) {
+                video_window[i].put_pending = 0;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (event->type == ConfigureNotify) {
+        XConfigureEvent *ev = &event->xconfigure;
+        for (int i = 0; i <= MAX_NUM_FRIENDS; i++) {
+            if (video_win[i] && video_win[i] == ev->window) {
+                video_window[i].window_width  = ev->width  ? ev->width  : 1;
+                video_window[i].window_height = ev->height ? ev->height : 1;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
 }
 
 void video_begin(uint32_t id, char_t *name, STRING_IDX name_length, uint16_t width, uint16_t height) {
@@ -73,6 +200,12 @@ void video_begin(uint32_t id, char_t *name, STRING_IDX name_length, uint16_t wid
 
     XSetClassHint(display, *win, &hint);
 
+    /* Track the size from ConfigureNotify instead of asking the server every frame */
+    XSelectInput(display, *win, StructureNotifyMask);
+    video_window[id].window_width  = width;
+    video_window[id].window_height = height;
+    video_window[id].window_pic    = XRenderCreatePicture(display, *win, pictformat, 0, NULL);
+
     XMapWindow(display, *win);
     debug("new window %u\n", id);
 }
@@ -82,6 +215,10 @@ void video_end(uint32_t id) {
         return;
     }
 
+    video_window_free_image(&video_window[id]);
+    XRenderFreePicture(display, video_window[id].window_pic);
+    video_window[id].window_pic = None;
+
     XDestroyWindow(display, video_win[id]);
     video_win[id] = None;
     debug("killed window %u\n", id);
@@ -148,6 +285,36 @@ void desktopgrab(_Bool video) {
 
 static uint16_t video_x, video_y;
 
+/* Desktop capture only converts the parts of the screen that changed. The grab is split into tiles, and a tile is
+ * only converted again when its hash changes. If nothing changed no frame is sent at all, except for one every
+ * CAPTURE_KEEPALIVE so friends that joined late or lost a frame still get a picture. */
+#define CAPTURE_TILE_WIDTH  64
+#define CAPTURE_TILE_HEIGHT 16
+#define CAPTURE_KEEPALIVE   ((uint64_t)1000 * 1000 * 1000)
+
+static uint64_t *capture_tile_hash;
+static uint32_t capture_tiles_x, capture_tiles_y;
+static _Bool    capture_full; /* Convert every tile on the next grab */
+
+static struct {
+    uint64_t captured, skipped;
+    uint64_t convert_time; /* ns spent hashing and converting */
+} capture_stats;
+
+static uint64_t capture_hash_tile(const uint8_t *data, uint16_t width, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint16_t row = y; row < y + h; row++) {
+        const uint8_t *p = data + ((size_t)row * width + x) * 4;
+        /* w is always even, so this takes two pixels at a time */
+        for (uint16_t i = 0; i < w; i += 2) {
+            uint64_t pixels;
+            memcpy(&pixels, p + i * 4, sizeof(pixels));
+            hash = (hash ^ pixels) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
 _Bool video_init(void *handle) {
     if(isdesktop(handle)) {
         utox_v4l_fd = -1;
@@ -188,6 +355,16 @@ _Bool video_init(void *handle) {
             return 0;
         }
 
+        capture_tiles_x = (video_width  + CAPTURE_TILE_WIDTH  - 1) / CAPTURE_TILE_WIDTH;
+        capture_tiles_y = (video_height + CAPTURE_TILE_HEIGHT - 1) / CAPTURE_TILE_HEIGHT;
+        free(capture_tile_hash);
+        capture_tile_hash = calloc(capture_tiles_x * capture_tiles_y, sizeof(*capture_tile_hash));
+        if (!capture_tile_hash) {
+            return 0;
+        }
+        capture_full = 1;
+        memset(&capture_stats, 0, sizeof(capture_stats));
+
         return 1;
     }
 
@@ -197,6 +374,14 @@ _Bool video_init(void *handle) {
 void video_close(void *handle) {
     if(isdesktop(handle)) {
         XShmDetach(deskdisplay, &shminfo);
+        free(capture_tile_hash);
+        capture_tile_hash = NULL;
+
+        uint64_t grabs = capture_stats.captured + capture_stats.skipped;
+        if (grabs) {
+            debug("uToxVideo:\tDesktop capture: %"PRIu64" frames sent, %"PRIu64" skipped, %"PRIu64"us average convert time\n",
+                  capture_stats.captured, capture_stats.skipped, capture_stats.convert_time / grabs / 1000);
+        }
         return;
     }
 
@@ -221,7 +406,7 @@ _Bool video_endread(void) {
 
 int video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height) {
     if(utox_v4l_fd == -1) {
-        static uint64_t lasttime;
+        static uint64_t lasttime, lastsent;
         uint64_t t = get_time();
         if(t - lasttime >= (uint64_t)1000 * 1000 * 1000 / 24) {
             XShmGetImage(deskdisplay,RootWindow(deskdisplay, deskscreen), screen_image, video_x, video_y, AllPlanes);
@@ -229,9 +414,34 @@ int video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t
                 debug("uTox:\twidth/height mismatch %u %u != %u %u\n", width, height, screen_image->width, screen_image->height);
                 return 0;
             }
-
-            bgrxtoyuv420(y, u, v, (uint8_t*)screen_image->data, screen_image->width, screen_image->height);
             lasttime = t;
+
+            const uint8_t *data = (uint8_t*)screen_image->data;
+            _Bool changed = 0;
+            for (uint32_t tile_y = 0; tile_y < capture_tiles_y; tile_y++) {
+                for (uint32_t tile_x = 0; tile_x < capture_tiles_x; tile_x++) {
+                    uint16_t x = tile_x * CAPTURE_TILE_WIDTH, row = tile_y * CAPTURE_TILE_HEIGHT,
+                             w = width - x  < CAPTURE_TILE_WIDTH  ? width - x  : CAPTURE_TILE_WIDTH,
+                             h = height - row < CAPTURE_TILE_HEIGHT ? height - row : CAPTURE_TILE_HEIGHT;
+
+                    uint64_t hash = capture_hash_tile(data, width, x, row, w, h);
+                    uint64_t *tile = &capture_tile_hash[tile_y * capture_tiles_x + tile_x];
+                    if (capture_full || hash != *tile) {
+                        *tile = hash;
+                        bgrxtoyuv420_rect(y, u, v, data, width, x, row, w, h);
+                        changed = 1;
+                    }
+                }
+            }
+            capture_full = 0;
+            capture_stats.convert_time += get_time() - t;
+
+            if (!changed && t - lastsent < CAPTURE_KEEPALIVE) {
+                capture_stats.skipped++;
+                return 0;
+            }
+            capture_stats.captured++;
+            lastsent = t;
             return 1;
         }
         return 0;
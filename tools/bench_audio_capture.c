@@ -0,0 +1,121 @@
+/* Simulates how long captured audio waits before it's sent, with the capture loop of the audio thread in src/audio.c
+ * as it was and as it is.
+ *
+ * A fake capture device fills at 48kHz on the monotonic clock. The old loop slept a flat 50ms unless two frames were
+ * waiting. The new one sleeps until the samples still missing from the next frame are in, rounded up to the next
+ * millisecond, with pthread_cond_timedwait() like msg_queue_wait(). For every frame taken it measures how old its
+ * first sample is. 20ms of that is the frame itself, the rest is down to the loop.
+ *
+ * It only shows what the loops do on an ideal device, not the latency of real capture hardware.
+ *
+ * make bench builds and runs it.
+ *
+ * cc -pthread -o bench_audio_capture tools/bench_audio_capture.c
+ * ./bench_audio_capture [seconds per loop]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Same as UTOX_DEFAULT_SAMPLE_RATE_A and UTOX_DEFAULT_FRAME_A */
+#define SAMPLE_RATE 48000
+#define FRAME_SAMPLES (SAMPLE_RATE * 20 / 1000)
+
+static uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The fake device, started at device_start, of which device_taken samples were captured */
+static uint64_t device_start, device_taken;
+
+static uint32_t device_samples(void)
+{
+    return (get_time() - device_start) * SAMPLE_RATE / 1000000000 - device_taken;
+}
+
+/* Sleeps like msg_queue_wait() with nothing posted */
+static void wait_ms(uint32_t ms)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (ms % 1000) * 1000 * 1000;
+    if(until.tv_nsec >= 1000 * 1000 * 1000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&lock);
+    pthread_cond_timedwait(&cond, &lock, &until);
+    pthread_mutex_unlock(&lock);
+}
+
+static void run(_Bool frame_timer, uint64_t duration)
+{
+    uint64_t frames = 0, total = 0, max = 0;
+
+    device_start = get_time();
+    device_taken = 0;
+
+    while(get_time() - device_start < duration) {
+        uint32_t samples = device_samples();
+        _Bool sleep = 1;
+        uint32_t wait = 50;
+
+        if(samples >= FRAME_SAMPLES) {
+            /* The first sample of the frame was recorded as long ago as all the samples waiting take */
+            uint64_t recorded = get_time() - (uint64_t)samples * 1000000000 / SAMPLE_RATE;
+            device_taken += FRAME_SAMPLES;
+            samples -= FRAME_SAMPLES;
+
+            uint64_t age = get_time() - recorded;
+            frames++;
+            total += age;
+            if(age > max) {
+                max = age;
+            }
+
+            if(!frame_timer && samples >= FRAME_SAMPLES) {
+                sleep = 0;
+            }
+        }
+
+        if(frame_timer) {
+            if(samples >= FRAME_SAMPLES) {
+                sleep = 0;
+            } else {
+                wait = ((FRAME_SAMPLES - samples) * 1000 + SAMPLE_RATE - 1) / SAMPLE_RATE;
+            }
+        }
+
+        if(sleep) {
+            if(frame_timer) {
+                wait_ms(wait);
+            } else {
+                usleep(50 * 1000);
+            }
+        }
+    }
+
+    printf("%-12s %llu frames, oldest sample avg %.2fms max %.2fms old at send, avg %.2fms more than the frame\n",
+           frame_timer ? "frame timer" : "yieldcpu(50)", (unsigned long long)frames, total / 1e6 / frames, max / 1e6,
+           total / 1e6 / frames - 20);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t duration = (argc > 1 ? strtoull(argv[1], NULL, 10) : 4) * 1000000000ull;
+
+    run(0, duration);
+    run(1, duration);
+    return 0;
+}
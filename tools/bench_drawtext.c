@@ -0,0 +1,399 @@
+/* Benchmarks the X requests that drawing text takes, with _drawtext() of src/xlib/main.c as it was and as it is, by
+ * scrolling through a backlog of 128 messages. It includes src/xlib/freetype.c, so glyphs come from the real glyph
+ * cache and are rendered by FreeType from the fonts fontconfig finds.
+ *
+ * The old _drawtext() did an XRenderComposite() for every glyph with a picture, and loadglyphpic() made every glyph a
+ * Pixmap and a Picture, which took 6 requests. The new one puts glyphs in a glyphset with one XRenderAddGlyphs() and
+ * draws a whole string with one XRenderCompositeText32(). main.c can't be built without the rest of uTox, so this has
+ * a copy of both _drawtext()s, and the Xlib and XRender calls they make only count the requests and the bytes those
+ * would send. There is no server: the time is what it takes uTox to work out the requests, not to draw them.
+ *
+ * Every message is wrapped like the chat does it, one line is one string, and a frame draws the lines that fit in the
+ * window. Each frame scrolls 3 lines further, like a turn of the mouse wheel. The first frame of each run starts with
+ * the glyph cache empty.
+ *
+ * make bench builds and runs it. It includes the uTox headers, so it builds with the same flags as uTox.
+ *
+ * cc -pthread -o bench_drawtext tools/bench_drawtext.c $(pkg-config --cflags --libs <the uTox DEPS>)
+ * ./bench_drawtext [window height in pixels]
+ */
+#include "../src/xlib/freetype.c"
+
+#define MESSAGES 128
+
+uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Same as utf8_len_read() of src/util.c, for all but the 5 and 6 byte forms no text has */
+uint8_t utf8_len_read(char_t *data, uint32_t *ch)
+{
+    uint8_t a = data[0];
+    if(!(a & 0x80)) {
+        *ch = data[0];
+        return 1;
+    }
+
+    if(!(a & 0x20)) {
+        *ch = ((data[0] & 0x1F) << 6) | (data[1] & 0x3F);
+        return 2;
+    }
+
+    if(!(a & 0x10)) {
+        *ch = ((data[0] & 0xF) << 12) | ((data[1] & 0x3F) << 6) | (data[2] & 0x3F);
+        return 3;
+    }
+
+    *ch = ((data[0] & 0x7) << 18) | ((data[1] & 0x3F) << 12) | ((data[2] & 0x3F) << 6) | (data[3] & 0x3F);
+    return 4;
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* What the Xlib and XRender calls would have sent */
+static _Bool old_drawtext_run;
+static uint64_t requests, request_bytes;
+
+static void request(uint64_t bytes)
+{
+    requests++;
+    request_bytes += (bytes + 3) & ~3;
+}
+
+static XRenderPictFormat standard_format;
+
+XRenderPictFormat* XRenderFindStandardFormat(Display *UNUSED(dpy), int UNUSED(format))
+{
+    return &standard_format;
+}
+
+int XRenderQuerySubpixelOrder(Display *UNUSED(dpy), int UNUSED(screen))
+{
+    return SubPixelUnknown;
+}
+
+GlyphSet XRenderCreateGlyphSet(Display *UNUSED(dpy), _Xconst XRenderPictFormat *UNUSED(format))
+{
+    static GlyphSet last;
+    if(!old_drawtext_run) {
+        request(12);
+    }
+    return ++last;
+}
+
+void XRenderFreeGlyphSet(Display *UNUSED(dpy), GlyphSet UNUSED(glyphset))
+{
+}
+
+void XRenderAddGlyphs(Display *UNUSED(dpy), GlyphSet UNUSED(glyphset), _Xconst Glyph *UNUSED(gids),
+                      _Xconst XGlyphInfo *UNUSED(glyphs), int nglyphs, _Xconst char *UNUSED(images), int nbyte_images)
+{
+    if(old_drawtext_run) {
+        /* loadglyphpic() of an image as big: XCreatePixmap(), XCreateGC(), XPutImage(), XRenderCreatePicture(),
+         * XFreeGC() and XFreePixmap() */
+        if(nbyte_images) {
+            request(16);
+            request(16);
+            request(24 + nbyte_images);
+            request(24);
+            request(8);
+            request(8);
+        }
+    } else {
+        request(12 + nglyphs * (4 + 12) + nbyte_images);
+    }
+}
+
+void XRenderComposite(Display *UNUSED(dpy), int UNUSED(op), Picture UNUSED(src), Picture UNUSED(mask),
+                      Picture UNUSED(dst), int UNUSED(src_x), int UNUSED(src_y), int UNUSED(mask_x), int UNUSED(mask_y),
+                      int UNUSED(dst_x), int UNUSED(dst_y), unsigned int UNUSED(width), unsigned int UNUSED(height))
+{
+    request(36);
+}
+
+void XRenderCompositeText32(Display *UNUSED(dpy), int UNUSED(op), Picture UNUSED(src), Picture UNUSED(dst),
+                            _Xconst XRenderPictFormat *UNUSED(maskFormat), int UNUSED(xSrc), int UNUSED(ySrc),
+                            int UNUSED(xDst), int UNUSED(yDst), _Xconst XGlyphElt32 *elts, int nelt)
+{
+    uint64_t bytes = 28;
+    for(int i = 0; i < nelt; i++) {
+        bytes += 8 + 4 * elts[i].nchars;
+    }
+    request(bytes);
+}
+
+/* The old _drawtext(), where a glyph had a picture if it wasn't empty */
+static int old_drawtext(int x, int xmax, int y, char_t *str, STRING_IDX length)
+{
+    GLYPH *g;
+    uint8_t len;
+    uint32_t ch;
+    while(length) {
+        len = utf8_len_read(str, &ch);
+        str += len;
+        length -= len;
+
+        g = font_getglyph(sfont, ch);
+        if(g) {
+            if(x + g->xadvance + UTOX_SCALE(5) > xmax && length) {
+                return -x;
+            }
+
+            if(g->width && g->height) {
+                XRenderComposite(display, PictOpOver, colorpic, g->set, renderpic, 0, 0, 0, 0, x + g->x, y + g->y,
+                                 g->width, g->height);
+            }
+            x += g->xadvance;
+        }
+    }
+
+    return x;
+}
+
+/* The new _drawtext() */
+#define TEXT_BATCH_GLYPHS 256
+
+typedef struct {
+    XGlyphElt32  elt[TEXT_BATCH_GLYPHS];
+    unsigned int glyph[TEXT_BATCH_GLYPHS];
+    int elts, glyphs;
+    int x, y;
+} TEXT_BATCH;
+
+static void text_batch_flush(TEXT_BATCH *batch)
+{
+    if(batch->glyphs) {
+        XRenderCompositeText32(display, PictOpOver, colorpic, renderpic, NULL, 0, 0, batch->x, batch->y, batch->elt,
+                               batch->elts);
+    }
+    batch->elts = 0;
+    batch->glyphs = 0;
+}
+
+static int new_drawtext(int x, int xmax, int y, char_t *str, STRING_IDX length)
+{
+    TEXT_BATCH batch;
+    batch.elts = 0;
+    batch.glyphs = 0;
+
+    GLYPH *g;
+    uint8_t len;
+    uint32_t ch;
+    while(length) {
+        len = utf8_len_read(str, &ch);
+        str += len;
+        length -= len;
+
+        g = font_getglyph(sfont, ch);
+        if(g) {
+            if(x + g->xadvance + UTOX_SCALE(5) > xmax && length) {
+                text_batch_flush(&batch);
+                return -x;
+            }
+
+            if(!g->set) {
+                text_batch_flush(&batch);
+            } else {
+                if(batch.glyphs == TEXT_BATCH_GLYPHS) {
+                    text_batch_flush(&batch);
+                }
+
+                if(!batch.glyphs) {
+                    batch.x = x;
+                    batch.y = y;
+                    batch.elt[0] = (XGlyphElt32){
+                        .glyphset = g->set,
+                        .chars = batch.glyph,
+                        .nchars = 0,
+                        .xOff = x,
+                        .yOff = y
+                    };
+                    batch.elts = 1;
+                } else if(batch.elt[batch.elts - 1].glyphset != g->set) {
+                    batch.elt[batch.elts++] = (XGlyphElt32){
+                        .glyphset = g->set,
+                        .chars = batch.glyph + batch.glyphs,
+                        .nchars = 0,
+                        .xOff = 0,
+                        .yOff = 0
+                    };
+                }
+
+                batch.glyph[batch.glyphs++] = g->ucs4;
+                batch.elt[batch.elts - 1].nchars++;
+            }
+            x += g->xadvance;
+        }
+    }
+
+    text_batch_flush(&batch);
+    return x;
+}
+
+/* The backlog, as lines of at most the width of the chat */
+static char_t *text;
+static struct {
+    uint32_t start;
+    STRING_IDX length;
+} *lines;
+static uint32_t line_count;
+
+static int text_width(char_t *str, STRING_IDX length)
+{
+    int width = 0;
+    while(length) {
+        uint32_t ch;
+        uint8_t len = utf8_len_read(str, &ch);
+        str += len;
+        length -= len;
+
+        GLYPH *g = font_getglyph(sfont, ch);
+        if(g) {
+            width += g->xadvance;
+        }
+    }
+    return width;
+}
+
+/* Writes MESSAGES messages of chat from a few languages and wraps them at width, returns 0 if out of memory */
+static _Bool make_backlog(int width)
+{
+    static const char *words[] = {
+        "the", "file", "is", "on", "its", "way,", "call", "me", "when", "you're", "back", "from", "lunch.", "did",
+        "anyone", "see", "the", "build", "break?", "works", "for", "me", "now", "thanks!", "привет,", "как", "дела?",
+        "καλημέρα", "φίλε", "ok", "see", "you", "tomorrow", "at", "10:30", "https://utox.org", "lol", "tox",
+    };
+
+    uint32_t size = MESSAGES * 1024;
+    text = malloc(size);
+    lines = malloc(MESSAGES * 64 * sizeof(*lines));
+    if(!text || !lines) {
+        return 0;
+    }
+
+    uint32_t used = 0;
+    for(int m = 0; m < MESSAGES; m++) {
+        /* Mostly short messages, now and then a long one */
+        uint32_t count = 1 + random_next() % 12;
+        if(random_next() % 8 == 0) {
+            count += 40 + random_next() % 60;
+        }
+
+        uint32_t line_start = used;
+        int x = 0, space = text_width((char_t*)" ", 1);
+        for(uint32_t w = 0; w < count; w++) {
+            const char *word = words[random_next() % countof(words)];
+            int word_width = text_width((char_t*)word, strlen(word));
+
+            if(x && x + space + word_width > width) {
+                lines[line_count].start = line_start;
+                lines[line_count++].length = used - line_start;
+                line_start = used;
+                x = 0;
+            } else if(x) {
+                text[used++] = ' ';
+                x += space;
+            }
+
+            memcpy(text + used, word, strlen(word));
+            used += strlen(word);
+            x += word_width;
+        }
+        lines[line_count].start = line_start;
+        lines[line_count++].length = used - line_start;
+    }
+
+    return 1;
+}
+
+static void run(_Bool old, int width, int height, int lineheight)
+{
+    /* Start with no glyphs */
+    freefonts();
+    loadfonts();
+    sfont = &font[FONT_TEXT];
+    old_drawtext_run = old;
+
+    uint32_t visible = height / lineheight + 1, frames = 0;
+    uint64_t first_requests = 0, first_bytes = 0, first_time = 0, total_time = 0, max_requests = 0;
+    requests = request_bytes = 0;
+
+    for(uint32_t top = 0; top + visible <= line_count || !frames; top += 3) {
+        uint64_t start = get_time(), start_requests = requests;
+
+        for(uint32_t i = top; i < top + visible && i < line_count; i++) {
+            int y = (i - top) * lineheight;
+            if(old) {
+                old_drawtext(0, INT_MAX, y, text + lines[i].start, lines[i].length);
+            } else {
+                new_drawtext(0, INT_MAX, y, text + lines[i].start, lines[i].length);
+            }
+        }
+
+        uint64_t took = get_time() - start;
+        if(!frames) {
+            first_requests = requests;
+            first_bytes = request_bytes;
+            first_time = took;
+        } else {
+            total_time += took;
+            if(requests - start_requests > max_requests) {
+                max_requests = requests - start_requests;
+            }
+        }
+        frames++;
+    }
+
+    printf("%-12s first frame %llu requests, %llu KiB, %.0fus; then %u frames of %.0f requests (at most %llu), "
+           "%.1f KiB, %.1fus on average\n", old ? "old drawtext" : "new drawtext", (unsigned long long)first_requests,
+           (unsigned long long)first_bytes / 1024, first_time / 1e3, frames - 1,
+           (double)(requests - first_requests) / (frames - 1), (unsigned long long)max_requests,
+           (request_bytes - first_bytes) / 1024.0 / (frames - 1), total_time / 1e3 / (frames - 1));
+}
+
+int main(int argc, char *argv[])
+{
+    int height = argc > 1 ? atoi(argv[1]) : 600;
+    if(height <= 0) {
+        printf("usage: %s [window height in pixels]\n", argv[0]);
+        return 1;
+    }
+
+    ui_scale = DEFAULT_SCALE;
+    initfonts();
+    loadfonts();
+    sfont = &font[FONT_TEXT];
+    if(!sfont->info[0].face) {
+        printf("No font for the text\n");
+        return 1;
+    }
+
+    /* About 60 characters a line */
+    int width = UTOX_SCALE(230), lineheight = (sfont->info[0].face->size->metrics.height + (1 << 5)) >> 6;
+    if(!make_backlog(width)) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    printf("%u messages in %u lines of up to %dpx, %d lines of %dpx in the window\n", MESSAGES, line_count, width,
+           height / lineheight + 1, lineheight);
+    run(1, width, height, lineheight);
+    run(0, width, height, lineheight);
+
+    freefonts();
+    free(lines);
+    free(text);
+    return 0;
+}
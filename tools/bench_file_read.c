@@ -0,0 +1,188 @@
+/* Benchmarks how outgoing file chunks are read, in outgoing_file_callback_chunk() of src/file_transfers.c, as it was
+ * and as it is.
+ *
+ * The old callback did an fseeko() and an fread() of every chunk into a buffer on the stack. The new one reads
+ * FILE_READ_AHEAD_SIZE at a time with utox_file_read_ahead(), of which this has a copy, and hands toxcore a slice of
+ * that. Either way the chunk is copied once more, like tox_file_send_chunk() copies it into a packet.
+ *
+ * Chunks are asked for like toxcore does: in order, MAX_FILE_DATA_SIZE (1371 bytes) at a time, and now and then
+ * again from a bit further back, as if it had lost some. The file is fresh, so it's in the page cache and what's
+ * measured is stdio and the system calls, not the disk.
+ *
+ * make bench builds and runs it.
+ *
+ * cc -o bench_file_read tools/bench_file_read.c
+ * ./bench_file_read [file size in MiB]
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Same as MAX_FILE_DATA_SIZE of toxcore */
+#define CHUNK_SIZE 1371
+
+#define FILE_READ_AHEAD_SIZE (1024 * 1024)
+
+static char file_path[] = "/tmp/bench_file_read.XXXXXX";
+
+static uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* The fields of FILE_TRANSFER that utox_file_read_ahead() uses */
+typedef struct {
+    FILE *file;
+    uint8_t *read_buffer;
+    uint64_t read_position;
+    size_t read_length;
+    uint32_t read_count;
+} TRANSFER;
+
+/* utox_file_read_ahead() */
+static const uint8_t* read_ahead(TRANSFER *file, uint64_t position, size_t length)
+{
+    if(position < file->read_position || position + length > file->read_position + file->read_length) {
+        if(!file->read_buffer) {
+            file->read_buffer = malloc(FILE_READ_AHEAD_SIZE);
+            if(!file->read_buffer) {
+                return NULL;
+            }
+        }
+        fseeko(file->file, position, SEEK_SET);
+        file->read_position = position;
+        file->read_length = fread(file->read_buffer, 1, FILE_READ_AHEAD_SIZE, file->file);
+        file->read_count++;
+
+        if(length > file->read_length) {
+            return NULL;
+        }
+    }
+
+    return file->read_buffer + (position - file->read_position);
+}
+
+static uint8_t packet[CHUNK_SIZE];
+
+/* The old way, returns 0 if a chunk couldn't be read */
+static _Bool send_chunk_fread(TRANSFER *file, uint64_t position, size_t length)
+{
+    uint8_t buffer[length];
+    fseeko(file->file, position, SEEK_SET);
+    size_t read_size = fread(buffer, 1, length, file->file);
+    file->read_count++;
+    if(read_size != length) {
+        return 0;
+    }
+    memcpy(packet, buffer, length);
+    return 1;
+}
+
+/* The new way */
+static _Bool send_chunk_read_ahead(TRANSFER *file, uint64_t position, size_t length)
+{
+    const uint8_t *data = read_ahead(file, position, length);
+    if(!data) {
+        return 0;
+    }
+    memcpy(packet, data, length);
+    return 1;
+}
+
+static _Bool run(_Bool new_way, uint64_t size)
+{
+    TRANSFER file = { .file = fopen(file_path, "rb") };
+    if(!file.file) {
+        printf("Unable to open %s\n", file_path);
+        return 0;
+    }
+
+    random_state = 1;
+    uint64_t chunks = 0, again = 0, position = 0, check = 0;
+    uint64_t start = get_time();
+
+    while(position < size) {
+        size_t length = size - position < CHUNK_SIZE ? size - position : CHUNK_SIZE;
+        uint64_t ask = position;
+
+        /* Lost chunks are asked for again, from up to 32 chunks back */
+        if(position >= 32 * CHUNK_SIZE && random_next() % 100 == 0) {
+            ask -= (1 + random_next() % 32) * CHUNK_SIZE;
+            length = CHUNK_SIZE;
+            again++;
+        } else {
+            position += length;
+        }
+
+        if(!(new_way ? send_chunk_read_ahead(&file, ask, length) : send_chunk_fread(&file, ask, length))) {
+            printf("Unable to read %zu bytes at %llu\n", length, (unsigned long long)ask);
+            fclose(file.file);
+            free(file.read_buffer);
+            return 0;
+        }
+        check += packet[0] + packet[length - 1];
+        chunks++;
+    }
+
+    uint64_t took = get_time() - start;
+    fclose(file.file);
+    free(file.read_buffer);
+
+    printf("%-22s %llu chunks (%llu again), %u fread()s, %.0f chunks/s, %.0f MiB/s, checksum %llu\n",
+           new_way ? "utox_file_read_ahead()" : "fseeko() + fread()", (unsigned long long)chunks,
+           (unsigned long long)again, file.read_count, chunks / (took / 1e9), size / 1048576.0 / (took / 1e9),
+           (unsigned long long)check);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t size = (argc > 1 ? strtoull(argv[1], NULL, 10) : 256) * 1024 * 1024;
+    if(!size) {
+        printf("usage: %s [file size in MiB]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = mkstemp(file_path);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "wb");
+    if(!file) {
+        printf("Unable to make a file to read\n");
+        return 1;
+    }
+
+    /* Not the same byte everywhere, so the checksums show both ways read the same chunks */
+    uint8_t block[65536];
+    for(uint64_t written = 0; written < size; written += sizeof(block)) {
+        for(size_t i = 0; i < sizeof(block); i++) {
+            block[i] = random_next();
+        }
+        fwrite(block, 1, size - written < sizeof(block) ? size - written : sizeof(block), file);
+    }
+    fclose(file);
+
+    /* Twice each, to show how much the numbers vary from run to run */
+    _Bool ok = 1;
+    for(int round = 0; round < 2 && ok; round++) {
+        ok = run(0, size) && run(1, size);
+    }
+
+    remove(file_path);
+    return !ok;
+}
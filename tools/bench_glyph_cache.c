@@ -0,0 +1,328 @@
+/* Benchmarks font_getglyph() of src/xlib/freetype.c, which it includes, against the one it replaced, over text that
+ * mixes Latin with Cyrillic, Greek, CJK and emoji.
+ *
+ * The old font_getglyph() hashed codepoints into 128 buckets, each an array it scanned, looked through every face for
+ * the codepoint when it wasn't cached, and read the render settings of the font again for every glyph it rendered. It
+ * didn't remember codepoints none of the fonts have, so those were looked for in charset every time. This has a copy
+ * of it, working on a FONT of its own opened like the text font. Both render the same glyphs with FreeType; the
+ * XRender calls that would upload them do nothing.
+ *
+ * The first pass over the text starts with nothing cached, the second finds every glyph in the cache. Which codepoints
+ * have a glyph depends on the fonts fontconfig finds.
+ *
+ * make bench builds and runs it. It includes the uTox headers, so it builds with the same flags as uTox.
+ *
+ * cc -pthread -o bench_glyph_cache tools/bench_glyph_cache.c $(pkg-config --cflags --libs <the uTox DEPS>)
+ * ./bench_glyph_cache [codepoints]
+ */
+#include "../src/xlib/freetype.c"
+
+static XRenderPictFormat standard_format;
+
+XRenderPictFormat* XRenderFindStandardFormat(Display *UNUSED(dpy), int UNUSED(format))
+{
+    return &standard_format;
+}
+
+int XRenderQuerySubpixelOrder(Display *UNUSED(dpy), int UNUSED(screen))
+{
+    return SubPixelUnknown;
+}
+
+GlyphSet XRenderCreateGlyphSet(Display *UNUSED(dpy), _Xconst XRenderPictFormat *UNUSED(format))
+{
+    static GlyphSet last;
+    return ++last;
+}
+
+void XRenderFreeGlyphSet(Display *UNUSED(dpy), GlyphSet UNUSED(glyphset))
+{
+}
+
+void XRenderAddGlyphs(Display *UNUSED(dpy), GlyphSet UNUSED(glyphset), _Xconst Glyph *UNUSED(gids),
+                      _Xconst XGlyphInfo *UNUSED(glyphs), int UNUSED(nglyphs), _Xconst char *UNUSED(images),
+                      int UNUSED(nbyte_images))
+{
+}
+
+uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* The old font_getglyph(), with its buckets in old_glyphs instead of the FONT */
+static GLYPH *old_glyphs[128];
+
+static GLYPH* old_getglyph(FONT *f, uint32_t ch)
+{
+    uint32_t hash = ch % 128;
+    GLYPH *g = old_glyphs[hash], *s = g;
+    if(g) {
+        while(g->ucs4 != ~0) {
+            if(g->ucs4 == ch) {
+                return g;
+            }
+            g++;
+        }
+
+        if(!FcCharSetHasChar(charset, ch)) {
+            return NULL;
+        }
+
+        uint32_t count = (uint32_t)(g - s);
+        g = realloc(s, (count + 2) * sizeof(GLYPH));
+        if(!g) {
+            return NULL;
+        }
+
+        old_glyphs[hash] = g;
+        g += count;
+    } else {
+        if(!FcCharSetHasChar(charset, ch)) {
+            return NULL;
+        }
+
+        g = malloc(sizeof(GLYPH) * 2);
+        if(!g) {
+            return NULL;
+        }
+
+        old_glyphs[hash] = g;
+    }
+
+    FONT_INFO *i = f->info;
+    while(i->face) {
+        if(FcCharSetHasChar(i->cs, ch)) {
+            break;
+        }
+        i++;
+    }
+
+    if(!i->face) {
+        uint32_t count = (uint32_t)(i - f->info);
+        i = realloc(f->info, (count + 2) * sizeof(FONT_INFO));
+        if(!i) {
+            return NULL;
+        }
+
+        f->info = i;
+        i += count;
+
+        i[1].face = NULL;
+
+        int j;
+        for(j = 0; j != fs->nfont; j++) {
+            FcCharSet *cs;
+
+            FcPatternGetCharSet(fs->fonts[j], FC_CHARSET, 0, &cs);
+            if(FcCharSetHasChar(cs, ch)) {
+                FcPattern *p = FcPatternDuplicate(fs->fonts[j]);
+
+                double size;
+                if(!FcPatternGetDouble(f->pattern, FC_PIXEL_SIZE, 0, &size)) {
+                    FcPatternAddDouble(p, FC_PIXEL_SIZE, size);
+                }
+
+                font_info_open(i, p);
+                FcPatternDestroy(p);
+                break;
+            }
+        }
+
+        if(!i->face) {
+            return NULL;
+        }
+    }
+
+    int lcd_filter = FC_LCD_DEFAULT;
+    FcPatternGetInteger(f->pattern, FC_LCD_FILTER, 0, &lcd_filter);
+    FT_Library_SetLcdFilter(ftlib, lcd_filter);
+
+    int ft_flags = FT_LOAD_DEFAULT;
+    int ft_render_flags = FT_RENDER_MODE_NORMAL;
+
+    FcBool hinting = 1, antialias = 1, vertical_layout = 0, autohint = 0;
+    FcPatternGetBool(f->pattern, FC_HINTING, 0, &hinting);
+    FcPatternGetBool(f->pattern, FC_ANTIALIAS, 0, &antialias);
+    FcPatternGetBool(f->pattern, FC_VERTICAL_LAYOUT, 0, &vertical_layout);
+    FcPatternGetBool(f->pattern, FC_AUTOHINT, 0, &autohint);
+
+    int hint_style = FC_HINT_FULL;
+    FcPatternGetInteger(f->pattern, FC_HINT_STYLE, 0, &hint_style);
+
+    int subpixel = FC_RGBA_NONE;
+    FcPatternGetInteger(f->pattern, FC_RGBA, 0, &subpixel);
+
+    _Bool no_subpixel = (subpixel == FC_RGBA_NONE);
+    _Bool vert = ft_vert;
+
+    if (no_subpixel) {
+        ft_render_flags = FT_RENDER_MODE_NORMAL;
+    } else {
+        ft_render_flags |= (vert ? FT_RENDER_MODE_LCD_V : FT_RENDER_MODE_LCD);
+    }
+
+    if (antialias) {
+        if (hint_style == FC_HINT_NONE) {
+            ft_flags |= FT_LOAD_NO_HINTING;
+        } else if (hint_style == FC_HINT_SLIGHT) {
+            ft_flags |= FT_LOAD_TARGET_LIGHT;
+        } else if (hint_style == FC_HINT_FULL && !no_subpixel) {
+            ft_flags |= (vert ? FT_LOAD_TARGET_LCD_V : FT_LOAD_TARGET_LCD);
+        } else {
+            ft_flags |= FT_LOAD_TARGET_NORMAL;
+        }
+    } else {
+        ft_flags |= FT_LOAD_TARGET_MONO;
+        ft_render_flags = FT_RENDER_MODE_NORMAL;
+    }
+
+    if (vertical_layout)
+        ft_flags |= FT_LOAD_VERTICAL_LAYOUT;
+
+    if (autohint)
+        ft_flags |= FT_LOAD_FORCE_AUTOHINT;
+
+    /* Rendered like font_getglyph() does, minus turning mono bitmaps into A8 ones, which the text font doesn't need */
+    g[1].ucs4 = ~0;
+    FT_Load_Char(i->face, ch, ft_flags);
+    FT_Render_Glyph(i->face->glyph, ft_render_flags);
+    FT_GlyphSlotRec *p = i->face->glyph;
+
+    memset(g, 0, sizeof(*g));
+    g->ucs4 = ch;
+    g->x = p->bitmap_left;
+    g->y = PIXELS(i->face->size->metrics.ascender) - p->bitmap_top;
+    g->height = p->bitmap.rows;
+    g->xadvance = (p->advance.x + (1 << 5)) >> 6;
+    g->width = p->bitmap.pixel_mode == FT_PIXEL_MODE_LCD ? p->bitmap.width / 3 : p->bitmap.width;
+    if(p->bitmap.pixel_mode == FT_PIXEL_MODE_LCD_V) {
+        g->height = p->bitmap.rows / 3;
+    }
+
+    g->set = loadglyph(f, g, p->bitmap.buffer, p->bitmap.pitch, no_subpixel, vert, ft_swap_blue_red);
+
+    return g;
+}
+
+static void old_free(void)
+{
+    for(int i = 0; i < 128; i++) {
+        free(old_glyphs[i]);
+        old_glyphs[i] = NULL;
+    }
+}
+
+/* Half Latin, then some Cyrillic, Greek, CJK and emoji, each from a range of commonly used codepoints */
+static uint32_t* mixed_text(uint32_t count)
+{
+    uint32_t *text = malloc(count * sizeof(*text));
+    if(!text) {
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t r = random_next() % 20;
+        if(r < 10) {
+            text[i] = 0x20 + random_next() % 95;
+        } else if(r < 13) {
+            text[i] = 0x410 + random_next() % 64;
+        } else if(r < 14) {
+            text[i] = 0x3B1 + random_next() % 25;
+        } else if(r < 18) {
+            text[i] = 0x4E00 + random_next() % 3000;
+        } else {
+            text[i] = 0x1F600 + random_next() % 80;
+        }
+    }
+    return text;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 20;
+    if(!count) {
+        printf("usage: %s [codepoints]\n", argv[0]);
+        return 1;
+    }
+
+    ui_scale = DEFAULT_SCALE;
+    initfonts();
+    loadfonts();
+
+    /* The old lookup gets a FONT of its own, opened like the text font, so neither shares the other's faces */
+    FONT old_font = { 0 };
+    font_open(&old_font, FC_FAMILY, FcTypeString, "Roboto", FC_PIXEL_SIZE, FcTypeDouble, UTOX_SCALE(12.0) / 2.0,
+              FC_WEIGHT, FcTypeInteger, FC_WEIGHT_NORMAL, FC_SLANT, FcTypeInteger, FC_SLANT_ROMAN, NULL);
+
+    FONT *new_font = &font[FONT_TEXT];
+    if(!new_font->info[0].face || !old_font.info[0].face) {
+        printf("No font for the text\n");
+        return 1;
+    }
+
+    uint32_t *text = mixed_text(count);
+    if(!text) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    uint64_t old_sum = 0, new_sum = 0;
+    uint32_t found = 0;
+    for(int pass = 0; pass < 2; pass++) {
+        uint64_t start = get_time();
+        for(uint32_t i = 0; i < count; i++) {
+            GLYPH *g = old_getglyph(&old_font, text[i]);
+            old_sum += g ? g->xadvance : 0;
+        }
+        uint64_t old_time = get_time() - start;
+
+        start = get_time();
+        found = 0;
+        for(uint32_t i = 0; i < count; i++) {
+            GLYPH *g = font_getglyph(new_font, text[i]);
+            if(g) {
+                new_sum += g->xadvance;
+                found++;
+            }
+        }
+        uint64_t new_time = get_time() - start;
+
+        printf("%s: 128 buckets %.1fns per codepoint, open addressing %.1fns per codepoint\n",
+               pass ? "cached" : "empty cache", (double)old_time / count, (double)new_time / count);
+    }
+
+    uint32_t faces = 0;
+    while(new_font->info[faces].face) {
+        faces++;
+    }
+    printf("%u codepoints, %u of them with a glyph; %u different ones cached, from %u faces\n", count, found,
+           new_font->glyph_count, faces);
+
+    if(old_sum != new_sum) {
+        printf("The old and new lookup disagree on the glyphs\n");
+    }
+
+    old_free();
+    for(FONT_INFO *i = old_font.info; i->face; i++) {
+        FT_Done_Face(i->face);
+    }
+    free(old_font.info);
+    FcPatternDestroy(old_font.pattern);
+    free(text);
+    freefonts();
+    return old_sum != new_sum;
+}
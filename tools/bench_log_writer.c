@@ -0,0 +1,261 @@
+/* Benchmarks the log writer thread of src/log_writer.c against the log_write() it replaced, which opened, appended to
+ * and closed the log and its record index for every record, on the toxcore thread.
+ *
+ * Records come in like they do on the toxcore thread: a few every iteration, then a 1ms sleep. Each run prints the
+ * time the posting thread spent per record, the CPU time of the whole process and the wall time, and then checks that
+ * every log reads back as whole records that match its record index.
+ *
+ * make bench builds and runs it. It includes the uTox headers, so it builds with the same flags as uTox.
+ *
+ * cc -pthread -fcommon -o bench_log_writer tools/bench_log_writer.c src/log_writer.c src/msg_queue.c
+ *     $(pkg-config --cflags <the uTox DEPS>)
+ * ./bench_log_writer [friends [records [records per iteration]]]
+ *
+ * Without arguments it runs a few setups, from one busy chat to more friends than the writer keeps logs open for.
+ */
+#include "../src/main.h"
+
+static char data_dir[] = "/tmp/bench_log_writer.XXXXXX";
+
+uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int datapath(uint8_t *dest)
+{
+    return sprintf((char*)dest, "%s/", data_dir);
+}
+
+int log_file_name_key(uint8_t *dest, size_t size_dest, const uint8_t *key, const char *ext)
+{
+    return snprintf((char*)dest, size_dest, "%02x%02x%s", key[0], key[1], ext);
+}
+
+void yieldcpu(uint32_t ms)
+{
+    usleep(1000 * ms);
+}
+
+void postmessage_search(uint8_t msg, uint32_t param1, uint32_t param2, void *data)
+{
+    free(data);
+}
+
+static void friend_key(uint8_t *cid, uint32_t number)
+{
+    memset(cid, 0, TOX_PUBLIC_KEY_SIZE);
+    cid[0] = number;
+    cid[1] = number >> 8;
+}
+
+static void friend_path(uint8_t *path, uint32_t number, const char *ext)
+{
+    uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+    friend_key(cid, number);
+    int length = datapath(path);
+    log_file_name_key(path + length, UTOX_FILE_NAME_LENGTH - length, cid, ext);
+}
+
+/* The old log_write(), minus asking toxcore for the name and key */
+static void old_log_write(const uint8_t *cid, const uint8_t *message, uint16_t length)
+{
+    uint8_t path[UTOX_FILE_NAME_LENGTH];
+    int p = datapath(path);
+    log_file_name_key(path + p, sizeof(path) - p, cid, ".txt");
+
+    FILE *file = fopen((char*)path, "ab");
+    if(!file) {
+        return;
+    }
+
+    LOG_FILE_MSG_HEADER header = { .time = time(NULL), .namelen = 10, .length = length };
+    fseeko(file, 0, SEEK_END);
+    LOG_FILE_INDEX_RECORD record = { .offset = ftello(file), .time = header.time };
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite("friendname", 10, 1, file);
+    fwrite(message, length, 1, file);
+    fclose(file);
+
+    log_file_name_key(path + p, sizeof(path) - p, cid, ".idx");
+    file = fopen((char*)path, "r+b");
+    if(file) {
+        fseeko(file, 0, SEEK_END);
+        if(ftello(file) % sizeof(record) == 0) {
+            fwrite(&record, sizeof(record), 1, file);
+        }
+        fclose(file);
+    }
+}
+
+/* What log_write() does now */
+static void new_log_write(const uint8_t *cid, const uint8_t *message, uint16_t length)
+{
+    LOG_WRITE *w = malloc(sizeof(*w) + 10 + length);
+    memcpy(w->cid, cid, TOX_PUBLIC_KEY_SIZE);
+    memcpy(w->data, "friendname", 10);
+    memcpy(w->data + 10, message, length);
+    w->length = 10 + length;
+    w->header = (LOG_FILE_MSG_HEADER){ .time = time(NULL), .namelen = 10, .length = length };
+
+    postmessage_log(LOG_WRITER_RECORD, cid[0], 0, w);
+}
+
+/* Starts count friends with an empty log and record index, returns 0 if it couldn't */
+static _Bool reset_logs(uint32_t count)
+{
+    uint8_t path[UTOX_FILE_NAME_LENGTH];
+
+    for(uint32_t f = 0; f < count; f++) {
+        friend_path(path, f, ".txt");
+        remove((char*)path);
+
+        friend_path(path, f, ".idx");
+        FILE *file = fopen((char*)path, "wb");
+        if(!file) {
+            return 0;
+        }
+        fclose(file);
+    }
+    return 1;
+}
+
+/* returns 1 if the logs of count friends have records whole records between them, each at the offset its record
+ * index has for it */
+static _Bool check_logs(uint32_t count, uint32_t records)
+{
+    uint64_t total = 0;
+
+    for(uint32_t f = 0; f < count; f++) {
+        uint8_t path[UTOX_FILE_NAME_LENGTH];
+        friend_path(path, f, ".txt");
+        FILE *log = fopen((char*)path, "rb");
+        friend_path(path, f, ".idx");
+        FILE *index = fopen((char*)path, "rb");
+        if(!log || !index) {
+            printf("log %u is missing\n", f);
+            return 0;
+        }
+
+        LOG_FILE_MSG_HEADER header;
+        LOG_FILE_INDEX_RECORD record;
+        uint64_t offset = 0;
+        while(fread(&header, sizeof(header), 1, log) == 1) {
+            if(fread(&record, sizeof(record), 1, index) != 1 || record.offset != offset) {
+                printf("record %llu of log %u doesn't match its index\n", (unsigned long long)total, f);
+                return 0;
+            }
+            offset += sizeof(header) + header.namelen + header.length;
+            fseeko(log, offset, SEEK_SET);
+            total++;
+        }
+
+        fclose(index);
+        fclose(log);
+    }
+
+    if(total != records) {
+        printf("%llu records written of %u\n", (unsigned long long)total, records);
+        return 0;
+    }
+    return 1;
+}
+
+/* Writes records records for friend_count friends, burst per iteration, the old way and then the new way. returns 0 if
+ * the logs came out wrong. */
+static _Bool bench(uint32_t friend_count, uint32_t records, uint32_t burst)
+{
+    uint8_t message[100];
+    memset(message, 'x', sizeof(message));
+
+    _Bool ok = 1;
+    for(int mode = 0; mode < 2 && ok; mode++) {
+        if(!reset_logs(friend_count)) {
+            printf("Unable to write to %s\n", data_dir);
+            return 0;
+        }
+
+        uint64_t start = get_time(), posting = 0;
+        struct timespec cpu_start, cpu_end;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+        for(uint32_t n = 0; n < records;) {
+            uint64_t tick = get_time();
+            for(uint32_t k = 0; k < burst && n < records; k++, n++) {
+                uint8_t cid[TOX_PUBLIC_KEY_SIZE];
+                friend_key(cid, n % friend_count);
+                if(mode) {
+                    new_log_write(cid, message, 60 + n % 40);
+                } else {
+                    old_log_write(cid, message, 60 + n % 40);
+                }
+            }
+            posting += get_time() - tick;
+            yieldcpu(1);
+        }
+
+        if(mode) {
+            log_writer_close(NULL);
+        }
+
+        uint64_t wall = get_time() - start;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+        double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e3 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+
+        printf("%-13s %u records, %u friends, %u per iteration: %.2fus per record on the posting thread, "
+               "%.1fms CPU in all, %.0fms wall\n", mode ? "log writer" : "old log_write", records, friend_count, burst,
+               posting / 1e3 / records, cpu, wall / 1e6);
+
+        ok = check_logs(friend_count, records);
+    }
+
+    reset_logs(friend_count);
+    for(uint32_t f = 0; f < friend_count; f++) {
+        uint8_t path[UTOX_FILE_NAME_LENGTH];
+        friend_path(path, f, ".idx");
+        remove((char*)path);
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    /* One busy chat, a few, and more than LOG_WRITER_HANDLES, which has the writer close a log for every record */
+    static const struct {
+        uint32_t friends, records, burst;
+    } setups[] = {
+        { 1, 5000, 1 },
+        { 5, 20000, 10 },
+        { 24, 20000, 10 },
+        { 60, 20000, 10 },
+    };
+
+    if(!mkdtemp(data_dir)) {
+        printf("Unable to make a directory for the logs\n");
+        return 1;
+    }
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, (void*(*)(void*))log_writer_thread, NULL);
+
+    _Bool ok = 1;
+    if(argc > 1) {
+        uint32_t friend_count = atoi(argv[1]), records = argc > 2 ? atoi(argv[2]) : 20000,
+                 burst = argc > 3 ? atoi(argv[3]) : 10;
+        if(!friend_count || friend_count > 256 || !burst) {
+            printf("usage: %s [friends, at most 256 [records [records per iteration]]]\n", argv[0]);
+            ok = 0;
+        } else {
+            ok = bench(friend_count, records, burst);
+        }
+    } else {
+        for(uint32_t i = 0; i < sizeof(setups) / sizeof(*setups) && ok; i++) {
+            ok = bench(setups[i].friends, setups[i].records, setups[i].burst);
+        }
+    }
+
+    rmdir(data_dir);
+    return !ok;
+}
@@ -0,0 +1,149 @@
+/* Benchmarks how long a message posted to the toxcore thread waits before it's handled, with the loop of
+ * toxcore_thread() in src/tox.c as it was and as it is. It includes src/msg_queue.c.
+ *
+ * The old loop slept for tox_iteration_interval(), at most 20ms, with yieldcpu() and then handled what was posted
+ * meanwhile. The new one sleeps in msg_queue_wait() for the whole interval, and goes straight back to handling after
+ * it was woken up. tox_iterate() and tox_iteration_interval() are stood in for by a fixed interval.
+ *
+ * A producer thread posts messages at random times, like the UI does, and the loop notes how long each waited from
+ * msg_queue_post() to the point where the toxcore thread would call tox_friend_send_message(). Then nothing is posted
+ * for a while, and the loop counts how often it wakes up.
+ *
+ * make bench builds and runs it. It includes the uTox headers, so it builds with the same flags as uTox.
+ *
+ * cc -pthread -o bench_msg_queue tools/bench_msg_queue.c $(pkg-config --cflags <the uTox DEPS>)
+ * ./bench_msg_queue [tox_iteration_interval() in ms [messages]]
+ */
+#include "../src/msg_queue.c"
+
+uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void yieldcpu(uint32_t ms)
+{
+    usleep(1000 * ms);
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+enum {
+    BENCH_MSG = 1,
+    BENCH_STOP,
+};
+
+static UTOX_MSG_QUEUE queue = UTOX_MSG_QUEUE_INIT;
+
+static uint32_t interval_ms = 50;
+static _Bool event_driven;
+
+static uint64_t *latency;
+static uint32_t latency_count, wakeups;
+
+static void* loop_thread(void *UNUSED(args))
+{
+    while(1) {
+        /* tox_iterate() would go here */
+        wakeups++;
+
+        TOX_MSG msg;
+        int handled = 0;
+        while(handled < UTOX_MSG_QUEUE_SIZE && msg_queue_get(&queue, &msg)) {
+            if(msg.msg == BENCH_STOP) {
+                return NULL;
+            }
+            latency[latency_count++] = get_time() - queue.last_posted;
+            handled++;
+        }
+
+        if(event_driven) {
+            if(!handled) {
+                msg_queue_wait(&queue, interval_ms);
+            }
+        } else {
+            yieldcpu(interval_ms > 20 ? 20 : interval_ms);
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void run(_Bool new_loop, uint32_t messages)
+{
+    event_driven = new_loop;
+    latency_count = 0;
+    wakeups = 0;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_thread, NULL);
+
+    /* Up to 20ms apart, so the posts don't line up with the sleeps of either loop */
+    for(uint32_t i = 0; i < messages; i++) {
+        usleep(random_next() % 20000);
+        msg_queue_post_wait(&queue, BENCH_MSG, i, 0, NULL);
+    }
+
+    /* Idle, only waking up for toxcore */
+    usleep(100 * 1000);
+    uint32_t busy_wakeups = wakeups;
+    uint64_t idle_start = get_time();
+    usleep(2000 * 1000);
+    double idle_wakeups = (wakeups - busy_wakeups) / ((get_time() - idle_start) / 1e9);
+
+    msg_queue_post_wait(&queue, BENCH_STOP, 0, 0, NULL);
+    pthread_join(thread, NULL);
+
+    qsort(latency, latency_count, sizeof(*latency), compare_u64);
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < latency_count; i++) {
+        total += latency[i];
+    }
+
+    printf("%-16s %u messages, post to handle avg %.3fms, median %.3fms, 99%% %.3fms, max %.3fms; "
+           "%.1f wakeups/s idle\n", new_loop ? "msg_queue_wait()" : "yieldcpu(<=20)", latency_count,
+           total / 1e6 / latency_count, latency[latency_count / 2] / 1e6, latency[latency_count * 99 / 100] / 1e6,
+           latency[latency_count - 1] / 1e6, idle_wakeups);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t messages = 500;
+    if(argc > 1) {
+        interval_ms = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        messages = atoi(argv[2]);
+    }
+    if(!interval_ms || !messages) {
+        printf("usage: %s [tox_iteration_interval() in ms [messages]]\n", argv[0]);
+        return 1;
+    }
+
+    latency = malloc(messages * sizeof(*latency));
+    if(!latency) {
+        return 1;
+    }
+
+    printf("tox_iteration_interval() of %ums\n", interval_ms);
+    run(0, messages);
+    run(1, messages);
+
+    free(latency);
+    return 0;
+}
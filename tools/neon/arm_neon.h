@@ -0,0 +1,111 @@
+/* Portable C stand-ins for the NEON intrinsics the image conversions use, so their NEON kernels can be compiled and
+ * checked on any machine. Every vector type is a distinct struct, so mixing them up fails to compile just like it
+ * does with the real arm_neon.h. Only meant for tests, it's slow. */
+#include <stdint.h>
+#include <string.h>
+
+#define NEON_EMU_TYPE(name, type, lanes) typedef struct { type lane[lanes]; } name;
+NEON_EMU_TYPE(uint8x8_t, uint8_t, 8)
+NEON_EMU_TYPE(uint16x4_t, uint16_t, 4)
+NEON_EMU_TYPE(uint16x8_t, uint16_t, 8)
+NEON_EMU_TYPE(uint32x2_t, uint32_t, 2)
+NEON_EMU_TYPE(uint32x4_t, uint32_t, 4)
+NEON_EMU_TYPE(int16x4_t, int16_t, 4)
+NEON_EMU_TYPE(int16x8_t, int16_t, 8)
+NEON_EMU_TYPE(int32x4_t, int32_t, 4)
+typedef struct { uint8x8_t val[2]; } uint8x8x2_t;
+typedef struct { uint8x8_t val[4]; } uint8x8x4_t;
+
+#define NEON_EMU_FOR(n) for (int i = 0; i < (n); i++)
+
+static inline uint8_t neon_emu_sat_u8(int32_t x) { return x < 0 ? 0 : x > 255 ? 255 : x; }
+static inline int16_t neon_emu_sat_s16(int32_t x) { return x < -32768 ? -32768 : x > 32767 ? 32767 : x; }
+
+/* Loads and stores */
+static inline uint8x8_t vld1_u8(const uint8_t *p) { uint8x8_t r; memcpy(r.lane, p, 8); return r; }
+static inline void vst1_u8(uint8_t *p, uint8x8_t a) { memcpy(p, a.lane, 8); }
+static inline uint8x8x4_t vld4_u8(const uint8_t *p) {
+    uint8x8x4_t r;
+    NEON_EMU_FOR(8) { for (int k = 0; k < 4; k++) { r.val[k].lane[i] = p[4 * i + k]; } }
+    return r;
+}
+static inline void vst4_u8(uint8_t *p, uint8x8x4_t a) {
+    NEON_EMU_FOR(8) { for (int k = 0; k < 4; k++) { p[4 * i + k] = a.val[k].lane[i]; } }
+}
+static inline uint32x2_t vld1_lane_u32(const uint32_t *p, uint32x2_t a, const int lane) {
+    memcpy(&a.lane[lane], p, 4);
+    return a;
+}
+static inline void vst1_lane_u32(uint32_t *p, uint32x2_t a, const int lane) { memcpy(p, &a.lane[lane], 4); }
+
+/* Duplicates */
+static inline uint8x8_t vdup_n_u8(uint8_t x) { uint8x8_t r; NEON_EMU_FOR(8) { r.lane[i] = x; } return r; }
+static inline uint16x4_t vdup_n_u16(uint16_t x) { uint16x4_t r; NEON_EMU_FOR(4) { r.lane[i] = x; } return r; }
+static inline uint32x2_t vdup_n_u32(uint32_t x) { uint32x2_t r; NEON_EMU_FOR(2) { r.lane[i] = x; } return r; }
+static inline uint32x4_t vdupq_n_u32(uint32_t x) { uint32x4_t r; NEON_EMU_FOR(4) { r.lane[i] = x; } return r; }
+static inline int16x8_t vdupq_n_s16(int16_t x) { int16x8_t r; NEON_EMU_FOR(8) { r.lane[i] = x; } return r; }
+static inline int32x4_t vdupq_n_s32(int32_t x) { int32x4_t r; NEON_EMU_FOR(4) { r.lane[i] = x; } return r; }
+
+/* Reinterpreting, little endian */
+#define NEON_EMU_CAST(name, to, from) static inline to name(from a) { to r; memcpy(&r, &a, sizeof(r)); return r; }
+NEON_EMU_CAST(vreinterpret_u8_u32, uint8x8_t, uint32x2_t)
+NEON_EMU_CAST(vreinterpret_u32_u8, uint32x2_t, uint8x8_t)
+NEON_EMU_CAST(vreinterpret_s16_u16, int16x4_t, uint16x4_t)
+NEON_EMU_CAST(vreinterpretq_s16_u16, int16x8_t, uint16x8_t)
+
+/* Halves */
+static inline uint16x4_t vget_low_u16(uint16x8_t a) { uint16x4_t r; memcpy(r.lane, a.lane, 8); return r; }
+static inline uint16x4_t vget_high_u16(uint16x8_t a) { uint16x4_t r; memcpy(r.lane, a.lane + 4, 8); return r; }
+static inline int16x4_t vget_low_s16(int16x8_t a) { int16x4_t r; memcpy(r.lane, a.lane, 8); return r; }
+static inline int16x4_t vget_high_s16(int16x8_t a) { int16x4_t r; memcpy(r.lane, a.lane + 4, 8); return r; }
+static inline uint16x8_t vcombine_u16(uint16x4_t a, uint16x4_t b) {
+    uint16x8_t r; memcpy(r.lane, a.lane, 8); memcpy(r.lane + 4, b.lane, 8); return r;
+}
+static inline int16x8_t vcombine_s16(int16x4_t a, int16x4_t b) {
+    int16x8_t r; memcpy(r.lane, a.lane, 8); memcpy(r.lane + 4, b.lane, 8); return r;
+}
+static inline uint8x8x2_t vzip_u8(uint8x8_t a, uint8x8_t b) {
+    uint8x8x2_t r;
+    NEON_EMU_FOR(8) { r.val[i / 4].lane[2 * (i % 4)] = a.lane[i]; r.val[i / 4].lane[2 * (i % 4) + 1] = b.lane[i]; }
+    return r;
+}
+
+/* Arithmetic */
+static inline uint8x8_t vmax_u8(uint8x8_t a, uint8x8_t b) {
+    NEON_EMU_FOR(8) { a.lane[i] = a.lane[i] > b.lane[i] ? a.lane[i] : b.lane[i]; } return a;
+}
+static inline uint16x4_t vadd_u16(uint16x4_t a, uint16x4_t b) { NEON_EMU_FOR(4) { a.lane[i] += b.lane[i]; } return a; }
+static inline int32x4_t vaddq_s32(int32x4_t a, int32x4_t b) { NEON_EMU_FOR(4) { a.lane[i] += b.lane[i]; } return a; }
+static inline int16x8_t vsubq_s16(int16x8_t a, int16x8_t b) { NEON_EMU_FOR(8) { a.lane[i] -= b.lane[i]; } return a; }
+static inline uint16x4_t vpaddl_u8(uint8x8_t a) {
+    uint16x4_t r; NEON_EMU_FOR(4) { r.lane[i] = a.lane[2 * i] + a.lane[2 * i + 1]; } return r;
+}
+static inline uint32x4_t vmull_n_u16(uint16x4_t a, uint16_t b) {
+    uint32x4_t r; NEON_EMU_FOR(4) { r.lane[i] = (uint32_t)a.lane[i] * b; } return r;
+}
+static inline uint32x4_t vmlal_n_u16(uint32x4_t acc, uint16x4_t a, uint16_t b) {
+    NEON_EMU_FOR(4) { acc.lane[i] += (uint32_t)a.lane[i] * b; } return acc;
+}
+static inline int32x4_t vmull_n_s16(int16x4_t a, int16_t b) {
+    int32x4_t r; NEON_EMU_FOR(4) { r.lane[i] = (int32_t)a.lane[i] * b; } return r;
+}
+static inline int32x4_t vmlal_n_s16(int32x4_t acc, int16x4_t a, int16_t b) {
+    NEON_EMU_FOR(4) { acc.lane[i] += (int32_t)a.lane[i] * b; } return acc;
+}
+
+/* Widening, narrowing and shifts */
+static inline uint16x8_t vmovl_u8(uint8x8_t a) { uint16x8_t r; NEON_EMU_FOR(8) { r.lane[i] = a.lane[i]; } return r; }
+static inline uint8x8_t vmovn_u16(uint16x8_t a) { uint8x8_t r; NEON_EMU_FOR(8) { r.lane[i] = (uint8_t)a.lane[i]; } return r; }
+static inline uint8x8_t vqmovn_u16(uint16x8_t a) {
+    uint8x8_t r; NEON_EMU_FOR(8) { r.lane[i] = a.lane[i] > 255 ? 255 : a.lane[i]; } return r;
+}
+static inline int16x4_t vqmovn_s32(int32x4_t a) { int16x4_t r; NEON_EMU_FOR(4) { r.lane[i] = neon_emu_sat_s16(a.lane[i]); } return r; }
+static inline uint8x8_t vqmovun_s16(int16x8_t a) { uint8x8_t r; NEON_EMU_FOR(8) { r.lane[i] = neon_emu_sat_u8(a.lane[i]); } return r; }
+static inline uint16x4_t vshr_n_u16(uint16x4_t a, const int n) { NEON_EMU_FOR(4) { a.lane[i] >>= n; } return a; }
+static inline int32x4_t vshrq_n_s32(int32x4_t a, const int n) { NEON_EMU_FOR(4) { a.lane[i] >>= n; } return a; }
+static inline uint16x4_t vshrn_n_u32(uint32x4_t a, const int n) {
+    uint16x4_t r; NEON_EMU_FOR(4) { r.lane[i] = (uint16_t)(a.lane[i] >> n); } return r;
+}
+static inline uint16x4_t vrshrn_n_u32(uint32x4_t a, const int n) {
+    uint16x4_t r; NEON_EMU_FOR(4) { r.lane[i] = (uint16_t)(((uint64_t)a.lane[i] + (1u << (n - 1))) >> n); } return r;
+}
@@ -0,0 +1,128 @@
+/* Builds the search index of a log from scratch, the same way uTox does.
+ *
+ * cc -o rebuild_search_index tools/rebuild_search_index.c src/search_index.c
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/search_index.h"
+
+int file_truncate(FILE *file, uint64_t size)
+{
+    fflush(file);
+    return ftruncate(fileno(file), size);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Writes the record index of log to a temporary file, uTox keeps one of these as <pubkey>.idx */
+static FILE* index_records(FILE *log, uint64_t *count)
+{
+    FILE *index = tmpfile();
+    if(!index) {
+        return NULL;
+    }
+
+    LOG_FILE_MSG_HEADER header;
+    LOG_FILE_INDEX_RECORD record = { .offset = 0 };
+
+    *count = 0;
+    fseeko(log, 0, SEEK_SET);
+    while(fread(&header, sizeof(header), 1, log) == 1) {
+        record.time = header.time;
+        if(fwrite(&record, sizeof(record), 1, index) != 1) {
+            fclose(index);
+            return NULL;
+        }
+        (*count)++;
+
+        record.offset += sizeof(header) + header.namelen + header.length;
+        fseeko(log, record.offset, SEEK_SET);
+    }
+
+    return index;
+}
+
+int main(int argc, char *argv[])
+{
+    SEARCH_INDEX index;
+    uint64_t records, done = 0;
+
+    if(argc < 3) {
+        printf("usage: ./a.out <log file> <index file out> [words to search for]\n");
+        return 0;
+    }
+
+    FILE *log = fopen(argv[1], "rb");
+    if(!log) {
+        printf("File not found (%s)\n", argv[1]);
+        return 1;
+    }
+
+    double start = now();
+    FILE *log_index = index_records(log, &records);
+    if(!log_index) {
+        printf("Unable to index the records of %s\n", argv[1]);
+        fclose(log);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[2], "w+b");
+    if(!file || !search_index_open(&index, file)) {
+        printf("Unable to open %s\n", argv[2]);
+        fclose(log_index);
+        fclose(log);
+        return 1;
+    }
+
+    while(done < records) {
+        uint64_t added = search_index_read_log(&index, log, log_index, SEARCH_INDEX_FLUSH_RECORDS);
+        if(!added) {
+            printf("Read error after %llu records\n", (unsigned long long)done);
+            break;
+        }
+        done += added;
+
+        if(!search_index_flush(&index)) {
+            printf("Write error (%s)\n", argv[2]);
+            break;
+        }
+    }
+
+    fseeko(file, 0, SEEK_END);
+    printf("Indexed %llu records in %.2fs, %d segments, %llu bytes\n", (unsigned long long)done, now() - start,
+           index.segments, (unsigned long long)ftello(file));
+
+    if(argc > 3) {
+        uint64_t hashes[16], found[256];
+        uint32_t terms = 0;
+
+        for(int i = 3; i < argc && terms < 16; i++) {
+            terms += search_terms((uint8_t*)argv[i], strlen(argv[i]), hashes + terms, 16 - terms);
+        }
+        if(terms > 16) {
+            terms = 16;
+        }
+
+        start = now();
+        uint32_t count = search_index_find(&index, hashes, terms, found, 256);
+        printf("%u records found in %.3fms, newest first:\n", count, (now() - start) * 1000);
+        for(uint32_t i = 0; i < count; i++) {
+            printf("%llu\n", (unsigned long long)found[i]);
+        }
+    }
+
+    search_index_close(&index);
+    fclose(log_index);
+    fclose(log);
+    return 0;
+}
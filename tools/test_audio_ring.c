@@ -0,0 +1,222 @@
+/* Tests the ring of audio frames of src/audio_ring.c, which it includes: filling it up, wrapping its indexes around,
+ * and then a producer and a consumer thread passing 2 million frames through it as fast as they can, with the
+ * consumer sleeping in audio_ring_wait() whenever it runs dry.
+ *
+ * make check builds and runs it twice, as it is and with ThreadSanitizer (-fsanitize=thread), which reports any
+ * access to a frame that the ring doesn't order. ThreadSanitizer doesn't model the fences of the sleeping consumer,
+ * those are left to the tests of audio_ring_wait().
+ *
+ * cc -pthread -o test_audio_ring tools/test_audio_ring.c $(pkg-config --cflags <the uTox DEPS>)
+ */
+#include "../src/audio_ring.c"
+
+static int failures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+#define STRESS_FRAMES 2000000
+
+uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Marks frame f as the n-th, at both ends and in the middle, so a frame read before it was written out shows */
+static void frame_mark(AUDIO_FRAME *f, uint32_t n)
+{
+    f->pcm[0] = n;
+    f->pcm[AUDIO_FRAME_SAMPLES / 2] = n >> 8;
+    f->pcm[AUDIO_FRAME_SAMPLES - 1] = n >> 16;
+    f->recorded = n;
+}
+
+/* returns the n frame f was marked with, or -1 if its marks don't agree */
+static int64_t frame_number(const AUDIO_FRAME *f)
+{
+    uint32_t n = f->recorded;
+    if(f->pcm[0] != (int16_t)n || f->pcm[AUDIO_FRAME_SAMPLES / 2] != (int16_t)(n >> 8) ||
+       f->pcm[AUDIO_FRAME_SAMPLES - 1] != (int16_t)(n >> 16)) {
+        return -1;
+    }
+    return n;
+}
+
+/* A ring holds AUDIO_RING_SIZE frames, hands them back in order, and counts the ones it had no room for */
+static void test_full_and_empty(uint32_t start)
+{
+    static AUDIO_RING r = AUDIO_RING_INIT;
+    r.head = r.tail = start;
+    r.dropped = 0;
+
+    CHECK(!audio_ring_read(&r), "read a frame from an empty ring at %u", start);
+
+    for(uint32_t round = 0; round < 3; round++) {
+        for(uint32_t i = 0; i < AUDIO_RING_SIZE; i++) {
+            AUDIO_FRAME *f = audio_ring_write(&r);
+            if(!f) {
+                CHECK(0, "ring at %u full after %u frames", start, i);
+                return;
+            }
+            frame_mark(f, round * AUDIO_RING_SIZE + i);
+            audio_ring_push(&r);
+        }
+        CHECK(!audio_ring_write(&r) && r.dropped == round + 1, "wrote to a full ring at %u", start);
+
+        for(uint32_t i = 0; i < AUDIO_RING_SIZE; i++) {
+            AUDIO_FRAME *f = audio_ring_read(&r);
+            if(!f) {
+                CHECK(0, "ring at %u empty after %u frames", start, i);
+                return;
+            }
+            CHECK(frame_number(f) == round * AUDIO_RING_SIZE + i, "frame %u of round %u at %u came out as %lld", i,
+                  round, start, (long long)frame_number(f));
+            audio_ring_pop(&r);
+        }
+        CHECK(!audio_ring_read(&r), "read from an emptied ring at %u", start);
+    }
+}
+
+/* audio_ring_wait() returns right away with a frame waiting, when one is pushed, on audio_ring_wake(), and after its
+ * timeout */
+static void* push_thread(void *args)
+{
+    usleep(20 * 1000);
+    audio_ring_write(args);
+    audio_ring_push(args);
+    return NULL;
+}
+
+static void* wake_thread(void *args)
+{
+    usleep(20 * 1000);
+    audio_ring_wake(args);
+    return NULL;
+}
+
+static void test_wait(void)
+{
+    static AUDIO_RING r = AUDIO_RING_INIT;
+
+    uint64_t start = get_time();
+    audio_ring_wait(&r, 50);
+    uint64_t took = get_time() - start;
+    CHECK(took >= 50 * 1000 * 1000 && took < 2000ull * 1000 * 1000, "a wait for 50ms took %lluus",
+          (unsigned long long)took / 1000);
+
+    audio_ring_write(&r);
+    audio_ring_push(&r);
+    start = get_time();
+    audio_ring_wait(&r, 10 * 1000);
+    CHECK(get_time() - start < 1000ull * 1000 * 1000, "waited with a frame in the ring");
+    audio_ring_read(&r);
+    audio_ring_pop(&r);
+
+    pthread_t t;
+    pthread_create(&t, NULL, push_thread, &r);
+    start = get_time();
+    audio_ring_wait(&r, 10 * 1000);
+    CHECK(get_time() - start < 5000ull * 1000 * 1000, "a frame pushed didn't wake the consumer");
+    pthread_join(t, NULL);
+    CHECK(audio_ring_read(&r), "no frame after waking up");
+    audio_ring_pop(&r);
+
+    pthread_create(&t, NULL, wake_thread, &r);
+    start = get_time();
+    audio_ring_wait(&r, 10 * 1000);
+    CHECK(get_time() - start < 5000ull * 1000 * 1000, "audio_ring_wake() didn't wake the consumer");
+    pthread_join(t, NULL);
+}
+
+static AUDIO_RING stress_ring = AUDIO_RING_INIT;
+static volatile _Bool stress_done;
+
+static struct {
+    uint32_t frames, torn, out_of_order, sleeps;
+} stress;
+
+static void* stress_consumer(void *UNUSED(args))
+{
+    int64_t last = -1;
+
+    while(1) {
+        AUDIO_FRAME *f = audio_ring_read(&stress_ring);
+        if(!f) {
+            if(__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE) && !audio_ring_read(&stress_ring)) {
+                break;
+            }
+            audio_ring_wait(&stress_ring, 10);
+            stress.sleeps++;
+            continue;
+        }
+
+        int64_t n = frame_number(f);
+        if(n < 0) {
+            stress.torn++;
+        } else if(n <= last) {
+            stress.out_of_order++;
+        } else {
+            last = n;
+        }
+        stress.frames++;
+
+        /* Scribbled over before it goes back, so a producer writing to it too early is a race to ThreadSanitizer */
+        f->recorded = UINT64_MAX;
+        audio_ring_pop(&stress_ring);
+    }
+
+    return NULL;
+}
+
+static void test_stress(void)
+{
+    /* Starting close to wrapping, so the indexes wrap in the middle of it */
+    stress_ring.head = stress_ring.tail = UINT32_MAX - STRESS_FRAMES / 2;
+
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, stress_consumer, NULL);
+
+    uint32_t pushed = 0;
+    for(uint32_t i = 0; i < STRESS_FRAMES; i++) {
+        AUDIO_FRAME *f = audio_ring_write(&stress_ring);
+        if(!f) {
+            /* Like a capture thread, it doesn't wait. Letting the consumer run keeps most frames from being dropped. */
+            if(i % 16 == 0) {
+                sched_yield();
+            }
+            continue;
+        }
+        frame_mark(f, i);
+        audio_ring_push(&stress_ring);
+        pushed++;
+    }
+
+    __atomic_store_n(&stress_done, 1, __ATOMIC_RELEASE);
+    audio_ring_wake(&stress_ring);
+    pthread_join(consumer, NULL);
+
+    CHECK(!stress.torn, "%u frames read before they were written", stress.torn);
+    CHECK(!stress.out_of_order, "%u frames out of order", stress.out_of_order);
+    CHECK(stress.frames == pushed, "%u frames read of %u pushed", stress.frames, pushed);
+    CHECK(pushed + stress_ring.dropped == STRESS_FRAMES, "%u pushed and %u dropped of %u", pushed, stress_ring.dropped,
+          STRESS_FRAMES);
+    CHECK(stress.frames > 0, "no frames got through");
+    printf("%u frames through the ring, %u dropped, the consumer slept %u times\n", stress.frames, stress_ring.dropped,
+           stress.sleeps);
+}
+
+int main(void)
+{
+    test_full_and_empty(0);
+    test_full_and_empty(UINT32_MAX - AUDIO_RING_SIZE / 2);
+    test_wait();
+    test_stress();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("audio ring: all tests passed\n");
+    return 0;
+}
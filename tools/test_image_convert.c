@@ -0,0 +1,612 @@
+/* Tests the color conversions and the scaler of src/image_convert.c against plain C references, and benchmarks them.
+ *
+ * make check builds and runs it three times: with the SIMD versions for this machine, with none (-DUTOX_SIMD_NONE),
+ * and with NEON emulated by tools/neon/arm_neon.h (-DUTOX_SIMD_NEON). make bench runs the benchmarks.
+ *
+ * cc -O2 -pthread -o test_image_convert tools/test_image_convert.c src/image_convert.c -lm
+ * ./test_image_convert [--bench | --images <dir to write the golden images of the scaler to>]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/image_convert.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void random_fill(uint8_t *data, size_t length)
+{
+    for(size_t i = 0; i < length; i++) {
+        data[i] = random_next();
+    }
+}
+
+/* yuv420tobgr() as it was before it had SIMD versions */
+static void ref_yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                            unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out)
+{
+    unsigned long int i, j;
+    for(i = 0; i < height; ++i) {
+        for(j = 0; j < width; ++j) {
+            uint8_t *point = out + 4 * ((i * width) + j);
+            int t_y = y[((i * ystride) + j)];
+            int t_u = u[(((i / 2) * ustride) + (j / 2))];
+            int t_v = v[(((i / 2) * vstride) + (j / 2))];
+            t_y = t_y < 16 ? 16 : t_y;
+
+            int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
+            int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
+            int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
+
+            point[2] = r>255? 255 : r<0 ? 0 : r;
+            point[1] = g>255? 255 : g<0 ? 0 : g;
+            point[0] = b>255? 255 : b<0 ? 0 : b;
+            point[3] = ~0;
+        }
+    }
+}
+
+/* Every Y, U and V combination, then random frames of awkward sizes and strides */
+static void test_yuv420tobgr(void)
+{
+    uint8_t *y = malloc(512 * 512), *u = malloc(256 * 256), *v = malloc(256 * 256);
+    uint8_t *out = malloc(512 * 512 * 4), *ref = malloc(512 * 512 * 4);
+
+    /* U goes down, V across, and each frame has 4 of the Y values in every 2x2 block */
+    for(int i = 0; i < 256 * 256; i++) {
+        u[i] = i / 256;
+        v[i] = i % 256;
+    }
+    for(int frame = 0; frame < 64; frame++) {
+        for(int i = 0; i < 512 * 512; i++) {
+            y[i] = frame * 4 + (i / 512 % 2) * 2 + i % 2;
+        }
+        yuv420tobgr(512, 512, y, u, v, 512, 256, 256, out);
+        ref_yuv420tobgr(512, 512, y, u, v, 512, 256, 256, ref);
+        CHECK(!memcmp(out, ref, 512 * 512 * 4), "yuv420tobgr() Y values %d to %d", frame * 4, frame * 4 + 3);
+    }
+
+    free(y);
+    free(u);
+    free(v);
+    free(out);
+    free(ref);
+
+    static const uint16_t sizes[][2] = {
+        {1, 1}, {2, 2}, {7, 3}, {15, 5}, {16, 2}, {17, 3}, {31, 7}, {32, 4}, {33, 9}, {63, 1}, {64, 64}, {65, 33},
+        {100, 50}, {640, 480}, {641, 481}, {1920, 1080},
+    };
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        uint16_t width = sizes[s][0], height = sizes[s][1];
+        unsigned int ystride = width + s % 3 * 7, cstride = (width + 1) / 2 + s % 2 * 5;
+        size_t ysize = (size_t)ystride * height, csize = (size_t)cstride * ((height + 1) / 2);
+
+        y = malloc(ysize);
+        u = malloc(csize);
+        v = malloc(csize);
+        out = malloc((size_t)width * height * 4);
+        ref = malloc((size_t)width * height * 4);
+        random_fill(y, ysize);
+        random_fill(u, csize);
+        random_fill(v, csize);
+
+        yuv420tobgr(width, height, y, u, v, ystride, cstride, cstride, out);
+        ref_yuv420tobgr(width, height, y, u, v, ystride, cstride, cstride, ref);
+        CHECK(!memcmp(out, ref, (size_t)width * height * 4), "yuv420tobgr() %ux%u", width, height);
+
+        free(y);
+        free(u);
+        free(v);
+        free(out);
+        free(ref);
+    }
+}
+
+static uint8_t rgb_to_y(int r, int g, int b)
+{
+    int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
+    return y>255? 255 : y<0 ? 0 : y;
+}
+
+static uint8_t rgb_to_u(int r, int g, int b)
+{
+    int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
+    return u>255? 255 : u<0 ? 0 : u;
+}
+
+static uint8_t rgb_to_v(int r, int g, int b)
+{
+    int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
+    return v>255? 255 : v<0 ? 0 : v;
+}
+
+/* bgrtoyuv420() and bgrxtoyuv420() as they were before they had SIMD versions, bytes_per_pixel apart, and stopping
+ * at the last whole row pair. For an odd height, the last row is converted paired with itself. */
+static void ref_rgbtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb, uint16_t width,
+                            uint16_t height, int bytes_per_pixel)
+{
+    const uint8_t *start = rgb, *p;
+    uint8_t *start_y = plane_y, *start_u = plane_u, *start_v = plane_v;
+    uint16_t x, y;
+    uint8_t r, g, b;
+    int n = bytes_per_pixel;
+
+    for(y = 0; y + 1 < height; y += 2) {
+        p = rgb;
+        for(x = 0; x != width; x++) {
+            b = rgb[0];
+            g = rgb[1];
+            r = rgb[2];
+            rgb += n;
+            *plane_y++ = rgb_to_y(r, g, b);
+        }
+
+        for(x = 0; x != width / 2; x++) {
+            b = rgb[0];
+            g = rgb[1];
+            r = rgb[2];
+            rgb += n;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = rgb[0];
+            g = rgb[1];
+            r = rgb[2];
+            rgb += n;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = ((int)b + (int)*(rgb - 2 * n) + (int)p[0] + (int)p[n] + 2) / 4;
+            g = ((int)g + (int)*(rgb - 2 * n + 1) + (int)p[1] + (int)p[n + 1] + 2) / 4;
+            r = ((int)r + (int)*(rgb - 2 * n + 2) + (int)p[2] + (int)p[n + 2] + 2) / 4;
+
+            *plane_u++ = rgb_to_u(r, g, b);
+            *plane_v++ = rgb_to_v(r, g, b);
+
+            p += 2 * n;
+        }
+    }
+
+    if(height & 1) {
+        const uint8_t *row = start + (size_t)(height - 1) * width * n;
+        plane_y = start_y + (size_t)(height - 1) * width;
+        plane_u = start_u + (size_t)(height / 2) * (width / 2);
+        plane_v = start_v + (size_t)(height / 2) * (width / 2);
+
+        for(x = 0; x != width; x++) {
+            plane_y[x] = rgb_to_y(row[n * x + 2], row[n * x + 1], row[n * x]);
+        }
+        for(x = 0; x != width / 2; x++) {
+            p = row + 2 * n * x;
+            b = ((int)p[0] * 2 + (int)p[n] * 2 + 2) / 4;
+            g = ((int)p[1] * 2 + (int)p[n + 1] * 2 + 2) / 4;
+            r = ((int)p[2] * 2 + (int)p[n + 2] * 2 + 2) / 4;
+            plane_u[x] = rgb_to_u(r, g, b);
+            plane_v[x] = rgb_to_v(r, g, b);
+        }
+    }
+}
+
+/* Both pixel formats, whole frames from 2x1 up to 4K, odd sizes included, and some rectangles of them */
+static void test_rgbtoyuv420(void)
+{
+    static const uint16_t sizes[][2] = {
+        {2, 1}, {2, 2}, {16, 2}, {16, 3}, {17, 3}, {18, 4}, {30, 6}, {32, 4}, {33, 7}, {34, 8}, {64, 64}, {100, 50},
+        {640, 480}, {640, 481}, {641, 480}, {1920, 1080}, {1922, 1082}, {3840, 2160},
+    };
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        uint16_t width = sizes[s][0], height = sizes[s][1];
+        /* Some room past the planes, that has to stay untouched */
+        size_t ysize = (size_t)width * height, csize = (size_t)(width / 2) * ((height + 1) / 2), pad = 64;
+
+        uint8_t *rgb = malloc(ysize * 4);
+        uint8_t *y = malloc(ysize + pad), *u = malloc(csize + pad), *v = malloc(csize + pad);
+        uint8_t *ref_y = malloc(ysize + pad), *ref_u = malloc(csize + pad), *ref_v = malloc(csize + pad);
+        random_fill(rgb, ysize * 4);
+
+        for(int n = 3; n <= 4; n++) {
+            memset(y, 0xAA, ysize + pad);
+            memset(u, 0xAA, csize + pad);
+            memset(v, 0xAA, csize + pad);
+            memset(ref_y, 0xAA, ysize + pad);
+            memset(ref_u, 0xAA, csize + pad);
+            memset(ref_v, 0xAA, csize + pad);
+
+            if(n == 3) {
+                bgrtoyuv420(y, u, v, rgb, width, height);
+            } else {
+                bgrxtoyuv420(y, u, v, rgb, width, height);
+            }
+            ref_rgbtoyuv420(ref_y, ref_u, ref_v, rgb, width, height, n);
+
+            CHECK(!memcmp(y, ref_y, ysize + pad) && !memcmp(u, ref_u, csize + pad) && !memcmp(v, ref_v, csize + pad),
+                  "%s %ux%u", n == 3 ? "bgrtoyuv420()" : "bgrxtoyuv420()", width, height);
+        }
+
+        /* A rectangle in the middle of an even frame, converted into the reference, gives the reference */
+        if(width >= 8 && !(width & 1) && !(height & 1) && height >= 4) {
+            uint16_t rx = width / 4 & ~1, ry = height / 4 & ~1, rw = width / 2 & ~1, rh = height / 2 & ~1;
+            memcpy(y, ref_y, ysize);
+            memcpy(u, ref_u, csize);
+            memcpy(v, ref_v, csize);
+            memset(ref_y, 0, ysize);
+            memset(ref_u, 0, csize);
+            memset(ref_v, 0, csize);
+            for(uint16_t row = ry; row < ry + rh; row++) {
+                memcpy(ref_y + (size_t)row * width + rx, y + (size_t)row * width + rx, rw);
+            }
+            for(uint16_t row = ry / 2; row < (ry + rh) / 2; row++) {
+                memcpy(ref_u + (size_t)row * width / 2 + rx / 2, u + (size_t)row * width / 2 + rx / 2, rw / 2);
+                memcpy(ref_v + (size_t)row * width / 2 + rx / 2, v + (size_t)row * width / 2 + rx / 2, rw / 2);
+            }
+
+            memset(y, 0, ysize);
+            memset(u, 0, csize);
+            memset(v, 0, csize);
+            bgrxtoyuv420_rect(y, u, v, rgb, width, rx, ry, rw, rh);
+            CHECK(!memcmp(y, ref_y, ysize) && !memcmp(u, ref_u, csize) && !memcmp(v, ref_v, csize),
+                  "bgrxtoyuv420_rect() %ux%u at %u,%u of %ux%u", rw, rh, rx, ry, width, height);
+        }
+
+        free(rgb);
+        free(y);
+        free(u);
+        free(v);
+        free(ref_y);
+        free(ref_u);
+        free(ref_v);
+    }
+}
+
+/* The weights of source sample j for output sample i, in double precision: bilinear when growing, the share of the
+ * source it covers when shrinking */
+static double ref_scale_weight(int i, int j, int old_size, int new_size)
+{
+    double scale = (double)old_size / new_size;
+
+    if(scale <= 1.0) {
+        double center = (i + 0.5) * scale - 0.5;
+        if(center < 0) {
+            center = 0;
+        } else if(center > old_size - 1) {
+            center = old_size - 1;
+        }
+        double distance = center > j ? center - j : j - center;
+        return distance < 1.0 ? 1.0 - distance : 0.0;
+    }
+
+    double lo = i * scale, hi = (i + 1) * scale, from = j < lo ? lo : j, to = j + 1 > hi ? hi : j + 1;
+    return to > from ? (to - from) / scale : 0.0;
+}
+
+static void ref_scale_rgbx_image(const uint8_t *old_rgbx, int old_width, int old_height, uint8_t *new_rgbx,
+                                 int new_width, int new_height)
+{
+    double *row = malloc(old_width * 4 * sizeof(double));
+
+    for(int y = 0; y < new_height; y++) {
+        for(int x = 0; x < old_width * 4; x++) {
+            row[x] = 0;
+        }
+        for(int j = 0; j < old_height; j++) {
+            double w = ref_scale_weight(y, j, old_height, new_height);
+            for(int x = 0; w && x < old_width * 4; x++) {
+                row[x] += w * old_rgbx[(size_t)j * old_width * 4 + x];
+            }
+        }
+
+        for(int x = 0; x < new_width; x++) {
+            double sum[4] = {0};
+            for(int j = 0; j < old_width; j++) {
+                double w = ref_scale_weight(x, j, old_width, new_width);
+                for(int c = 0; w && c < 4; c++) {
+                    sum[c] += w * row[j * 4 + c];
+                }
+            }
+            for(int c = 0; c < 4; c++) {
+                int value = (int)(sum[c] + 0.5);
+                new_rgbx[((size_t)y * new_width + x) * 4 + c] = value > 255 ? 255 : value < 0 ? 0 : value;
+            }
+        }
+    }
+
+    free(row);
+}
+
+/* Gradients in B and G, a checkerboard in R for the edges, and a pattern in X */
+static uint8_t* golden_source(uint16_t width, uint16_t height)
+{
+    uint8_t *rgbx = malloc((size_t)width * height * 4);
+    for(uint16_t y = 0; y < height; y++) {
+        for(uint16_t x = 0; x < width; x++) {
+            uint8_t *p = rgbx + ((size_t)y * width + x) * 4;
+            p[0] = x * 255 / (width - 1);
+            p[1] = y * 255 / (height - 1);
+            p[2] = ((x / 8 + y / 8) & 1) * 255;
+            p[3] = x * y;
+        }
+    }
+    return rgbx;
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* Writes a BGRX image as a binary PPM, dropping X */
+static void write_ppm(const char *dir, const char *name, const uint8_t *rgbx, uint16_t width, uint16_t height)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        printf("Unable to write %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    for(size_t i = 0; i < (size_t)width * height; i++) {
+        uint8_t rgb[3] = {rgbx[i * 4 + 2], rgbx[i * 4 + 1], rgbx[i * 4]};
+        fwrite(rgb, 3, 1, file);
+    }
+    fclose(file);
+}
+
+/* Scales of the golden source image, and the FNV-1a hash of the result. Every SIMD version has to give exactly
+ * these; if the scaler is changed on purpose, look at the images from --images before updating them. */
+static const struct {
+    uint16_t old_width, old_height, new_width, new_height;
+    uint64_t hash;
+} golden[] = {
+    {320, 180,  320,  180, 0x7771c2cfc3362e65ull},
+    {320, 180,  640,  360, 0xeb03883a317b8979ull},
+    {320, 180,  100,   57, 0x3b756aebc992abcbull},
+    {320, 180,  333,   77, 0x5b922ed51ea23670ull},
+    {320, 180,    1,    1, 0x45886f37adda2838ull},
+    {320, 180, 1920, 1080, 0x9afce59cf85a4ee2ull},
+    { 97,  31,   13,  200, 0x464480a9f4dc5626ull},
+};
+
+/* Against the double precision reference, flat images staying flat, and the golden images. With images_dir, also
+ * writes the golden images there, to look at. */
+static void test_scale_rgbx_image(const char *images_dir)
+{
+    static const uint16_t sizes[][4] = {
+        {1, 1, 1, 1}, {1, 1, 7, 5}, {7, 5, 1, 1}, {2, 2, 3, 3}, {16, 9, 32, 18}, {32, 18, 16, 9}, {33, 17, 65, 9},
+        {100, 100, 33, 67}, {64, 48, 63, 47}, {64, 48, 65, 49}, {120, 90, 41, 200}, {640, 360, 427, 240},
+    };
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        uint16_t old_width = sizes[s][0], old_height = sizes[s][1], new_width = sizes[s][2], new_height = sizes[s][3];
+        size_t old_size = (size_t)old_width * old_height * 4, new_size = (size_t)new_width * new_height * 4;
+        uint8_t *in = malloc(old_size), *out = malloc(new_size), *ref = malloc(new_size);
+
+        random_fill(in, old_size);
+        scale_rgbx_image(in, old_width, old_height, out, new_width, new_height);
+        ref_scale_rgbx_image(in, old_width, old_height, ref, new_width, new_height);
+
+        int worst = 0;
+        for(size_t i = 0; i < new_size; i++) {
+            int diff = out[i] > ref[i] ? out[i] - ref[i] : ref[i] - out[i];
+            worst = diff > worst ? diff : worst;
+        }
+        CHECK(worst <= 1, "scale_rgbx_image() %ux%u to %ux%u is %d off", old_width, old_height, new_width,
+              new_height, worst);
+
+        uint8_t flat[4] = {random_next(), random_next(), random_next(), random_next()};
+        for(size_t i = 0; i < old_size; i++) {
+            in[i] = flat[i % 4];
+        }
+        scale_rgbx_image(in, old_width, old_height, out, new_width, new_height);
+        int changed = 0;
+        for(size_t i = 0; i < new_size; i++) {
+            changed |= out[i] != flat[i % 4];
+        }
+        CHECK(!changed, "scale_rgbx_image() %ux%u to %ux%u of a flat image isn't flat", old_width, old_height,
+              new_width, new_height);
+
+        free(in);
+        free(out);
+        free(ref);
+    }
+
+    for(unsigned g = 0; g < sizeof(golden) / sizeof(*golden); g++) {
+        uint8_t *in = golden_source(golden[g].old_width, golden[g].old_height);
+        uint8_t *out = malloc((size_t)golden[g].new_width * golden[g].new_height * 4);
+
+        scale_rgbx_image(in, golden[g].old_width, golden[g].old_height, out, golden[g].new_width,
+                         golden[g].new_height);
+        uint64_t hash = fnv1a(out, (size_t)golden[g].new_width * golden[g].new_height * 4);
+        CHECK(hash == golden[g].hash, "scale_rgbx_image() golden %ux%u to %ux%u, hash %016llx", golden[g].old_width,
+              golden[g].old_height, golden[g].new_width, golden[g].new_height, (unsigned long long)hash);
+
+        if(images_dir) {
+            char name[64];
+            snprintf(name, sizeof(name), "scale_%ux%u.ppm", golden[g].new_width, golden[g].new_height);
+            write_ppm(images_dir, name, out, golden[g].new_width, golden[g].new_height);
+            snprintf(name, sizeof(name), "source_%ux%u.ppm", golden[g].old_width, golden[g].old_height);
+            write_ppm(images_dir, name, in, golden[g].old_width, golden[g].old_height);
+        }
+
+        free(in);
+        free(out);
+    }
+}
+
+static const uint16_t bench_sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+
+/* Frames per second of convert, run for about a second */
+static double bench_fps(void (*convert)(void *data), void *data)
+{
+    double start = now(), elapsed;
+    int frames = 0;
+    do {
+        convert(data);
+        frames++;
+        elapsed = now() - start;
+    } while(elapsed < 1.0);
+    return frames / elapsed;
+}
+
+typedef struct {
+    uint16_t width, height;
+    uint8_t *y, *u, *v, *rgb;
+} BENCH_FRAME;
+
+static void bench_frame_alloc(BENCH_FRAME *f, uint16_t width, uint16_t height)
+{
+    f->width  = width;
+    f->height = height;
+    f->y      = malloc((size_t)width * height);
+    f->u      = malloc((size_t)width * height / 4);
+    f->v      = malloc((size_t)width * height / 4);
+    f->rgb    = malloc((size_t)width * height * 4);
+    random_fill(f->y, (size_t)width * height);
+    random_fill(f->u, (size_t)width * height / 4);
+    random_fill(f->v, (size_t)width * height / 4);
+    random_fill(f->rgb, (size_t)width * height * 4);
+}
+
+static void bench_frame_free(BENCH_FRAME *f)
+{
+    free(f->y);
+    free(f->u);
+    free(f->v);
+    free(f->rgb);
+}
+
+static void run_yuv420tobgr(void *data)
+{
+    BENCH_FRAME *f = data;
+    yuv420tobgr(f->width, f->height, f->y, f->u, f->v, f->width, f->width / 2, f->width / 2, f->rgb);
+}
+
+static void run_ref_yuv420tobgr(void *data)
+{
+    BENCH_FRAME *f = data;
+    ref_yuv420tobgr(f->width, f->height, f->y, f->u, f->v, f->width, f->width / 2, f->width / 2, f->rgb);
+}
+
+static void run_bgrxtoyuv420(void *data)
+{
+    BENCH_FRAME *f = data;
+    bgrxtoyuv420(f->y, f->u, f->v, f->rgb, f->width, f->height);
+}
+
+static void run_ref_bgrxtoyuv420(void *data)
+{
+    BENCH_FRAME *f = data;
+    ref_rgbtoyuv420(f->y, f->u, f->v, f->rgb, f->width, f->height, 4);
+}
+
+static void run_bgrtoyuv420(void *data)
+{
+    BENCH_FRAME *f = data;
+    bgrtoyuv420(f->y, f->u, f->v, f->rgb, f->width, f->height);
+}
+
+static void run_ref_bgrtoyuv420(void *data)
+{
+    BENCH_FRAME *f = data;
+    ref_rgbtoyuv420(f->y, f->u, f->v, f->rgb, f->width, f->height, 3);
+}
+
+/* Milliseconds per scale, run for about a second */
+static double bench_scale(const uint8_t *in, uint16_t old_width, uint16_t old_height, uint8_t *out,
+                          uint16_t new_width, uint16_t new_height)
+{
+    double start = now(), elapsed;
+    int scales = 0;
+    do {
+        scale_rgbx_image((uint8_t*)in, old_width, old_height, out, new_width, new_height);
+        scales++;
+        elapsed = now() - start;
+    } while(elapsed < 1.0);
+    return elapsed * 1000 / scales;
+}
+
+static void bench(void)
+{
+    printf("Frames per second, plain C reference vs src/image_convert.c:\n");
+    for(unsigned s = 0; s < sizeof(bench_sizes) / sizeof(*bench_sizes); s++) {
+        BENCH_FRAME f;
+        bench_frame_alloc(&f, bench_sizes[s][0], bench_sizes[s][1]);
+
+        printf("%4ux%-4u yuv420tobgr   %8.1f vs %8.1f\n", f.width, f.height, bench_fps(run_ref_yuv420tobgr, &f),
+               bench_fps(run_yuv420tobgr, &f));
+        printf("%4ux%-4u bgrxtoyuv420  %8.1f vs %8.1f\n", f.width, f.height, bench_fps(run_ref_bgrxtoyuv420, &f),
+               bench_fps(run_bgrxtoyuv420, &f));
+        printf("%4ux%-4u bgrtoyuv420   %8.1f vs %8.1f\n", f.width, f.height, bench_fps(run_ref_bgrtoyuv420, &f),
+               bench_fps(run_bgrtoyuv420, &f));
+
+        bench_frame_free(&f);
+    }
+
+    static const uint16_t scales[][4] = {
+        {1920, 1080, 1280, 720}, {1920, 1080, 640, 360}, {1280, 720, 1920, 1080}, {640, 480, 1920, 1080},
+    };
+
+    printf("Milliseconds per scale_rgbx_image():\n");
+    for(unsigned s = 0; s < sizeof(scales) / sizeof(*scales); s++) {
+        uint8_t *in = malloc((size_t)scales[s][0] * scales[s][1] * 4),
+                *out = malloc((size_t)scales[s][2] * scales[s][3] * 4);
+        random_fill(in, (size_t)scales[s][0] * scales[s][1] * 4);
+
+        printf("%4ux%-4u to %4ux%-4u %8.3f\n", scales[s][0], scales[s][1], scales[s][2], scales[s][3],
+               bench_scale(in, scales[s][0], scales[s][1], out, scales[s][2], scales[s][3]));
+
+        free(in);
+        free(out);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+#if defined(UTOX_SIMD_NONE)
+    const char *simd = "plain C";
+#elif defined(UTOX_SIMD_NEON)
+    const char *simd = "NEON";
+#else
+    const char *simd = "native SIMD";
+#endif
+
+    if(argc > 1 && !strcmp(argv[1], "--bench")) {
+        printf("Benchmarking with %s\n", simd);
+        bench();
+        return 0;
+    }
+
+    test_yuv420tobgr();
+    test_rgbtoyuv420();
+    test_scale_rgbx_image(argc > 2 && !strcmp(argv[1], "--images") ? argv[2] : NULL);
+
+    printf("%s: %s\n", simd, failures ? "FAILED" : "all tests passed");
+    return failures != 0;
+}
@@ -0,0 +1,234 @@
+/* Tests the jitter buffer of src/jitter_buffer.c: the delay a talkspurt starts with, catching up with the target
+ * after a burst, the concealment of frames that didn't arrive, and the bound on the frame size.
+ *
+ * make check builds and runs it.
+ *
+ * cc -O2 -o test_jitter_buffer tools/test_jitter_buffer.c src/jitter_buffer.c -lm
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/jitter_buffer.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+#define MS (1000 * 1000ull)
+
+/* 20ms of 48kHz mono, what a call sends by default */
+#define FRAME_SAMPLES 960
+#define FRAME_US 20000
+
+static int16_t frame_in[JITTER_FRAME_MAX], frame_out[JITTER_FRAME_MAX];
+
+static void push(JITTER_BUFFER *jb, uint64_t now)
+{
+    jitter_push(jb, frame_in, FRAME_SAMPLES, 1, 48000, now);
+}
+
+static int pop(JITTER_BUFFER *jb, uint64_t ahead_us, uint64_t now)
+{
+    uint32_t samples, rate;
+    uint8_t channels;
+    return jitter_pop(jb, ahead_us, now, frame_out, &samples, &channels, &rate);
+}
+
+static void fill(int16_t value)
+{
+    for(int i = 0; i < JITTER_FRAME_MAX; i++) {
+        frame_in[i] = value;
+    }
+}
+
+/* A talkspurt waits for the target delay to be buffered, or for that long to pass */
+static void test_spurt_start(void)
+{
+    JITTER_BUFFER jb;
+    CHECK(jitter_init(&jb), "jitter_init");
+
+    CHECK(pop(&jb, 0, 0) == JITTER_NONE, "played from an empty buffer");
+
+    /* One frame is less than the target, it waits for another one */
+    push(&jb, 1000 * MS);
+    CHECK(jb.stats.target_us == JITTER_MIN_DELAY_US, "target %u with no jitter", jb.stats.target_us);
+    CHECK(pop(&jb, 0, 1000 * MS) == JITTER_NONE, "started with one frame buffered");
+    CHECK(pop(&jb, 0, 1000 * MS + JITTER_MIN_DELAY_US * 1000ull - 1) == JITTER_NONE, "started before the target");
+
+    /* Which arrives on time, and the spurt starts right away */
+    push(&jb, 1020 * MS);
+    CHECK(jb.stats.jitter_us == 0, "jitter %u of frames on time", jb.stats.jitter_us);
+    CHECK(pop(&jb, 0, 1020 * MS) == JITTER_FRAME, "didn't start with the target buffered");
+    CHECK(pop(&jb, FRAME_US, 1020 * MS) == JITTER_FRAME, "didn't play the second frame");
+    CHECK(pop(&jb, 2 * FRAME_US, 1020 * MS) == JITTER_NONE, "played a frame that wasn't there");
+
+    /* A single frame after a silence starts once the target delay passed, even if no more come */
+    for(uint32_t i = 0; i <= JITTER_CONCEAL_FRAMES; i++) {
+        pop(&jb, 0, 1040 * MS);
+    }
+    CHECK(!jb.playing, "still playing after the concealment");
+
+    push(&jb, 3000 * MS);
+    CHECK(jb.stats.jitter_us == 0, "jitter %u after a silence", jb.stats.jitter_us);
+    CHECK(pop(&jb, 0, 3000 * MS + JITTER_MIN_DELAY_US * 1000ull - 1) == JITTER_NONE, "started before the target");
+    CHECK(pop(&jb, 0, 3000 * MS + JITTER_MIN_DELAY_US * 1000ull) == JITTER_FRAME, "didn't start after the target");
+
+    jitter_free(&jb);
+}
+
+/* A burst of frames is dropped down to the target, with no more than the slack past it */
+static void test_burst(void)
+{
+    JITTER_BUFFER jb;
+    CHECK(jitter_init(&jb), "jitter_init");
+
+    uint64_t now = 1000 * MS;
+    for(int i = 0; i < 10; i++, now += 20 * MS) {
+        push(&jb, now);
+        /* The output plays every frame at once, so it never conceals one */
+        while(jb.count && pop(&jb, 0, now) == JITTER_FRAME) {
+        }
+    }
+    CHECK(jb.count == 0 && jb.stats.dropped == 0, "%u buffered, %u dropped while on time", jb.count, jb.stats.dropped);
+
+    /* The network holds 20 frames back and lets them through at once */
+    now += 400 * MS;
+    for(int i = 0; i < 20; i++) {
+        push(&jb, now);
+    }
+    CHECK(jb.count == 20, "%u of the burst buffered", jb.count);
+
+    uint32_t target = jb.stats.target_us;
+    CHECK(target > JITTER_MIN_DELAY_US && target < JITTER_MAX_DELAY_US, "target %u after the burst", target);
+
+    CHECK(pop(&jb, 0, now) == JITTER_FRAME, "didn't play after the burst");
+
+    /* The frame played counts as buffered: the loop stopped once one more drop would go below target + slack */
+    uint32_t left = jb.stats.buffered_us + FRAME_US;
+    CHECK(jb.stats.dropped > 0, "nothing dropped after the burst");
+    CHECK(left < target + (JITTER_SLACK_FRAMES + 1) * FRAME_US, "%uus left for a target of %uus", left, target);
+    CHECK(left >= target + JITTER_SLACK_FRAMES * FRAME_US, "dropped down to %uus for a target of %uus", left, target);
+    CHECK(jb.stats.dropped + jb.count + 1 == 20, "%u dropped, %u left of 20", jb.stats.dropped, jb.count);
+
+    /* A full buffer drops the oldest frame for the new one */
+    JITTER_BUFFER full;
+    CHECK(jitter_init(&full), "jitter_init");
+    for(int i = 0; i < JITTER_FRAMES + 3; i++) {
+        push(&full, 1000 * MS);
+    }
+    CHECK(full.count == JITTER_FRAMES && full.stats.dropped == 3, "%u buffered, %u dropped when full", full.count,
+          full.stats.dropped);
+    CHECK(full.stats.buffered_us == JITTER_FRAMES * FRAME_US, "%uus buffered when full", full.stats.buffered_us);
+
+    jitter_free(&full);
+    jitter_free(&jb);
+}
+
+/* A frame that didn't arrive is the last one again, fading out over JITTER_CONCEAL_FRAMES, and then the spurt ends */
+static void test_conceal(void)
+{
+    JITTER_BUFFER jb;
+    CHECK(jitter_init(&jb), "jitter_init");
+
+    fill(10000);
+    push(&jb, 1000 * MS);
+    push(&jb, 1020 * MS);
+    CHECK(pop(&jb, 0, 1020 * MS) == JITTER_FRAME, "didn't start");
+    CHECK(pop(&jb, 0, 1020 * MS) == JITTER_FRAME, "didn't play the second frame");
+
+    /* Not yet while the output has enough to play for the next frame to still make it */
+    CHECK(pop(&jb, JITTER_CONCEAL_AHEAD_US, 1040 * MS) == JITTER_NONE, "concealed with the output not running dry");
+    CHECK(jb.stats.concealed == 0, "counted a concealed frame");
+
+    for(int i = 0; i < JITTER_CONCEAL_FRAMES; i++) {
+        CHECK(pop(&jb, 0, 1040 * MS) == JITTER_CONCEALED, "frame %d wasn't concealed", i);
+
+        /* The gain goes from 1 - i / n at the start of the frame down to 1 - (i + 1) / n at its end */
+        int start = 10000 - 10000 * i / JITTER_CONCEAL_FRAMES;
+        int end = 10000 - 10000 * (i + 1) / JITTER_CONCEAL_FRAMES;
+        CHECK(abs(frame_out[0] - start) <= 1, "concealed frame %d starts at %d, not %d", i, frame_out[0], start);
+        CHECK(frame_out[FRAME_SAMPLES - 1] > end && frame_out[FRAME_SAMPLES - 1] < start,
+              "concealed frame %d ends at %d, not %d..%d", i, frame_out[FRAME_SAMPLES - 1], end, start);
+        for(int s = 1; s < FRAME_SAMPLES; s++) {
+            if(frame_out[s] > frame_out[s - 1]) {
+                CHECK(0, "concealed frame %d gets louder at sample %d", i, s);
+                break;
+            }
+        }
+    }
+
+    CHECK(pop(&jb, 0, 1040 * MS) == JITTER_NONE, "concealed past JITTER_CONCEAL_FRAMES");
+    CHECK(!jb.playing, "the talkspurt didn't end");
+    CHECK(jb.stats.underruns == 1 && jb.stats.concealed == JITTER_CONCEAL_FRAMES, "%u underruns, %u concealed",
+          jb.stats.underruns, jb.stats.concealed);
+
+    /* The next frame plays as it is, after the start delay again */
+    push(&jb, 1100 * MS);
+    CHECK(pop(&jb, 0, 1100 * MS) == JITTER_NONE, "the next talkspurt started without the delay");
+    CHECK(pop(&jb, 0, 1100 * MS + JITTER_MIN_DELAY_US * 1000ull) == JITTER_FRAME, "the next talkspurt didn't start");
+    CHECK(frame_out[0] == 10000 && frame_out[FRAME_SAMPLES - 1] == 10000, "the next frame was faded");
+
+    /* A concealment cut short by a frame arriving after all counts once */
+    pop(&jb, 0, 1140 * MS);
+    push(&jb, 1140 * MS);
+    CHECK(pop(&jb, 0, 1140 * MS) == JITTER_FRAME, "the late frame wasn't played");
+    CHECK(jb.stats.underruns == 2 && jb.stats.concealed == JITTER_CONCEAL_FRAMES + 1, "%u underruns, %u concealed",
+          jb.stats.underruns, jb.stats.concealed);
+
+    jitter_free(&jb);
+}
+
+/* Frames of more than JITTER_FRAME_MAX samples are left out, and one of just that many goes through whole */
+static void test_frame_max(void)
+{
+    JITTER_BUFFER jb;
+    CHECK(jitter_init(&jb), "jitter_init");
+
+    uint32_t samples = JITTER_FRAME_MAX / 2;
+    for(int i = 0; i < JITTER_FRAME_MAX; i++) {
+        frame_in[i] = i;
+    }
+
+    jitter_push(&jb, frame_in, samples + 1, 2, 48000, 1000 * MS);
+    jitter_push(&jb, frame_in, JITTER_FRAME_MAX + 1, 1, 48000, 1000 * MS);
+    jitter_push(&jb, frame_in, 0, 2, 48000, 1000 * MS);
+    jitter_push(&jb, frame_in, samples, 0, 48000, 1000 * MS);
+    jitter_push(&jb, frame_in, samples, 2, 0, 1000 * MS);
+    CHECK(jb.count == 0 && jb.stats.frames == 0, "%u frames buffered past the bound", jb.count);
+
+    jitter_push(&jb, frame_in, samples, 2, 48000, 1000 * MS);
+    CHECK(jb.count == 1 && jb.stats.buffered_us == 60 * 1000, "a frame of JITTER_FRAME_MAX samples wasn't buffered");
+
+    uint32_t out_samples = 0, rate = 0;
+    uint8_t channels = 0;
+    memset(frame_out, 0, sizeof(frame_out));
+    CHECK(jitter_pop(&jb, 0, 1000 * MS, frame_out, &out_samples, &channels, &rate) == JITTER_FRAME,
+          "the largest frame wasn't played");
+    CHECK(out_samples == samples && channels == 2 && rate == 48000, "played %u samples of %u channels at %u",
+          out_samples, channels, rate);
+    CHECK(!memcmp(frame_in, frame_out, sizeof(frame_out)), "the largest frame changed");
+
+    /* And it's concealed whole too */
+    CHECK(jitter_pop(&jb, 0, 1060 * MS, frame_out, &out_samples, &channels, &rate) == JITTER_CONCEALED,
+          "the largest frame wasn't concealed");
+    CHECK(out_samples == samples && frame_out[JITTER_FRAME_MAX - 1] > 0, "the concealed frame was cut short");
+
+    jitter_free(&jb);
+}
+
+int main(void)
+{
+    test_spurt_start();
+    test_burst();
+    test_conceal();
+    test_frame_max();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("jitter buffer: all tests passed\n");
+    return 0;
+}
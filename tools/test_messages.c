@@ -0,0 +1,382 @@
+/* Tests the message list of src/messages.c, with the drawing and the rest of uTox it calls stubbed out. It includes
+ * messages.c, to check the Fenwick tree of heights and the ring directly.
+ *
+ * make check builds and runs it.
+ *
+ * cc -pthread -o test_messages tools/test_messages.c $(pkg-config --cflags <the uTox DEPS>)
+ */
+#include "../src/messages.c"
+
+static int failures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+/* Text messages are a line of LINE_HEIGHT for every 8 characters they have, started */
+#define LINE_HEIGHT 20
+
+UI_LANG_ID LANG;
+MESSAGES messages_friend, messages_group;
+ITEM *selected_item;
+
+static uint32_t log_pages_read;
+
+void contextmenu_new(uint8_t count, UI_STRING_ID *menu, void (*onselect)(uint8_t)) {}
+void draw_image(const UTOX_NATIVE_IMAGE *image, int x, int y, uint32_t width, uint32_t height, uint32_t imgx, uint32_t imgy) {}
+void draw_rect_fill(int x, int y, int width, int height, uint32_t color) {}
+void drawalpha(int bm, int x, int y, int width, int height, uint32_t color) {}
+void drawtext(int x, int y, char_t *str, STRING_IDX length) {}
+void drawtextrange(int x, int x2, int y, char_t *str, STRING_IDX length) {}
+void drawtextwidth_right(int x, int width, int y, char_t *str, STRING_IDX length) {}
+uint32_t setcolor(uint32_t color) { return 0; }
+void setfont(int id) {}
+int textwidth(char_t *str, STRING_IDX length) { return length; }
+
+void image_free(UTOX_NATIVE_IMAGE *image) {}
+void image_set_filter(UTOX_NATIVE_IMAGE *image, uint8_t filter) {}
+void image_set_scale(UTOX_NATIVE_IMAGE *image, double scale) {}
+
+void copy(int value) {}
+void native_select_dir_ft(uint32_t fid, MSG_FILE *file) {}
+void openurl(char_t *str) {}
+void redraw(void) {}
+void redraw_rect(int x, int y, int width, int height) {}
+void savefiledata(MSG_FILE *file) {}
+void setselection(char_t *data, STRING_IDX length) {}
+
+_Bool log_read_page(uint32_t fid, uint64_t start, uint32_t count)
+{
+    log_pages_read++;
+    return 1;
+}
+
+void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {}
+
+/* How far down the view is scrolled */
+static int scroll_y;
+
+int scroll_gety(SCROLLABLE *s, int height)
+{
+    return scroll_y;
+}
+
+int sprint_humanread_bytes(uint8_t *dest, unsigned int size, uint64_t bytes) { return 0; }
+uint8_t utf8_len(char_t *data) { return 1; }
+uint8_t utf8_unlen(char_t *data) { return 1; }
+
+/* The layout is just the height */
+TEXT_LAYOUT* text_layout(TEXT_LAYOUT **layout, int width, uint16_t lineheight, char_t *str, STRING_IDX length)
+{
+    if(!*layout) {
+        *layout = malloc(sizeof(int));
+        *(int*)*layout = LINE_HEIGHT * (1 + length / 8);
+    }
+    return *layout;
+}
+
+int text_layout_draw(const TEXT_LAYOUT *layout, int x, int y, int top, int bottom, char_t *str, STRING_IDX h,
+                     STRING_IDX hlen, STRING_IDX mark, STRING_IDX marklen)
+{
+    return y + LINE_HEIGHT;
+}
+
+int text_layout_height(const TEXT_LAYOUT *layout) { return *(const int*)layout; }
+STRING_IDX text_layout_hit(const TEXT_LAYOUT *layout, int mx, int my, char_t *str, STRING_IDX length) { return 0; }
+
+STRING* ui_gettext(UI_LANG_ID lang, UI_STRING_ID string_id)
+{
+    static STRING empty;
+    return &empty;
+}
+
+static MESSAGE* text_message(const char *text)
+{
+    STRING_IDX length = strlen(text);
+    MESSAGE *msg = calloc(1, sizeof(MESSAGE) + length);
+    msg->msg_type = MSG_TYPE_TEXT;
+    msg->length = length;
+    memcpy(msg->msg, text, length);
+    return msg;
+}
+
+/* A text message length characters long */
+static MESSAGE* text_message_length(STRING_IDX length)
+{
+    char text[length + 1];
+    memset(text, 'x', length);
+    text[length] = 0;
+    return text_message(text);
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* Checks the Fenwick tree of p against the heights of its messages added up one by one */
+static void check_heights(MSG_DATA *p, const char *what)
+{
+    uint32_t y = 0;
+    int bad = 0;
+    for(MSG_IDX i = 0; i < p->n && !bad; i++) {
+        uint32_t height = ((MESSAGE*)message_get(p, i))->height;
+        uint32_t before = message_heights_before(p, i);
+        if(before != y) {
+            printf("FAIL: %s: %u above message %u of %u, not %u\n", what, before, i, p->n, y);
+            bad++;
+        } else if(height && (message_heights_find(p, y) != i || message_heights_find(p, y + height - 1) != i)) {
+            printf("FAIL: %s: message %u of %u at y %u to %u, found %u and %u\n", what, i, p->n, y, y + height - 1,
+                   message_heights_find(p, y), message_heights_find(p, y + height - 1));
+            bad++;
+        }
+        y += height;
+    }
+
+    if(!bad && (message_heights_before(p, p->n) != y || message_heights_find(p, y) != p->n || p->height != y)) {
+        printf("FAIL: %s: %u messages %u high, tree says %u, height %u\n", what, p->n, y,
+               message_heights_before(p, p->n), p->height);
+        bad++;
+    }
+    failures += bad;
+}
+
+/* Sets up p as friend_load_log() leaves it, with count messages read from records log_start onwards of a log with
+ * log_end records, and shows it in m */
+static void load_history(MESSAGES *m, MSG_DATA *p, MSG_IDX count, uint64_t log_start, uint64_t log_end)
+{
+    message_reserve(p, count);
+    for(MSG_IDX i = 0; i < count; i++) {
+        p->data[i] = text_message("history");
+    }
+    p->n = count;
+    p->history = count;
+    p->log_start = log_start;
+    p->log_end = log_end;
+
+    m->data = p;
+    messages_updateheight(m);
+}
+
+/* Clearing the history of a friend while scrolled back to it, and then getting a message */
+static void test_clear_then_add(void)
+{
+    static SCROLLABLE scroll;
+    MESSAGES m = { .panel = { .content_scroll = &scroll }, .width = 400, .view_height = 100 };
+    MSG_DATA p = { 0 };
+
+    load_history(&m, &p, 50, 1000, 1200);
+    p.log_loading = 1;
+    p.log_jump = 900;
+
+    message_clear(&m, &p);
+    CHECK(p.n == 0 && p.height == 0 && scroll.content_height == 0, "message_clear() left %u messages", p.n);
+    CHECK(p.history == 0 && p.log_start == 0 && p.log_end == 0 && p.log_loading == 0 && p.log_jump == 0,
+          "message_clear() left history %u, log records %lu to %lu, loading %u, jump %lu", p.history,
+          (unsigned long)p.log_start, (unsigned long)p.log_end, p.log_loading, (unsigned long)p.log_jump);
+
+    MESSAGE *msg = text_message("hello");
+    message_add(&m, msg, &p);
+    CHECK(p.n == 1 && message_get(&p, 0) == msg, "message_add() after message_clear() left %u messages", p.n);
+    CHECK(p.history == 0, "message_add() after message_clear() left history %u", p.history);
+    CHECK(p.height == msg->height && msg->height && scroll.content_height == p.height,
+          "message_add() after message_clear() left height %u, message height %u", p.height, msg->height);
+
+    // A page of the old log that was still being read gets dropped
+    void *page[2] = { text_message("old"), text_message("old") };
+    messages_log_page(&m, &p, 1000 - 2, page, 2);
+    CHECK(p.n == 1 && p.history == 0, "a page of the cleared log was added, %u messages", p.n);
+
+    // Nothing is paged in from the cleared log
+    log_pages_read = 0;
+    messages_draw(&m, 0, 0, 400, 100);
+    CHECK(!log_pages_read, "%u pages of the cleared log were read", log_pages_read);
+
+    for(int i = 0; i < 10; i++) {
+        message_add(&m, text_message("more"), &p);
+    }
+    CHECK(p.n == 11 && p.height == 11 * msg->height, "%u messages after adding 10 more", p.n);
+
+    message_data_free(&p);
+}
+
+/* Pages of the log going in at both ends of the history and dropping out of it, with the ring wrapping around, and
+ * messages changing height */
+static void test_heights_paging(void)
+{
+    static SCROLLABLE scroll;
+    MESSAGES m = { .panel = { .content_scroll = &scroll }, .width = 400, .view_height = 100 };
+    MSG_DATA p = { 0 };
+
+    utox_backlog_capacity = 200;
+    load_history(&m, &p, 10, 5000, 5100);
+    check_heights(&p, "loaded history");
+
+    /* Older pages go in front of slot first, and wrap around to the end of the ring */
+    void *page[60];
+    uint64_t start = 5000;
+    for(int round = 0; round < 20; round++) {
+        MSG_IDX count = 1 + random_next() % 60;
+        for(MSG_IDX i = 0; i < count; i++) {
+            page[i] = text_message_length(random_next() % 40);
+        }
+        start -= count;
+        void *oldest = page[0], *newest = page[count - 1];
+        messages_log_page(&m, &p, start, page, count);
+
+        char what[64];
+        snprintf(what, sizeof(what), "older page %d of %u", round, count);
+        check_heights(&p, what);
+        CHECK(message_get(&p, 0) == oldest && message_get(&p, count - 1) == newest && p.log_start == start,
+              "%s isn't at the start of the history", what);
+        CHECK(p.history <= utox_backlog_capacity && p.history == p.n, "%s left %u messages, %u history", what, p.n,
+              p.history);
+    }
+
+    /* Newer pages close the gap after the history, dropping the oldest messages */
+    while(p.log_start + p.history < p.log_end) {
+        MSG_IDX count = 1 + random_next() % 60;
+        if(count > p.log_end - p.log_start - p.history) {
+            count = p.log_end - p.log_start - p.history;
+        }
+        for(MSG_IDX i = 0; i < count; i++) {
+            page[i] = text_message_length(random_next() % 40);
+        }
+        void *newest = page[count - 1];
+        messages_log_page(&m, &p, p.log_start + p.history, page, count);
+
+        check_heights(&p, "newer page");
+        CHECK(message_get(&p, p.n - 1) == newest, "the newer page isn't at the end of the history");
+        CHECK(p.history <= utox_backlog_capacity, "newer page left %u history", p.history);
+    }
+
+    /* Messages that get taller or shorter in place */
+    for(int round = 0; round < 100; round++) {
+        MESSAGE *msg = message_get(&p, random_next() % p.n);
+        free(msg->layout);
+        msg->layout = NULL;
+        msg->length = random_next() % (msg->length + 1);
+        message_updateheight(&m, msg, &p);
+        check_heights(&p, "updated height");
+    }
+
+    /* Without the tree */
+    free(p.height_tree);
+    p.height_tree = NULL;
+    p.height_count = 0;
+    check_heights(&p, "no tree");
+
+    message_data_free(&p);
+    utox_backlog_capacity = UTOX_MAX_BACKLOG_MESSAGES;
+}
+
+/* New messages replacing the oldest ones once the ring is full, around and around it */
+static void test_ring_evict(void)
+{
+    static SCROLLABLE scroll;
+    MESSAGES m = { .panel = { .content_scroll = &scroll }, .width = 400, .view_height = 100 };
+    MSG_DATA p = { 0 };
+    m.data = &p;
+
+    utox_backlog_capacity = 100;
+    enum { ADDED = 1000 };
+    static void *added[ADDED];
+    for(int i = 0; i < ADDED; i++) {
+        added[i] = text_message_length(random_next() % 40);
+        message_add(&m, added[i], &p);
+
+        MSG_IDX expect = (i + 1 < 100) ? i + 1 : 100;
+        CHECK(p.n == expect, "%u messages after adding %d", p.n, i + 1);
+        CHECK(p.size <= 128, "the ring grew to %u slots", p.size);
+        CHECK(message_get(&p, 0) == added[i + 1 - p.n] && message_get(&p, p.n - 1) == added[i],
+              "wrong oldest or newest message after adding %d", i + 1);
+        if(i % 37 == 0 || i > ADDED - 3) {
+            check_heights(&p, "evicting");
+        }
+    }
+    CHECK(scroll.content_height == p.height, "content height %u, messages %u", scroll.content_height, p.height);
+
+    /* The capacity going down while there are more than that: the list shrinks by one with every new message */
+    utox_backlog_capacity = 90;
+    for(int i = 0; i < 15; i++) {
+        message_add(&m, text_message_length(random_next() % 40), &p);
+    }
+    CHECK(p.n == 90, "%u messages after lowering the capacity to 90", p.n);
+    check_heights(&p, "lowered capacity");
+
+    message_data_free(&p);
+    utox_backlog_capacity = UTOX_MAX_BACKLOG_MESSAGES;
+}
+
+/* New messages while scrolled back to the history drop the oldest new ones, never the history being read */
+static void test_ring_history(void)
+{
+    static SCROLLABLE scroll;
+    MESSAGES m = { .panel = { .content_scroll = &scroll }, .width = 400, .view_height = 100 };
+    MSG_DATA p = { 0 };
+
+    utox_backlog_capacity = 64;
+    load_history(&m, &p, 50, 2000, 2050);
+    void *history[50];
+    for(MSG_IDX i = 0; i < 50; i++) {
+        history[i] = message_get(&p, i);
+    }
+
+    scroll_y = 0;
+    void *newest = NULL;
+    for(int i = 0; i < 200; i++) {
+        newest = text_message_length(random_next() % 40);
+        message_add(&m, newest, &p);
+    }
+    CHECK(p.history == 50 && p.n == 50 + 64, "%u messages, %u history, after 200 new ones while reading it", p.n,
+          p.history);
+    for(MSG_IDX i = 0; i < 50; i++) {
+        CHECK(message_get(&p, i) == history[i], "history message %u was replaced", i);
+    }
+    CHECK(message_get(&p, p.n - 1) == newest, "the newest message is missing");
+    check_heights(&p, "history kept");
+
+    /* Scrolled down to the new messages: the history goes first, two messages at a time until it's back in bounds */
+    scroll_y = p.height - 1;
+    MSG_IDX n = p.n;
+    uint64_t log_start = p.log_start;
+    message_add(&m, text_message_length(3), &p);
+    CHECK(p.n == n - 1 && p.history == 48 && p.log_start == log_start + 2 && message_get(&p, 0) == history[2],
+          "%u messages, %u history from %lu, after a new one while scrolled down", p.n, p.history,
+          (unsigned long)p.log_start);
+    check_heights(&p, "history evicted");
+
+    for(int i = 0; i < 100; i++) {
+        scroll_y = p.height - 1;
+        message_add(&m, text_message_length(random_next() % 40), &p);
+    }
+    CHECK(p.n == 64 && p.history == 0 && p.log_start == p.log_end,
+          "%u messages, %u history from %lu to %lu, after the history was all evicted", p.n, p.history,
+          (unsigned long)p.log_start, (unsigned long)p.log_end);
+    check_heights(&p, "all history evicted");
+
+    scroll_y = 0;
+    message_data_free(&p);
+    utox_backlog_capacity = UTOX_MAX_BACKLOG_MESSAGES;
+}
+
+int main(void)
+{
+    utox_backlog_capacity = UTOX_MAX_BACKLOG_MESSAGES;
+
+    test_clear_then_add();
+    test_heights_paging();
+    test_ring_evict();
+    test_ring_history();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("messages: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,423 @@
+/* Tests the full text index of src/search_index.c against a brute force scan of the log, and benchmarks it on a
+ * synthetic log.
+ *
+ * The test adds records to a log in random sized batches, catches the index up with them in random sized steps with
+ * random flushes in between, and now and then reopens the index or cuts its file short, like a crash would. After
+ * every step random queries of 1 to 3 words have to find exactly the records a scan finds, newest first.
+ *
+ * The benchmark writes a log of the given size (2.5 GiB by default) with a vocabulary of 50000 words used with Zipf's
+ * law, indexes it, and times queries for words of every frequency, with the index dropped from the page cache for the
+ * first one. Every file is a tmpfile(), so /tmp needs room for the log and its index.
+ *
+ * make check runs the test, make bench the benchmark.
+ *
+ * cc -O2 -o test_search_index tools/test_search_index.c src/search_index.c -lm
+ * ./test_search_index [--seed <n> | --bench [MiB of log]]
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../src/search_index.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while(0)
+
+int file_truncate(FILE *file, uint64_t size)
+{
+    fflush(file);
+    return ftruncate(fileno(file), size);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Same numbers everywhere, unlike rand() */
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+/* A random word of the vocabulary, word 0 the most likely */
+static uint32_t random_word(uint32_t vocabulary)
+{
+    double u = (double)(random_next() % 1000000) / 1000000;
+    return vocabulary * u * u * u;
+}
+
+/* Makes up a word that has its number in it, so no two are the same */
+static char* make_word(uint32_t i)
+{
+    char word[32];
+    int length = 2 + random_next() % 8;
+    for(int k = 0; k < length; k++) {
+        word[k] = 'a' + random_next() % 26;
+    }
+    sprintf(word + length, "%x", i);
+    return strdup(word);
+}
+
+static void append_record(FILE *log, FILE *log_index, uint64_t time, const char *text, uint16_t length)
+{
+    LOG_FILE_MSG_HEADER header = { .time = time, .namelen = 5, .length = length };
+
+    LOG_FILE_INDEX_RECORD record = { .offset = ftello(log), .time = time };
+    fwrite(&header, sizeof(header), 1, log);
+    fwrite("alice", 5, 1, log);
+    fwrite(text, length, 1, log);
+    fwrite(&record, sizeof(record), 1, log_index);
+}
+
+#define TEST_RECORDS 60000
+#define TEST_VOCABULARY 3000
+#define TEST_WORDS_MAX 12
+
+static char *test_words[TEST_VOCABULARY];
+static uint16_t test_record_words[TEST_RECORDS][TEST_WORDS_MAX];
+static uint8_t test_record_count[TEST_RECORDS];
+
+static _Bool record_has(uint64_t record, uint32_t word)
+{
+    for(int k = 0; k < test_record_count[record]; k++) {
+        if(test_record_words[record][k] == word) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Adds a record of random words to the log, with random case and punctuation between them */
+static void test_append(FILE *log, FILE *log_index, uint64_t record)
+{
+    char text[TEST_WORDS_MAX * 32];
+    int length = 0;
+
+    test_record_count[record] = 1 + random_next() % TEST_WORDS_MAX;
+    for(int k = 0; k < test_record_count[record]; k++) {
+        uint32_t word = random_word(TEST_VOCABULARY);
+        test_record_words[record][k] = word;
+        length += sprintf(text + length, "%s%s", k ? (random_next() % 3 ? " " : ", ") : "", test_words[word]);
+        if(random_next() % 4 == 0 && text[length - 1] >= 'a' && text[length - 1] <= 'z') {
+            text[length - 1] -= 'a' - 'A';
+        }
+    }
+
+    fseeko(log, 0, SEEK_END);
+    fseeko(log_index, 0, SEEK_END);
+    append_record(log, log_index, 1000 + record, text, length);
+    fflush(log);
+    fflush(log_index);
+}
+
+/* Runs count random queries against the index of the first records records, returns the number that were wrong */
+static int test_queries(SEARCH_INDEX *index, uint64_t records, int count)
+{
+    int wrong = 0;
+
+    for(int q = 0; q < count; q++) {
+        uint32_t terms = 1 + random_next() % 3, words[3];
+        uint64_t hashes[3];
+        for(uint32_t t = 0; t < terms; t++) {
+            words[t] = (random_next() % 2) ? random_word(TEST_VOCABULARY) : random_next() % TEST_VOCABULARY;
+            search_terms((uint8_t*)test_words[words[t]], strlen(test_words[words[t]]), &hashes[t], 1);
+        }
+
+        uint32_t max = (random_next() % 2) ? 256 : 5;
+        uint64_t found[256], expected[256];
+        uint32_t found_count = search_index_find(index, hashes, terms, found, max), expected_count = 0;
+
+        for(uint64_t r = records; r-- && expected_count < max;) {
+            _Bool all = 1;
+            for(uint32_t t = 0; t < terms; t++) {
+                all &= record_has(r, words[t]);
+            }
+            if(all) {
+                expected[expected_count++] = r;
+            }
+        }
+
+        if(found_count != expected_count || memcmp(found, expected, found_count * sizeof(*found))) {
+            if(!wrong) {
+                printf("query of %u words: found %u records, a scan %u\n", terms, found_count, expected_count);
+            }
+            wrong++;
+        }
+    }
+
+    return wrong;
+}
+
+/* Catches the index up with the log in steps of up to 5000 records, flushing after a third of them */
+static void test_catch_up(SEARCH_INDEX *index, FILE *log, FILE *log_index, uint64_t records, _Bool flush)
+{
+    while(index->pending.end < records) {
+        if(!search_index_read_log(index, log, log_index, 1 + random_next() % 5000)) {
+            CHECK(0, "read error at record %llu", (unsigned long long)index->pending.end);
+            return;
+        }
+        if(flush && random_next() % 3 == 0) {
+            CHECK(search_index_flush(index), "write error at record %llu", (unsigned long long)index->pending.end);
+        }
+    }
+}
+
+static void test_random(uint32_t seed)
+{
+    random_state = seed;
+    for(uint32_t i = 0; i < TEST_VOCABULARY; i++) {
+        free(test_words[i]);
+        test_words[i] = make_word(i);
+    }
+
+    FILE *log = tmpfile(), *log_index = tmpfile(), *file = tmpfile();
+    SEARCH_INDEX index;
+    if(!log || !log_index || !file || !search_index_open(&index, file)) {
+        CHECK(0, "can't make the files of the test");
+        return;
+    }
+
+    uint64_t records = 0;
+    int wrong = 0, reopens = 0, crashes = 0;
+
+    while(records < TEST_RECORDS) {
+        uint32_t add = 1 + random_next() % 3000;
+        for(uint32_t i = 0; i < add && records < TEST_RECORDS; i++) {
+            test_append(log, log_index, records++);
+        }
+
+        test_catch_up(&index, log, log_index, records, 1);
+        wrong += test_queries(&index, records, 40);
+
+        /* Closing drops what wasn't flushed, a crash loses the tail of the file too */
+        switch(random_next() % 10) {
+            case 0: {
+                fflush(index.file);
+                index.file = NULL;
+                search_index_close(&index);
+                CHECK(search_index_open(&index, file), "can't open the index again");
+                reopens++;
+                break;
+            }
+
+            case 1: {
+                search_index_flush(&index);
+                fseeko(index.file, 0, SEEK_END);
+                uint64_t size = ftello(index.file);
+                index.file = NULL;
+                search_index_close(&index);
+                if(size) {
+                    file_truncate(file, random_next() % size);
+                }
+                CHECK(search_index_open(&index, file), "can't open the index after a crash");
+                crashes++;
+                break;
+            }
+        }
+        CHECK(index.pending.end <= records, "the index has %llu records of %llu", (unsigned long long)index.pending.end,
+              (unsigned long long)records);
+
+        test_catch_up(&index, log, log_index, records, 0);
+        wrong += test_queries(&index, records, 40);
+    }
+
+    CHECK(!wrong, "seed %u: %d queries wrong after %d reopens and %d crashes", seed, wrong, reopens, crashes);
+
+    /* And built again from scratch */
+    CHECK(search_index_clear(&index), "search_index_clear");
+    test_catch_up(&index, log, log_index, records, 0);
+    CHECK(search_index_flush(&index), "search_index_flush");
+    wrong = test_queries(&index, records, 200);
+    CHECK(!wrong, "seed %u: %d queries wrong after clearing the index", seed, wrong);
+
+    search_index_close(&index);
+    fclose(log_index);
+    fclose(log);
+}
+
+/* A word whose list of records couldn't grow is left out of the segment, instead of being written with none */
+static void test_empty_term(void)
+{
+    FILE *file = tmpfile();
+    SEARCH_INDEX index;
+    if(!file || !search_index_open(&index, file)) {
+        CHECK(0, "can't make the file of the test");
+        return;
+    }
+
+    for(int round = 0; round < 2; round++) {
+        for(int i = 0; i < 100; i++) {
+            char text[32];
+            int length = sprintf(text, "hello w%d", i % 50);
+            search_index_add(&index, index.pending.end, (uint8_t*)text, length);
+        }
+
+        SEARCH_PENDING *pending = &index.pending;
+        for(uint32_t i = 0; i < pending->size; i++) {
+            if(!pending->table[i].hash) {
+                pending->table[i].hash = 12345;
+                pending->terms++;
+                break;
+            }
+        }
+
+        CHECK(search_index_flush(&index), "flush with a word without records, round %d", round);
+    }
+
+    /* The second flush merged the first segment, which failed on a word without records before */
+    CHECK(index.segments == 1, "%d segments", index.segments);
+
+    uint64_t hash, records[256];
+    search_terms((const uint8_t*)"hello", 5, &hash, 1);
+    CHECK(search_index_find(&index, &hash, 1, records, 256) == 200, "hello not found in every record");
+
+    search_index_close(&index);
+}
+
+/* Zipf's law over this many words, about what a chat uses */
+#define BENCH_VOCABULARY 50000
+
+static void bench(uint64_t log_size)
+{
+    static char *words[BENCH_VOCABULARY];
+    static double cdf[BENCH_VOCABULARY];
+    double total = 0;
+
+    for(uint32_t i = 0; i < BENCH_VOCABULARY; i++) {
+        words[i] = make_word(i);
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+
+    FILE *log = tmpfile(), *log_index = tmpfile(), *file = tmpfile();
+    if(!log || !log_index || !file) {
+        printf("can't make the files of the benchmark\n");
+        return;
+    }
+
+    double start = now();
+    uint64_t records = 0;
+    char text[4096];
+
+    while((uint64_t)ftello(log) < log_size) {
+        int count = 1 + random_next() % 30, length = 0;
+        for(int k = 0; k < count; k++) {
+            double u = (double)random_next() / UINT32_MAX * total;
+            uint32_t low = 0, high = BENCH_VOCABULARY - 1;
+            while(low < high) {
+                uint32_t middle = (low + high) / 2;
+                if(cdf[middle] < u) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            length += sprintf(text + length, k ? " %s" : "%s", words[low]);
+        }
+        append_record(log, log_index, 1400000000 + records * 7, text, length);
+        records++;
+    }
+    fflush(log);
+    fflush(log_index);
+    printf("Wrote a log of %llu records, %llu MiB, in %.1fs\n", (unsigned long long)records,
+           (unsigned long long)ftello(log) >> 20, now() - start);
+
+    SEARCH_INDEX index;
+    if(!search_index_open(&index, file)) {
+        printf("can't open the index\n");
+        return;
+    }
+
+    start = now();
+    while(index.pending.end < records) {
+        if(!search_index_read_log(&index, log, log_index, SEARCH_INDEX_FLUSH_RECORDS) || !search_index_flush(&index)) {
+            printf("read or write error\n");
+            return;
+        }
+    }
+    double took = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fseeko(file, 0, SEEK_END);
+    printf("Indexed it in %.1fs, %.0f records/s: %llu MiB in %d segments, max RSS %ld MiB\n", took, records / took,
+           (unsigned long long)ftello(file) >> 20, index.segments, usage.ru_maxrss / 1024);
+
+    /* Words from the most common to ones used a few times, alone and together */
+    static const uint32_t rank[] = { 0, 10, 100, 1000, 10000, 40000 };
+    printf("%-30s %8s %12s %12s\n", "words (by rank)", "found", "cold ms", "warm ms");
+    for(uint32_t terms = 1; terms <= 3; terms++) {
+        for(uint32_t r = 0; r < sizeof(rank) / sizeof(*rank); r++) {
+            uint64_t hashes[3], found[256];
+            char name[64];
+            int length = 0;
+            for(uint32_t t = 0; t < terms; t++) {
+                uint32_t word = (t == 0) ? rank[r] : (t == 1) ? rank[r] / 10 + 1 : 3;
+                search_terms((uint8_t*)words[word], strlen(words[word]), &hashes[t], 1);
+                length += sprintf(name + length, t ? " + %u" : "%u", word);
+            }
+
+            /* Without the index in the page cache, as far as the kernel lets go of it */
+            fflush(file);
+            fdatasync(fileno(file));
+            posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+
+            uint32_t count = 0;
+            double cold = 0, warm = INFINITY;
+            for(int k = 0; k < 20; k++) {
+                start = now();
+                count = search_index_find(&index, hashes, terms, found, 256);
+                took = now() - start;
+                if(!k) {
+                    cold = took;
+                } else if(took < warm) {
+                    warm = took;
+                }
+            }
+            printf("%-30s %8u %12.3f %12.3f\n", name, count, cold * 1000, warm * 1000);
+        }
+    }
+
+    search_index_close(&index);
+    fclose(log_index);
+    fclose(log);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && !strcmp(argv[1], "--bench")) {
+        bench((argc > 2 ? strtoull(argv[2], NULL, 10) : 2560) << 20);
+        return 0;
+    }
+
+    if(argc > 2 && !strcmp(argv[1], "--seed")) {
+        test_random(strtoul(argv[2], NULL, 10));
+    } else {
+        for(uint32_t seed = 1; seed <= 3; seed++) {
+            test_random(seed);
+        }
+    }
+    test_empty_term();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("search index: all tests passed\n");
+    return 0;
+}